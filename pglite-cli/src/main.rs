@@ -1,21 +1,1384 @@
+use std::time::Instant;
+
 use structopt::StructOpt;
-use pglite::Connection;
+use pglite::{create_container, AsyncConnection, Connection, Database, Template, Value};
 
 #[derive(StructOpt)]
 struct Opt {
     #[structopt(short, long)]
     database: std::path::PathBuf,
+
+    /// clone new databases from this pre-bootstrapped cluster
+    #[structopt(short, long)]
+    template: Option<std::path::PathBuf>,
+
+    /// time this many primary key lookups with and without the statement
+    /// cache
+    #[structopt(long)]
+    bench_lookups: Option<u32>,
+
+    /// time loading this many rows with copy_in, with pipelined INSERTs,
+    /// and into sqlite
+    #[structopt(long)]
+    bench_copy: Option<i64>,
+
+    /// stream a query returning this many rows, reporting time to first
+    /// row and peak RSS
+    #[structopt(long)]
+    bench_stream: Option<i64>,
+
+    /// run this many concurrent queries through an AsyncConnection on a
+    /// separate database, reporting latency percentiles
+    #[structopt(long)]
+    bench_async: Option<usize>,
+
+    /// run this many lookups and updates per thread through a Database on a
+    /// separate data directory, with 1 to 32 threads
+    #[structopt(long)]
+    bench_scaling: Option<u32>,
+
+    /// time an aggregate over a table of this many rows through a Database
+    /// on a separate data directory, with 0 to 8 parallel workers
+    #[structopt(long)]
+    bench_parallel: Option<i64>,
+
+    /// look up rows all over a table filling half of this many MB of
+    /// shared_buffers, through a Database on a separate data directory, with
+    /// SysV and with mmap shared memory, reporting throughput and data TLB
+    /// misses
+    #[structopt(long)]
+    bench_shmem: Option<u64>,
+
+    /// pass advisory locks back and forth between two backend threads of a
+    /// Database on a separate data directory this many times, reporting the
+    /// round trip latency
+    #[structopt(long)]
+    bench_latch: Option<u32>,
+
+    /// run this many hot row lookups, then this many commits, per thread
+    /// through a Database on a separate data directory, with 1 to 32
+    /// threads contending on the same buffer headers and on ProcArrayLock
+    #[structopt(long)]
+    bench_spin: Option<u32>,
+
+    /// open, use and drop this many connections one after another on a
+    /// Database on a separate data directory, without and then with a pool
+    /// of warm backends, reporting the time per connection
+    #[structopt(long)]
+    bench_pool: Option<u32>,
+
+    /// have this many threads each run the same 50 join queries through a
+    /// Database on a separate data directory, without and then with plans
+    /// shared between sessions, reporting the time and memory taken
+    #[structopt(long)]
+    bench_plans: Option<u32>,
+
+    /// time bootstrap, then loading, scanning, updating and vacuuming a
+    /// table of this many rows, creating and dropping tables and a
+    /// checkpoint, on a cluster in memory and on one with its files on tmpfs
+    #[structopt(long)]
+    bench_memory: Option<i64>,
+
+    /// scan a table of this many MB through a Database on a separate data
+    /// directory, sequentially and with a bitmap heap scan, from a cold
+    /// page cache, without and then with io_uring read-ahead
+    #[structopt(long)]
+    bench_readahead: Option<u64>,
+
+    /// create this many tables, each with an index, on two separate data
+    /// directories, one with its relations in a container file, and report
+    /// the files each has, and the time and descriptors opening the cluster
+    /// and reading every table take
+    #[structopt(long)]
+    bench_container: Option<u32>,
+
+    /// create this many tables on a Database on a separate data directory,
+    /// have 200 threads each read 500 of them at random, without and then
+    /// with descriptors shared between threads, and report the time taken,
+    /// the descriptors open and the shared descriptors' hit rate
+    #[structopt(long)]
+    bench_fds: Option<u32>,
+
+    /// open this many new databases in fresh data directories, first
+    /// bootstrapping each and then cloning each from a template, and report
+    /// the time each open takes
+    #[structopt(long)]
+    bench_open: Option<u32>,
+
+    /// create this many tables on a Database on a separate data directory,
+    /// have 500 threads each open every one of them, without and then with
+    /// catalog tuples shared between sessions, and report the memory their
+    /// catalog and relation caches take
+    #[structopt(long)]
+    bench_catcache: Option<u32>,
+
+    /// run a few statements in and out of transaction blocks and fail on
+    /// any error, before any benchmark
+    #[structopt(long)]
+    check: bool,
+
+    /// where --bench-memory puts the cluster with files
+    #[structopt(long, default_value = "/dev/shm")]
+    tmpfs: std::path::PathBuf,
+
+    /// count LWLock acquisitions and waits during --bench-spin, and report
+    /// the tranches waited on longest
+    #[structopt(long)]
+    lwlock_stats: bool,
 }
 
 fn main() -> anyhow::Result<()> {
     let (_log, _scope) = init_logger();
     let opt = Opt::from_args();
 
-    let _conn = Connection::open(&opt.database);
+    let conn = match opt.template {
+        Some(template) => Template::open(&template)
+            .and_then(|template| Connection::open_with_template(&opt.database, &template)),
+        None => Connection::open(&opt.database),
+    };
+
+    let conn = conn.map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+    if opt.check {
+        check(&conn)?;
+        check_pool(&opt.database.with_extension("check"))?;
+    }
+
+    if let Some(lookups) = opt.bench_lookups {
+        bench_lookups(&conn, lookups)?;
+    }
+
+    if let Some(rows) = opt.bench_copy {
+        bench_copy(&conn, &opt.database.with_extension("bench.sqlite"), rows)?;
+    }
+
+    if let Some(rows) = opt.bench_stream {
+        bench_stream(&conn, rows)?;
+    }
+
+    if let Some(tasks) = opt.bench_async {
+        // a second backend can't share the first one's data directory
+        futures::executor::block_on(bench_async(&opt.database.with_extension("async"), tasks))?;
+    }
+
+    if let Some(ops) = opt.bench_scaling {
+        bench_scaling(&opt.database.with_extension("shared"), ops)?;
+    }
+
+    if let Some(rows) = opt.bench_parallel {
+        bench_parallel(&opt.database.with_extension("parallel"), rows)?;
+    }
+
+    if let Some(shared_buffers_mb) = opt.bench_shmem {
+        bench_shmem(&opt.database.with_extension("shmem"), shared_buffers_mb)?;
+    }
+
+    if let Some(rounds) = opt.bench_latch {
+        bench_latch(&opt.database.with_extension("latch"), rounds)?;
+    }
+
+    if let Some(ops) = opt.bench_spin {
+        bench_spin(&opt.database.with_extension("spin"), ops, opt.lwlock_stats)?;
+    }
+
+    if let Some(connections) = opt.bench_pool {
+        bench_pool(&opt.database.with_extension("pool"), connections)?;
+    }
+
+    if let Some(threads) = opt.bench_plans {
+        bench_plans(&opt.database.with_extension("plans"), threads)?;
+    }
+
+    if let Some(rows) = opt.bench_memory {
+        bench_memory(&opt.tmpfs, rows)?;
+    }
+
+    if let Some(mb) = opt.bench_readahead {
+        bench_readahead(&opt.database.with_extension("readahead"), mb)?;
+    }
+
+    if let Some(tables) = opt.bench_container {
+        bench_container(&opt.database, tables)?;
+    }
+
+    if let Some(tables) = opt.bench_fds {
+        bench_fds(&opt.database.with_extension("fds"), tables)?;
+    }
+
+    if let Some(opens) = opt.bench_open {
+        bench_open(&opt.database.with_extension("open"), opens)?;
+    }
+
+    if let Some(tables) = opt.bench_catcache {
+        bench_catcache(&opt.database.with_extension("catcache"), tables)?;
+    }
+
+    Ok(())
+}
+
+fn check(conn: &Connection) -> anyhow::Result<()> {
+    let mut one = None;
+    conn.query("SELECT 1", |row| one = row.get::<i64>(0))?;
+    anyhow::ensure!(one == Some(1), "SELECT 1 returned {:?}", one);
+
+    conn.execute("DROP TABLE IF EXISTS pglite_check")?;
+    conn.execute("CREATE TABLE pglite_check (id int4 PRIMARY KEY)")?;
+
+    // one round trip per statement, then all in one query string
+    conn.execute("BEGIN")?;
+    conn.execute("INSERT INTO pglite_check VALUES (1)")?;
+    conn.execute("COMMIT")?;
+    conn.execute("BEGIN; INSERT INTO pglite_check VALUES (2); COMMIT")?;
+    conn.execute("INSERT INTO pglite_check VALUES (3); INSERT INTO pglite_check VALUES (4)")?;
+
+    // a failed statement aborts the block until ROLLBACK, prepared
+    // statements and loads included, and an implicit block as a whole
+    let stmt = conn.prepare("SELECT id FROM pglite_check WHERE id = $1")?;
+    conn.execute("BEGIN")?;
+    conn.execute("INSERT INTO pglite_check VALUES (5)")?;
+    anyhow::ensure!(conn.execute("INSERT INTO pglite_check VALUES (1)").is_err(),
+        "duplicate key was inserted");
+    anyhow::ensure!(conn.execute("SELECT 1").is_err(), "aborted block ran a statement");
+    anyhow::ensure!(stmt.execute(&[Value::Int(1)]).is_err(), "aborted block ran a prepared statement");
+    anyhow::ensure!(conn.copy_in("pglite_check", &[], [[Value::Int(8)]]).is_err(),
+        "aborted block loaded a row");
+    conn.execute("ROLLBACK")?;
+    anyhow::ensure!(conn.execute("INSERT INTO pglite_check VALUES (6); INSERT INTO pglite_check VALUES (1)").is_err(),
+        "duplicate key was inserted");
+
+    // a pipeline in a block of its own, handing back each statement's rows
+    let mut pipeline = conn.pipeline();
+    pipeline.transaction(true);
+    pipeline.execute("INSERT INTO pglite_check VALUES ($1)", vec![Value::Int(7)]);
+    pipeline.execute("SELECT id FROM pglite_check WHERE id = $1", vec![Value::Int(7)]);
+    let results = pipeline.run()?;
+    anyhow::ensure!(results[1].rows == [[Value::Int(7)]], "pipeline returned {:?}", results[1].rows);
+    conn.execute("DELETE FROM pglite_check WHERE id = 7")?;
+
+    // loads over one round trip run in a Transaction, rolled back as a
+    // whole when a row fails
+    conn.copy_in("pglite_check", &[], (100..5100).map(|i| [Value::Int(i)]))?;
+    let bad = (5100..10100).map(|i| [if i < 10000 { Value::Int(i) } else { Value::Text("x".into()) }]);
+    anyhow::ensure!(conn.copy_in("pglite_check", &[], bad).is_err(), "loaded an int4 from \"x\"");
+    let loaded = conn.execute("DELETE FROM pglite_check WHERE id >= 100")?;
+    anyhow::ensure!(loaded == 5000, "expected 5000 rows loaded, found {}", loaded);
+
+    // loads are refused where row-level security applies, and have to fit
+    // the bounds of a partition loaded directly
+    conn.execute("DROP ROLE IF EXISTS pglite_check_role")?;
+    conn.execute("CREATE ROLE pglite_check_role")?;
+    conn.execute("GRANT SELECT, INSERT ON pglite_check TO pglite_check_role")?;
+    conn.execute("ALTER TABLE pglite_check ENABLE ROW LEVEL SECURITY")?;
+    conn.execute("SET ROLE pglite_check_role")?;
+    let secured = conn.copy_in("pglite_check", &[], [[Value::Int(8)]]);
+    conn.execute("RESET ROLE")?;
+    conn.execute("ALTER TABLE pglite_check DISABLE ROW LEVEL SECURITY")?;
+    conn.execute("REVOKE ALL ON pglite_check FROM pglite_check_role")?;
+    conn.execute("DROP ROLE pglite_check_role")?;
+    anyhow::ensure!(secured.is_err(), "loaded a row past row-level security");
+
+    conn.execute("DROP TABLE IF EXISTS pglite_check_parted")?;
+    conn.execute("CREATE TABLE pglite_check_parted (id int4) PARTITION BY RANGE (id)")?;
+    conn.execute("CREATE TABLE pglite_check_part PARTITION OF pglite_check_parted FOR VALUES FROM (0) TO (10)")?;
+    conn.copy_in("pglite_check_part", &[], [[Value::Int(5)]])?;
+    let outside = conn.copy_in("pglite_check_part", &[], [[Value::Int(20)]]);
+    conn.execute("DROP TABLE pglite_check_parted")?;
+    anyhow::ensure!(outside.is_err(), "loaded a row outside its partition's bounds");
+
+    // a stream opens a block for its cursor and ends it once read, or
+    // reads in the caller's
+    let streamed = conn.stream("SELECT i FROM generate_series(1, 100) i", &[])?
+        .with_batch_size(8)
+        .collect::<Result<Vec<_>, _>>()?;
+    anyhow::ensure!(streamed.len() == 100, "streamed {} rows of 100", streamed.len());
+    conn.execute("BEGIN")?;
+    let streamed = conn.stream("SELECT id FROM pglite_check", &[])?.count();
+    conn.execute("COMMIT")?;
+    anyhow::ensure!(streamed == 4, "streamed {} rows of 4", streamed);
+
+    // nothing says what type $1 is
+    anyhow::ensure!(conn.prepare("SELECT $1").is_err(), "prepared a parameter of unknown type");
+
+    let mut count = None;
+    conn.query("SELECT count(*) FROM pglite_check", |row| count = row.get::<i64>(0))?;
+    anyhow::ensure!(count == Some(4), "expected 4 rows, found {:?}", count);
+
+    conn.execute("DROP TABLE pglite_check")?;
+
+    println!("check: ok");
+
+    Ok(())
+}
+
+fn check_pool(database: &std::path::Path) -> anyhow::Result<()> {
+    let db = Database::open(database)
+        .map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+    db.set_pool_size(1)
+        .map_err(|e| anyhow::anyhow!("filling pool: {:?}", e))?;
+
+    // leave a setting, a temporary table and an aborted block behind for
+    // the pool to reset
+    for _ in 0..2 {
+        let conn = db.connect()
+            .map_err(|e| anyhow::anyhow!("connecting: {:?}", e))?;
+
+        let mut work_mem = String::new();
+        conn.query("SHOW work_mem", |row| work_mem = row.get::<&str>(0).unwrap_or("").into())?;
+        anyhow::ensure!(work_mem == "4MB", "pooled session kept work_mem = {}", work_mem);
+        anyhow::ensure!(conn.execute("SELECT * FROM pglite_check_temp").is_err(),
+            "pooled session kept its temporary table");
+
+        conn.execute("SET work_mem = '1MB'")?;
+        conn.execute("CREATE TEMP TABLE pglite_check_temp (id int4)")?;
+        conn.execute("BEGIN")?;
+        anyhow::ensure!(conn.execute("SELECT 1 / 0").is_err(), "divided by zero");
+    }
+
+    println!("check pool: ok");
+
+    Ok(())
+}
+
+fn bench_lookups(conn: &Connection, lookups: u32) -> anyhow::Result<()> {
+    const ROWS: u32 = 10_000;
+
+    conn.execute("DROP TABLE IF EXISTS pglite_bench")?;
+    conn.execute("CREATE TABLE pglite_bench (id int4 PRIMARY KEY, value text NOT NULL)")?;
+    conn.execute(&format!("INSERT INTO pglite_bench
+        SELECT i, md5(i::text) FROM generate_series(1, {}) i", ROWS))?;
+
+    let start = Instant::now();
+    for i in 0..lookups {
+        let sql = format!("SELECT value FROM pglite_bench WHERE id = {}", i % ROWS + 1);
+        conn.query(&sql, |row| { row.get::<&str>(0); })?;
+    }
+    let uncached = start.elapsed();
+
+    let start = Instant::now();
+    for i in 0..lookups {
+        let stmt = conn.prepare("SELECT value FROM pglite_bench WHERE id = $1")?;
+        stmt.query(&[Value::Int((i % ROWS + 1).into())], |row| { row.get::<&str>(0); })?;
+    }
+    let cached = start.elapsed();
+
+    conn.execute("DROP TABLE pglite_bench")?;
+
+    println!("{} lookups: {:?}/lookup uncached, {:?}/lookup with statement cache",
+        lookups, uncached / lookups.max(1), cached / lookups.max(1));
+
+    Ok(())
+}
+
+fn bench_copy(conn: &Connection, sqlite_path: &std::path::Path, rows: i64) -> anyhow::Result<()> {
+    const BATCH: i64 = 1000;
+
+    let row = |i: i64| [Value::Int(i), Value::Text(format!("row {}", i)), Value::Float(i as f64 * 0.5)];
+
+    conn.execute("DROP TABLE IF EXISTS pglite_bench")?;
+    conn.execute("CREATE TABLE pglite_bench (id int8 NOT NULL, name text NOT NULL, score float8)")?;
+
+    let start = Instant::now();
+    conn.copy_in("pglite_bench", &[], (0..rows).map(row))?;
+    let copy_in = start.elapsed();
+
+    conn.execute("TRUNCATE pglite_bench")?;
+
+    let start = Instant::now();
+    for batch in (0..rows).step_by(BATCH as usize) {
+        let mut pipeline = conn.pipeline();
+        pipeline.transaction(true);
+
+        for i in batch..(batch + BATCH).min(rows) {
+            pipeline.execute("INSERT INTO pglite_bench VALUES ($1, $2, $3)", row(i).to_vec());
+        }
+
+        pipeline.run()?;
+    }
+    let inserts = start.elapsed();
+
+    conn.execute("DROP TABLE pglite_bench")?;
+
+    let _ = std::fs::remove_file(sqlite_path);
+    let mut sqlite = rusqlite::Connection::open(sqlite_path)?;
+    sqlite.execute("CREATE TABLE bench (id INTEGER NOT NULL, name TEXT NOT NULL, score REAL)", [])?;
+
+    let start = Instant::now();
+    {
+        let tx = sqlite.transaction()?;
+        {
+            let mut insert = tx.prepare("INSERT INTO bench VALUES (?, ?, ?)")?;
+            for i in 0..rows {
+                insert.execute(rusqlite::params![i, format!("row {}", i), i as f64 * 0.5])?;
+            }
+        }
+        tx.commit()?;
+    }
+    let sqlite_elapsed = start.elapsed();
+
+    drop(sqlite);
+    let _ = std::fs::remove_file(sqlite_path);
+
+    println!("{} rows: copy_in {:?}, pipelined inserts {:?}, sqlite {:?}",
+        rows, copy_in, inserts, sqlite_elapsed);
+
+    Ok(())
+}
+
+fn bench_stream(conn: &Connection, rows: i64) -> anyhow::Result<()> {
+    let rss_before = peak_rss_kb();
+    let start = Instant::now();
+
+    let stream = conn.stream("SELECT i, md5(i::text) FROM generate_series(1, $1::int8) i",
+        &[Value::Int(rows)])?;
+
+    let mut first_row = None;
+    let mut count = 0u64;
+
+    for row in stream {
+        row?;
+
+        if first_row.is_none() {
+            first_row = Some(start.elapsed());
+        }
+
+        count += 1;
+    }
+
+    println!("{} rows streamed in {:?}: first row after {:?}, peak RSS {} kB (was {} kB)",
+        count, start.elapsed(), first_row.unwrap_or_default(), peak_rss_kb(), rss_before);
+
+    Ok(())
+}
+
+async fn bench_async(database: &std::path::Path, tasks: usize) -> anyhow::Result<()> {
+    use futures::stream::{FuturesUnordered, StreamExt};
+
+    let conn = AsyncConnection::open(database).await
+        .map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+    let start = Instant::now();
+
+    let mut in_flight = (0..tasks)
+        .map(|i| {
+            let conn = conn.clone();
+            async move {
+                let submitted = Instant::now();
+                conn.query("SELECT $1::int8", vec![Value::Int(i as i64)]).await?;
+                Ok::<_, pglite::Error>(submitted.elapsed())
+            }
+        })
+        .collect::<FuturesUnordered<_>>();
+
+    let mut latencies = Vec::with_capacity(tasks);
+
+    while let Some(latency) = in_flight.next().await {
+        latencies.push(latency?);
+    }
+
+    let elapsed = start.elapsed();
+    latencies.sort();
+
+    let percentile = |p: usize| latencies.get(latencies.len() * p / 100)
+        .or(latencies.last())
+        .copied()
+        .unwrap_or_default();
+
+    println!("{} concurrent tasks in {:?}: p50 {:?}, p99 {:?}, max {:?}",
+        tasks, elapsed, percentile(50), percentile(99), percentile(100));
+
+    Ok(())
+}
+
+fn bench_scaling(database: &std::path::Path, ops: u32) -> anyhow::Result<()> {
+    const ROWS: i64 = 100_000;
+
+    let db = Database::open(database)
+        .map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+    let connect = || db.connect()
+        .map_err(|e| anyhow::anyhow!("connecting: {:?}", e));
+
+    {
+        let conn = connect()?;
+        conn.execute("DROP TABLE IF EXISTS pglite_bench")?;
+        conn.execute("CREATE TABLE pglite_bench (id int8 PRIMARY KEY, hits int8 NOT NULL)")?;
+        conn.execute(&format!("INSERT INTO pglite_bench
+            SELECT i, 0 FROM generate_series(1, {}) i", ROWS))?;
+    }
+
+    let mut baseline = None;
+
+    for threads in [1, 2, 4, 8, 16, 32] {
+        let conns = (0..threads).map(|_| connect()).collect::<anyhow::Result<Vec<_>>>()?;
+        let start = Instant::now();
+
+        // nine lookups to every update, over rows spread across the table
+        let results = std::thread::scope(|scope| {
+            let workers = conns.into_iter()
+                .enumerate()
+                .map(|(t, conn)| scope.spawn(move || -> anyhow::Result<()> {
+                    let lookup = conn.prepare("SELECT hits FROM pglite_bench WHERE id = $1")?;
+                    let update = conn.prepare("UPDATE pglite_bench SET hits = hits + 1 WHERE id = $1")?;
+                    let mut id = t as i64;
+
+                    for i in 0..ops {
+                        id = (id * 7919 + 1) % ROWS + 1;
+
+                        if i % 10 == 0 {
+                            update.execute(&[Value::Int(id)])?;
+                        } else {
+                            lookup.query(&[Value::Int(id)], |row| { row.get::<i64>(0); })?;
+                        }
+                    }
+
+                    Ok(())
+                }))
+                .collect::<Vec<_>>();
+
+            workers.into_iter()
+                .map(|worker| worker.join().expect("bench thread panicked"))
+                .collect::<Vec<_>>()
+        });
+
+        let elapsed = start.elapsed();
+
+        for result in results {
+            result?;
+        }
+
+        let throughput = (threads as u64 * ops as u64) as f64 / elapsed.as_secs_f64();
+        let baseline = *baseline.get_or_insert(throughput);
+
+        println!("{:>2} threads: {:.0} ops/s ({:.1}x)", threads, throughput, throughput / baseline);
+    }
+
+    Ok(())
+}
+
+fn bench_parallel(database: &std::path::Path, rows: i64) -> anyhow::Result<()> {
+    let db = Database::open(database)
+        .map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+    let conn = db.connect()
+        .map_err(|e| anyhow::anyhow!("connecting: {:?}", e))?;
+
+    conn.execute("DROP TABLE IF EXISTS pglite_bench")?;
+    conn.execute("CREATE TABLE pglite_bench (id int8 NOT NULL, score float8 NOT NULL)")?;
+    conn.execute(&format!("INSERT INTO pglite_bench
+        SELECT i, random() FROM generate_series(1, {}) i", rows))?;
+    conn.execute("VACUUM ANALYZE pglite_bench")?;
+
+    let mut baseline = None;
+
+    for workers in [0, 1, 2, 4, 8] {
+        conn.execute(&format!("SET max_parallel_workers_per_gather = {}", workers))?;
+
+        let start = Instant::now();
+        let mut total = 0.0;
+
+        conn.query("SELECT sum(score) FROM pglite_bench WHERE id % 7 = 3", |row| {
+            total = row.get::<f64>(0).unwrap_or_default();
+        })?;
+
+        let elapsed = start.elapsed();
+        let baseline = *baseline.get_or_insert(elapsed);
+
+        println!("{} workers: {:?} ({:.1}x), sum {:.0}",
+            workers, elapsed, baseline.as_secs_f64() / elapsed.as_secs_f64(), total);
+    }
+
+    conn.execute("DROP TABLE pglite_bench")?;
+
+    Ok(())
+}
+
+fn bench_shmem(database: &std::path::Path, shared_buffers_mb: u64) -> anyhow::Result<()> {
+    const LOOKUPS: u64 = 1_000_000;
+
+    // four rows to a page, over half of shared_buffers
+    let rows = shared_buffers_mb * 1024 * 1024 / 8192 / 2 * 4;
+    let shared_buffers = format!("{}MB", shared_buffers_mb);
+
+    for (i, shared_memory_type) in ["sysv", "mmap"].into_iter().enumerate() {
+        let db = Database::open_with_settings(database, &[
+            ("shared_buffers", &shared_buffers),
+            ("shared_memory_type", shared_memory_type),
+        ]).map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+        let connect = || db.connect()
+            .map_err(|e| anyhow::anyhow!("connecting: {:?}", e));
+
+        {
+            let conn = connect()?;
+
+            if i == 0 {
+                conn.execute("DROP TABLE IF EXISTS pglite_bench")?;
+                conn.execute("CREATE TABLE pglite_bench (id int8 PRIMARY KEY, pad text NOT NULL)")?;
+                conn.execute("ALTER TABLE pglite_bench ALTER COLUMN pad SET STORAGE PLAIN")?;
+                conn.execute(&format!("INSERT INTO pglite_bench
+                    SELECT i, repeat('x', 1900) FROM generate_series(1, {}) i", rows))?;
+            }
+
+            // read the whole table into shared_buffers through the index, as
+            // a sequential scan this large would go through a ring buffer
+            conn.execute("SET enable_seqscan = off; SET enable_bitmapscan = off")?;
+            conn.execute("SELECT sum(length(pad)) FROM pglite_bench WHERE id > 0")?;
+        }
+
+        // counts the backend thread the connection starts too
+        let mut tlb_misses = TlbMissCounter::open();
+        let start = Instant::now();
+
+        {
+            let conn = connect()?;
+            conn.execute("SET enable_hashjoin = off; SET enable_mergejoin = off")?;
+            conn.execute(&format!("SELECT count(p.pad) FROM generate_series(1, {}) g
+                JOIN pglite_bench p ON p.id = g::int8 * 7919 % {} + 1", LOOKUPS, rows))?;
+        }
+
+        let elapsed = start.elapsed();
+
+        let tlb_misses = match tlb_misses.as_mut().map(TlbMissCounter::read) {
+            Some(misses) => format!("{:.1} dTLB misses per lookup", misses as f64 / LOOKUPS as f64),
+            None => "dTLB misses unavailable".to_string(),
+        };
+
+        println!("{}: {:.0} lookups/s, {}",
+            shared_memory_type, LOOKUPS as f64 / elapsed.as_secs_f64(), tlb_misses);
+    }
+
+    Ok(())
+}
+
+fn bench_latch(database: &std::path::Path, rounds: u32) -> anyhow::Result<()> {
+    let db = Database::open(database)
+        .map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+    let connect = || db.connect()
+        .map_err(|e| anyhow::anyhow!("connecting: {:?}", e));
+
+    let (a, b) = (connect()?, connect()?);
+
+    // a holds lock 1 and b lock 2. Each round, a lets go of its lock and
+    // waits for b's, which b lets go of once it has a's, so every round
+    // trip is two lock waits ended by the other thread setting the
+    // waiter's latch.
+    a.execute("SELECT pg_advisory_lock(1)")?;
+    b.execute("SELECT pg_advisory_lock(2)")?;
+
+    let start = Instant::now();
+
+    let results = std::thread::scope(|scope| {
+        let players = [
+            (a, "SELECT pg_advisory_unlock($1), pg_advisory_lock($2)"),
+            (b, "SELECT pg_advisory_lock($1), pg_advisory_unlock($2)"),
+        ];
+
+        let players = players.into_iter()
+            .map(|(conn, sql)| scope.spawn(move || -> anyhow::Result<()> {
+                let pass = conn.prepare(sql)?;
+
+                for round in 0..rounds as i64 {
+                    let (from, to) = if round % 2 == 0 { (1, 2) } else { (2, 1) };
+                    pass.execute(&[Value::Int(from), Value::Int(to)])?;
+                }
+
+                Ok(())
+            }))
+            .collect::<Vec<_>>();
+
+        players.into_iter()
+            .map(|player| player.join().expect("bench thread panicked"))
+            .collect::<Vec<_>>()
+    });
+
+    let elapsed = start.elapsed();
+
+    for result in results {
+        result?;
+    }
+
+    println!("{} round trips in {:?}: {:?} per round trip",
+        rounds, elapsed, elapsed / rounds.max(1));
+
+    Ok(())
+}
+
+fn bench_spin(database: &std::path::Path, ops: u32, lwlock_stats: bool) -> anyhow::Result<()> {
+    let db = Database::open(database)
+        .map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+    db.set_lwlock_stats(lwlock_stats);
+
+    let connect = || db.connect()
+        .map_err(|e| anyhow::anyhow!("connecting: {:?}", e));
+
+    {
+        let conn = connect()?;
+        conn.execute("DROP TABLE IF EXISTS pglite_bench")?;
+        conn.execute("CREATE TABLE pglite_bench (id int8 PRIMARY KEY, hits int8 NOT NULL)")?;
+        conn.execute("INSERT INTO pglite_bench VALUES (1, 0)")?;
+    }
+
+    // every lookup pins the same index and heap buffers, and every commit of
+    // a transaction with an xid takes ProcArrayLock exclusively while the
+    // other threads take their snapshots under it
+    let workloads = [
+        ("hot row lookups", "SELECT hits FROM pglite_bench WHERE id = 1"),
+        ("xid commits", "SELECT txid_current()"),
+    ];
+
+    for (workload, sql) in workloads {
+        let mut baseline = None;
+
+        for threads in [1, 2, 4, 8, 16, 32] {
+            let conns = (0..threads).map(|_| connect()).collect::<anyhow::Result<Vec<_>>>()?;
+            let start = Instant::now();
+
+            let results = std::thread::scope(|scope| {
+                let workers = conns.into_iter()
+                    .map(|conn| scope.spawn(move || -> anyhow::Result<()> {
+                        let stmt = conn.prepare(sql)?;
+
+                        for _ in 0..ops {
+                            stmt.query(&[], |_| ())?;
+                        }
+
+                        Ok(())
+                    }))
+                    .collect::<Vec<_>>();
+
+                workers.into_iter()
+                    .map(|worker| worker.join().expect("bench thread panicked"))
+                    .collect::<Vec<_>>()
+            });
+
+            let elapsed = start.elapsed();
+
+            for result in results {
+                result?;
+            }
+
+            let throughput = (threads as u64 * ops as u64) as f64 / elapsed.as_secs_f64();
+            let baseline = *baseline.get_or_insert(throughput);
+
+            println!("{}, {:>2} threads: {:.0} ops/s ({:.1}x)",
+                workload, threads, throughput, throughput / baseline);
+        }
+    }
+
+    if lwlock_stats {
+        db.set_lwlock_stats(false);
+
+        let mut stats = db.lwlock_stats();
+        stats.sort_by(|a, b| b.wait.cmp(&a.wait));
+
+        for tranche in stats.iter().take(10) {
+            println!("{:<24} {:>12} acquired, {:>10} contended, {:>10} spin delays, {:>10.3}s waiting",
+                tranche.tranche, tranche.acquisitions, tranche.contended,
+                tranche.spin_delays, tranche.wait.as_secs_f64());
+        }
+    }
+
+    Ok(())
+}
+
+fn bench_pool(database: &std::path::Path, connections: u32) -> anyhow::Result<()> {
+    let db = Database::open(database)
+        .map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+    for pool_size in [0, 4] {
+        db.set_pool_size(pool_size)
+            .map_err(|e| anyhow::anyhow!("filling pool: {:?}", e))?;
+
+        let start = Instant::now();
+
+        for _ in 0..connections {
+            let conn = db.connect()
+                .map_err(|e| anyhow::anyhow!("connecting: {:?}", e))?;
+
+            conn.query("SELECT relname FROM pg_class WHERE oid = 'pg_class'::regclass", |_| ())?;
+        }
+
+        println!("pool of {}: {:?} per connection",
+            pool_size, start.elapsed() / connections);
+    }
+
+    Ok(())
+}
+
+fn bench_plans(database: &std::path::Path, threads: u32) -> anyhow::Result<()> {
+    const QUERIES: u32 = 50;
+    const ROUNDS: u32 = 3;
+
+    let max_connections = (threads + 10).to_string();
+
+    let db = Database::open_with_settings(database, &[
+        ("max_connections", &max_connections),
+    ]).map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+    let connect = || db.connect()
+        .map_err(|e| anyhow::anyhow!("connecting: {:?}", e));
+
+    {
+        let conn = connect()?;
+        conn.execute("DROP TABLE IF EXISTS pglite_orders, pglite_customers")?;
+        conn.execute("CREATE TABLE pglite_customers (id int8 PRIMARY KEY, name text NOT NULL, region int4 NOT NULL)")?;
+        conn.execute("CREATE TABLE pglite_orders (id int8 PRIMARY KEY, customer int8 NOT NULL REFERENCES pglite_customers, total numeric NOT NULL)")?;
+        conn.execute("CREATE INDEX ON pglite_orders (customer)")?;
+        conn.execute("INSERT INTO pglite_customers SELECT i, 'customer ' || i, i % 10 FROM generate_series(1, 1000) i")?;
+        conn.execute("INSERT INTO pglite_orders SELECT i, i % 1000 + 1, i FROM generate_series(1, 10000) i")?;
+        conn.execute("ANALYZE pglite_customers, pglite_orders")?;
+    }
+
+    // the statements an ORM would send, each with its own text
+    let queries = (0..QUERIES)
+        .map(|q| format!("SELECT c.name, count(o.id), sum(o.total)
+            FROM pglite_customers c JOIN pglite_orders o ON o.customer = c.id
+            WHERE c.region = {} AND c.id > {}
+            GROUP BY c.name ORDER BY 3 DESC LIMIT 10", q % 10, q))
+        .collect::<Vec<_>>();
+
+    for shared in [false, true] {
+        db.set_shared_plans(shared);
+
+        let rss_before = rss_kb();
+        let conns = (0..threads).map(|_| connect()).collect::<anyhow::Result<Vec<_>>>()?;
+        let start = Instant::now();
+
+        // the sessions are handed back, to be measured before they go
+        let results = std::thread::scope(|scope| {
+            let workers = conns.into_iter()
+                .map(|conn| scope.spawn(|| -> anyhow::Result<_> {
+                    for _ in 0..ROUNDS {
+                        for sql in &queries {
+                            conn.prepare(sql)?.query(&[], |_| ())?;
+                        }
+                    }
+
+                    Ok(conn)
+                }))
+                .collect::<Vec<_>>();
+
+            workers.into_iter()
+                .map(|worker| worker.join().expect("bench thread panicked"))
+                .collect::<Vec<_>>()
+        });
+
+        let elapsed = start.elapsed();
+        let rss = rss_kb().saturating_sub(rss_before);
+
+        let conns = results.into_iter().collect::<anyhow::Result<Vec<_>>>()?;
+        drop(conns);
+
+        println!("{} plans, {} threads: {:?}, {} kB per session",
+            if shared { "shared" } else { "per-session" }, threads, elapsed, rss / threads as u64);
+    }
 
     Ok(())
 }
 
+fn bench_memory(tmpfs: &std::path::Path, rows: i64) -> anyhow::Result<()> {
+    const TABLES: u32 = 100;
+
+    let data_dir = tmpfs.join(format!("pglite-bench-memory-{}", std::process::id()));
+    let _ = std::fs::remove_dir_all(&data_dir);
+
+    let start = Instant::now();
+    let on_tmpfs = Connection::open(&data_dir)
+        .map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+    let tmpfs_open = start.elapsed();
+
+    let start = Instant::now();
+    let in_memory = Connection::open_in_memory()
+        .map_err(|e| anyhow::anyhow!("opening database in memory: {:?}", e))?;
+    let memory_open = start.elapsed();
+
+    println!("{:<24} {:>14} {:>14}", "", "md.c on tmpfs", "in memory");
+    println!("{:<24} {:>14?} {:>14?}", "bootstrap", tmpfs_open, memory_open);
+
+    let create_drop = (0..TABLES)
+        .map(|t| format!("CREATE TABLE pglite_mem_{0} (id int8 PRIMARY KEY); DROP TABLE pglite_mem_{0};", t))
+        .collect::<String>();
+
+    let steps = [
+        ("load", format!("CREATE TABLE pglite_mem (id int8 PRIMARY KEY, v text NOT NULL);
+            INSERT INTO pglite_mem SELECT i, md5(i::text) FROM generate_series(1, {}) i", rows)),
+        ("scan", "SELECT count(*), sum(length(v)) FROM pglite_mem".to_owned()),
+        ("update", "UPDATE pglite_mem SET v = v || 'x'".to_owned()),
+        ("delete half, vacuum", "DELETE FROM pglite_mem WHERE id > (SELECT max(id) / 2 FROM pglite_mem);
+            VACUUM pglite_mem".to_owned()),
+        ("create and drop tables", create_drop),
+        ("checkpoint", "CHECKPOINT".to_owned()),
+    ];
+
+    for (step, sql) in &steps {
+        let mut times = Vec::new();
+
+        for conn in [&on_tmpfs, &in_memory] {
+            let start = Instant::now();
+            conn.execute(sql)?;
+            times.push(start.elapsed());
+        }
+
+        println!("{:<24} {:>14?} {:>14?}", step, times[0], times[1]);
+    }
+
+    drop(on_tmpfs);
+    std::fs::remove_dir_all(&data_dir)?;
+
+    Ok(())
+}
+
+fn bench_readahead(database: &std::path::Path, mb: u64) -> anyhow::Result<()> {
+    // a 500 byte row and its header, fifteen to a page
+    let rows = mb * 1024 * 1024 / 8192 * 15;
+
+    for (i, readahead) in [false, true].into_iter().enumerate() {
+        // shared_buffers much smaller than the table, so the scans read it
+        // from the files, and opened afresh so nothing of the last run is
+        // left in it
+        let db = Database::open_with_settings(database, &[
+            ("shared_buffers", "16MB"),
+            ("effective_io_concurrency", "32"),
+        ]).map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+        db.set_readahead(readahead);
+
+        let conn = db.connect()
+            .map_err(|e| anyhow::anyhow!("connecting: {:?}", e))?;
+
+        if i == 0 {
+            conn.execute("DROP TABLE IF EXISTS pglite_readahead")?;
+            conn.execute("CREATE TABLE pglite_readahead (k int4 NOT NULL, pad text NOT NULL)")?;
+            conn.execute("ALTER TABLE pglite_readahead ALTER COLUMN pad SET STORAGE PLAIN")?;
+            conn.execute(&format!("INSERT INTO pglite_readahead
+                SELECT (random() * 1000)::int4, repeat('x', 500) FROM generate_series(1, {}) i", rows))?;
+            conn.execute("CREATE INDEX ON pglite_readahead (k)")?;
+            conn.execute("VACUUM ANALYZE pglite_readahead")?;
+        }
+
+        let mut table_bytes = 0;
+        conn.query("SELECT pg_relation_size('pglite_readahead')", |row| {
+            table_bytes = row.get::<i64>(0).unwrap_or_default();
+        })?;
+
+        conn.execute("CHECKPOINT")?;
+        evict_page_cache(&database.join("base"))?;
+
+        let start = Instant::now();
+        conn.execute("SELECT count(*) FROM pglite_readahead")?;
+        let seq_scan = start.elapsed();
+
+        evict_page_cache(&database.join("base"))?;
+
+        // one in a hundred rows, in block order, over a table this size
+        conn.execute("SET enable_seqscan = off; SET enable_indexscan = off")?;
+        let start = Instant::now();
+        conn.execute("SELECT count(*) FROM pglite_readahead WHERE k < 10")?;
+        let bitmap_scan = start.elapsed();
+
+        let mb = table_bytes as f64 / 1024.0 / 1024.0;
+        println!("read-ahead {}: seq scan {:?} ({:.0} MB/s), bitmap heap scan {:?}",
+            if readahead { "on" } else { "off" },
+            seq_scan, mb / seq_scan.as_secs_f64(), bitmap_scan);
+    }
+
+    Ok(())
+}
+
+/// Drops the files under `dir` from the page cache, so they're read from
+/// the disk again. Only clean pages are dropped, so checkpoint first.
+fn evict_page_cache(dir: &std::path::Path) -> std::io::Result<()> {
+    use std::os::unix::io::AsRawFd;
+
+    for entry in std::fs::read_dir(dir)? {
+        let entry = entry?;
+
+        if entry.file_type()?.is_dir() {
+            evict_page_cache(&entry.path())?;
+            continue;
+        }
+
+        let file = std::fs::File::open(entry.path())?;
+        unsafe {
+            libc::posix_fadvise(file.as_raw_fd(), 0, 0, libc::POSIX_FADV_DONTNEED);
+        }
+    }
+
+    Ok(())
+}
+
+fn bench_container(database: &std::path::Path, tables: u32) -> anyhow::Result<()> {
+    // tables created or read per transaction, keeping the locks in check
+    const BATCH: u32 = 50;
+
+    for container in [false, true] {
+        let data_dir = database.with_extension(if container { "container" } else { "dirs" });
+
+        if container && !data_dir.join("global/pg_control").exists() {
+            create_container(&data_dir)
+                .map_err(|e| anyhow::anyhow!("creating container: {:?}", e))?;
+        }
+
+        {
+            let db = Database::open(&data_dir)
+                .map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+            let conn = db.connect()
+                .map_err(|e| anyhow::anyhow!("connecting: {:?}", e))?;
+
+            for start in (0..tables).step_by(BATCH as usize) {
+                let sql = (start..tables.min(start + BATCH))
+                    .map(|t| format!("CREATE TABLE IF NOT EXISTS pglite_container_{} (id int8 PRIMARY KEY, v text);
+                        INSERT INTO pglite_container_{} VALUES (1, 'x') ON CONFLICT DO NOTHING;", t, t))
+                    .collect::<String>();
+                conn.execute(&sql)?;
+            }
+
+            conn.execute("CHECKPOINT")?;
+        }
+
+        let files = count_files(&data_dir)?;
+        let fds_before = count_files(std::path::Path::new("/proc/self/fd"))?;
+
+        let start = Instant::now();
+        let db = Database::open(&data_dir)
+            .map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+        let conn = db.connect()
+            .map_err(|e| anyhow::anyhow!("connecting: {:?}", e))?;
+        let open = start.elapsed();
+
+        let start = Instant::now();
+        for start in (0..tables).step_by(BATCH as usize) {
+            let sql = (start..tables.min(start + BATCH))
+                .map(|t| format!("SELECT v FROM pglite_container_{} WHERE id = 1;", t))
+                .collect::<String>();
+            conn.execute(&sql)?;
+        }
+        let read = start.elapsed();
+
+        let fds = count_files(std::path::Path::new("/proc/self/fd"))?.saturating_sub(fds_before);
+
+        println!("{}: {} files, open {:?}, reading {} tables {:?}, {} descriptors open",
+            if container { "container" } else { "directories" }, files, open, tables, read, fds);
+    }
+
+    Ok(())
+}
+
+/// Counts the files under `dir`, not counting directories
+fn count_files(dir: &std::path::Path) -> std::io::Result<u64> {
+    let mut count = 0;
+
+    for entry in std::fs::read_dir(dir)? {
+        let entry = entry?;
+
+        if entry.file_type()?.is_dir() {
+            count += count_files(&entry.path())?;
+        } else {
+            count += 1;
+        }
+    }
+
+    Ok(count)
+}
+
+fn bench_fds(database: &std::path::Path, tables: u32) -> anyhow::Result<()> {
+    const THREADS: u32 = 200;
+    const READS: u32 = 500;
+    // tables created or read per transaction, keeping the locks in check
+    const BATCH: u32 = 25;
+
+    let max_connections = (THREADS + 10).to_string();
+
+    for (i, shared) in [false, true].into_iter().enumerate() {
+        // opened afresh, so no thread has any of the tables open yet
+        let db = Database::open_with_settings(database, &[
+            ("max_connections", &max_connections),
+        ]).map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+        db.set_shared_fds(shared);
+
+        let connect = || db.connect()
+            .map_err(|e| anyhow::anyhow!("connecting: {:?}", e));
+
+        if i == 0 {
+            let conn = connect()?;
+
+            for start in (0..tables).step_by(BATCH as usize) {
+                let sql = (start..tables.min(start + BATCH))
+                    .map(|t| format!("CREATE TABLE IF NOT EXISTS pglite_fds_{} (id int8, v text);
+                        INSERT INTO pglite_fds_{} SELECT 1, 'x' WHERE NOT EXISTS (SELECT FROM pglite_fds_{});", t, t, t))
+                    .collect::<String>();
+                conn.execute(&sql)?;
+            }
+        }
+
+        let conns = (0..THREADS).map(|_| connect()).collect::<anyhow::Result<Vec<_>>>()?;
+        let stats_before = db.shared_fd_stats();
+        let fds_before = count_files(std::path::Path::new("/proc/self/fd"))?;
+        // the workers wait here once done, for their descriptors to be counted
+        let done = std::sync::Barrier::new(THREADS as usize + 1);
+        let start = Instant::now();
+
+        let (elapsed, fds, results) = std::thread::scope(|scope| {
+            let workers = conns.into_iter()
+                .enumerate()
+                .map(|(thread, conn)| {
+                    let done = &done;
+
+                    scope.spawn(move || {
+                        let mut failed = 0;
+
+                        for batch in (0..READS).step_by(BATCH as usize) {
+                            // spread over the tables, differently in each thread
+                            let sql = (batch..READS.min(batch + BATCH))
+                                .map(|read| (thread as u64 * 7919 + read as u64 * 104_729) % tables as u64)
+                                .map(|t| format!("SELECT v FROM pglite_fds_{} WHERE id = 1;", t))
+                                .collect::<String>();
+
+                            if conn.execute(&sql).is_err() {
+                                failed += 1;
+                            }
+                        }
+
+                        done.wait();
+                        done.wait();
+                        failed
+                    })
+                })
+                .collect::<Vec<_>>();
+
+            done.wait();
+            let elapsed = start.elapsed();
+            let fds = count_files(std::path::Path::new("/proc/self/fd"));
+            done.wait();
+
+            let results = workers.into_iter()
+                .map(|worker| worker.join().expect("bench thread panicked"))
+                .collect::<Vec<u32>>();
+
+            (elapsed, fds, results)
+        });
+
+        let stats = db.shared_fd_stats();
+        let opens = stats.opens - stats_before.opens;
+        let hits = stats.hits - stats_before.hits;
+
+        print!("shared descriptors {}: {} threads over {} tables in {:?}, {} descriptors open",
+            if shared { "on" } else { "off" }, THREADS, tables, elapsed,
+            fds?.saturating_sub(fds_before));
+        if shared {
+            print!(", {} of {} opens hit ({:.1}%), {} evicted",
+                hits, opens, if opens == 0 { 0.0 } else { hits as f64 * 100.0 / opens as f64 },
+                stats.evictions - stats_before.evictions);
+        }
+        println!(", {} batches failed", results.iter().sum::<u32>());
+    }
+
+    Ok(())
+}
+
+/// Counts data TLB misses in user space on this thread and the threads it
+/// starts from now on, those that have exited by the time it's read
+struct TlbMissCounter(std::fs::File);
+
+impl TlbMissCounter {
+    /// `None` if perf events aren't available to us
+    fn open() -> Option<Self> {
+        use std::os::unix::io::FromRawFd;
+
+        /// perf_event_attr, as of PERF_ATTR_SIZE_VER0
+        #[repr(C)]
+        #[derive(Default)]
+        struct PerfEventAttr {
+            kind: u32,
+            size: u32,
+            config: u64,
+            sample_period: u64,
+            sample_type: u64,
+            read_format: u64,
+            flags: u64,
+            wakeup_events: u32,
+            bp_type: u32,
+            config1: u64,
+        }
+
+        const PERF_TYPE_HW_CACHE: u32 = 3;
+        // PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+        // PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+        const DTLB_READ_MISS: u64 = 3 | 0 << 8 | 1 << 16;
+        const INHERIT: u64 = 1 << 1;
+        const EXCLUDE_KERNEL: u64 = 1 << 5;
+        const EXCLUDE_HV: u64 = 1 << 6;
+
+        let attr = PerfEventAttr {
+            kind: PERF_TYPE_HW_CACHE,
+            size: std::mem::size_of::<PerfEventAttr>() as u32,
+            config: DTLB_READ_MISS,
+            flags: INHERIT | EXCLUDE_KERNEL | EXCLUDE_HV,
+            ..Default::default()
+        };
+
+        let fd = unsafe {
+            libc::syscall(libc::SYS_perf_event_open, &attr as *const PerfEventAttr, 0 as libc::pid_t, -1 as libc::c_int, -1 as libc::c_int, 0 as libc::c_ulong)
+        };
+
+        if fd < 0 {
+            return None;
+        }
+
+        Some(TlbMissCounter(unsafe { std::fs::File::from_raw_fd(fd as libc::c_int) }))
+    }
+
+    fn read(&mut self) -> u64 {
+        use std::io::Read;
+
+        let mut count = [0; 8];
+        self.0.read_exact(&mut count)
+            .map(|_| u64::from_ne_bytes(count))
+            .unwrap_or(0)
+    }
+}
+
+fn bench_open(database: &std::path::Path, opens: u32) -> anyhow::Result<()> {
+    let template = Template::open(&database.with_extension("template"))
+        .map_err(|e| anyhow::anyhow!("opening template: {:?}", e))?;
+
+    for with_template in [false, true] {
+        let start = Instant::now();
+
+        for i in 0..opens {
+            let data_dir = database.with_extension(format!("open-{}", i));
+            if data_dir.exists() {
+                std::fs::remove_dir_all(&data_dir)?;
+            }
+
+            let conn = if with_template {
+                Connection::open_with_template(&data_dir, &template)
+            } else {
+                Connection::open(&data_dir)
+            };
+            let conn = conn.map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+            conn.execute("SELECT 1")?;
+            drop(conn);
+
+            std::fs::remove_dir_all(&data_dir)?;
+        }
+
+        let elapsed = start.elapsed();
+        println!("{}: {} opens in {:?} ({:?}/open)",
+            if with_template { "template" } else { "bootstrap" },
+            opens, elapsed, elapsed / opens.max(1));
+    }
+
+    Ok(())
+}
+
+fn bench_catcache(database: &std::path::Path, tables: u32) -> anyhow::Result<()> {
+    const THREADS: u32 = 500;
+    // tables opened per transaction, keeping each thread's locks in check
+    const BATCH: u32 = 50;
+
+    let max_connections = (THREADS + 10).to_string();
+
+    let db = Database::open_with_settings(database, &[
+        ("max_connections", &max_connections),
+        ("max_locks_per_transaction", "256"),
+    ]).map_err(|e| anyhow::anyhow!("opening database: {:?}", e))?;
+
+    let connect = || db.connect()
+        .map_err(|e| anyhow::anyhow!("connecting: {:?}", e));
+
+    {
+        let conn = connect()?;
+
+        for start in (0..tables).step_by(BATCH as usize) {
+            let sql = (start..tables.min(start + BATCH))
+                .map(|t| format!("CREATE TABLE IF NOT EXISTS pglite_cat_{} (id int8 PRIMARY KEY, v text);", t))
+                .collect::<String>();
+            conn.execute(&sql)?;
+        }
+    }
+
+    for shared in [false, true] {
+        db.set_shared_catcache(shared);
+
+        let rss_before = rss_kb();
+        let conns = (0..THREADS).map(|_| connect()).collect::<anyhow::Result<Vec<_>>>()?;
+        let rss_connected = rss_kb();
+        let start = Instant::now();
+
+        // the sessions are handed back, to be measured before they go
+        let results = std::thread::scope(|scope| {
+            let workers = conns.into_iter()
+                .map(|conn| scope.spawn(move || -> anyhow::Result<_> {
+                    for start in (0..tables).step_by(BATCH as usize) {
+                        let sql = (start..tables.min(start + BATCH))
+                            .map(|t| format!("SELECT id FROM pglite_cat_{} WHERE id = 1;", t))
+                            .collect::<String>();
+                        conn.execute(&sql)?;
+                    }
+
+                    // CacheMemoryContext and the index info contexts under
+                    // it; shared tuples are outside them, and in the rss
+                    let mut cache_bytes = 0;
+                    conn.query("SELECT sum(total_bytes)::int8 FROM pg_backend_memory_contexts
+                        WHERE name = 'CacheMemoryContext' OR parent = 'CacheMemoryContext'", |row| {
+                        cache_bytes = row.get::<i64>(0).unwrap_or_default();
+                    })?;
+
+                    Ok((conn, cache_bytes))
+                }))
+                .collect::<Vec<_>>();
+
+            workers.into_iter()
+                .map(|worker| worker.join().expect("bench thread panicked"))
+                .collect::<Vec<_>>()
+        });
+
+        let elapsed = start.elapsed();
+        let rss_after = rss_kb();
+
+        let mut cache_bytes = 0;
+        let mut conns = Vec::new();
+        for result in results {
+            let (conn, bytes) = result?;
+            cache_bytes += bytes;
+            conns.push(conn);
+        }
+        drop(conns);
+
+        println!("{} catalog tuples, {} threads over {} tables: {:?}",
+            if shared { "shared" } else { "per-session" }, THREADS, tables, elapsed);
+        println!("  caches: {} kB per thread, {} MB in all",
+            cache_bytes / THREADS as i64 / 1024, cache_bytes / 1024 / 1024);
+        println!("  rss: {} kB per thread connected, {} kB per thread after opening every table",
+            rss_connected.saturating_sub(rss_before) / THREADS as u64,
+            rss_after.saturating_sub(rss_before) / THREADS as u64);
+    }
+
+    Ok(())
+}
+
+fn peak_rss_kb() -> u64 {
+    proc_status_kb("VmHWM:")
+}
+
+fn rss_kb() -> u64 {
+    proc_status_kb("VmRSS:")
+}
+
+fn proc_status_kb(field: &str) -> u64 {
+    std::fs::read_to_string("/proc/self/status")
+        .ok()
+        .and_then(|status| status.lines()
+            .find_map(|line| line.strip_prefix(field))
+            .and_then(|kb| kb.trim().trim_end_matches("kB").trim().parse().ok()))
+        .unwrap_or(0)
+}
+
 fn init_logger() -> (slog::Logger, slog_scope::GlobalLoggerGuard) {
     use sloggers::Build;
     use sloggers::terminal::{TerminalLoggerBuilder, Destination};
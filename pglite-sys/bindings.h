@@ -3,8 +3,10 @@
 #include <access/xact.h>
 #include <access/xlog.h>
 #include <bootstrap/bootstrap.h>
+#include <catalog/pg_type.h>
 #include <miscadmin.h>
 #include <postgres_ext.h>
+#include <postmaster/autovacuum.h>
 #include <storage/ipc.h>
 #include <storage/proc.h>
 #include <storage/s_lock.h>
@@ -13,4 +15,7 @@
 #include <utils/pg_locale.h>
 #include <utils/relmapper.h>
 
+#include "src/shim/pglite.h"
+
 void pglite_set_bootstrap_processing_mode(void);
+void pglite_set_normal_processing_mode(void);
@@ -35,7 +35,13 @@ fn main() {
     }
 
     // compile postgres backend
-    mk_cc("backend")
+    let mut backend = mk_cc("backend");
+
+    for flag in BACKEND_CFLAGS {
+        backend.flag(flag);
+    }
+
+    backend
         .files(postgres_backend_sources())
         .files(postgres_backend_generated_sources())
         .files(pglite_backend_sources())
@@ -48,6 +54,9 @@ fn main() {
     // strlcat and strlcpy
     println!("cargo:rustc-link-lib=bsd");
 
+    // timer_create, for older glibc
+    println!("cargo:rustc-link-lib=rt");
+
     // bindgen
     let bindings_path = gen_bindings();
     println!("cargo:rustc-env=pglite_bindings_path={}", bindings_path.to_str().unwrap());
@@ -74,6 +83,7 @@ fn mk_cc(component: &str) -> cc::Build {
 fn gen_bindings() -> PathBuf {
     let bindings_path = out_dir().join("bindings.rs");
     println!("cargo:rerun-if-changed=bindings.h");
+    println!("cargo:rerun-if-changed=src/shim/pglite.h");
 
     #[derive(Debug)]
     struct Callback;
@@ -168,6 +178,16 @@ static CFLAGS: &[&str] = &[
     "-D_GNU_SOURCE=1", // syncfs
 ];
 
+/// signals between backends are aimed at single threads, see shim/signal.c,
+/// and paths are relative to the data directory, see shim/fs.c
+static BACKEND_CFLAGS: &[&str] = &[
+    "-Dkill=pglite_kill",
+    "-Dsetitimer=pglite_setitimer",
+    "-Dunlink=pglite_unlink",
+    "-Drmdir=pglite_rmdir",
+    "-Drename=pglite_rename",
+];
+
 static POSTGRES_COMMON_SOURCES: &[&str] = &[
     "src/common/archive.c",
     "src/common/base64.c",
@@ -215,6 +235,23 @@ static PGLITE_BACKEND_SOURCES: &[&str] = &[
     "src/shim/pqsignal.c",
     "src/shim/ps_status.c",
     "src/shim/fs.c",
+    "src/shim/copy.c",
+    "src/shim/dest.c",
+    "src/shim/exec.c",
+    "src/shim/attach.c",
+    "src/shim/signal.c",
+    "src/shim/postmaster.c",
+    "src/shim/dsm_process.c",
+    "src/shim/anon_shmem.c",
+    "src/shim/futex.c",
+    "src/shim/spin.c",
+    "src/shim/lwlock_stats.c",
+    "src/shim/shared_plan.c",
+    "src/shim/shared_catcache.c",
+    "src/shim/memory_smgr.c",
+    "src/shim/readahead.c",
+    "src/shim/container_smgr.c",
+    "src/shim/shared_fd.c",
 ];
 
 static POSTGRES_BACKEND_SOURCES: &[&str] = &[
@@ -941,8 +978,6 @@ static POSTGRES_BACKEND_GENERATED_SOURCES: &[&str] = &[
     "src/backend/bootstrap/bootparse.c",
     "src/backend/parser/gram.c",
     "src/backend/parser/scan.c",
-    "src/backend/port/pg_sema.c",
-    "src/backend/port/pg_shmem.c",
     "src/backend/replication/repl_gram.c",
     "src/backend/replication/syncrep_gram.c",
     "src/backend/storage/lmgr/lwlocknames.c",
@@ -967,7 +1002,6 @@ static POSTGRES_PORT_SOURCES: &[&str] = &[
     "src/port/pgsleep.c",
     "src/port/pgstrcasecmp.c",
     "src/port/pgstrsignal.c",
-    "src/port/pqsignal.c",
     "src/port/qsort.c",
     "src/port/qsort_arg.c",
     "src/port/quotes.c",
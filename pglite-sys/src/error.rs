@@ -3,12 +3,19 @@ use std::fmt;
 use std::os::raw::{c_char, c_int};
 use std::ffi::CStr;
 
+/// Unwound with when Postgres exits the thread, by way of `proc_exit`
 #[derive(Debug, Copy, Clone)]
 pub struct ExitThread {
-    #[allow(unused)]
     code: c_int,
 }
 
+impl ExitThread {
+    /// The exit code a process would have exited with
+    pub fn code(&self) -> c_int {
+        self.code
+    }
+}
+
 impl fmt::Display for ExitThread {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         write!(f, "{:?}", self)
@@ -17,9 +24,11 @@ impl fmt::Display for ExitThread {
 
 impl Error for ExitThread {}
 
+/// Exiting is routine for the postmaster's children, so this unwinds
+/// without a panic message, for the thread's entry point to catch.
 #[no_mangle]
-unsafe extern "C" fn pglite_exit_thread(code: c_int) {
-    panic!("pglite_exit_thread: {:?}", ExitThread { code });
+unsafe extern "C-unwind" fn pglite_exit_thread(code: c_int) {
+    std::panic::resume_unwind(Box::new(ExitThread { code }));
 }
 
 #[no_mangle]
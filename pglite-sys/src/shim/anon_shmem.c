@@ -0,0 +1,374 @@
+/*
+ * anon_shmem.c
+ *
+ * The main shared memory segment, in place of sysv_shmem.c. Backends are
+ * threads of one process, so the segment needn't be shared with anything
+ * but ourselves: it's ordinary private anonymous memory, which needs no
+ * SysV interlock segment, isn't subject to the kernel's shm limits, goes
+ * away with the process however it ends, and unlike MAP_SHARED memory is
+ * eligible for transparent huge pages. Explicit huge pages are used when
+ * huge_pages allows and some are reserved. On machines with more than one
+ * NUMA node the segment is interleaved across them, as backends on every
+ * node use the buffer pool alike.
+ *
+ * shared_memory_type = sysv still gets a SysV segment, removed as soon as
+ * it's attached so nothing is left behind after a crash, mostly to compare
+ * against.
+ */
+#include <postgres.h>
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <miscadmin.h>
+#include <port/pg_bitutils.h>
+#include <storage/ipc.h>
+#include <storage/pg_shmem.h>
+
+#include "pglite.h"
+
+/* as in sysv_shmem.c */
+#define IPCProtection (0600)
+
+/* nodes beyond this many aren't interleaved across */
+#define PGLITE_MAX_NUMA_NODES 1024
+
+/* per-thread like the rest of the backend's globals; see attach.c */
+__thread unsigned long UsedShmemSegID = 0;
+__thread void *UsedShmemSegAddr = NULL;
+
+/* the segment this thread created, 0 in size if it has none */
+static __thread void *pglite_shmem_address;
+static __thread Size pglite_shmem_size;
+
+/* read once for the whole process, as it can't change under us */
+static pthread_once_t pglite_hugepagesize_once = PTHREAD_ONCE_INIT;
+static Size pglite_default_hugepagesize;
+
+static void
+pglite_read_default_hugepagesize(void)
+{
+    FILE       *fp = fopen("/proc/meminfo", "r");
+    char        buf[128];
+    unsigned int sz;
+    char        ch;
+
+    if (fp == NULL)
+        return;
+
+    while (fgets(buf, sizeof(buf), fp))
+    {
+        if (sscanf(buf, "Hugepagesize: %u %c", &sz, &ch) == 2 && ch == 'k')
+        {
+            pglite_default_hugepagesize = sz * (Size) 1024;
+            break;
+        }
+    }
+
+    fclose(fp);
+}
+
+/*
+ * As in sysv_shmem.c, except that /proc/meminfo is read only once, as
+ * dsm_process.c asks for every segment it creates
+ */
+void
+GetHugePageSize(Size *hugepagesize, int *mmap_flags)
+{
+    Size        hugepagesize_local;
+    int         mmap_flags_local = MAP_HUGETLB;
+
+    pthread_once(&pglite_hugepagesize_once, pglite_read_default_hugepagesize);
+
+    if (huge_page_size != 0)
+        hugepagesize_local = (Size) huge_page_size * 1024;
+    else if (pglite_default_hugepagesize != 0)
+        hugepagesize_local = pglite_default_hugepagesize;
+    else
+        hugepagesize_local = 2 * 1024 * 1024;
+
+#if defined(MAP_HUGE_MASK) && defined(MAP_HUGE_SHIFT)
+    if (hugepagesize_local != pglite_default_hugepagesize)
+    {
+        int         shift = pg_ceil_log2_64(hugepagesize_local);
+
+        mmap_flags_local |= (shift & MAP_HUGE_MASK) << MAP_HUGE_SHIFT;
+    }
+#endif
+
+    if (mmap_flags)
+        *mmap_flags = mmap_flags_local;
+    if (hugepagesize)
+        *hugepagesize = hugepagesize_local;
+}
+
+/*
+ * Sets a bit in `nodemask` for each NUMA node online, returning how many
+ * there are
+ */
+static int
+pglite_online_numa_nodes(unsigned long *nodemask)
+{
+    FILE       *fp = fopen("/sys/devices/system/node/online", "r");
+    int         nodes = 0;
+    int         first;
+    int         last;
+    char        sep;
+
+    if (fp == NULL)
+        return 0;
+
+    /* a list of ranges, like "0-1,4" */
+    while (fscanf(fp, "%d", &first) == 1)
+    {
+        last = first;
+        sep = fgetc(fp);
+        if (sep == '-')
+        {
+            if (fscanf(fp, "%d", &last) != 1)
+                break;
+            sep = fgetc(fp);
+        }
+
+        for (int node = first; node <= last && node < PGLITE_MAX_NUMA_NODES; node++)
+        {
+            nodemask[node / (8 * sizeof(unsigned long))] |=
+                1UL << (node % (8 * sizeof(unsigned long)));
+            nodes++;
+        }
+
+        if (sep != ',')
+            break;
+    }
+
+    fclose(fp);
+    return nodes;
+}
+
+/*
+ * Spreads the pages of the segment across the NUMA nodes, before any of
+ * them is touched. Without this each page would land on the node of the
+ * backend that happened to touch it first.
+ */
+static void
+pglite_interleave_shmem(void *address, Size size)
+{
+    unsigned long nodemask[PGLITE_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+
+    memset(nodemask, 0, sizeof(nodemask));
+
+    if (pglite_online_numa_nodes(nodemask) < 2)
+        return;
+
+    if (syscall(SYS_mbind, address, size, MPOL_INTERLEAVE, nodemask,
+                PGLITE_MAX_NUMA_NODES + 1, 0) < 0)
+        elog(DEBUG1, "mbind(%zu) failed, shared memory not interleaved: %m",
+             size);
+}
+
+/*
+ * Maps `*size` bytes of private anonymous memory, updating `*size` to the
+ * length mapped
+ */
+static void *
+pglite_map_shmem(Size *size)
+{
+    Size        hugepagesize;
+    int         mmap_flags;
+    Size        allocsize = *size;
+    Size        reserved;
+    char       *address = MAP_FAILED;
+    char       *aligned;
+    int         mmap_errno = 0;
+
+    GetHugePageSize(&hugepagesize, &mmap_flags);
+
+    if (huge_pages == HUGE_PAGES_ON || huge_pages == HUGE_PAGES_TRY)
+    {
+        allocsize = add_size(*size, hugepagesize - 1) & ~(hugepagesize - 1);
+        address = mmap(NULL, allocsize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | mmap_flags, -1, 0);
+        mmap_errno = errno;
+        if (huge_pages == HUGE_PAGES_TRY && address == MAP_FAILED)
+            elog(DEBUG1, "mmap(%zu) with MAP_HUGETLB failed, huge pages disabled: %m",
+                 allocsize);
+    }
+
+    if (address == MAP_FAILED && huge_pages != HUGE_PAGES_ON)
+    {
+        /*
+         * Transparent huge pages only back whole aligned huge pages of the
+         * mapping, so map a huge page more than needed and trim it to an
+         * aligned start.
+         */
+        allocsize = *size;
+        reserved = add_size(allocsize, hugepagesize);
+        address = mmap(NULL, reserved, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        mmap_errno = errno;
+
+        if (address != MAP_FAILED)
+        {
+            aligned = (char *) TYPEALIGN(hugepagesize, address);
+
+            if (aligned != address)
+                munmap(address, aligned - address);
+            munmap(aligned + allocsize, address + reserved - (aligned + allocsize));
+            address = aligned;
+
+#ifdef MADV_HUGEPAGE
+            if (huge_pages != HUGE_PAGES_OFF)
+                (void) madvise(address, allocsize, MADV_HUGEPAGE);
+#endif
+        }
+    }
+
+    if (address == MAP_FAILED)
+    {
+        errno = mmap_errno;
+        ereport(FATAL,
+                (errmsg("could not map anonymous shared memory: %m"),
+                 (mmap_errno == ENOMEM) ?
+                 errhint("This error usually means that PostgreSQL's request "
+                         "for a shared memory segment exceeded available memory, "
+                         "swap space, or huge pages. To reduce the request size "
+                         "(currently %zu bytes), reduce PostgreSQL's shared "
+                         "memory usage, perhaps by reducing shared_buffers or "
+                         "max_connections.",
+                         allocsize) : 0));
+    }
+
+    pglite_interleave_shmem(address, allocsize);
+
+    *size = allocsize;
+    return address;
+}
+
+/*
+ * A SysV segment of `size` bytes, removed right away: it stays until
+ * detached, which the kernel does when the process ends
+ */
+static void *
+pglite_create_sysv_shmem(Size size, unsigned long *shmid)
+{
+    int         id;
+    void       *address;
+
+    id = shmget(IPC_PRIVATE, size, IPC_CREAT | IPC_EXCL | IPCProtection);
+    if (id < 0)
+        ereport(FATAL,
+                (errmsg("could not create shared memory segment: %m"),
+                 errdetail("Failed system call was shmget(key=%d, size=%zu, 0%o).",
+                           IPC_PRIVATE, size, IPC_CREAT | IPC_EXCL | IPCProtection)));
+
+    address = shmat(id, NULL, 0);
+    shmctl(id, IPC_RMID, NULL);
+
+    if (address == (void *) -1)
+        ereport(FATAL,
+                (errmsg("could not attach to shared memory segment: %m")));
+
+    *shmid = id;
+    return address;
+}
+
+static void
+pglite_shmem_exit(int status, Datum arg)
+{
+    PGSharedMemoryDetach();
+}
+
+/*
+ * Creates the main shared memory segment. There's no shim segment to
+ * interlock with other postmasters, whom the data directory lock keeps out,
+ * so `*shim` is the segment's own header.
+ */
+PGShmemHeader *
+PGSharedMemoryCreate(Size size, PGShmemHeader **shim)
+{
+    PGShmemHeader *hdr;
+    unsigned long shmid = 0;
+    struct stat statbuf;
+
+    Assert(size > MAXALIGN(sizeof(PGShmemHeader)));
+
+    if (huge_pages == HUGE_PAGES_ON && shared_memory_type != SHMEM_TYPE_MMAP)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("huge pages not supported with the current shared_memory_type setting")));
+
+    if (shared_memory_type == SHMEM_TYPE_SYSV)
+        hdr = pglite_create_sysv_shmem(size, &shmid);
+    else
+        hdr = pglite_map_shmem(&size);
+
+    pglite_shmem_address = hdr;
+    pglite_shmem_size = size;
+    on_shmem_exit(pglite_shmem_exit, 0);
+
+    hdr->creatorPID = getpid();
+    hdr->magic = PGShmemMagic;
+    hdr->dsm_control = 0;
+
+    if (stat(DataDir, &statbuf) < 0)
+        ereport(FATAL,
+                (errcode_for_file_access(),
+                 errmsg("could not stat data directory \"%s\": %m",
+                        DataDir)));
+    hdr->device = statbuf.st_dev;
+    hdr->inode = statbuf.st_ino;
+
+    hdr->totalsize = size;
+    hdr->freeoffset = MAXALIGN(sizeof(PGShmemHeader));
+    *shim = hdr;
+
+    UsedShmemSegAddr = hdr;
+    UsedShmemSegID = shmid;
+
+    return hdr;
+}
+
+/*
+ * Nothing outside this process can attach to the segment, so it's never in
+ * use by anything the data directory lock doesn't know about
+ */
+bool
+PGSharedMemoryIsInUse(unsigned long id1, unsigned long id2)
+{
+    return false;
+}
+
+/*
+ * Unmaps the segment if this thread created it, once every backend thread
+ * attached has exited. Threads that attached only forget about it.
+ */
+void
+PGSharedMemoryDetach(void)
+{
+    if (pglite_shmem_size != 0)
+    {
+        /* plans and tuples of this cluster could be mistaken for the next's */
+        pglite_forget_shared_plans(pglite_shmem_address);
+        pglite_forget_shared_catcache(pglite_shmem_address);
+
+        if (shared_memory_type == SHMEM_TYPE_SYSV)
+        {
+            if (shmdt(pglite_shmem_address) < 0)
+                elog(LOG, "shmdt(%p) failed: %m", pglite_shmem_address);
+        }
+        else if (munmap(pglite_shmem_address, pglite_shmem_size) < 0)
+            elog(LOG, "munmap(%p, %zu) failed: %m",
+                 pglite_shmem_address, pglite_shmem_size);
+
+        pglite_shmem_address = NULL;
+        pglite_shmem_size = 0;
+    }
+
+    UsedShmemSegAddr = NULL;
+}
@@ -0,0 +1,278 @@
+/*
+ * attach.c
+ *
+ * Attaching backend threads to the shared memory created by the postmaster
+ * thread, so that they run as concurrent sessions on the same cluster. A forked postmaster child inherits the shared memory globals;
+ * our globals are thread-local, so the creating thread records them here
+ * and each attaching thread copies them into its own, much as an
+ * EXEC_BACKEND child restores them from its BackendParameters.
+ *
+ * prepare-postgres.sh patches in what EXEC_BACKEND would provide for this:
+ * the NON_EXEC_STATIC globals, and the reattach paths of ipci.c and dsm.c.
+ */
+#include <postgres.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <access/transam.h>
+#include <miscadmin.h>
+#include <postmaster/postmaster.h>
+#include <storage/dsm.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/pg_shmem.h>
+#include <storage/pmsignal.h>
+#include <storage/proc.h>
+#include <storage/shmem.h>
+
+#include "pglite.h"
+
+/*
+ * Declared only where an EXEC_BACKEND postmaster passes them on; the
+ * NON_EXEC_STATIC ones are made global by prepare-postgres.sh
+ */
+extern __thread slock_t *ShmemLock;
+extern __thread slock_t *ProcStructLock;
+extern __thread PGPROC *AuxiliaryProcs;
+extern __thread volatile PMSignalData *PMSignalState;
+
+/* declared only for EXEC_BACKEND builds */
+extern void dsm_set_control_handle(dsm_handle h);
+
+struct PgliteSharedMemory
+{
+    /*
+     * Postmaster child slots are handed out by the postmaster alone, without
+     * locking, so attaching threads take turns.
+     */
+    pthread_mutex_t child_slot_lock;
+
+    pid_t       postmaster_pid;
+    int         alive_fds[2];
+
+    /* set once the postmaster has given up on the cluster */
+    volatile sig_atomic_t crashed;
+
+    unsigned long shmem_seg_id;
+    void       *shmem_seg_addr;
+    slock_t    *shmem_lock;
+    VariableCache variable_cache;
+    LWLockPadded *main_lwlock_array;
+    int         named_lwlock_tranche_requests;
+    NamedLWLockTranche *named_lwlock_tranche_array;
+    slock_t    *proc_struct_lock;
+    PROC_HDR   *proc_global;
+    PGPROC     *auxiliary_procs;
+    PGPROC     *prepared_xact_procs;
+    volatile PMSignalData *pm_signal_state;
+};
+
+/* the shared memory this thread attached to, if it didn't create its own */
+static __thread PgliteSharedMemory *pglite_attached;
+
+/*
+ * Records where the shared memory created by the postmaster on this thread
+ * lives, for other threads to attach to. Returns NULL with errno set
+ * on failure.
+ */
+PgliteSharedMemory *
+pglite_export_shared_memory(void)
+{
+    PgliteSharedMemory *shared;
+
+    shared = malloc(sizeof(PgliteSharedMemory));
+    if (shared == NULL)
+        return NULL;
+
+    /*
+     * Attached backends watch the read end for postmaster death, as forked
+     * children do. It never becomes readable while we hold the write end.
+     */
+    if (pipe2(shared->alive_fds, O_CLOEXEC) < 0)
+    {
+        int         save_errno = errno;
+
+        free(shared);
+        errno = save_errno;
+        return NULL;
+    }
+
+    fcntl(shared->alive_fds[POSTMASTER_FD_WATCH], F_SETFL, O_NONBLOCK);
+
+    pthread_mutex_init(&shared->child_slot_lock, NULL);
+
+    shared->postmaster_pid = MyProcPid;
+    shared->crashed = false;
+
+    shared->shmem_seg_id = UsedShmemSegID;
+    shared->shmem_seg_addr = UsedShmemSegAddr;
+    shared->shmem_lock = ShmemLock;
+    shared->variable_cache = ShmemVariableCache;
+    shared->main_lwlock_array = MainLWLockArray;
+    shared->named_lwlock_tranche_requests = NamedLWLockTrancheRequests;
+    shared->named_lwlock_tranche_array = NamedLWLockTrancheArray;
+    shared->proc_struct_lock = ProcStructLock;
+    shared->proc_global = ProcGlobal;
+    shared->auxiliary_procs = AuxiliaryProcs;
+    shared->prepared_xact_procs = PreparedXactProcs;
+    shared->pm_signal_state = PMSignalState;
+
+    return shared;
+}
+
+/*
+ * Only once the postmaster and every backend attached have exited
+ */
+void
+pglite_free_shared_memory(PgliteSharedMemory *shared)
+{
+    close(shared->alive_fds[POSTMASTER_FD_WATCH]);
+    close(shared->alive_fds[POSTMASTER_FD_OWN]);
+    pthread_mutex_destroy(&shared->child_slot_lock);
+    free(shared);
+}
+
+/*
+ * Points this thread's shared memory globals at `shared`, the part of
+ * InitPostmasterChild a forked child gets for free. Called after
+ * InitializeMaxBackends; from here on InitProcess (or InitAuxiliaryProcess)
+ * and CreateSharedMemoryAndSemaphores attach rather than create, in that
+ * order, as the shared structures can't be looked up without a PGPROC to
+ * wait on their locks with.
+ */
+void
+pglite_attach_shared_memory(PgliteSharedMemory *shared)
+{
+    PGShmemHeader *hdr;
+
+    IsPostmasterEnvironment = true;
+    IsUnderPostmaster = true;
+    PostmasterPid = shared->postmaster_pid;
+    postmaster_alive_fds[POSTMASTER_FD_WATCH] = shared->alive_fds[POSTMASTER_FD_WATCH];
+    postmaster_alive_fds[POSTMASTER_FD_OWN] = shared->alive_fds[POSTMASTER_FD_OWN];
+
+    UsedShmemSegID = shared->shmem_seg_id;
+    UsedShmemSegAddr = shared->shmem_seg_addr;
+    ShmemLock = shared->shmem_lock;
+    ShmemVariableCache = shared->variable_cache;
+    MainLWLockArray = shared->main_lwlock_array;
+    NamedLWLockTrancheRequests = shared->named_lwlock_tranche_requests;
+    NamedLWLockTrancheArray = shared->named_lwlock_tranche_array;
+    ProcStructLock = shared->proc_struct_lock;
+    ProcGlobal = shared->proc_global;
+    AuxiliaryProcs = shared->auxiliary_procs;
+    PreparedXactProcs = shared->prepared_xact_procs;
+    PMSignalState = shared->pm_signal_state;
+
+    hdr = (PGShmemHeader *) UsedShmemSegAddr;
+    InitShmemAccess(hdr);
+
+    if (hdr->dsm_control != 0)
+        dsm_set_control_handle(hdr->dsm_control);
+
+    pglite_attached = shared;
+}
+
+/*
+ * Tells every thread attached to `shared` that the postmaster has given up
+ * on the cluster after a child crashed, where HandleChildCrash would send
+ * them SIGQUIT. Their latch waits report postmaster death from then on, and
+ * SIGUSR1 wakes those asleep in one. The pids are read without
+ * ProcStructLock, which the crashed child may have held.
+ */
+void
+pglite_crash_shared_memory(PgliteSharedMemory *shared)
+{
+    PROC_HDR   *procglobal = shared->proc_global;
+
+    shared->crashed = true;
+    pg_memory_barrier();
+
+    for (uint32 i = 0; i < procglobal->allProcCount; i++)
+    {
+        int         pid = procglobal->allProcs[i].pid;
+
+        if (pid != 0)
+            kill(pid, SIGUSR1);
+    }
+}
+
+/*
+ * Whether the postmaster this thread is attached to has given up on the
+ * cluster. Never so on the postmaster itself.
+ */
+bool
+pglite_postmaster_gone(void)
+{
+    return pglite_attached != NULL && pglite_attached->crashed;
+}
+
+static void
+pglite_release_child_slot(int code, Datum arg)
+{
+    pglite_detach_shared_memory();
+}
+
+/*
+ * Claims a postmaster child slot, as the postmaster does before forking a
+ * backend or an autovacuum worker; auxiliary processes go without. Called
+ * after pglite_attach_shared_memory and before InitProcess. The slot is
+ * given back when the thread exits, or by pglite_detach_shared_memory.
+ */
+void
+pglite_claim_child_slot(void)
+{
+    PgliteSharedMemory *shared = pglite_attached;
+
+    Assert(shared != NULL);
+
+    pthread_mutex_lock(&shared->child_slot_lock);
+    MyPMChildSlot = AssignPostmasterChildSlot();
+    pthread_mutex_unlock(&shared->child_slot_lock);
+
+    on_proc_exit(pglite_release_child_slot, 0);
+}
+
+/*
+ * InitPostgres for an attached backend. Under a postmaster it would
+ * authenticate the client on MyProcPort, which we don't have. Background
+ * workers skip that and run as the bootstrap superuser, which is what a
+ * standalone backend does too, so we pass for one while it runs.
+ */
+void
+pglite_init_attached_session(const char *dbname)
+{
+    pglite_shared_plan_init_backend();
+    pglite_shared_catcache_init_backend();
+
+    IsBackgroundWorker = true;
+    InitPostgres(dbname, InvalidOid, NULL, InvalidOid, false, false, NULL);
+    IsBackgroundWorker = false;
+}
+
+/*
+ * Gives back the postmaster child slot once shmem_exit has released
+ * everything else the backend held. Does nothing on the postmaster, or if
+ * already detached.
+ */
+void
+pglite_detach_shared_memory(void)
+{
+    PgliteSharedMemory *shared = pglite_attached;
+
+    if (shared == NULL)
+        return;
+
+    if (MyPMChildSlot > 0)
+    {
+        pthread_mutex_lock(&shared->child_slot_lock);
+        ReleasePostmasterChildSlot(MyPMChildSlot);
+        pthread_mutex_unlock(&shared->child_slot_lock);
+    }
+
+    MyPMChildSlot = 0;
+    pglite_attached = NULL;
+}
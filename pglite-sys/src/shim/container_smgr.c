@@ -0,0 +1,1989 @@
+/*
+ * container_smgr.c
+ *
+ * A storage manager keeping every relation fork of a cluster in one file,
+ * pglite.container in the data directory, where md.c has a file per fork
+ * and segment. Opening a cluster's relations takes one open(), whose
+ * descriptor every thread of the process shares, and copying them is
+ * copying one file: a single reflink, on file systems that have them.
+ *
+ * The file is made of BLCKSZ blocks. Blocks 0 and 1 each hold a header,
+ * written in turn, pointing at a map of the blocks each fork is made of; the
+ * rest are forks' pages, maps and free space. A fork grows by an extent as
+ * big as itself, up to PGLITE_CONTAINER_MAX_EXTENT blocks, so that reading
+ * it in order mostly reads the file in order.
+ *
+ * Pages are written in place. The map is written when forks have come, gone,
+ * grown or shrunk since the last one was: at each checkpoint, when md.c's
+ * files would be synced, on smgrimmedsync, and when the last thread using
+ * the file lets it go. A map goes to free blocks and is synced, then made
+ * current by a header, synced in its turn, so a crash leaves one map or the
+ * other whole. Blocks a fork gives up aren't reused until a map without
+ * them is current; those a fork grew into since are in no map, and free
+ * again after a crash, with WAL replay extending the fork as it needs.
+ *
+ * Only relation data is kept here: the control file, WAL, SLRUs and relation
+ * map files still go to the data directory.
+ *
+ * prepare-postgres.sh adds this to smgr.c's smgrsw[], for smgropen to pick
+ * in clusters with a container file, and hooks the places that work on
+ * relation files by path rather than through smgr: GetNewRelFileNode's
+ * check for a file in the way of a new relfilenode; copying, dropping and
+ * moving databases, and replaying their drop; resetting unlogged relations
+ * after a crash; pg_relation_size and pg_database_size; and the
+ * checkpointer's sync.
+ */
+#include <postgres.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <access/xlogutils.h>
+#include <catalog/pg_tablespace_d.h>
+#include <common/hashfn.h>
+#include <common/relpath.h>
+#include <miscadmin.h>
+#include <pgstat.h>
+#include <port/pg_crc32c.h>
+#include <storage/bufmgr.h>
+#include <storage/fd.h>
+#include <storage/reinit.h>
+#include <storage/smgr.h>
+
+#include "pglite.h"
+
+/* this storage manager's index in smgrsw[] */
+#define PGLITE_CONTAINER_SMGR 2
+
+#define PGLITE_CONTAINER_FILE "pglite.container"
+#define PGLITE_CONTAINER_VERSION 1
+
+/* the most blocks a fork grows by at once */
+#define PGLITE_CONTAINER_MAX_EXTENT 128
+
+#define PGLITE_CONTAINER_BUCKETS 1024
+
+/*
+ * An unlinked main fork is kept, empty, until this many checkpoints have
+ * begun, so its relfilenode isn't reused while recovery could still replay
+ * the unlink: as md.c keeps its first segment until the next checkpoint, but
+ * counting from this one, as it may have begun before the unlink.
+ */
+#define PGLITE_CONTAINER_UNLINK_CHECKPOINTS 3
+
+static const char pglite_container_magic[8] = "PGLITECT";
+
+typedef struct PgliteContainerHeader
+{
+    char        magic[8];
+    uint32      version;
+    uint32      blcksz;
+    /* bumped by every map written */
+    uint64      generation;
+    BlockNumber map_start;
+    uint32      map_size;
+    pg_crc32c   map_crc;
+    /* of everything before it */
+    pg_crc32c   crc;
+} PgliteContainerHeader;
+
+/* a fork in the map, followed by its extents */
+typedef struct PgliteContainerMapFork
+{
+    RelFileNode node;
+    int32       forknum;
+    BlockNumber nblocks;
+    uint32      nextents;
+    /* PGLITE_CONTAINER_UNLINKED for a main fork kept after its unlink */
+    uint32      flags;
+} PgliteContainerMapFork;
+
+#define PGLITE_CONTAINER_UNLINKED 0x1
+
+/* blocks start to start + count - 1 of the file */
+typedef struct PgliteContainerExtent
+{
+    BlockNumber start;
+    BlockNumber count;
+} PgliteContainerExtent;
+
+typedef struct PgliteContainerExtents
+{
+    PgliteContainerExtent *extents;
+    int         count;
+    int         max;
+} PgliteContainerExtents;
+
+typedef struct PgliteContainerForkKey
+{
+    RelFileNodeBackend rnode;
+    ForkNumber  forknum;
+} PgliteContainerForkKey;
+
+typedef struct PgliteContainerFork
+{
+    PgliteContainerForkKey key;
+    /* taken exclusively to add or remove blocks */
+    pthread_rwlock_t lock;
+    BlockNumber nblocks;
+    /* blocks the fork has grown into, the first nblocks of them in use */
+    BlockNumber nmapped;
+    BlockNumber max_mapped;
+    /* where each of them is in the file */
+    BlockNumber *blocks;
+    /* for an unlinked main fork, the checkpoint to drop it at; else 0 */
+    uint64      drop_at;
+    struct PgliteContainerFork *next;
+} PgliteContainerFork;
+
+typedef struct PgliteContainer
+{
+    char       *data_dir;
+    int         fd;
+    /* threads using it */
+    int         refcount;
+    /* taken exclusively to create or unlink forks */
+    pthread_rwlock_t lock;
+    PgliteContainerFork *forks[PGLITE_CONTAINER_BUCKETS];
+
+    /* guards what follows */
+    pthread_mutex_t space_lock;
+    /* the file's length in blocks, as far as it's been handed out */
+    BlockNumber nblocks;
+    PgliteContainerExtents free;
+    /* blocks given up since the current map was written */
+    PgliteContainerExtents released;
+    /* forks have changed since then */
+    bool        map_dirty;
+    /* pages have been written since the file was last synced */
+    bool        data_dirty;
+    /* checkpoints begun since the file was opened */
+    uint64      checkpoints;
+
+    /* serializes writing maps, and guards what follows */
+    pthread_mutex_t sync_lock;
+    uint64      generation;
+    PgliteContainerExtent map;
+
+    struct PgliteContainer *next;
+} PgliteContainer;
+
+/* shared by every thread, unlike the globals of the backend */
+static pthread_mutex_t pglite_containers_lock = PTHREAD_MUTEX_INITIALIZER;
+static PgliteContainer *pglite_containers;
+
+static pthread_once_t pglite_container_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pglite_container_key;
+
+/* whether DataDir has a container file, -1 until looked for */
+static __thread int pglite_container_found = -1;
+static __thread PgliteContainer *pglite_container;
+
+static const PGAlignedBlock pglite_container_zeros;
+
+/*
+ * Adds blocks to the list, merging them into the last extent if they follow
+ * on from it. Out of memory, the blocks are lost until the file is opened
+ * again.
+ */
+static void
+pglite_container_extents_add(PgliteContainerExtents *list, BlockNumber start,
+                             BlockNumber count)
+{
+    PgliteContainerExtent *last;
+
+    if (count == 0)
+        return;
+
+    last = list->count > 0 ? &list->extents[list->count - 1] : NULL;
+    if (last != NULL && last->start + last->count == start)
+    {
+        last->count += count;
+        return;
+    }
+
+    if (list->count == list->max)
+    {
+        int         max = Max(list->max * 2, 16);
+        PgliteContainerExtent *extents;
+
+        extents = realloc(list->extents, sizeof(PgliteContainerExtent) * max);
+        if (extents == NULL)
+            return;
+
+        list->extents = extents;
+        list->max = max;
+    }
+
+    list->extents[list->count].start = start;
+    list->extents[list->count].count = count;
+    list->count++;
+}
+
+static int
+pglite_container_extent_cmp(const void *a, const void *b)
+{
+    BlockNumber x = ((const PgliteContainerExtent *) a)->start;
+    BlockNumber y = ((const PgliteContainerExtent *) b)->start;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Sorts the list by block, merging extents that touch
+ */
+static void
+pglite_container_extents_sort(PgliteContainerExtents *list)
+{
+    int         merged = 0;
+
+    if (list->count == 0)
+        return;
+
+    qsort(list->extents, list->count, sizeof(PgliteContainerExtent),
+          pglite_container_extent_cmp);
+
+    for (int i = 1; i < list->count; i++)
+    {
+        PgliteContainerExtent *last = &list->extents[merged];
+
+        if (last->start + last->count == list->extents[i].start)
+            last->count += list->extents[i].count;
+        else
+            list->extents[++merged] = list->extents[i];
+    }
+
+    list->count = merged + 1;
+}
+
+/*
+ * Adds the extents of `blocks` to the list
+ */
+static void
+pglite_container_extents_add_blocks(PgliteContainerExtents *list,
+                                    const BlockNumber *blocks, BlockNumber count)
+{
+    for (BlockNumber i = 0; i < count; i++)
+        pglite_container_extents_add(list, blocks[i], 1);
+}
+
+/*
+ * Takes `count` blocks in a row from free space, or else from past the end
+ * of the file. Returns the first, or InvalidBlockNumber if the file can't
+ * grow that far. The space lock must be held.
+ */
+static BlockNumber
+pglite_container_take(PgliteContainer *c, BlockNumber count)
+{
+    BlockNumber start;
+
+    for (int i = 0; i < c->free.count; i++)
+    {
+        PgliteContainerExtent *extent = &c->free.extents[i];
+
+        if (extent->count < count)
+            continue;
+
+        start = extent->start;
+        extent->start += count;
+        extent->count -= count;
+
+        if (extent->count == 0)
+        {
+            memmove(extent, extent + 1,
+                    sizeof(PgliteContainerExtent) * (c->free.count - i - 1));
+            c->free.count--;
+        }
+
+        return start;
+    }
+
+    if (count >= InvalidBlockNumber - c->nblocks)
+        return InvalidBlockNumber;
+
+    start = c->nblocks;
+    c->nblocks += count;
+    return start;
+}
+
+/*
+ * Has the fork's blocks from `from` on reused once the next map is current
+ */
+static void
+pglite_container_release(PgliteContainer *c, PgliteContainerFork *fork,
+                         BlockNumber from)
+{
+    pthread_mutex_lock(&c->space_lock);
+
+    pglite_container_extents_add_blocks(&c->released, fork->blocks + from,
+                                        fork->nmapped - from);
+    c->map_dirty = true;
+
+    pthread_mutex_unlock(&c->space_lock);
+
+    fork->nmapped = from;
+    fork->nblocks = Min(fork->nblocks, from);
+}
+
+static void
+pglite_container_map_changed(PgliteContainer *c)
+{
+    pthread_mutex_lock(&c->space_lock);
+    c->map_dirty = true;
+    pthread_mutex_unlock(&c->space_lock);
+}
+
+static void
+pglite_container_data_written(PgliteContainer *c)
+{
+    pthread_mutex_lock(&c->space_lock);
+    c->data_dirty = true;
+    pthread_mutex_unlock(&c->space_lock);
+}
+
+static PgliteContainerFork *
+pglite_container_new_fork(RelFileNodeBackend rnode, ForkNumber forknum)
+{
+    PgliteContainerFork *fork = calloc(1, sizeof(PgliteContainerFork));
+
+    if (fork == NULL)
+        return NULL;
+
+    /* hashed as bytes, padding and all */
+    memset(&fork->key, 0, sizeof(fork->key));
+    fork->key.rnode = rnode;
+    fork->key.forknum = forknum;
+    pthread_rwlock_init(&fork->lock, NULL);
+
+    return fork;
+}
+
+static void
+pglite_container_free_fork(PgliteContainerFork *fork)
+{
+    pthread_rwlock_destroy(&fork->lock);
+    free(fork->blocks);
+    free(fork);
+}
+
+/*
+ * Where the fork is filed, or would be. The container must be locked.
+ */
+static PgliteContainerFork **
+pglite_container_slot(PgliteContainer *c, RelFileNodeBackend rnode,
+                      ForkNumber forknum)
+{
+    PgliteContainerForkKey key;
+    PgliteContainerFork **slot;
+
+    memset(&key, 0, sizeof(key));
+    key.rnode = rnode;
+    key.forknum = forknum;
+
+    slot = &c->forks[hash_bytes((const unsigned char *) &key, sizeof(key)) %
+                     PGLITE_CONTAINER_BUCKETS];
+
+    while (*slot != NULL && memcmp(&(*slot)->key, &key, sizeof(key)) != 0)
+        slot = &(*slot)->next;
+
+    return slot;
+}
+
+/*
+ * Maps blocks for the fork up to `nblocks`, growing it by an extent as big
+ * as it is, within limits. Returns false with errno set if it can't, with
+ * nothing mapped. The fork must be locked exclusively.
+ */
+static bool
+pglite_container_map_blocks(PgliteContainer *c, PgliteContainerFork *fork,
+                            BlockNumber nblocks)
+{
+    BlockNumber count;
+    BlockNumber start;
+
+    if (nblocks <= fork->nmapped)
+        return true;
+
+    count = Max(nblocks - fork->nmapped,
+                Min(Max(fork->nmapped, 1), PGLITE_CONTAINER_MAX_EXTENT));
+    count = Min(count, InvalidBlockNumber - fork->nmapped);
+
+    if (fork->nmapped + count > fork->max_mapped)
+    {
+        BlockNumber max_mapped = Max(fork->max_mapped, 8);
+        BlockNumber *blocks;
+
+        while (max_mapped < fork->nmapped + count)
+            max_mapped = Min((uint64) max_mapped * 2, (uint64) InvalidBlockNumber);
+
+        blocks = realloc(fork->blocks, sizeof(BlockNumber) * max_mapped);
+        if (blocks == NULL)
+        {
+            errno = ENOMEM;
+            return false;
+        }
+
+        fork->blocks = blocks;
+        fork->max_mapped = max_mapped;
+    }
+
+    pthread_mutex_lock(&c->space_lock);
+    start = pglite_container_take(c, count);
+    pthread_mutex_unlock(&c->space_lock);
+
+    if (start == InvalidBlockNumber)
+    {
+        errno = EFBIG;
+        return false;
+    }
+
+    for (BlockNumber i = 0; i < count; i++)
+        fork->blocks[fork->nmapped + i] = start + i;
+
+    fork->nmapped += count;
+    return true;
+}
+
+/*
+ * Grows the fork to `nblocks`, zeroing the pages added before the last, as
+ * a write past the end of a file would leave them. Returns false with errno
+ * set if it can't. The fork must be locked exclusively.
+ */
+static bool
+pglite_container_grow(PgliteContainer *c, PgliteContainerFork *fork,
+                      BlockNumber nblocks)
+{
+    if (!pglite_container_map_blocks(c, fork, nblocks))
+        return false;
+
+    for (BlockNumber blkno = fork->nblocks; blkno + 1 < nblocks; blkno++)
+    {
+        ssize_t     nbytes;
+
+        nbytes = pg_pwrite(c->fd, pglite_container_zeros.data, BLCKSZ,
+                           (off_t) fork->blocks[blkno] * BLCKSZ);
+        if (nbytes != BLCKSZ)
+        {
+            if (nbytes >= 0)
+                errno = ENOSPC;
+            return false;
+        }
+    }
+
+    fork->nblocks = nblocks;
+    pglite_container_map_changed(c);
+    return true;
+}
+
+/*
+ * Copies the first `nblocks` pages of one fork over another's, which must
+ * be as long. Returns false with errno set if it can't.
+ */
+static bool
+pglite_container_copy_pages(PgliteContainer *c, PgliteContainerFork *from,
+                            PgliteContainerFork *to, BlockNumber nblocks)
+{
+    PGAlignedBlock page;
+
+    for (BlockNumber blkno = 0; blkno < nblocks; blkno++)
+    {
+        ssize_t     nbytes;
+
+        nbytes = pg_pread(c->fd, page.data, BLCKSZ,
+                          (off_t) from->blocks[blkno] * BLCKSZ);
+        if (nbytes == BLCKSZ)
+            nbytes = pg_pwrite(c->fd, page.data, BLCKSZ,
+                               (off_t) to->blocks[blkno] * BLCKSZ);
+        if (nbytes != BLCKSZ)
+        {
+            if (nbytes >= 0)
+                errno = EIO;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Reads `size` bytes at `offset`, returning false with errno set if it
+ * can't read them all
+ */
+static bool
+pglite_container_read_at(int fd, void *buf, size_t size, off_t offset)
+{
+    ssize_t     nbytes = pg_pread(fd, buf, size, offset);
+
+    if (nbytes == size)
+        return true;
+
+    if (nbytes >= 0)
+        errno = EIO;
+    return false;
+}
+
+static bool
+pglite_container_write_at(int fd, const void *buf, size_t size, off_t offset)
+{
+    ssize_t     nbytes = pg_pwrite(fd, buf, size, offset);
+
+    if (nbytes == size)
+        return true;
+
+    if (nbytes >= 0)
+        errno = ENOSPC;
+    return false;
+}
+
+static void
+pglite_container_header_crc(PgliteContainerHeader *header)
+{
+    INIT_CRC32C(header->crc);
+    COMP_CRC32C(header->crc, header, offsetof(PgliteContainerHeader, crc));
+    FIN_CRC32C(header->crc);
+}
+
+static bool
+pglite_container_header_valid(const PgliteContainerHeader *header)
+{
+    PgliteContainerHeader copy = *header;
+
+    pglite_container_header_crc(&copy);
+
+    return memcmp(header->magic, pglite_container_magic, sizeof(header->magic)) == 0 &&
+        header->version == PGLITE_CONTAINER_VERSION &&
+        header->blcksz == BLCKSZ &&
+        EQ_CRC32C(copy.crc, header->crc);
+}
+
+/*
+ * Appends `size` bytes to a map being written, returning false if out of
+ * memory
+ */
+static bool
+pglite_container_map_append(char **map, size_t *size, size_t *max,
+                            const void *data, size_t len)
+{
+    if (*size + len > *max)
+    {
+        size_t      new_max = Max(*max * 2, *size + len);
+        char       *grown = realloc(*map, new_max);
+
+        if (grown == NULL)
+            return false;
+
+        *map = grown;
+        *max = new_max;
+    }
+
+    memcpy(*map + *size, data, len);
+    *size += len;
+    return true;
+}
+
+/*
+ * The map of every fork but temporary relations', which don't outlive the
+ * cluster's run. NULL if out of memory.
+ */
+static char *
+pglite_container_serialize(PgliteContainer *c, size_t *size)
+{
+    char       *map = NULL;
+    size_t      max = 0;
+    uint32      nforks = 0;
+    bool        ok;
+
+    *size = 0;
+    ok = pglite_container_map_append(&map, size, &max, &nforks, sizeof(nforks));
+
+    pthread_rwlock_rdlock(&c->lock);
+
+    for (int i = 0; ok && i < PGLITE_CONTAINER_BUCKETS; i++)
+    {
+        for (PgliteContainerFork *fork = c->forks[i]; ok && fork != NULL; fork = fork->next)
+        {
+            PgliteContainerMapFork entry;
+            size_t      entry_at = *size;
+            BlockNumber blkno = 0;
+
+            if (RelFileNodeBackendIsTemp(fork->key.rnode))
+                continue;
+
+            pthread_rwlock_rdlock(&fork->lock);
+
+            memset(&entry, 0, sizeof(entry));
+            entry.node = fork->key.rnode.node;
+            entry.forknum = fork->key.forknum;
+            entry.nblocks = fork->nblocks;
+            entry.flags = fork->drop_at != 0 ? PGLITE_CONTAINER_UNLINKED : 0;
+            ok = pglite_container_map_append(&map, size, &max, &entry, sizeof(entry));
+
+            while (ok && blkno < fork->nblocks)
+            {
+                PgliteContainerExtent extent = {fork->blocks[blkno], 1};
+
+                while (blkno + extent.count < fork->nblocks &&
+                       fork->blocks[blkno + extent.count] == extent.start + extent.count)
+                    extent.count++;
+
+                ok = pglite_container_map_append(&map, size, &max, &extent, sizeof(extent));
+                blkno += extent.count;
+                entry.nextents++;
+            }
+
+            pthread_rwlock_unlock(&fork->lock);
+
+            if (ok)
+                memcpy(map + entry_at, &entry, sizeof(entry));
+            nforks++;
+        }
+    }
+
+    pthread_rwlock_unlock(&c->lock);
+
+    if (!ok)
+    {
+        free(map);
+        return NULL;
+    }
+
+    memcpy(map, &nforks, sizeof(nforks));
+    return map;
+}
+
+/*
+ * Makes everything written so far durable, writing a map if forks have
+ * changed since the last. Returns false with errno set if it can't.
+ */
+static bool
+pglite_container_write_map(PgliteContainer *c)
+{
+    PgliteContainerExtents released;
+    PgliteContainerHeader header;
+    PgliteContainerExtent map_extent = {0, 0};
+    char       *map = NULL;
+    size_t      size;
+    bool        map_dirty;
+    bool        data_dirty;
+    bool        ok;
+    int         save_errno;
+
+    memset(&header, 0, sizeof(header));
+
+    pthread_mutex_lock(&c->sync_lock);
+
+    /*
+     * Blocks released so far are in no fork by now, so not in the map about
+     * to be written, and free once it's current
+     */
+    pthread_mutex_lock(&c->space_lock);
+    map_dirty = c->map_dirty;
+    data_dirty = c->data_dirty;
+    c->map_dirty = false;
+    c->data_dirty = false;
+    released = c->released;
+    memset(&c->released, 0, sizeof(c->released));
+    pthread_mutex_unlock(&c->space_lock);
+
+    if (!map_dirty)
+    {
+        ok = !data_dirty || pg_fdatasync(c->fd) == 0;
+        save_errno = errno;
+
+        if (!ok)
+            pglite_container_data_written(c);
+
+        /* nothing's released without the map changing */
+        free(released.extents);
+        pthread_mutex_unlock(&c->sync_lock);
+        errno = save_errno;
+        return ok;
+    }
+
+    map = pglite_container_serialize(c, &size);
+    ok = map != NULL;
+    if (!ok)
+        errno = ENOMEM;
+
+    if (ok)
+    {
+        map_extent.count = (size + BLCKSZ - 1) / BLCKSZ;
+
+        pthread_mutex_lock(&c->space_lock);
+        map_extent.start = pglite_container_take(c, map_extent.count);
+        pthread_mutex_unlock(&c->space_lock);
+
+        ok = map_extent.start != InvalidBlockNumber;
+        if (!ok)
+        {
+            map_extent.count = 0;
+            errno = EFBIG;
+        }
+    }
+
+    if (ok)
+    {
+        memcpy(header.magic, pglite_container_magic, sizeof(header.magic));
+        header.version = PGLITE_CONTAINER_VERSION;
+        header.blcksz = BLCKSZ;
+        header.generation = c->generation + 1;
+        header.map_start = map_extent.start;
+        header.map_size = size;
+        INIT_CRC32C(header.map_crc);
+        COMP_CRC32C(header.map_crc, map, size);
+        FIN_CRC32C(header.map_crc);
+        pglite_container_header_crc(&header);
+
+        pgstat_report_wait_start(WAIT_EVENT_DATA_FILE_SYNC);
+        ok = pglite_container_write_at(c->fd, map, size, (off_t) map_extent.start * BLCKSZ) &&
+            pg_fdatasync(c->fd) == 0 &&
+            pglite_container_write_at(c->fd, &header, sizeof(header),
+                                      (off_t) (header.generation % 2) * BLCKSZ) &&
+            pg_fdatasync(c->fd) == 0;
+        pgstat_report_wait_end();
+    }
+
+    save_errno = errno;
+    free(map);
+
+    pthread_mutex_lock(&c->space_lock);
+
+    if (ok)
+    {
+        /* the last map is free too, now this one's current */
+        for (int i = 0; i < released.count; i++)
+            pglite_container_extents_add(&c->free, released.extents[i].start,
+                                         released.extents[i].count);
+        pglite_container_extents_add(&c->free, c->map.start, c->map.count);
+        pglite_container_extents_sort(&c->free);
+
+        c->generation = header.generation;
+        c->map = map_extent;
+    }
+    else
+    {
+        /* the header may yet be durable, so this map isn't free either */
+        for (int i = 0; i < released.count; i++)
+            pglite_container_extents_add(&c->released, released.extents[i].start,
+                                         released.extents[i].count);
+        pglite_container_extents_add(&c->released, map_extent.start, map_extent.count);
+
+        c->map_dirty = true;
+        c->data_dirty = true;
+    }
+
+    pthread_mutex_unlock(&c->space_lock);
+
+    free(released.extents);
+    pthread_mutex_unlock(&c->sync_lock);
+
+    errno = save_errno;
+    return ok;
+}
+
+/*
+ * Reads the current map into the container's forks, and works out the free
+ * space from what's left. Returns NULL, or what's wrong with the file, or ""
+ * for an I/O error with errno set.
+ */
+static const char *
+pglite_container_load(PgliteContainer *c)
+{
+    PgliteContainerHeader headers[2];
+    PgliteContainerHeader *header = NULL;
+    PgliteContainerExtents used = {0};
+    struct stat st;
+    char       *map = NULL;
+    char       *pos;
+    uint32      nforks;
+    pg_crc32c   crc;
+    BlockNumber next;
+    const char *problem = NULL;
+
+    if (fstat(c->fd, &st) != 0)
+        return "";
+
+    if (st.st_size / BLCKSZ >= InvalidBlockNumber)
+        return "it is too large";
+
+    c->nblocks = Max((st.st_size + BLCKSZ - 1) / BLCKSZ, 2);
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (!pglite_container_read_at(c->fd, &headers[i], sizeof(headers[i]),
+                                      (off_t) i * BLCKSZ))
+        {
+            if (errno != EIO)
+                return "";
+
+            /* short: the file ends before it */
+            memset(&headers[i], 0, sizeof(headers[i]));
+        }
+
+        if (pglite_container_header_valid(&headers[i]) &&
+            (header == NULL || headers[i].generation > header->generation))
+            header = &headers[i];
+    }
+
+    if (header == NULL)
+        return "it has no valid header";
+
+    c->generation = header->generation;
+    c->map.start = header->map_start;
+    c->map.count = (header->map_size + BLCKSZ - 1) / BLCKSZ;
+
+    if (header->map_size < sizeof(nforks) ||
+        c->map.start < 2 || c->map.start + c->map.count > c->nblocks)
+        return "its map is out of bounds";
+
+    map = malloc(header->map_size);
+    if (map == NULL)
+    {
+        errno = ENOMEM;
+        return "";
+    }
+
+    if (!pglite_container_read_at(c->fd, map, header->map_size,
+                                  (off_t) c->map.start * BLCKSZ))
+    {
+        free(map);
+        return "";
+    }
+
+    INIT_CRC32C(crc);
+    COMP_CRC32C(crc, map, header->map_size);
+    FIN_CRC32C(crc);
+
+    if (!EQ_CRC32C(crc, header->map_crc))
+    {
+        free(map);
+        return "its map is corrupt";
+    }
+
+    pglite_container_extents_add(&used, 0, 2);
+    pglite_container_extents_add(&used, c->map.start, c->map.count);
+
+    memcpy(&nforks, map, sizeof(nforks));
+    pos = map + sizeof(nforks);
+
+    for (uint32 i = 0; problem == NULL && i < nforks; i++)
+    {
+        PgliteContainerMapFork entry;
+        RelFileNodeBackend rnode;
+        PgliteContainerFork *fork;
+        PgliteContainerFork **slot;
+
+        if (pos + sizeof(entry) > map + header->map_size)
+        {
+            problem = "its map is truncated";
+            break;
+        }
+
+        memcpy(&entry, pos, sizeof(entry));
+        pos += sizeof(entry);
+
+        if (entry.forknum < 0 || entry.forknum > MAX_FORKNUM ||
+            pos + sizeof(PgliteContainerExtent) * entry.nextents > map + header->map_size)
+        {
+            problem = "its map is truncated";
+            break;
+        }
+
+        rnode.node = entry.node;
+        rnode.backend = InvalidBackendId;
+
+        slot = pglite_container_slot(c, rnode, entry.forknum);
+        if (*slot != NULL)
+        {
+            problem = "its map has a fork twice";
+            break;
+        }
+
+        fork = pglite_container_new_fork(rnode, entry.forknum);
+        if (fork == NULL)
+        {
+            problem = "";
+            errno = ENOMEM;
+            break;
+        }
+
+        *slot = fork;
+
+        if (entry.nblocks > 0 &&
+            (fork->blocks = malloc(sizeof(BlockNumber) * entry.nblocks)) == NULL)
+        {
+            problem = "";
+            errno = ENOMEM;
+            break;
+        }
+
+        fork->max_mapped = entry.nblocks;
+
+        /* the checkpoints it was waiting for are counted again */
+        if (entry.flags & PGLITE_CONTAINER_UNLINKED)
+            fork->drop_at = PGLITE_CONTAINER_UNLINK_CHECKPOINTS;
+
+        for (uint32 e = 0; e < entry.nextents; e++)
+        {
+            PgliteContainerExtent extent;
+
+            memcpy(&extent, pos, sizeof(extent));
+            pos += sizeof(extent);
+
+            if (extent.start < 2 || extent.count > c->nblocks - extent.start ||
+                extent.count > entry.nblocks - fork->nmapped)
+            {
+                problem = "its map is out of bounds";
+                break;
+            }
+
+            for (BlockNumber b = 0; b < extent.count; b++)
+                fork->blocks[fork->nmapped++] = extent.start + b;
+
+            pglite_container_extents_add(&used, extent.start, extent.count);
+        }
+
+        if (problem == NULL && fork->nmapped != entry.nblocks)
+            problem = "its map is truncated";
+
+        fork->nblocks = fork->nmapped;
+    }
+
+    free(map);
+
+    if (problem != NULL)
+    {
+        free(used.extents);
+        return problem;
+    }
+
+    /* what no fork nor map is using is free */
+    pglite_container_extents_sort(&used);
+
+    next = 0;
+    for (int i = 0; i < used.count; i++)
+    {
+        if (used.extents[i].start < next)
+        {
+            free(used.extents);
+            return "its map has a block in two places";
+        }
+
+        pglite_container_extents_add(&c->free, next, used.extents[i].start - next);
+        next = used.extents[i].start + used.extents[i].count;
+    }
+    pglite_container_extents_add(&c->free, next, c->nblocks - next);
+
+    free(used.extents);
+    return NULL;
+}
+
+static void
+pglite_container_free(PgliteContainer *c)
+{
+    for (int i = 0; i < PGLITE_CONTAINER_BUCKETS; i++)
+    {
+        PgliteContainerFork *fork = c->forks[i];
+
+        while (fork != NULL)
+        {
+            PgliteContainerFork *next = fork->next;
+
+            pglite_container_free_fork(fork);
+            fork = next;
+        }
+    }
+
+    if (c->fd >= 0)
+        close(c->fd);
+
+    pthread_rwlock_destroy(&c->lock);
+    pthread_mutex_destroy(&c->space_lock);
+    pthread_mutex_destroy(&c->sync_lock);
+    free(c->free.extents);
+    free(c->released.extents);
+    free(c->data_dir);
+    free(c);
+}
+
+/*
+ * Lets go of the thread's container when it exits, writing its map and
+ * closing it if it was the last thread using it. That's done before
+ * another thread can open it afresh, so it never reads a stale map.
+ */
+static void
+pglite_container_detach(void *arg)
+{
+    PgliteContainer *c = arg;
+    PgliteContainer **slot;
+
+    pthread_mutex_lock(&pglite_containers_lock);
+
+    if (--c->refcount > 0)
+    {
+        pthread_mutex_unlock(&pglite_containers_lock);
+        return;
+    }
+
+    for (slot = &pglite_containers; *slot != c; slot = &(*slot)->next)
+        ;
+    *slot = c->next;
+
+    if (!pglite_container_write_map(c))
+        write_stderr("pglite: could not write the map of %s/%s: %s\n",
+                     c->data_dir, PGLITE_CONTAINER_FILE, strerror(errno));
+
+    pglite_container_free(c);
+
+    pthread_mutex_unlock(&pglite_containers_lock);
+}
+
+static void
+pglite_container_init(void)
+{
+    pthread_key_create(&pglite_container_key, pglite_container_detach);
+}
+
+/*
+ * The container of the cluster in DataDir, opened by the first thread to
+ * use it and closed after the last
+ */
+static PgliteContainer *
+pglite_container_get(void)
+{
+    PgliteContainer *c = pglite_container;
+    const char *problem = NULL;
+    int         save_errno = 0;
+
+    if (likely(c != NULL))
+        return c;
+
+    pthread_once(&pglite_container_once, pglite_container_init);
+
+    pthread_mutex_lock(&pglite_containers_lock);
+
+    for (c = pglite_containers; c != NULL; c = c->next)
+    {
+        if (strcmp(c->data_dir, DataDir) == 0)
+            break;
+    }
+
+    if (c == NULL)
+    {
+        c = calloc(1, sizeof(PgliteContainer));
+        if (c == NULL || (c->data_dir = strdup(DataDir)) == NULL)
+        {
+            free(c);
+            pthread_mutex_unlock(&pglite_containers_lock);
+            ereport(ERROR,
+                    (errcode(ERRCODE_OUT_OF_MEMORY),
+                     errmsg("out of memory")));
+        }
+
+        pthread_rwlock_init(&c->lock, NULL);
+        pthread_mutex_init(&c->space_lock, NULL);
+        pthread_mutex_init(&c->sync_lock, NULL);
+
+        c->fd = pglite_open(PGLITE_CONTAINER_FILE, O_RDWR | PG_BINARY | O_CLOEXEC, 0);
+        problem = c->fd < 0 ? "" : pglite_container_load(c);
+
+        if (problem != NULL)
+        {
+            save_errno = errno;
+            pglite_container_free(c);
+            pthread_mutex_unlock(&pglite_containers_lock);
+
+            errno = save_errno;
+            if (problem[0] == '\0')
+                ereport(ERROR,
+                        (errcode_for_file_access(),
+                         errmsg("could not open file \"%s\": %m",
+                                PGLITE_CONTAINER_FILE)));
+            else
+                ereport(ERROR,
+                        (errcode(ERRCODE_DATA_CORRUPTED),
+                         errmsg("could not open file \"%s\": %s",
+                                PGLITE_CONTAINER_FILE, problem)));
+        }
+
+        c->next = pglite_containers;
+        pglite_containers = c;
+    }
+
+    c->refcount++;
+
+    pthread_mutex_unlock(&pglite_containers_lock);
+
+    pthread_setspecific(pglite_container_key, c);
+    pglite_container = c;
+    return c;
+}
+
+/*
+ * Finds the fork and locks it, shared or exclusive, along with the
+ * container, which stays locked so that the fork can't be unlinked under
+ * us. Raises an error as md.c would for a missing file.
+ */
+static PgliteContainerFork *
+pglite_container_lock_fork(PgliteContainer *c, SMgrRelation reln,
+                           ForkNumber forknum, bool exclusive)
+{
+    PgliteContainerFork *fork;
+
+    pthread_rwlock_rdlock(&c->lock);
+
+    fork = *pglite_container_slot(c, reln->smgr_rnode, forknum);
+    if (fork == NULL)
+    {
+        pthread_rwlock_unlock(&c->lock);
+        errno = ENOENT;
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not open file \"%s\": %m",
+                        relpath(reln->smgr_rnode, forknum))));
+    }
+
+    if (exclusive)
+        pthread_rwlock_wrlock(&fork->lock);
+    else
+        pthread_rwlock_rdlock(&fork->lock);
+
+    return fork;
+}
+
+static void
+pglite_container_unlock_fork(PgliteContainer *c, PgliteContainerFork *fork)
+{
+    pthread_rwlock_unlock(&fork->lock);
+    pthread_rwlock_unlock(&c->lock);
+}
+
+/*
+ * Writes `buffer` as page `blocknum`, growing the fork first if it's past
+ * the end
+ */
+static void
+pglite_container_store(SMgrRelation reln, ForkNumber forknum,
+                       BlockNumber blocknum, const char *buffer, bool skipFsync)
+{
+    PgliteContainer *c = pglite_container_get();
+    PgliteContainerFork *fork;
+    ssize_t     nbytes;
+    int         save_errno;
+
+    fork = pglite_container_lock_fork(c, reln, forknum, false);
+
+    if (blocknum >= fork->nblocks)
+    {
+        pthread_rwlock_unlock(&fork->lock);
+        pthread_rwlock_wrlock(&fork->lock);
+
+        if (blocknum >= fork->nblocks && !pglite_container_grow(c, fork, blocknum + 1))
+        {
+            save_errno = errno;
+            pglite_container_unlock_fork(c, fork);
+            errno = save_errno;
+            ereport(ERROR,
+                    (errcode_for_file_access(),
+                     errmsg("could not extend file \"%s\": %m",
+                            relpath(reln->smgr_rnode, forknum)),
+                     errhint("Check free disk space.")));
+        }
+    }
+
+    pgstat_report_wait_start(WAIT_EVENT_DATA_FILE_WRITE);
+    nbytes = pg_pwrite(c->fd, buffer, BLCKSZ, (off_t) fork->blocks[blocknum] * BLCKSZ);
+    pgstat_report_wait_end();
+    save_errno = errno;
+
+    pglite_container_unlock_fork(c, fork);
+
+    if (nbytes != BLCKSZ)
+    {
+        errno = save_errno;
+        if (nbytes < 0)
+            ereport(ERROR,
+                    (errcode_for_file_access(),
+                     errmsg("could not write block %u in file \"%s\": %m",
+                            blocknum, relpath(reln->smgr_rnode, forknum))));
+        ereport(ERROR,
+                (errcode(ERRCODE_DISK_FULL),
+                 errmsg("could not write block %u in file \"%s\": wrote only %d of %d bytes",
+                        blocknum, relpath(reln->smgr_rnode, forknum),
+                        (int) nbytes, BLCKSZ),
+                 errhint("Check free disk space.")));
+    }
+
+    if (!skipFsync)
+        pglite_container_data_written(c);
+}
+
+void
+pglite_container_open(SMgrRelation reln)
+{
+}
+
+void
+pglite_container_close(SMgrRelation reln, ForkNumber forknum)
+{
+}
+
+void
+pglite_container_create(SMgrRelation reln, ForkNumber forknum, bool isRedo)
+{
+    PgliteContainer *c = pglite_container_get();
+    PgliteContainerFork **slot;
+    PgliteContainerFork *fork;
+
+    pthread_rwlock_wrlock(&c->lock);
+
+    slot = pglite_container_slot(c, reln->smgr_rnode, forknum);
+    if (*slot != NULL)
+    {
+        /* replayed, it may be a main fork waiting to be dropped */
+        if (isRedo)
+            (*slot)->drop_at = 0;
+
+        pthread_rwlock_unlock(&c->lock);
+
+        if (isRedo)
+            return;
+
+        errno = EEXIST;
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not create file \"%s\": %m",
+                        relpath(reln->smgr_rnode, forknum))));
+    }
+
+    fork = pglite_container_new_fork(reln->smgr_rnode, forknum);
+    if (fork == NULL)
+    {
+        pthread_rwlock_unlock(&c->lock);
+        ereport(ERROR,
+                (errcode(ERRCODE_OUT_OF_MEMORY),
+                 errmsg("out of memory")));
+    }
+
+    *slot = fork;
+    pglite_container_map_changed(c);
+
+    pthread_rwlock_unlock(&c->lock);
+}
+
+bool
+pglite_container_exists_fork(SMgrRelation reln, ForkNumber forknum)
+{
+    PgliteContainer *c = pglite_container_get();
+    bool        exists;
+
+    pthread_rwlock_rdlock(&c->lock);
+    exists = *pglite_container_slot(c, reln->smgr_rnode, forknum) != NULL;
+    pthread_rwlock_unlock(&c->lock);
+
+    return exists;
+}
+
+/*
+ * Removes the fork, or all of them for InvalidForkNumber. A main fork of a
+ * permanent relation is emptied but kept until its relfilenode is safe to
+ * reuse, as md.c does, unless in recovery.
+ */
+void
+pglite_container_unlink(RelFileNodeBackend rnode, ForkNumber forknum, bool isRedo)
+{
+    PgliteContainer *c = pglite_container_get();
+    ForkNumber  first = forknum;
+    ForkNumber  last = forknum;
+    PgliteContainerFork *unlinked = NULL;
+
+    if (forknum == InvalidForkNumber)
+    {
+        first = 0;
+        last = MAX_FORKNUM;
+    }
+
+    pthread_rwlock_wrlock(&c->lock);
+
+    for (ForkNumber forkno = first; forkno <= last; forkno++)
+    {
+        PgliteContainerFork **slot = pglite_container_slot(c, rnode, forkno);
+        PgliteContainerFork *found = *slot;
+
+        if (found == NULL)
+            continue;
+
+        /* nobody else has the fork locked, with the container locked */
+        pglite_container_release(c, found, 0);
+
+        if (forkno == MAIN_FORKNUM && !isRedo && !RelFileNodeBackendIsTemp(rnode))
+        {
+            pthread_mutex_lock(&c->space_lock);
+            found->drop_at = c->checkpoints + PGLITE_CONTAINER_UNLINK_CHECKPOINTS;
+            pthread_mutex_unlock(&c->space_lock);
+            continue;
+        }
+
+        *slot = found->next;
+        found->next = unlinked;
+        unlinked = found;
+    }
+
+    pthread_rwlock_unlock(&c->lock);
+
+    while (unlinked != NULL)
+    {
+        PgliteContainerFork *next = unlinked->next;
+
+        pglite_container_free_fork(unlinked);
+        unlinked = next;
+    }
+}
+
+void
+pglite_container_extend(SMgrRelation reln, ForkNumber forknum,
+                        BlockNumber blocknum, char *buffer, bool skipFsync)
+{
+    if (blocknum == InvalidBlockNumber)
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("cannot extend file \"%s\" beyond %u blocks",
+                        relpath(reln->smgr_rnode, forknum),
+                        InvalidBlockNumber)));
+
+    pglite_container_store(reln, forknum, blocknum, buffer, skipFsync);
+}
+
+bool
+pglite_container_prefetch(SMgrRelation reln, ForkNumber forknum,
+                          BlockNumber blocknum)
+{
+#ifdef USE_PREFETCH
+    PgliteContainer *c = pglite_container_get();
+    PgliteContainerFork *fork;
+
+    fork = pglite_container_lock_fork(c, reln, forknum, false);
+
+    if (blocknum < fork->nblocks)
+        (void) posix_fadvise(c->fd, (off_t) fork->blocks[blocknum] * BLCKSZ,
+                             BLCKSZ, POSIX_FADV_WILLNEED);
+
+    pglite_container_unlock_fork(c, fork);
+#endif
+
+    return true;
+}
+
+void
+pglite_container_read(SMgrRelation reln, ForkNumber forknum,
+                      BlockNumber blocknum, char *buffer)
+{
+    PgliteContainer *c = pglite_container_get();
+    PgliteContainerFork *fork;
+    ssize_t     nbytes = 0;
+    int         save_errno = 0;
+
+    fork = pglite_container_lock_fork(c, reln, forknum, false);
+
+    if (blocknum < fork->nblocks)
+    {
+        pgstat_report_wait_start(WAIT_EVENT_DATA_FILE_READ);
+        nbytes = pg_pread(c->fd, buffer, BLCKSZ, (off_t) fork->blocks[blocknum] * BLCKSZ);
+        pgstat_report_wait_end();
+        save_errno = errno;
+    }
+
+    pglite_container_unlock_fork(c, fork);
+
+    if (nbytes == BLCKSZ)
+        return;
+
+    if (nbytes < 0)
+    {
+        errno = save_errno;
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not read block %u in file \"%s\": %m",
+                        blocknum, relpath(reln->smgr_rnode, forknum))));
+    }
+
+    /* past the end: as md.c does with a short read */
+    if (zero_damaged_pages || InRecovery)
+        MemSet(buffer, 0, BLCKSZ);
+    else
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_CORRUPTED),
+                 errmsg("could not read block %u in file \"%s\": read only %d of %d bytes",
+                        blocknum, relpath(reln->smgr_rnode, forknum),
+                        (int) nbytes, BLCKSZ)));
+}
+
+void
+pglite_container_write(SMgrRelation reln, ForkNumber forknum,
+                       BlockNumber blocknum, char *buffer, bool skipFsync)
+{
+    pglite_container_store(reln, forknum, blocknum, buffer, skipFsync);
+}
+
+/*
+ * Leaves writing pages back to the kernel: they're scattered over the file,
+ * and it's synced whole anyway
+ */
+void
+pglite_container_writeback(SMgrRelation reln, ForkNumber forknum,
+                           BlockNumber blocknum, BlockNumber nblocks)
+{
+}
+
+BlockNumber
+pglite_container_nblocks(SMgrRelation reln, ForkNumber forknum)
+{
+    PgliteContainer *c = pglite_container_get();
+    PgliteContainerFork *fork;
+    BlockNumber nblocks;
+
+    fork = pglite_container_lock_fork(c, reln, forknum, false);
+    nblocks = fork->nblocks;
+    pglite_container_unlock_fork(c, fork);
+
+    return nblocks;
+}
+
+void
+pglite_container_truncate(SMgrRelation reln, ForkNumber forknum,
+                          BlockNumber nblocks)
+{
+    PgliteContainer *c = pglite_container_get();
+    PgliteContainerFork *fork;
+    BlockNumber curnblk;
+
+    fork = pglite_container_lock_fork(c, reln, forknum, true);
+
+    curnblk = fork->nblocks;
+    if (nblocks > curnblk)
+    {
+        pglite_container_unlock_fork(c, fork);
+
+        /* as md.c: a truncation replayed after a later one already was */
+        if (InRecovery)
+            return;
+
+        ereport(ERROR,
+                (errmsg("could not truncate file \"%s\" to %u blocks: it's only %u blocks now",
+                        relpath(reln->smgr_rnode, forknum),
+                        nblocks, curnblk)));
+    }
+
+    pglite_container_release(c, fork, nblocks);
+
+    pglite_container_unlock_fork(c, fork);
+}
+
+void
+pglite_container_immedsync(SMgrRelation reln, ForkNumber forknum)
+{
+    PgliteContainer *c = pglite_container_get();
+
+    if (!pglite_container_write_map(c))
+        ereport(data_sync_elevel(ERROR),
+                (errcode_for_file_access(),
+                 errmsg("could not fsync file \"%s\": %m",
+                        PGLITE_CONTAINER_FILE)));
+}
+
+/*
+ * Whether the cluster in DataDir keeps its relations in a container file
+ */
+static bool
+pglite_container_in_use(void)
+{
+    struct stat st;
+
+    if (likely(pglite_container_found >= 0))
+        return pglite_container_found;
+
+    if (DataDir == NULL)
+        return false;
+
+    if (pglite_stat(PGLITE_CONTAINER_FILE, &st) == 0)
+        pglite_container_found = 1;
+    else if (errno == ENOENT)
+        pglite_container_found = 0;
+    else
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not stat file \"%s\": %m",
+                        PGLITE_CONTAINER_FILE)));
+
+    return pglite_container_found;
+}
+
+/*
+ * The storage manager for smgropen to give relations of this thread's
+ * cluster, if they're not in memory: this one if it has a container file,
+ * else md.c
+ */
+int
+pglite_container_smgr_which(void)
+{
+    return pglite_container_in_use() ? PGLITE_CONTAINER_SMGR : 0;
+}
+
+/*
+ * For GetNewRelFileNode: whether the relfilenode is in use in the container,
+ * where there's no file for it to find in the way
+ */
+bool
+pglite_container_exists(RelFileNodeBackend rnode)
+{
+    PgliteContainer *c;
+    bool        exists;
+
+    if (!pglite_container_in_use())
+        return false;
+
+    c = pglite_container_get();
+
+    pthread_rwlock_rdlock(&c->lock);
+    exists = *pglite_container_slot(c, rnode, MAIN_FORKNUM) != NULL;
+    pthread_rwlock_unlock(&c->lock);
+
+    return exists;
+}
+
+/*
+ * For calculate_relation_size: the size of the fork, if the cluster keeps
+ * its relations in a container, 0 if there's no such fork
+ */
+bool
+pglite_container_fork_size(RelFileNode node, BackendId backend,
+                           ForkNumber forknum, int64 *size)
+{
+    PgliteContainer *c;
+    PgliteContainerFork *fork;
+    RelFileNodeBackend rnode;
+
+    if (!pglite_container_in_use())
+        return false;
+
+    c = pglite_container_get();
+    rnode.node = node;
+    rnode.backend = backend;
+
+    pthread_rwlock_rdlock(&c->lock);
+
+    fork = *pglite_container_slot(c, rnode, forknum);
+    *size = fork == NULL ? 0 : (int64) fork->nblocks * BLCKSZ;
+
+    pthread_rwlock_unlock(&c->lock);
+
+    return true;
+}
+
+/*
+ * The tablespace and database of a directory GetDatabasePath gave. Used by
+ * memory_smgr.c too.
+ */
+bool
+pglite_parse_db_path(const char *path, Oid *spcNode, Oid *dbNode)
+{
+    char        rest;
+
+    if (sscanf(path, "base/%u%c", dbNode, &rest) == 1)
+    {
+        *spcNode = DEFAULTTABLESPACE_OID;
+        return true;
+    }
+
+    return sscanf(path, "pg_tblspc/%u/" TABLESPACE_VERSION_DIRECTORY "/%u%c",
+                  spcNode, dbNode, &rest) == 2;
+}
+
+/*
+ * Unlinks the forks `drop` picks, at once. The container must be locked
+ * exclusively.
+ */
+static void
+pglite_container_drop_forks(PgliteContainer *c,
+                            bool (*drop) (PgliteContainer *c, PgliteContainerFork *fork, void *arg),
+                            void *arg)
+{
+    for (int i = 0; i < PGLITE_CONTAINER_BUCKETS; i++)
+    {
+        PgliteContainerFork **slot = &c->forks[i];
+
+        while (*slot != NULL)
+        {
+            PgliteContainerFork *fork = *slot;
+
+            if (!drop(c, fork, arg))
+            {
+                slot = &fork->next;
+                continue;
+            }
+
+            pglite_container_release(c, fork, 0);
+            *slot = fork->next;
+            pglite_container_free_fork(fork);
+        }
+    }
+}
+
+static bool
+pglite_container_in_database(PgliteContainer *c, PgliteContainerFork *fork, void *arg)
+{
+    const RelFileNode *db = arg;
+
+    return !RelFileNodeBackendIsTemp(fork->key.rnode) &&
+        fork->key.rnode.node.dbNode == db->dbNode &&
+        (db->spcNode == InvalidOid || fork->key.rnode.node.spcNode == db->spcNode);
+}
+
+/*
+ * For copydir, as CREATE DATABASE copies a template database's directory:
+ * copies the relations in it too. Those already in the one copied to, left
+ * by a database dropped in recovery, are dropped first.
+ */
+void
+pglite_container_copy_db(const char *fromdir, const char *todir)
+{
+    PgliteContainer *c;
+    RelFileNode from;
+    RelFileNode to;
+    PgliteContainerFork *copies = NULL;
+    bool        ok = true;
+    int         save_errno = 0;
+
+    if (!pglite_container_in_use() ||
+        !pglite_parse_db_path(fromdir, &from.spcNode, &from.dbNode) ||
+        !pglite_parse_db_path(todir, &to.spcNode, &to.dbNode))
+        return;
+
+    c = pglite_container_get();
+
+    pthread_rwlock_wrlock(&c->lock);
+
+    pglite_container_drop_forks(c, pglite_container_in_database, &to);
+
+    for (int i = 0; ok && i < PGLITE_CONTAINER_BUCKETS; i++)
+    {
+        for (PgliteContainerFork *fork = c->forks[i]; ok && fork != NULL; fork = fork->next)
+        {
+            RelFileNodeBackend rnode = fork->key.rnode;
+            PgliteContainerFork *copy;
+
+            if (!pglite_container_in_database(c, fork, &from) || fork->drop_at != 0)
+                continue;
+
+            rnode.node.spcNode = to.spcNode;
+            rnode.node.dbNode = to.dbNode;
+
+            copy = pglite_container_new_fork(rnode, fork->key.forknum);
+            if (copy == NULL)
+            {
+                ok = false;
+                save_errno = ENOMEM;
+                break;
+            }
+
+            copy->next = copies;
+            copies = copy;
+
+            ok = pglite_container_map_blocks(c, copy, fork->nblocks) &&
+                pglite_container_copy_pages(c, fork, copy, fork->nblocks);
+            save_errno = errno;
+            copy->nblocks = fork->nblocks;
+        }
+    }
+
+    /* filed once the walk's done, so it doesn't come across them */
+    while (copies != NULL)
+    {
+        PgliteContainerFork *copy = copies;
+
+        copies = copy->next;
+
+        if (ok)
+        {
+            PgliteContainerFork **slot = pglite_container_slot(c, copy->key.rnode,
+                                                               copy->key.forknum);
+
+            copy->next = NULL;
+            *slot = copy;
+        }
+        else
+        {
+            pglite_container_release(c, copy, 0);
+            pglite_container_free_fork(copy);
+        }
+    }
+
+    pglite_container_map_changed(c);
+
+    pthread_rwlock_unlock(&c->lock);
+
+    errno = save_errno;
+    if (!ok)
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not copy relations of \"%s\" to \"%s\" in file \"%s\": %m",
+                        fromdir, todir, PGLITE_CONTAINER_FILE)));
+
+    /* as copydir syncs the files it copies */
+    if (!pglite_container_write_map(c))
+        ereport(data_sync_elevel(ERROR),
+                (errcode_for_file_access(),
+                 errmsg("could not fsync file \"%s\": %m",
+                        PGLITE_CONTAINER_FILE)));
+}
+
+/*
+ * For DROP DATABASE, as it removes the database's directories: drops its
+ * relations
+ */
+void
+pglite_container_drop_db(Oid dbid)
+{
+    PgliteContainer *c;
+    RelFileNode db;
+
+    if (!pglite_container_in_use())
+        return;
+
+    c = pglite_container_get();
+    db.spcNode = InvalidOid;
+    db.dbNode = dbid;
+
+    pthread_rwlock_wrlock(&c->lock);
+    pglite_container_drop_forks(c, pglite_container_in_database, &db);
+    pthread_rwlock_unlock(&c->lock);
+}
+
+/*
+ * For ALTER DATABASE SET TABLESPACE, as it removes the database's directory
+ * in the tablespace it left, and for replaying the drop of a database, a
+ * directory at a time: drops its relations in that directory
+ */
+void
+pglite_container_drop_db_dir(const char *dbpath)
+{
+    PgliteContainer *c;
+    RelFileNode db;
+
+    if (!pglite_container_in_use() ||
+        !pglite_parse_db_path(dbpath, &db.spcNode, &db.dbNode))
+        return;
+
+    c = pglite_container_get();
+
+    pthread_rwlock_wrlock(&c->lock);
+    pglite_container_drop_forks(c, pglite_container_in_database, &db);
+    pthread_rwlock_unlock(&c->lock);
+}
+
+/*
+ * For calculate_database_size: the size of the database's relations in the
+ * container, 0 if the cluster has none
+ */
+int64
+pglite_container_database_size(Oid dbid)
+{
+    PgliteContainer *c;
+    int64       size = 0;
+
+    if (!pglite_container_in_use())
+        return 0;
+
+    c = pglite_container_get();
+
+    pthread_rwlock_rdlock(&c->lock);
+
+    for (int i = 0; i < PGLITE_CONTAINER_BUCKETS; i++)
+    {
+        for (PgliteContainerFork *fork = c->forks[i]; fork != NULL; fork = fork->next)
+        {
+            if (fork->key.rnode.node.dbNode == dbid)
+                size += (int64) fork->nblocks * BLCKSZ;
+        }
+    }
+
+    pthread_rwlock_unlock(&c->lock);
+
+    return size;
+}
+
+static bool
+pglite_container_unlogged(PgliteContainer *c, PgliteContainerFork *fork, void *arg)
+{
+    return fork->key.forknum != INIT_FORKNUM &&
+        *pglite_container_slot(c, fork->key.rnode, INIT_FORKNUM) != NULL;
+}
+
+/*
+ * For ResetUnloggedRelations, as it goes through the data directory's files
+ * after a crash: drops the forks of unlogged relations other than their
+ * init forks, or copies the init forks over their main forks
+ */
+void
+pglite_container_reset_unlogged(int op)
+{
+    PgliteContainer *c;
+    bool        ok = true;
+    int         save_errno = 0;
+
+    if (!pglite_container_in_use())
+        return;
+
+    c = pglite_container_get();
+
+    pthread_rwlock_wrlock(&c->lock);
+
+    if (op & UNLOGGED_RELATION_CLEANUP)
+        pglite_container_drop_forks(c, pglite_container_unlogged, NULL);
+
+    for (int i = 0; ok && (op & UNLOGGED_RELATION_INIT) && i < PGLITE_CONTAINER_BUCKETS; i++)
+    {
+        for (PgliteContainerFork *init = c->forks[i]; ok && init != NULL; init = init->next)
+        {
+            PgliteContainerFork **slot;
+            PgliteContainerFork *main;
+
+            if (init->key.forknum != INIT_FORKNUM)
+                continue;
+
+            slot = pglite_container_slot(c, init->key.rnode, MAIN_FORKNUM);
+            main = *slot;
+
+            if (main == NULL)
+            {
+                main = pglite_container_new_fork(init->key.rnode, MAIN_FORKNUM);
+                if (main == NULL)
+                {
+                    ok = false;
+                    save_errno = ENOMEM;
+                    break;
+                }
+
+                *slot = main;
+            }
+
+            pglite_container_release(c, main, 0);
+
+            ok = pglite_container_map_blocks(c, main, init->nblocks) &&
+                pglite_container_copy_pages(c, init, main, init->nblocks);
+            save_errno = errno;
+            main->nblocks = ok ? init->nblocks : 0;
+        }
+    }
+
+    pglite_container_map_changed(c);
+
+    pthread_rwlock_unlock(&c->lock);
+
+    errno = save_errno;
+    if (!ok)
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not reset unlogged relations in file \"%s\": %m",
+                        PGLITE_CONTAINER_FILE)));
+
+    /* as md.c syncs the main forks it copies */
+    if ((op & UNLOGGED_RELATION_INIT) && !pglite_container_write_map(c))
+        ereport(data_sync_elevel(ERROR),
+                (errcode_for_file_access(),
+                 errmsg("could not fsync file \"%s\": %m",
+                        PGLITE_CONTAINER_FILE)));
+}
+
+static bool
+pglite_container_due(PgliteContainer *c, PgliteContainerFork *fork, void *arg)
+{
+    return fork->drop_at != 0 && fork->drop_at <= *(uint64 *) arg;
+}
+
+/*
+ * For the checkpointer, as it syncs files: drops the main forks unlinked
+ * long enough ago, and writes the map
+ */
+void
+pglite_container_checkpoint(void)
+{
+    PgliteContainer *c;
+    uint64      checkpoints;
+
+    if (!pglite_container_in_use())
+        return;
+
+    c = pglite_container_get();
+
+    pthread_mutex_lock(&c->space_lock);
+    checkpoints = ++c->checkpoints;
+    pthread_mutex_unlock(&c->space_lock);
+
+    pthread_rwlock_wrlock(&c->lock);
+    pglite_container_drop_forks(c, pglite_container_due, &checkpoints);
+    pthread_rwlock_unlock(&c->lock);
+
+    if (!pglite_container_write_map(c))
+        ereport(data_sync_elevel(ERROR),
+                (errcode_for_file_access(),
+                 errmsg("could not fsync file \"%s\": %m",
+                        PGLITE_CONTAINER_FILE)));
+}
+
+/*
+ * Creates an empty container file in `data_dir`, so that the cluster
+ * bootstrapped there keeps its relations in it. Returns false with errno
+ * set if it can't.
+ */
+bool
+pglite_create_container(const char *data_dir)
+{
+    char        path[MAXPGPATH];
+    PGAlignedBlock block;
+    PgliteContainerHeader header;
+    uint32      nforks = 0;
+    int         fd;
+    bool        ok;
+    int         save_errno;
+
+    snprintf(path, sizeof(path), "%s/%s", data_dir, PGLITE_CONTAINER_FILE);
+
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | PG_BINARY | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        return false;
+
+    /* the first map, of no forks, in block 2 */
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, pglite_container_magic, sizeof(header.magic));
+    header.version = PGLITE_CONTAINER_VERSION;
+    header.blcksz = BLCKSZ;
+    header.generation = 2;
+    header.map_start = 2;
+    header.map_size = sizeof(nforks);
+    INIT_CRC32C(header.map_crc);
+    COMP_CRC32C(header.map_crc, &nforks, sizeof(nforks));
+    FIN_CRC32C(header.map_crc);
+    pglite_container_header_crc(&header);
+
+    memset(block.data, 0, BLCKSZ);
+    memcpy(block.data, &header, sizeof(header));
+
+    ok = pglite_container_write_at(fd, block.data, BLCKSZ, 0) &&
+        pglite_container_write_at(fd, pglite_container_zeros.data, BLCKSZ, BLCKSZ) &&
+        pglite_container_write_at(fd, &nforks, sizeof(nforks), 2 * BLCKSZ) &&
+        fsync(fd) == 0;
+    save_errno = errno;
+
+    close(fd);
+
+    if (!ok)
+    {
+        unlink(path);
+        errno = save_errno;
+    }
+
+    return ok;
+}
@@ -0,0 +1,372 @@
+/*
+ * copy.c
+ *
+ * Bulk loading of typed values, following the COPY FROM path in
+ * commands/copyfrom.c from the point where a row has been parsed: values
+ * are stored straight into virtual slots and written out in batches with
+ * table_multi_insert. There is no text parsing and no protocol framing.
+ *
+ * CopyMultiInsertBuffer and friends are private to copyfrom.c, so this
+ * keeps a single buffer of its own and supports the cases copyfrom.c can
+ * multi-insert into: plain tables without BEFORE/INSTEAD OF row triggers.
+ */
+#include <postgres.h>
+
+#include <access/heapam.h>
+#include <access/tableam.h>
+#include <access/xact.h>
+#include <catalog/namespace.h>
+#include <commands/trigger.h>
+#include <executor/executor.h>
+#include <nodes/makefuncs.h>
+#include <optimizer/optimizer.h>
+#include <rewrite/rewriteHandler.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/regproc.h>
+#include <utils/rls.h>
+#include <utils/snapmgr.h>
+
+#include "pglite.h"
+
+/* same as MAX_BUFFERED_TUPLES in copyfrom.c */
+#define PGLITE_COPY_BATCH_SIZE 1000
+
+typedef struct PgliteCopyState
+{
+    EState     *estate;
+    ResultRelInfo *resultRelInfo;
+    CommandId   mycid;
+    BulkInsertState bistate;
+    MemoryContext batchcontext;
+    TupleTableSlot *slots[PGLITE_COPY_BATCH_SIZE];
+    int         nbuffered;
+} PgliteCopyState;
+
+static void
+pglite_copy_flush(PgliteCopyState *cstate)
+{
+    ResultRelInfo *resultRelInfo = cstate->resultRelInfo;
+    EState     *estate = cstate->estate;
+
+    if (cstate->nbuffered == 0)
+        return;
+
+    table_multi_insert(resultRelInfo->ri_RelationDesc, cstate->slots,
+                       cstate->nbuffered, cstate->mycid, 0, cstate->bistate);
+
+    for (int i = 0; i < cstate->nbuffered; i++)
+    {
+        List       *recheckIndexes = NIL;
+
+        if (resultRelInfo->ri_NumIndices > 0)
+            recheckIndexes = ExecInsertIndexTuples(resultRelInfo,
+                                                   cstate->slots[i], estate,
+                                                   false, false, NULL, NIL);
+
+        /* AFTER ROW triggers, which is how foreign keys are checked */
+        ExecARInsertTriggers(estate, resultRelInfo, cstate->slots[i],
+                             recheckIndexes, NULL);
+
+        list_free(recheckIndexes);
+        ExecClearTuple(cstate->slots[i]);
+    }
+
+    cstate->nbuffered = 0;
+
+    MemoryContextReset(cstate->batchcontext);
+    ResetPerTupleExprContext(estate);
+}
+
+/*
+ * Resolves the target column list to attribute numbers, or every live
+ * column in order if none were given.
+ */
+static int
+pglite_copy_attnums(Relation rel, const char *const *columns, int ncolumns,
+                    AttrNumber *attnums)
+{
+    TupleDesc   tupdesc = RelationGetDescr(rel);
+    int         count = 0;
+
+    if (ncolumns == 0)
+    {
+        for (int i = 0; i < tupdesc->natts; i++)
+        {
+            if (!TupleDescAttr(tupdesc, i)->attisdropped)
+                attnums[count++] = i + 1;
+        }
+
+        return count;
+    }
+
+    for (int i = 0; i < ncolumns; i++)
+    {
+        AttrNumber  attnum = InvalidAttrNumber;
+
+        for (int j = 0; j < tupdesc->natts; j++)
+        {
+            Form_pg_attribute att = TupleDescAttr(tupdesc, j);
+
+            if (!att->attisdropped && namestrcmp(&att->attname, columns[i]) == 0)
+            {
+                attnum = j + 1;
+                break;
+            }
+        }
+
+        if (attnum == InvalidAttrNumber)
+            ereport(ERROR,
+                    (errcode(ERRCODE_UNDEFINED_COLUMN),
+                     errmsg("column \"%s\" of relation \"%s\" does not exist",
+                            columns[i], RelationGetRelationName(rel))));
+
+        for (int j = 0; j < count; j++)
+        {
+            if (attnums[j] == attnum)
+                ereport(ERROR,
+                        (errcode(ERRCODE_DUPLICATE_COLUMN),
+                         errmsg("column \"%s\" specified more than once",
+                                columns[i])));
+        }
+
+        attnums[count++] = attnum;
+    }
+
+    return count;
+}
+
+static void
+pglite_copy_check_relation(ResultRelInfo *resultRelInfo)
+{
+    Relation    rel = resultRelInfo->ri_RelationDesc;
+    TriggerDesc *trigdesc = resultRelInfo->ri_TrigDesc;
+    TupleDesc   tupdesc = RelationGetDescr(rel);
+
+    CheckValidResultRel(resultRelInfo, CMD_INSERT);
+
+    if (rel->rd_rel->relkind != RELKIND_RELATION)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("bulk loading into \"%s\" is not supported",
+                        RelationGetRelationName(rel)),
+                 errhint("Only plain tables can be bulk loaded; use INSERT instead.")));
+
+    /* as DoCopy, which leaves row-level security to INSERT */
+    if (check_enable_rls(RelationGetRelid(rel), InvalidOid, false) == RLS_ENABLED)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("COPY FROM not supported with row-level security"),
+                 errhint("Use INSERT statements instead.")));
+
+    if (trigdesc != NULL &&
+        (trigdesc->trig_insert_before_row || trigdesc->trig_insert_instead_row ||
+         trigdesc->trig_insert_new_table))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("bulk loading into \"%s\" is not supported",
+                        RelationGetRelationName(rel)),
+                 errdetail("The table has BEFORE or INSTEAD OF row triggers, or transition tables.")));
+
+    if (tupdesc->constr != NULL && tupdesc->constr->has_generated_stored)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("bulk loading into \"%s\" is not supported",
+                        RelationGetRelationName(rel)),
+                 errdetail("The table has generated columns.")));
+}
+
+/*
+ * Inserts nrows rows of width values each into table. columns names the
+ * column each value goes to; columns not named get their defaults. The
+ * rows are inserted in a single transaction command. A partition can be
+ * loaded directly, but not a partitioned table.
+ */
+ErrorData *
+pglite_copy_in(const char *table, const char *const *columns, int ncolumns,
+               const PgliteValue *values, int width, int nrows,
+               uint64 *processed)
+{
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ErrorData  *volatile edata = NULL;
+
+    *processed = 0;
+
+    PG_TRY();
+    {
+        EState     *estate;
+        RangeVar   *relation;
+        RangeTblEntry *rte;
+        PgliteCopyState *cstate;
+        Relation    rel;
+        TupleDesc   tupdesc;
+        AttrNumber *attnums;
+        int         nattnums;
+        ExprState **defexprs;
+        AttrNumber *defmap;
+        int         ndefaults = 0;
+        bool       *specified;
+
+        StartTransactionCommand();
+        pglite_check_not_aborted(NULL);
+        PushActiveSnapshot(GetTransactionSnapshot());
+
+        /* everything below is freed along with the executor state */
+        estate = CreateExecutorState();
+        MemoryContextSwitchTo(estate->es_query_cxt);
+
+        relation = makeRangeVarFromNameList(stringToQualifiedNameList(table));
+
+        rte = makeNode(RangeTblEntry);
+        rte->rtekind = RTE_RELATION;
+        rte->relid = RangeVarGetRelid(relation, RowExclusiveLock, false);
+        rte->relkind = get_rel_relkind(rte->relid);
+        rte->rellockmode = RowExclusiveLock;
+        rte->requiredPerms = ACL_INSERT;
+
+        cstate = palloc0(sizeof(PgliteCopyState));
+        cstate->estate = estate;
+        ExecInitRangeTable(cstate->estate, list_make1(rte));
+
+        cstate->resultRelInfo = makeNode(ResultRelInfo);
+        ExecInitResultRelation(cstate->estate, cstate->resultRelInfo, 1);
+
+        rel = cstate->resultRelInfo->ri_RelationDesc;
+        tupdesc = RelationGetDescr(rel);
+
+        pglite_copy_check_relation(cstate->resultRelInfo);
+
+        attnums = palloc(sizeof(AttrNumber) * Max(tupdesc->natts, ncolumns));
+        nattnums = pglite_copy_attnums(rel, columns, ncolumns, attnums);
+
+        if (width != nattnums)
+            ereport(ERROR,
+                    (errcode(ERRCODE_PROTOCOL_VIOLATION),
+                     errmsg("rows have %d values, but there are %d target columns",
+                            width, nattnums)));
+
+        specified = palloc0(sizeof(bool) * tupdesc->natts);
+
+        for (int i = 0; i < nattnums; i++)
+        {
+            specified[attnums[i] - 1] = true;
+            rte->insertedCols = bms_add_member(rte->insertedCols,
+                                               attnums[i] - FirstLowInvalidHeapAttributeNumber);
+        }
+
+        ExecCheckRTPerms(list_make1(rte), true);
+
+        /* defaults for the columns we weren't given, as BeginCopyFrom */
+        defexprs = palloc(sizeof(ExprState *) * tupdesc->natts);
+        defmap = palloc(sizeof(AttrNumber) * tupdesc->natts);
+
+        for (int i = 0; i < tupdesc->natts; i++)
+        {
+            Expr       *defexpr;
+
+            if (specified[i] || TupleDescAttr(tupdesc, i)->attisdropped)
+                continue;
+
+            defexpr = (Expr *) build_column_default(rel, i + 1);
+
+            if (defexpr != NULL)
+            {
+                defexpr = expression_planner(defexpr);
+                defexprs[ndefaults] = ExecInitExpr(defexpr, NULL);
+                defmap[ndefaults] = i;
+                ndefaults++;
+            }
+        }
+
+        ExecOpenIndices(cstate->resultRelInfo, false);
+
+        cstate->mycid = GetCurrentCommandId(true);
+        cstate->bistate = GetBulkInsertState();
+        cstate->batchcontext = AllocSetContextCreate(CurrentMemoryContext,
+                                                     "pglite copy batch",
+                                                     ALLOCSET_DEFAULT_SIZES);
+
+        AfterTriggerBeginQuery();
+        ExecBSInsertTriggers(cstate->estate, cstate->resultRelInfo);
+
+        for (int row = 0; row < nrows; row++)
+        {
+            const PgliteValue *rowvalues = &values[(size_t) row * width];
+            ExprContext *econtext = GetPerTupleExprContext(cstate->estate);
+            TupleTableSlot *slot;
+            MemoryContext rowcontext;
+
+            CHECK_FOR_INTERRUPTS();
+
+            if (cstate->slots[cstate->nbuffered] == NULL)
+                cstate->slots[cstate->nbuffered] =
+                    table_slot_create(rel, &cstate->estate->es_tupleTable);
+
+            slot = cstate->slots[cstate->nbuffered];
+            ExecClearTuple(slot);
+
+            /* converted values must live until the batch is flushed */
+            rowcontext = MemoryContextSwitchTo(cstate->batchcontext);
+
+            memset(slot->tts_isnull, true, sizeof(bool) * tupdesc->natts);
+
+            for (int i = 0; i < width; i++)
+            {
+                int         attidx = attnums[i] - 1;
+                const PgliteValue *value = &rowvalues[i];
+
+                slot->tts_isnull[attidx] = value->kind == PGLITE_VALUE_NULL;
+
+                if (!slot->tts_isnull[attidx])
+                    slot->tts_values[attidx] =
+                        pglite_value_datum(value, TupleDescAttr(tupdesc, attidx)->atttypid);
+            }
+
+            for (int i = 0; i < ndefaults; i++)
+                slot->tts_values[defmap[i]] = ExecEvalExpr(defexprs[i], econtext,
+                                                           &slot->tts_isnull[defmap[i]]);
+
+            MemoryContextSwitchTo(rowcontext);
+
+            ExecStoreVirtualTuple(slot);
+
+            if (tupdesc->constr != NULL)
+                ExecConstraints(cstate->resultRelInfo, slot, cstate->estate);
+
+            /* loading into a partition directly must respect its bounds */
+            if (rel->rd_rel->relispartition)
+                ExecPartitionCheck(cstate->resultRelInfo, slot, cstate->estate, true);
+
+            if (++cstate->nbuffered == PGLITE_COPY_BATCH_SIZE)
+                pglite_copy_flush(cstate);
+        }
+
+        pglite_copy_flush(cstate);
+
+        ExecASInsertTriggers(cstate->estate, cstate->resultRelInfo, NULL);
+        AfterTriggerEndQuery(cstate->estate);
+
+        FreeBulkInsertState(cstate->bistate);
+        table_finish_bulk_insert(rel, 0);
+
+        ExecResetTupleTable(cstate->estate->es_tupleTable, false);
+        ExecCloseResultRelations(cstate->estate);
+        ExecCloseRangeTableRelations(cstate->estate);
+        MemoryContextSwitchTo(oldcontext);
+        FreeExecutorState(cstate->estate);
+
+        PopActiveSnapshot();
+        CommitTransactionCommand();
+
+        *processed = nrows;
+    }
+    PG_CATCH();
+    {
+        edata = pglite_catch_error();
+        MemoryContextSwitchTo(oldcontext);
+    }
+    PG_END_TRY();
+
+    return edata;
+}
@@ -0,0 +1,220 @@
+/*
+ * dest.c
+ *
+ * A DestReceiver that hands each result slot straight to the Rust side, in
+ * place of printtup.c's text encoding. Values are read out of the slot
+ * directly; anything that has to be detoasted lives in a per-row memory
+ * context that is reset before the next row arrives.
+ *
+ * Detoasting a value or calling its output function can raise an error,
+ * which mustn't longjmp through the Rust frames of the receive callback.
+ * It's caught where it's raised, and raised again here once the callback
+ * has returned.
+ */
+#include <postgres.h>
+
+#include <access/tupdesc.h>
+#include <fmgr.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+
+#include "pglite.h"
+
+typedef struct PgliteReceiver
+{
+    DestReceiver pub;
+    pglite_startup_fn startup;
+    pglite_receive_fn receive;
+    void       *ctx;
+    MemoryContext rowcontext;
+} PgliteReceiver;
+
+/* raised reading a value, to be raised again once the callback returns */
+static __thread ErrorData *pglite_datum_error = NULL;
+
+static void
+pglite_receiver_startup(DestReceiver *self, int operation, TupleDesc typeinfo)
+{
+    PgliteReceiver *receiver = (PgliteReceiver *) self;
+
+    receiver->rowcontext = AllocSetContextCreate(CurrentMemoryContext,
+                                                 "pglite row",
+                                                 ALLOCSET_DEFAULT_SIZES);
+
+    receiver->startup(receiver->ctx, typeinfo);
+}
+
+static bool
+pglite_receiver_receive(TupleTableSlot *slot, DestReceiver *self)
+{
+    PgliteReceiver *receiver = (PgliteReceiver *) self;
+    MemoryContext oldcontext;
+    bool        keep_going;
+
+    slot_getallattrs(slot);
+
+    MemoryContextReset(receiver->rowcontext);
+    oldcontext = MemoryContextSwitchTo(receiver->rowcontext);
+
+    keep_going = receiver->receive(receiver->ctx, slot);
+
+    MemoryContextSwitchTo(oldcontext);
+
+    if (pglite_datum_error != NULL)
+    {
+        ErrorData  *edata = pglite_datum_error;
+
+        pglite_datum_error = NULL;
+        ReThrowError(edata);
+    }
+
+    return keep_going;
+}
+
+static void
+pglite_receiver_shutdown(DestReceiver *self)
+{
+    PgliteReceiver *receiver = (PgliteReceiver *) self;
+
+    if (receiver->rowcontext != NULL)
+    {
+        MemoryContextDelete(receiver->rowcontext);
+        receiver->rowcontext = NULL;
+    }
+}
+
+static void
+pglite_receiver_destroy(DestReceiver *self)
+{
+    pfree(self);
+}
+
+/*
+ * dest.c's CreateDestReceiver only knows about the built in CommandDest
+ * kinds, so like tstoreReceiver and friends we build our own and pass it
+ * to PortalRun directly. It reports itself as DestNone so that nothing in
+ * tcop mistakes it for a remote client.
+ */
+DestReceiver *
+pglite_create_receiver(pglite_startup_fn startup, pglite_receive_fn receive,
+                       void *ctx)
+{
+    PgliteReceiver *self;
+
+    /* receivers outlive the transactions they're used in */
+    self = (PgliteReceiver *) MemoryContextAllocZero(TopMemoryContext,
+                                                     sizeof(PgliteReceiver));
+
+    self->pub.receiveSlot = pglite_receiver_receive;
+    self->pub.rStartup = pglite_receiver_startup;
+    self->pub.rShutdown = pglite_receiver_shutdown;
+    self->pub.rDestroy = pglite_receiver_destroy;
+    self->pub.mydest = DestNone;
+
+    self->startup = startup;
+    self->receive = receive;
+    self->ctx = ctx;
+
+    return (DestReceiver *) self;
+}
+
+void
+pglite_tupdesc_column(TupleDesc desc, int attnum, PgliteColumn *column)
+{
+    Form_pg_attribute attr = TupleDescAttr(desc, attnum);
+
+    column->name = NameStr(attr->attname);
+    column->typid = attr->atttypid;
+    column->typlen = attr->attlen;
+    column->typbyval = attr->attbyval;
+}
+
+/*
+ * Holds on to the error being handled, in the current memory context, which
+ * while receiving is the per-row context, for pglite_receiver_receive to
+ * raise again
+ */
+static void
+pglite_datum_caught(MemoryContext oldcontext)
+{
+    MemoryContextSwitchTo(oldcontext);
+    pglite_datum_error = CopyErrorData();
+    FlushErrorState();
+}
+
+/*
+ * Gets the bytes of a by-reference datum. Varlenas are detoasted into the
+ * current memory context if they need to be, which while receiving is the
+ * per-row context. Returns false if that raised an error, or one was raised
+ * reading a value of this row already; the row's statement fails with it
+ * once the receive callback returns.
+ */
+bool
+pglite_datum_bytes(Datum value, int16 typlen, const char **bytes, size_t *len)
+{
+    MemoryContext oldcontext = CurrentMemoryContext;
+
+    if (pglite_datum_error != NULL)
+        return false;
+
+    if (typlen == -1)
+    {
+        PG_TRY();
+        {
+            struct varlena *varlena = pg_detoast_datum_packed((struct varlena *) DatumGetPointer(value));
+
+            *len = VARSIZE_ANY_EXHDR(varlena);
+            *bytes = VARDATA_ANY(varlena);
+        }
+        PG_CATCH();
+        {
+            pglite_datum_caught(oldcontext);
+        }
+        PG_END_TRY();
+
+        return pglite_datum_error == NULL;
+    }
+    else if (typlen == -2)
+    {
+        *bytes = DatumGetCString(value);
+        *len = strlen(*bytes);
+    }
+    else
+    {
+        *bytes = DatumGetPointer(value);
+        *len = typlen;
+    }
+
+    return true;
+}
+
+/*
+ * Gets the text form of a datum from its type's output function, allocated
+ * in the current memory context. Returns false if that raised an error, as
+ * pglite_datum_bytes does.
+ */
+bool
+pglite_datum_cstring(Datum value, Oid typid, char **cstring)
+{
+    MemoryContext oldcontext = CurrentMemoryContext;
+
+    if (pglite_datum_error != NULL)
+        return false;
+
+    PG_TRY();
+    {
+        Oid         typoutput;
+        bool        typisvarlena;
+
+        getTypeOutputInfo(typid, &typoutput, &typisvarlena);
+
+        *cstring = OidOutputFunctionCall(typoutput, value);
+    }
+    PG_CATCH();
+    {
+        pglite_datum_caught(oldcontext);
+    }
+    PG_END_TRY();
+
+    return pglite_datum_error == NULL;
+}
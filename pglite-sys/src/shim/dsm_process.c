@@ -0,0 +1,257 @@
+/*
+ * dsm_process.c
+ *
+ * The "process" dynamic_shared_memory_type, the default here. Every backend
+ * is a thread of this process, so a dynamic shared memory segment needs no
+ * more than process memory: creating one allocates it and files it in a
+ * registry under its handle, attaching looks it up there. Small segments
+ * come from the allocator, large ones are mapped anonymously, on huge pages
+ * if huge_pages allows.
+ *
+ * prepare-postgres.sh adds the type to dsm_impl.h and dsm_impl.c, and
+ * renames dsm_impl.c's dsm_impl_op to pglite_dsm_impl_os_op, which this
+ * falls back to for the other types.
+ */
+#include <postgres.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <storage/dsm_impl.h>
+#include <storage/pg_shmem.h>
+#include <storage/shmem.h>
+
+#include "pglite.h"
+
+/* the original dsm_impl_op, renamed by prepare-postgres.sh */
+extern bool pglite_dsm_impl_os_op(dsm_op op, dsm_handle handle,
+                                  Size request_size, void **impl_private,
+                                  void **mapped_address, Size *mapped_size,
+                                  int elevel);
+
+#define PGLITE_SEGMENT_BUCKETS 256
+
+typedef struct PgliteSegment
+{
+    dsm_handle  handle;
+    void       *address;
+    Size        size;
+    /* length of the mapping, or 0 if the segment came from calloc */
+    Size        mapped;
+    /* backends that have it mapped, its creator included */
+    int         refcnt;
+    /* destroyed, and only waiting for the last backend to detach */
+    bool        unlinked;
+    struct PgliteSegment *next;
+} PgliteSegment;
+
+/*
+ * Shared by all backend threads, unlike the globals of the backend.
+ * Destroyed segments stay filed under their handle until the last backend
+ * detaches, so the handle isn't reused meanwhile.
+ */
+static pthread_mutex_t pglite_segments_lock = PTHREAD_MUTEX_INITIALIZER;
+static PgliteSegment *pglite_segments[PGLITE_SEGMENT_BUCKETS];
+
+static PgliteSegment **
+pglite_segment_slot(dsm_handle handle)
+{
+    PgliteSegment **slot = &pglite_segments[handle % PGLITE_SEGMENT_BUCKETS];
+
+    while (*slot != NULL && (*slot)->handle != handle)
+        slot = &(*slot)->next;
+
+    return slot;
+}
+
+/*
+ * Memory for a new segment, zeroed as a new POSIX segment would be. Sets
+ * *mapped to the length mapped, or 0 if it came from calloc.
+ */
+static void *
+pglite_segment_alloc(Size size, Size *mapped)
+{
+    Size        hugepagesize;
+    int         mmap_flags;
+    void       *address;
+
+    GetHugePageSize(&hugepagesize, &mmap_flags);
+
+    if (size < hugepagesize)
+    {
+        *mapped = 0;
+        return calloc(1, size);
+    }
+
+    if (huge_pages != HUGE_PAGES_OFF)
+    {
+        *mapped = add_size(size, hugepagesize - 1) & ~(hugepagesize - 1);
+        address = mmap(NULL, *mapped, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | mmap_flags,
+                       -1, 0);
+        if (address != MAP_FAILED)
+            return address;
+    }
+
+    /* no huge pages reserved, or not wanted: transparent ones may do */
+    *mapped = size;
+    address = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (address == MAP_FAILED)
+        return NULL;
+
+#ifdef MADV_HUGEPAGE
+    if (huge_pages != HUGE_PAGES_OFF)
+        (void) madvise(address, size, MADV_HUGEPAGE);
+#endif
+
+    return address;
+}
+
+static void
+pglite_segment_free(PgliteSegment *segment)
+{
+    if (segment->mapped != 0)
+        munmap(segment->address, segment->mapped);
+    else
+        free(segment->address);
+
+    free(segment);
+}
+
+/*
+ * dsm_impl_op for the "process" type. Errors are raised only once the
+ * registry is unlocked, as they may not return.
+ */
+static bool
+dsm_impl_process(dsm_op op, dsm_handle handle, Size request_size,
+                 void **mapped_address, Size *mapped_size, int elevel)
+{
+    PgliteSegment **slot;
+    PgliteSegment *segment;
+    PgliteSegment *freed = NULL;
+
+    pthread_mutex_lock(&pglite_segments_lock);
+
+    slot = pglite_segment_slot(handle);
+    segment = *slot;
+
+    switch (op)
+    {
+        case DSM_OP_CREATE:
+            /* dsm.c picks another handle */
+            if (segment != NULL)
+            {
+                pthread_mutex_unlock(&pglite_segments_lock);
+                errno = EEXIST;
+                return false;
+            }
+
+            segment = malloc(sizeof(PgliteSegment));
+            if (segment != NULL)
+            {
+                segment->address = pglite_segment_alloc(request_size,
+                                                        &segment->mapped);
+                if (segment->address == NULL)
+                {
+                    free(segment);
+                    segment = NULL;
+                }
+            }
+
+            if (segment == NULL)
+            {
+                pthread_mutex_unlock(&pglite_segments_lock);
+                ereport(elevel,
+                        (errcode(ERRCODE_OUT_OF_MEMORY),
+                         errmsg("could not allocate shared memory segment of %zu bytes: %m",
+                                request_size)));
+                return false;
+            }
+
+            segment->handle = handle;
+            segment->size = request_size;
+            segment->refcnt = 1;
+            segment->unlinked = false;
+            segment->next = NULL;
+            *slot = segment;
+            break;
+
+        case DSM_OP_ATTACH:
+            if (segment == NULL || segment->unlinked)
+            {
+                pthread_mutex_unlock(&pglite_segments_lock);
+                errno = ENOENT;
+                ereport(elevel,
+                        (errcode(ERRCODE_UNDEFINED_OBJECT),
+                         errmsg("could not open shared memory segment %u: %m",
+                                handle)));
+                return false;
+            }
+
+            segment->refcnt++;
+            break;
+
+        case DSM_OP_DETACH:
+        case DSM_OP_DESTROY:
+            if (*mapped_address != NULL && segment != NULL)
+                segment->refcnt--;
+
+            *mapped_address = NULL;
+            *mapped_size = 0;
+
+            if (op == DSM_OP_DESTROY)
+            {
+                if (segment == NULL || segment->unlinked)
+                {
+                    pthread_mutex_unlock(&pglite_segments_lock);
+                    errno = ENOENT;
+                    ereport(elevel,
+                            (errcode(ERRCODE_UNDEFINED_OBJECT),
+                             errmsg("could not remove shared memory segment %u: %m",
+                                    handle)));
+                    return false;
+                }
+
+                segment->unlinked = true;
+            }
+
+            /* the memory stays until no backend has it mapped */
+            if (segment != NULL && segment->unlinked && segment->refcnt == 0)
+            {
+                *slot = segment->next;
+                freed = segment;
+            }
+
+            pthread_mutex_unlock(&pglite_segments_lock);
+
+            if (freed != NULL)
+                pglite_segment_free(freed);
+
+            return true;
+    }
+
+    *mapped_address = segment->address;
+    *mapped_size = segment->size;
+
+    pthread_mutex_unlock(&pglite_segments_lock);
+
+    return true;
+}
+
+bool
+dsm_impl_op(dsm_op op, dsm_handle handle, Size request_size,
+            void **impl_private, void **mapped_address, Size *mapped_size,
+            int elevel)
+{
+    Assert(op == DSM_OP_CREATE || request_size == 0);
+    Assert((op != DSM_OP_CREATE && op != DSM_OP_ATTACH) ||
+           (*mapped_address == NULL && *mapped_size == 0));
+
+    if (dynamic_shared_memory_type == DSM_IMPL_PROCESS)
+        return dsm_impl_process(op, handle, request_size, mapped_address,
+                                mapped_size, elevel);
+
+    return pglite_dsm_impl_os_op(op, handle, request_size, impl_private,
+                                 mapped_address, mapped_size, elevel);
+}
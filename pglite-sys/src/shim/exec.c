@@ -0,0 +1,738 @@
+/*
+ * exec.c
+ *
+ * Query execution for the resident backend thread, modelled on
+ * exec_simple_query and the extended query protocol in tcop/postgres.c but
+ * delivering results to a DestReceiver supplied by the caller, and
+ * reporting errors as a returned ErrorData rather than by longjmp'ing back
+ * to PostgresMain.
+ */
+#include <postgres.h>
+
+#include <access/xact.h>
+#include <catalog/pg_type.h>
+#include <miscadmin.h>
+#include <nodes/params.h>
+#include <parser/analyze.h>
+#include <tcop/pquery.h>
+#include <tcop/tcopprot.h>
+#include <tcop/utility.h>
+#include <utils/builtins.h>
+#include <utils/fmgrprotos.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/plancache.h>
+#include <utils/portal.h>
+#include <utils/snapmgr.h>
+
+#include "pglite.h"
+
+/* holds parse and plan trees for the duration of a single call */
+static __thread MemoryContext pglite_query_context = NULL;
+
+static MemoryContext
+pglite_begin_query(const char *query_string)
+{
+    if (pglite_query_context == NULL)
+        pglite_query_context = AllocSetContextCreate(TopMemoryContext,
+                                                     "pglite query",
+                                                     ALLOCSET_DEFAULT_SIZES);
+
+    debug_query_string = query_string;
+
+    return MemoryContextSwitchTo(pglite_query_context);
+}
+
+static void
+pglite_end_query(MemoryContext oldcontext)
+{
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextReset(pglite_query_context);
+    debug_query_string = NULL;
+}
+
+/*
+ * Error recovery, as done by the sigsetjmp block in PostgresMain. Must be
+ * called from a PG_CATCH block. The returned error is allocated in
+ * TopMemoryContext and must be freed with FreeErrorData.
+ */
+ErrorData *
+pglite_catch_error(void)
+{
+    ErrorData  *edata;
+
+    HOLD_INTERRUPTS();
+
+    MemoryContextSwitchTo(TopMemoryContext);
+    edata = CopyErrorData();
+    FlushErrorState();
+
+    AbortCurrentTransaction();
+    PortalErrorCleanup();
+
+    if (pglite_query_context != NULL)
+        MemoryContextReset(pglite_query_context);
+
+    debug_query_string = NULL;
+
+    RESUME_INTERRUPTS();
+
+    return edata;
+}
+
+static uint64
+pglite_run_portal(Portal portal, DestReceiver *dest)
+{
+    QueryCompletion qc;
+
+    InitializeQueryCompletion(&qc);
+    (void) PortalRun(portal, FETCH_ALL, true, true, dest, dest, &qc);
+    PortalDrop(portal, false);
+
+    return qc.nprocessed;
+}
+
+/*
+ * Starts a transaction command for the next statement unless one is open,
+ * like start_xact_command
+ */
+static void
+pglite_start_xact(bool *xact_started)
+{
+    if (!*xact_started)
+    {
+        StartTransactionCommand();
+        *xact_started = true;
+    }
+
+    /* parse and plan trees outlive the transaction commands between them */
+    MemoryContextSwitchTo(pglite_query_context);
+}
+
+/*
+ * Ends the transaction command, if one is open, like finish_xact_command
+ */
+static void
+pglite_finish_xact(bool *xact_started)
+{
+    if (*xact_started)
+    {
+        CommitTransactionCommand();
+        *xact_started = false;
+    }
+
+    MemoryContextSwitchTo(pglite_query_context);
+}
+
+/*
+ * Whether the statement ends a transaction block, as postgres.c's
+ * IsTransactionExitStmt has it
+ */
+static bool
+pglite_is_transaction_exit(Node *parsetree)
+{
+    if (parsetree && IsA(parsetree, TransactionStmt))
+    {
+        TransactionStmt *stmt = (TransactionStmt *) parsetree;
+
+        if (stmt->kind == TRANS_STMT_COMMIT ||
+            stmt->kind == TRANS_STMT_PREPARE ||
+            stmt->kind == TRANS_STMT_ROLLBACK ||
+            stmt->kind == TRANS_STMT_ROLLBACK_TO)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Refuses anything but a statement that ends the transaction block once an
+ * error has aborted it, as postgres.c does for each message it handles.
+ * parsetree may be NULL for an empty statement.
+ */
+void
+pglite_check_not_aborted(Node *parsetree)
+{
+    if (IsAbortedTransactionBlockState() &&
+        !pglite_is_transaction_exit(parsetree))
+        ereport(ERROR,
+                (errcode(ERRCODE_IN_FAILED_SQL_TRANSACTION),
+                 errmsg("current transaction is aborted, "
+                        "commands ignored until end of transaction block")));
+}
+
+/*
+ * Runs every statement in query_string, sending any result rows to dest.
+ * As in exec_simple_query, the statements run in one implicit transaction
+ * block unless they open or end one of their own, and each transaction
+ * command is started as a statement needs it and committed after the last
+ * statement or a transaction statement. Returns NULL on success, setting
+ * *processed to the row count of the last statement.
+ */
+ErrorData *
+pglite_exec(const char *query_string, DestReceiver *dest, uint64 *processed)
+{
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ErrorData  *volatile edata = NULL;
+
+    *processed = 0;
+
+    PG_TRY();
+    {
+        List       *parsetree_list;
+        ListCell   *lc;
+        bool        xact_started = false;
+        bool        use_implicit_block;
+
+        oldcontext = pglite_begin_query(query_string);
+
+        pglite_start_xact(&xact_started);
+        parsetree_list = pg_parse_query(query_string);
+
+        use_implicit_block = list_length(parsetree_list) > 1;
+
+        foreach(lc, parsetree_list)
+        {
+            RawStmt    *parsetree = lfirst_node(RawStmt, lc);
+            CommandTag  commandTag = CreateCommandTag(parsetree->stmt);
+            bool        snapshot_set = false;
+            List       *querytree_list;
+            List       *plantree_list;
+            Portal      portal;
+
+            pglite_check_not_aborted(parsetree->stmt);
+
+            pglite_start_xact(&xact_started);
+
+            if (use_implicit_block)
+                BeginImplicitTransactionBlock();
+
+            if (analyze_requires_snapshot(parsetree))
+            {
+                PushActiveSnapshot(GetTransactionSnapshot());
+                snapshot_set = true;
+            }
+
+            querytree_list = pg_analyze_and_rewrite_fixedparams(parsetree, query_string,
+                                                                NULL, 0, NULL);
+
+            plantree_list = pg_plan_queries(querytree_list, query_string,
+                                            CURSOR_OPT_PARALLEL_OK, NULL);
+
+            if (snapshot_set)
+                PopActiveSnapshot();
+
+            portal = CreatePortal("", true, true);
+            portal->visible = false;
+
+            PortalDefineQuery(portal, NULL, query_string, commandTag,
+                              plantree_list, NULL);
+            PortalStart(portal, NULL, 0, InvalidSnapshot);
+
+            *processed = pglite_run_portal(portal, dest);
+
+            if (lnext(parsetree_list, lc) == NULL)
+            {
+                if (use_implicit_block)
+                    EndImplicitTransactionBlock();
+                pglite_finish_xact(&xact_started);
+            }
+            else if (IsA(parsetree->stmt, TransactionStmt))
+                pglite_finish_xact(&xact_started);
+            else
+                CommandCounterIncrement();
+        }
+
+        /* an empty query string still started one */
+        pglite_finish_xact(&xact_started);
+
+        pglite_end_query(oldcontext);
+    }
+    PG_CATCH();
+    {
+        edata = pglite_catch_error();
+        MemoryContextSwitchTo(oldcontext);
+    }
+    PG_END_TRY();
+
+    return edata;
+}
+
+/*
+ * Parses, analyzes and saves a single statement as a CachedPlanSource, like
+ * exec_parse_message does for a named statement. Parameter types are
+ * inferred from the statement. plancache.c takes care of replanning if
+ * anything the plan depends on changes.
+ */
+ErrorData *
+pglite_prepare(const char *query_string, CachedPlanSource **plansource)
+{
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ErrorData  *volatile edata = NULL;
+
+    *plansource = NULL;
+
+    PG_TRY();
+    {
+        List       *parsetree_list;
+        RawStmt    *raw_parse_tree = NULL;
+        CommandTag  commandTag = CMDTAG_UNKNOWN;
+        List       *querytree_list = NIL;
+        Oid        *paramTypes = NULL;
+        int         numParams = 0;
+        CachedPlanSource *psrc;
+
+        oldcontext = pglite_begin_query(query_string);
+
+        StartTransactionCommand();
+        parsetree_list = pg_parse_query(query_string);
+
+        if (list_length(parsetree_list) > 1)
+            ereport(ERROR,
+                    (errcode(ERRCODE_SYNTAX_ERROR),
+                     errmsg("cannot insert multiple commands into a prepared statement")));
+
+        if (parsetree_list != NIL)
+        {
+            raw_parse_tree = linitial_node(RawStmt, parsetree_list);
+            pglite_check_not_aborted(raw_parse_tree->stmt);
+            commandTag = CreateCommandTag(raw_parse_tree->stmt);
+        }
+
+        psrc = CreateCachedPlan(raw_parse_tree, query_string, commandTag);
+
+        if (raw_parse_tree != NULL)
+        {
+            bool        snapshot_set = false;
+
+            if (analyze_requires_snapshot(raw_parse_tree))
+            {
+                PushActiveSnapshot(GetTransactionSnapshot());
+                snapshot_set = true;
+            }
+
+            querytree_list = pg_analyze_and_rewrite_varparams(raw_parse_tree, query_string,
+                                                              &paramTypes, &numParams,
+                                                              NULL);
+
+            /* as exec_parse_message, every parameter must have a type */
+            for (int i = 0; i < numParams; i++)
+            {
+                Oid         ptype = paramTypes[i];
+
+                if (ptype == InvalidOid || ptype == UNKNOWNOID)
+                    ereport(ERROR,
+                            (errcode(ERRCODE_INDETERMINATE_DATATYPE),
+                             errmsg("could not determine data type of parameter $%d",
+                                    i + 1)));
+            }
+
+            if (snapshot_set)
+                PopActiveSnapshot();
+        }
+
+        CompleteCachedPlan(psrc, querytree_list, NULL, paramTypes, numParams,
+                           NULL, NULL, CURSOR_OPT_PARALLEL_OK, true);
+        SaveCachedPlan(psrc);
+
+        CommitTransactionCommand();
+
+        pglite_end_query(oldcontext);
+
+        *plansource = psrc;
+    }
+    PG_CATCH();
+    {
+        edata = pglite_catch_error();
+        MemoryContextSwitchTo(oldcontext);
+    }
+    PG_END_TRY();
+
+    return edata;
+}
+
+ErrorData *
+pglite_drop_plan(CachedPlanSource *plansource)
+{
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ErrorData  *volatile edata = NULL;
+
+    PG_TRY();
+    {
+        DropCachedPlan(plansource);
+    }
+    PG_CATCH();
+    {
+        edata = pglite_catch_error();
+        MemoryContextSwitchTo(oldcontext);
+    }
+    PG_END_TRY();
+
+    return edata;
+}
+
+/*
+ * Text form of a value, for handing to a type's input function when there
+ * is no direct conversion to it.
+ */
+static char *
+pglite_value_cstring(const PgliteValue *value, Oid typid)
+{
+    switch (value->kind)
+    {
+        case PGLITE_VALUE_BOOL:
+            return DatumGetCString(DirectFunctionCall1(boolout, BoolGetDatum(value->b)));
+        case PGLITE_VALUE_INT:
+            return DatumGetCString(DirectFunctionCall1(int8out, Int64GetDatum(value->i)));
+        case PGLITE_VALUE_FLOAT:
+            return DatumGetCString(DirectFunctionCall1(float8out, Float8GetDatum(value->f)));
+        case PGLITE_VALUE_TEXT:
+            return pnstrdup(value->data, value->len);
+        default:
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATATYPE_MISMATCH),
+                     errmsg("cannot convert binary value to type %s",
+                            format_type_be(typid))));
+    }
+
+    pg_unreachable();
+}
+
+/*
+ * Converts a value to a datum of the given type, directly where the
+ * representations line up and through the type's input function otherwise.
+ */
+Datum
+pglite_value_datum(const PgliteValue *value, Oid typid)
+{
+    Oid         typinput;
+    Oid         typioparam;
+
+    switch (value->kind)
+    {
+        case PGLITE_VALUE_BOOL:
+            if (typid == BOOLOID)
+                return BoolGetDatum(value->b);
+            break;
+
+        case PGLITE_VALUE_INT:
+            switch (typid)
+            {
+                case INT2OID:
+                    if (value->i < PG_INT16_MIN || value->i > PG_INT16_MAX)
+                        ereport(ERROR,
+                                (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                                 errmsg("smallint out of range")));
+                    return Int16GetDatum((int16) value->i);
+                case INT4OID:
+                    if (value->i < PG_INT32_MIN || value->i > PG_INT32_MAX)
+                        ereport(ERROR,
+                                (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                                 errmsg("integer out of range")));
+                    return Int32GetDatum((int32) value->i);
+                case INT8OID:
+                    return Int64GetDatum(value->i);
+                case FLOAT4OID:
+                    return Float4GetDatum((float4) value->i);
+                case FLOAT8OID:
+                    return Float8GetDatum((float8) value->i);
+            }
+            break;
+
+        case PGLITE_VALUE_FLOAT:
+            switch (typid)
+            {
+                case FLOAT4OID:
+                    return Float4GetDatum((float4) value->f);
+                case FLOAT8OID:
+                    return Float8GetDatum(value->f);
+            }
+            break;
+
+        case PGLITE_VALUE_TEXT:
+            switch (typid)
+            {
+                case TEXTOID:
+                case VARCHAROID:
+                    return PointerGetDatum(cstring_to_text_with_len(value->data, value->len));
+            }
+            break;
+
+        case PGLITE_VALUE_BYTES:
+            if (typid == BYTEAOID)
+            {
+                bytea      *result = (bytea *) palloc(value->len + VARHDRSZ);
+
+                SET_VARSIZE(result, value->len + VARHDRSZ);
+                memcpy(VARDATA(result), value->data, value->len);
+                return PointerGetDatum(result);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    getTypeInputInfo(typid, &typinput, &typioparam);
+
+    return OidInputFunctionCall(typinput, pglite_value_cstring(value, typid),
+                                typioparam, -1);
+}
+
+static ParamListInfo
+pglite_bind_params(CachedPlanSource *plansource, const PgliteValue *params,
+                   int nparams)
+{
+    ParamListInfo paramLI;
+
+    if (nparams != plansource->num_params)
+        ereport(ERROR,
+                (errcode(ERRCODE_PROTOCOL_VIOLATION),
+                 errmsg("query supplies %d parameters, but prepared statement requires %d",
+                        nparams, plansource->num_params)));
+
+    if (nparams == 0)
+        return NULL;
+
+    paramLI = makeParamList(nparams);
+
+    for (int i = 0; i < nparams; i++)
+    {
+        ParamExternData *prm = &paramLI->params[i];
+        Oid         ptype = plansource->param_types[i];
+
+        prm->isnull = params[i].kind == PGLITE_VALUE_NULL;
+        prm->value = prm->isnull ? (Datum) 0 : pglite_value_datum(&params[i], ptype);
+        prm->pflags = PARAM_FLAG_CONST;
+        prm->ptype = ptype;
+    }
+
+    return paramLI;
+}
+
+/*
+ * Binds params to a statement from pglite_prepare and runs it to
+ * completion, like exec_bind_message followed by exec_execute_message.
+ * Runs another session's plan for the statement if there's one shared; see
+ * shared_plan.c.
+ */
+ErrorData *
+pglite_execute_plan(CachedPlanSource *plansource, const PgliteValue *params,
+                    int nparams, DestReceiver *dest, uint64 *processed)
+{
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ErrorData  *volatile edata = NULL;
+    PgliteSharedPlan *volatile shared_plan = NULL;
+
+    *processed = 0;
+
+    PG_TRY();
+    {
+        ParamListInfo paramLI;
+        CachedPlan *cplan = NULL;
+        List       *stmt_list;
+        Portal      portal;
+        bool        snapshot_set = false;
+
+        oldcontext = pglite_begin_query(plansource->query_string);
+
+        StartTransactionCommand();
+        pglite_check_not_aborted(plansource->raw_parse_tree ?
+                                 plansource->raw_parse_tree->stmt : NULL);
+
+        /* input functions and replanning may both need a snapshot */
+        if (nparams > 0 ||
+            (plansource->raw_parse_tree &&
+             analyze_requires_snapshot(plansource->raw_parse_tree)))
+        {
+            PushActiveSnapshot(GetTransactionSnapshot());
+            snapshot_set = true;
+        }
+
+        paramLI = pglite_bind_params(plansource, params, nparams);
+
+        portal = CreatePortal("", true, true);
+        portal->visible = false;
+
+        shared_plan = pglite_shared_plan_lookup(plansource);
+        if (shared_plan != NULL)
+            stmt_list = pglite_shared_plan_stmts(shared_plan);
+        else
+        {
+            cplan = GetCachedPlan(plansource, paramLI, NULL, NULL);
+            pglite_shared_plan_publish(plansource, cplan);
+            stmt_list = cplan->stmt_list;
+        }
+
+        PortalDefineQuery(portal, NULL, plansource->query_string,
+                          plansource->commandTag, stmt_list, cplan);
+        PortalStart(portal, paramLI, 0, InvalidSnapshot);
+
+        if (snapshot_set)
+            PopActiveSnapshot();
+
+        *processed = pglite_run_portal(portal, dest);
+
+        CommitTransactionCommand();
+
+        pglite_end_query(oldcontext);
+    }
+    PG_CATCH();
+    {
+        edata = pglite_catch_error();
+        MemoryContextSwitchTo(oldcontext);
+    }
+    PG_END_TRY();
+
+    /* the portal running it is gone either way */
+    if (shared_plan != NULL)
+        pglite_shared_plan_release(shared_plan);
+
+    return edata;
+}
+
+/*
+ * Opens a cursor over a statement from pglite_prepare, for pglite_fetch to
+ * read from in batches. The cursor only lives as long as the transaction
+ * it was opened in, so callers run it inside a transaction block. Returns
+ * the portal's name, allocated in TopMemoryContext, in *portal_name: the
+ * portal itself goes away without notice if the transaction aborts.
+ */
+ErrorData *
+pglite_open_cursor(CachedPlanSource *plansource, const PgliteValue *params,
+                   int nparams, char **portal_name)
+{
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ErrorData  *volatile edata = NULL;
+
+    *portal_name = NULL;
+
+    PG_TRY();
+    {
+        ParamListInfo paramLI;
+        CachedPlan *cplan;
+        Portal      portal;
+        char       *query_string;
+        bool        snapshot_set = false;
+
+        oldcontext = pglite_begin_query(plansource->query_string);
+
+        StartTransactionCommand();
+        pglite_check_not_aborted(plansource->raw_parse_tree ?
+                                 plansource->raw_parse_tree->stmt : NULL);
+
+        if (nparams > 0 ||
+            (plansource->raw_parse_tree &&
+             analyze_requires_snapshot(plansource->raw_parse_tree)))
+        {
+            PushActiveSnapshot(GetTransactionSnapshot());
+            snapshot_set = true;
+        }
+
+        portal = CreateNewPortal();
+        portal->visible = false;
+
+        /* params and query text must live as long as the portal */
+        MemoryContextSwitchTo(portal->portalContext);
+        query_string = pstrdup(plansource->query_string);
+        paramLI = pglite_bind_params(plansource, params, nparams);
+        MemoryContextSwitchTo(pglite_query_context);
+
+        cplan = GetCachedPlan(plansource, paramLI, NULL, NULL);
+
+        PortalDefineQuery(portal, NULL, query_string, plansource->commandTag,
+                          cplan->stmt_list, cplan);
+        PortalStart(portal, paramLI, 0, InvalidSnapshot);
+
+        if (snapshot_set)
+            PopActiveSnapshot();
+
+        *portal_name = MemoryContextStrdup(TopMemoryContext, portal->name);
+
+        CommitTransactionCommand();
+
+        pglite_end_query(oldcontext);
+    }
+    PG_CATCH();
+    {
+        edata = pglite_catch_error();
+        MemoryContextSwitchTo(oldcontext);
+    }
+    PG_END_TRY();
+
+    return edata;
+}
+
+/*
+ * Sends up to count more rows from a cursor to dest, like FETCH FORWARD.
+ * Fewer than count rows in *processed means the cursor is exhausted.
+ */
+ErrorData *
+pglite_fetch(const char *portal_name, long count, DestReceiver *dest,
+             uint64 *processed)
+{
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ErrorData  *volatile edata = NULL;
+
+    *processed = 0;
+
+    PG_TRY();
+    {
+        Portal      portal;
+
+        StartTransactionCommand();
+
+        portal = GetPortalByName(portal_name);
+
+        if (!PortalIsValid(portal))
+            ereport(ERROR,
+                    (errcode(ERRCODE_UNDEFINED_CURSOR),
+                     errmsg("cursor \"%s\" does not exist", portal_name)));
+
+        debug_query_string = portal->sourceText;
+
+        *processed = PortalRunFetch(portal, FETCH_FORWARD, count, dest);
+
+        CommitTransactionCommand();
+
+        debug_query_string = NULL;
+    }
+    PG_CATCH();
+    {
+        edata = pglite_catch_error();
+        MemoryContextSwitchTo(oldcontext);
+    }
+    PG_END_TRY();
+
+    return edata;
+}
+
+ErrorData *
+pglite_close_cursor(const char *portal_name)
+{
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ErrorData  *volatile edata = NULL;
+
+    PG_TRY();
+    {
+        Portal      portal;
+
+        StartTransactionCommand();
+
+        /* already gone if the transaction aborted */
+        portal = GetPortalByName(portal_name);
+
+        if (PortalIsValid(portal))
+            PortalDrop(portal, false);
+
+        CommitTransactionCommand();
+    }
+    PG_CATCH();
+    {
+        edata = pglite_catch_error();
+        MemoryContextSwitchTo(oldcontext);
+    }
+    PG_END_TRY();
+
+    return edata;
+}
@@ -1,76 +1,391 @@
+/*
+ * fs.c
+ *
+ * File system calls the backend makes on paths relative to the data
+ * directory. Backend threads share the process' working directory, so they
+ * can't chdir into their data directory as a postmaster would; open, stat,
+ * mkdir and opendir are routed here by our postgres fork, and unlink, rmdir
+ * and rename by the backend's build flags.
+ *
+ * Each goes through the thread's PgliteVfs. A cluster's file system calls
+ * can be taken over by registering a VFS under its data directory, before
+ * any thread works on it. The default one resolves paths relative to a
+ * descriptor of the data directory, opened once per thread, with openat and
+ * friends; an absolute path is taken as it is.
+ *
+ * Reads, writes, syncs and truncations fd.c makes on its virtual fds, of
+ * relation segments and temporary files, go through the VFS too, on the
+ * descriptors its open returned; prepare-postgres.sh has FileRead,
+ * FileWrite, FileSync and FileTruncate call them here. WAL and the other
+ * files Postgres reads and writes with descriptors of its own still go
+ * straight to those, and io_uring read-ahead (see readahead.c) is off for
+ * a cluster with a VFS of its own. Descriptors of relation segments shared
+ * between threads (see shared_fd.c) are forgotten as their files are
+ * unlinked or renamed over.
+ */
 #include <postgres.h>
 
+#include <dirent.h>
 #include <fcntl.h>
-#include <miscadmin.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <sys/stat.h>
-#include <utils/elog.h>
-#include <utils/palloc.h>
+#include <unistd.h>
+
+#include <miscadmin.h>
+#include <storage/fd.h>
+
+#include "pglite.h"
+
+typedef struct PgliteVfsEntry
+{
+    char       *data_dir;
+    PgliteVfs   vfs;
+    struct PgliteVfsEntry *next;
+} PgliteVfsEntry;
+
+/*
+ * Registered VFSes, newest first. Entries are never freed, as threads keep
+ * pointers to them; registering again for a data directory shadows the
+ * entry before.
+ */
+static pthread_mutex_t pglite_vfs_lock = PTHREAD_MUTEX_INITIALIZER;
+static PgliteVfsEntry *pglite_vfs_entries;
+
+static pthread_once_t pglite_data_dir_fd_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pglite_data_dir_fd_key;
+
+static __thread const PgliteVfs *pglite_vfs;
+/* the default VFS's descriptor of DataDir, -1 until opened */
+static __thread int pglite_data_dir_fd = -1;
+
+static void
+pglite_close_data_dir(void *arg)
+{
+    close((int) (intptr_t) arg - 1);
+}
+
+static void
+pglite_data_dir_fd_init(void)
+{
+    pthread_key_create(&pglite_data_dir_fd_key, pglite_close_data_dir);
+}
+
+/*
+ * This thread's descriptor of DataDir, closed when the thread exits, or
+ * AT_FDCWD if there's no DataDir yet. Returns -1 if it can't be opened.
+ */
+static int
+pglite_data_dir(void)
+{
+    int         fd = pglite_data_dir_fd;
+
+    if (likely(fd >= 0))
+        return fd;
+
+    if (DataDir == NULL)
+        return AT_FDCWD;
+
+    fd = open(DataDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    pthread_once(&pglite_data_dir_fd_once, pglite_data_dir_fd_init);
+    /* offset by one, as a NULL value doesn't get its destructor called */
+    pthread_setspecific(pglite_data_dir_fd_key, (void *) (intptr_t) (fd + 1));
+
+    pglite_data_dir_fd = fd;
+    return fd;
+}
+
+static int
+pglite_default_open(void *ctx, const char *path, int flags, mode_t mode)
+{
+    int         dirfd = pglite_data_dir();
+
+    return dirfd == -1 ? -1 : openat(dirfd, path, flags, mode);
+}
+
+static int
+pglite_default_stat(void *ctx, const char *path, struct stat *buf)
+{
+    int         dirfd = pglite_data_dir();
+
+    return dirfd == -1 ? -1 : fstatat(dirfd, path, buf, 0);
+}
+
+static int
+pglite_default_mkdir(void *ctx, const char *path, mode_t mode)
+{
+    int         dirfd = pglite_data_dir();
+
+    return dirfd == -1 ? -1 : mkdirat(dirfd, path, mode);
+}
+
+static int
+pglite_default_opendir(void *ctx, const char *path)
+{
+    int         dirfd = pglite_data_dir();
+
+    return dirfd == -1 ? -1 : openat(dirfd, path,
+                                   O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static int
+pglite_default_unlink(void *ctx, const char *path)
+{
+    int         dirfd = pglite_data_dir();
+
+    return dirfd == -1 ? -1 : unlinkat(dirfd, path, 0);
+}
+
+static int
+pglite_default_rmdir(void *ctx, const char *path)
+{
+    int         dirfd = pglite_data_dir();
+
+    return dirfd == -1 ? -1 : unlinkat(dirfd, path, AT_REMOVEDIR);
+}
+
+static int
+pglite_default_rename(void *ctx, const char *from, const char *to)
+{
+    int         dirfd = pglite_data_dir();
+
+    return dirfd == -1 ? -1 : renameat(dirfd, from, dirfd, to);
+}
+
+static ssize_t
+pglite_default_pread(void *ctx, int fd, void *buf, size_t count, off_t offset)
+{
+    return pg_pread(fd, buf, count, offset);
+}
+
+static ssize_t
+pglite_default_pwrite(void *ctx, int fd, const void *buf, size_t count,
+                      off_t offset)
+{
+    return pg_pwrite(fd, buf, count, offset);
+}
+
+static int
+pglite_default_fsync(void *ctx, int fd)
+{
+    return pg_fsync(fd);
+}
+
+static int
+pglite_default_ftruncate(void *ctx, int fd, off_t length)
+{
+    return ftruncate(fd, length);
+}
+
+static const PgliteVfs pglite_default_vfs = {
+    .ctx = NULL,
+    .open = pglite_default_open,
+    .stat = pglite_default_stat,
+    .mkdir = pglite_default_mkdir,
+    .opendir = pglite_default_opendir,
+    .unlink = pglite_default_unlink,
+    .rmdir = pglite_default_rmdir,
+    .rename = pglite_default_rename,
+    .pread = pglite_default_pread,
+    .pwrite = pglite_default_pwrite,
+    .fsync = pglite_default_fsync,
+    .ftruncate = pglite_default_ftruncate,
+};
+
+/*
+ * The VFS registered for DataDir, or the default one
+ */
+static const PgliteVfs *
+pglite_get_vfs(void)
+{
+    const PgliteVfs *vfs = pglite_vfs;
+    PgliteVfsEntry *entry;
+
+    if (likely(vfs != NULL))
+        return vfs;
+
+    /* not looked up until the data directory is known */
+    if (DataDir == NULL)
+        return &pglite_default_vfs;
+
+    vfs = &pglite_default_vfs;
+
+    pthread_mutex_lock(&pglite_vfs_lock);
+
+    for (entry = pglite_vfs_entries; entry != NULL; entry = entry->next)
+    {
+        if (strcmp(entry->data_dir, DataDir) == 0)
+        {
+            vfs = &entry->vfs;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pglite_vfs_lock);
+
+    pglite_vfs = vfs;
+    return vfs;
+}
+
+/*
+ * Whether this thread's cluster has a VFS of its own
+ */
+bool
+pglite_vfs_registered(void)
+{
+    return pglite_get_vfs() != &pglite_default_vfs;
+}
+
+/*
+ * Has threads working on the cluster in `data_dir`, given as the backend's
+ * DataDir would be, call through `vfs` from now on. Returns false if out of
+ * memory.
+ */
+bool
+pglite_register_vfs(const char *data_dir, const PgliteVfs *vfs)
+{
+    PgliteVfsEntry *entry = malloc(sizeof(PgliteVfsEntry));
+
+    if (entry == NULL)
+        return false;
+
+    entry->data_dir = strdup(data_dir);
+    if (entry->data_dir == NULL)
+    {
+        free(entry);
+        return false;
+    }
+
+    entry->vfs = *vfs;
+
+    pthread_mutex_lock(&pglite_vfs_lock);
+    entry->next = pglite_vfs_entries;
+    pglite_vfs_entries = entry;
+    pthread_mutex_unlock(&pglite_vfs_lock);
+
+    return true;
+}
+
+int
+pglite_open(const char *path, int flags, mode_t mode)
+{
+    const PgliteVfs *vfs = pglite_get_vfs();
+
+    return vfs->open(vfs->ctx, path, flags, mode);
+}
 
 int
-pglite_mkdir(const char* path, mode_t mode)
+pglite_stat(const char *restrict path, struct stat *restrict buf)
 {
-    int rc, save_errno;
-    char* abs_path = psprintf("%s/%s", DataDir, path);
+    const PgliteVfs *vfs = pglite_get_vfs();
 
-    elog(DEBUG1, "pglite_mkdir: %s\n", abs_path);
-    errno = 0;
-    rc = mkdir(abs_path, mode);
+    return vfs->stat(vfs->ctx, path, buf);
+}
 
-    save_errno = errno;
-    pfree(abs_path);
-    errno = save_errno;
+int
+pglite_mkdir(const char *path, mode_t mode)
+{
+    const PgliteVfs *vfs = pglite_get_vfs();
 
-    return rc;
+    return vfs->mkdir(vfs->ctx, path, mode);
 }
 
-DIR*
-pglite_opendir(const char* path)
+DIR *
+pglite_opendir(const char *path)
 {
-    DIR* dir;
-    int save_errno;
-    char* abs_path = psprintf("%s/%s", DataDir, path);
+    const PgliteVfs *vfs = pglite_get_vfs();
+    int         fd;
+    DIR        *dir;
+    int         save_errno;
 
-    elog(DEBUG1, "pglite_opendir: %s\n", abs_path);
-    errno = 0;
-    dir = opendir(abs_path);
+    fd = vfs->opendir(vfs->ctx, path);
+    if (fd < 0)
+        return NULL;
 
-    save_errno = errno;
-    pfree(abs_path);
-    errno = save_errno;
+    dir = fdopendir(fd);
+    if (dir == NULL)
+    {
+        save_errno = errno;
+        close(fd);
+        errno = save_errno;
+    }
 
     return dir;
 }
 
 int
-pglite_stat(const char* restrict path, struct stat* restrict buf)
+pglite_unlink(const char *path)
 {
-    int rc, save_errno;
-    char* abs_path = psprintf("%s/%s", DataDir, path);
+    const PgliteVfs *vfs = pglite_get_vfs();
+    int         result = vfs->unlink(vfs->ctx, path);
 
-    elog(DEBUG1, "pglite_stat: %s\n", abs_path);
-    errno = 0;
-    rc = stat(abs_path, buf);
+    if (result == 0)
+        pglite_shared_fd_forget(path);
 
-    save_errno = errno;
-    pfree(abs_path);
-    errno = save_errno;
+    return result;
+}
 
-    return rc;
+int
+pglite_rmdir(const char *path)
+{
+    const PgliteVfs *vfs = pglite_get_vfs();
+
+    return vfs->rmdir(vfs->ctx, path);
 }
 
 int
-pglite_open(const char* path, int flags, mode_t mode)
+pglite_rename(const char *from, const char *to)
 {
-    int fd, save_errno;
-    char* abs_path = psprintf("%s/%s", DataDir, path);
+    const PgliteVfs *vfs = pglite_get_vfs();
+    int         result = vfs->rename(vfs->ctx, from, to);
 
-    elog(DEBUG1, "pglite_open: %s\n", abs_path);
-    errno = 0;
-    fd = open(abs_path, flags, mode);
+    if (result == 0)
+    {
+        pglite_shared_fd_forget(from);
+        pglite_shared_fd_forget(to);
+    }
 
-    save_errno = errno;
-    pfree(abs_path);
-    errno = save_errno;
+    return result;
+}
 
-    return fd;
+ssize_t
+pglite_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    const PgliteVfs *vfs = pglite_get_vfs();
+
+    return vfs->pread(vfs->ctx, fd, buf, count, offset);
+}
+
+ssize_t
+pglite_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    const PgliteVfs *vfs = pglite_get_vfs();
+
+    return vfs->pwrite(vfs->ctx, fd, buf, count, offset);
+}
+
+/*
+ * As pg_fsync, which the default VFS calls: nothing is synced with fsync
+ * off
+ */
+int
+pglite_fsync(int fd)
+{
+    const PgliteVfs *vfs = pglite_get_vfs();
+
+    if (!enableFsync)
+        return 0;
+
+    return vfs->fsync(vfs->ctx, fd);
+}
+
+int
+pglite_ftruncate(int fd, off_t length)
+{
+    const PgliteVfs *vfs = pglite_get_vfs();
+
+    return vfs->ftruncate(vfs->ctx, fd, length);
 }
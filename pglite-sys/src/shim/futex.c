@@ -0,0 +1,281 @@
+/*
+ * futex.c
+ *
+ * Semaphores and latch waits on futexes, in place of posix_sema.c and of
+ * latch.c's signals. Every backend is a thread of this process, so a
+ * backend sleeping on a word of shared memory can be woken by another with
+ * no more than a futex wake, where latch.c would send it SIGURG to read
+ * from a signalfd and epoll.
+ *
+ * Only WaitLatch sleeps on the futex, as nothing else waits on a latch
+ * alone; waits that take sockets too stay with latch.c. SetLatch tells the
+ * two apart by maybe_sleeping. prepare-postgres.sh renames latch.c's own
+ * SetLatch and WaitLatch out of the way.
+ *
+ * The postmaster thread outlives every backend attached to it, so a
+ * WaitLatch only reports postmaster death once the postmaster has given up
+ * on the cluster after a child crashed (see attach.c).
+ */
+#include <postgres.h>
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <miscadmin.h>
+#include <port/atomics.h>
+#include <portability/instr_time.h>
+#include <storage/ipc.h>
+#include <storage/latch.h>
+#include <storage/pg_sema.h>
+#include <storage/shmem.h>
+#include <utils/wait_event.h>
+
+#include "pglite.h"
+
+/* maybe_sleeping while the owner sleeps on is_set in WaitLatch */
+#define PGLITE_LATCH_FUTEX_SLEEPING 2
+
+struct PGSemaphoreData
+{
+    pg_atomic_uint32 count;
+    /* backends asleep waiting for count to go up */
+    pg_atomic_uint32 waiters;
+} pg_attribute_aligned(PG_CACHE_LINE_SIZE);
+
+/* the postmaster's, as posix_sema.c keeps them */
+static __thread PGSemaphore pglite_semas;
+static __thread int pglite_num_semas;
+static __thread int pglite_max_semas;
+
+/* slept on by a WaitLatch without a latch, woken only by its timeout */
+static __thread uint32 pglite_no_latch;
+
+/*
+ * Sleeps while `*addr` is `expected`, for at most `timeout` if not NULL.
+ * Returns early on a signal, or if it wasn't `expected` to begin with.
+ */
+static inline void
+pglite_futex_wait(volatile void *addr, uint32 expected,
+                  const struct timespec *timeout)
+{
+    (void) syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout,
+                   NULL, 0);
+}
+
+static inline void
+pglite_futex_wake(volatile void *addr, int waiters)
+{
+    (void) syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, waiters, NULL, NULL,
+                   0);
+}
+
+Size
+PGSemaphoreShmemSize(int maxSemas)
+{
+    return mul_size(maxSemas, sizeof(struct PGSemaphoreData));
+}
+
+void
+PGReserveSemaphores(int maxSemas)
+{
+    pglite_semas = (PGSemaphore) ShmemAllocUnlocked(PGSemaphoreShmemSize(maxSemas));
+    pglite_num_semas = 0;
+    pglite_max_semas = maxSemas;
+}
+
+/*
+ * Starts at 1, as posix_sema.c's do
+ */
+PGSemaphore
+PGSemaphoreCreate(void)
+{
+    PGSemaphore sema;
+
+    Assert(!IsUnderPostmaster);
+
+    if (pglite_num_semas >= pglite_max_semas)
+        elog(PANIC, "too many semaphores created");
+
+    sema = &pglite_semas[pglite_num_semas++];
+    pg_atomic_init_u32(&sema->count, 1);
+    pg_atomic_init_u32(&sema->waiters, 0);
+
+    return sema;
+}
+
+void
+PGSemaphoreReset(PGSemaphore sema)
+{
+    pg_atomic_write_u32(&sema->count, 0);
+}
+
+bool
+PGSemaphoreTryLock(PGSemaphore sema)
+{
+    uint32      count = pg_atomic_read_u32(&sema->count);
+
+    while (count > 0)
+    {
+        if (pg_atomic_compare_exchange_u32(&sema->count, &count, count - 1))
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Like sem_wait, not interrupted by signals
+ */
+void
+PGSemaphoreLock(PGSemaphore sema)
+{
+    if (PGSemaphoreTryLock(sema))
+        return;
+
+    /*
+     * Counted as waiting before looking at the count again, so an unlock
+     * from here on either sees us or leaves a count the wait won't sleep on
+     */
+    pg_atomic_fetch_add_u32(&sema->waiters, 1);
+
+    while (!PGSemaphoreTryLock(sema))
+        pglite_futex_wait(&sema->count.value, 0, NULL);
+
+    pg_atomic_fetch_sub_u32(&sema->waiters, 1);
+}
+
+void
+PGSemaphoreUnlock(PGSemaphore sema)
+{
+    pg_atomic_fetch_add_u32(&sema->count, 1);
+
+    if (pg_atomic_read_u32(&sema->waiters) > 0)
+        pglite_futex_wake(&sema->count.value, 1);
+}
+
+/*
+ * As latch.c's, except that an owner asleep in WaitLatch is woken with a
+ * futex rather than SIGURG
+ */
+void
+SetLatch(Latch *latch)
+{
+    pid_t       owner_pid;
+
+    /* see latch.c for the barriers */
+    pg_memory_barrier();
+
+    if (latch->is_set)
+        return;
+
+    latch->is_set = true;
+
+    pg_memory_barrier();
+    if (!latch->maybe_sleeping)
+        return;
+
+    owner_pid = latch->owner_pid;
+    if (owner_pid == 0)
+        return;
+
+    if (latch->maybe_sleeping == PGLITE_LATCH_FUTEX_SLEEPING)
+        pglite_futex_wake(&latch->is_set, 1);
+    else
+        kill(owner_pid, SIGURG);
+}
+
+/*
+ * As latch.c's, sleeping on the latch's is_set. Signal handlers set the
+ * latch themselves if they want the wait to end, so a signal only makes
+ * us look again.
+ */
+int
+WaitLatch(Latch *latch, int wakeEvents, long timeout,
+          uint32 wait_event_info)
+{
+    instr_time  start_time;
+    instr_time  cur_time;
+    long        cur_timeout = -1;
+    struct timespec ts;
+    volatile void *futex = &pglite_no_latch;
+    int         result;
+
+    /* Postmaster-managed callers must handle postmaster death somehow. */
+    Assert(!IsUnderPostmaster ||
+           (wakeEvents & WL_EXIT_ON_PM_DEATH) ||
+           (wakeEvents & WL_POSTMASTER_DEATH));
+
+    if (!(wakeEvents & WL_LATCH_SET))
+        latch = NULL;
+    else if (latch->owner_pid != MyProcPid)
+        elog(ERROR, "cannot wait on a latch owned by another process");
+    else
+        futex = &latch->is_set;
+
+    if (wakeEvents & WL_TIMEOUT)
+    {
+        Assert(timeout >= 0);
+        INSTR_TIME_SET_CURRENT(start_time);
+        cur_timeout = timeout;
+    }
+
+    pgstat_report_wait_start(wait_event_info);
+
+    for (;;)
+    {
+        if ((wakeEvents & (WL_EXIT_ON_PM_DEATH | WL_POSTMASTER_DEATH)) &&
+            pglite_postmaster_gone())
+        {
+            /* as latch.c does */
+            if (wakeEvents & WL_EXIT_ON_PM_DEATH)
+                proc_exit(1);
+
+            result = WL_POSTMASTER_DEATH;
+            break;
+        }
+
+        if (latch != NULL)
+        {
+            latch->maybe_sleeping = PGLITE_LATCH_FUTEX_SLEEPING;
+            pg_memory_barrier();
+
+            if (latch->is_set)
+            {
+                result = WL_LATCH_SET;
+                break;
+            }
+        }
+
+        if (cur_timeout == 0)
+        {
+            result = WL_TIMEOUT;
+            break;
+        }
+
+        if (cur_timeout > 0)
+        {
+            ts.tv_sec = cur_timeout / 1000;
+            ts.tv_nsec = (cur_timeout % 1000) * 1000000L;
+        }
+
+        pglite_futex_wait(futex, 0, cur_timeout > 0 ? &ts : NULL);
+
+        if (cur_timeout > 0)
+        {
+            INSTR_TIME_SET_CURRENT(cur_time);
+            INSTR_TIME_SUBTRACT(cur_time, start_time);
+            cur_timeout = Max(timeout - (long) INSTR_TIME_GET_MILLISEC(cur_time), 0);
+        }
+    }
+
+    if (latch != NULL)
+        latch->maybe_sleeping = false;
+
+    pgstat_report_wait_end();
+
+    return result;
+}
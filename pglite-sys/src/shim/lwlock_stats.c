@@ -0,0 +1,250 @@
+/*
+ * lwlock_stats.c
+ *
+ * Per-tranche LWLock counters, summed over every backend thread, for
+ * finding the locks sessions queue up on. Like LWLOCK_STATS, but switched
+ * on and off at run time, and read through the Rust API rather than
+ * printed at exit.
+ *
+ * prepare-postgres.sh has lwlock.c call in here where LWLOCK_STATS would
+ * count, and only while pglite_lwlock_stats_enabled is set, so disabled
+ * counters cost a predictable branch. It patches lwlock.c once its globals
+ * have been made thread-local, as the flag is shared by every thread.
+ *
+ * Each thread counts in a block of its own, so counting needs no atomic
+ * read-modify-write; a reader sums the blocks of the threads running and
+ * those of the threads that have exited.
+ */
+#include <postgres.h>
+
+#include <pthread.h>
+#include <time.h>
+
+#include <port/atomics.h>
+#include <storage/lwlock.h>
+#include <utils/wait_event.h>
+
+#include "pglite.h"
+
+/* tranches past this many aren't counted */
+#define PGLITE_LWLOCK_TRANCHES 256
+
+typedef struct PgliteLWLockCounters
+{
+    /* written only by the thread counting, read by any */
+    pg_atomic_uint64 acquisitions;
+    pg_atomic_uint64 contended;
+    pg_atomic_uint64 spin_delays;
+    pg_atomic_uint64 wait_ns;
+} PgliteLWLockCounters;
+
+typedef struct PgliteLWLockThreadCounters
+{
+    PgliteLWLockCounters tranches[PGLITE_LWLOCK_TRANCHES];
+    struct PgliteLWLockThreadCounters *prev;
+    struct PgliteLWLockThreadCounters *next;
+} PgliteLWLockThreadCounters;
+
+bool        pglite_lwlock_stats_enabled = false;
+
+/* the blocks of the threads counting, and the sums of those that exited */
+static pthread_mutex_t pglite_lwlock_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pglite_lwlock_stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pglite_lwlock_stats_key;
+static PgliteLWLockThreadCounters *pglite_lwlock_threads;
+static PgliteLWLockStats pglite_lwlock_exited[PGLITE_LWLOCK_TRANCHES];
+
+static __thread PgliteLWLockThreadCounters *pglite_lwlock_counters;
+
+/* the wait under way on this thread, -1 in tranche if none */
+static __thread int pglite_lwlock_wait_tranche = -1;
+static __thread struct timespec pglite_lwlock_wait_started;
+
+static inline void
+pglite_lwlock_count(pg_atomic_uint64 *counter, uint64 n)
+{
+    pg_atomic_write_u64(counter, pg_atomic_read_u64(counter) + n);
+}
+
+/*
+ * Folds an exiting thread's block into the sums of those that exited
+ */
+static void
+pglite_lwlock_thread_exit(void *arg)
+{
+    PgliteLWLockThreadCounters *counters = arg;
+
+    pthread_mutex_lock(&pglite_lwlock_stats_lock);
+
+    for (int i = 0; i < PGLITE_LWLOCK_TRANCHES; i++)
+    {
+        PgliteLWLockCounters *tranche = &counters->tranches[i];
+        PgliteLWLockStats *exited = &pglite_lwlock_exited[i];
+
+        exited->acquisitions += pg_atomic_read_u64(&tranche->acquisitions);
+        exited->contended += pg_atomic_read_u64(&tranche->contended);
+        exited->spin_delays += pg_atomic_read_u64(&tranche->spin_delays);
+        exited->wait_ns += pg_atomic_read_u64(&tranche->wait_ns);
+    }
+
+    if (counters->prev != NULL)
+        counters->prev->next = counters->next;
+    else
+        pglite_lwlock_threads = counters->next;
+    if (counters->next != NULL)
+        counters->next->prev = counters->prev;
+
+    pthread_mutex_unlock(&pglite_lwlock_stats_lock);
+
+    free(counters);
+}
+
+static void
+pglite_lwlock_stats_init(void)
+{
+    pthread_key_create(&pglite_lwlock_stats_key, pglite_lwlock_thread_exit);
+}
+
+/*
+ * This thread's counters for `tranche`, or NULL if it isn't counted
+ */
+static PgliteLWLockCounters *
+pglite_lwlock_tranche(int tranche)
+{
+    PgliteLWLockThreadCounters *counters = pglite_lwlock_counters;
+
+    if (tranche < 0 || tranche >= PGLITE_LWLOCK_TRANCHES)
+        return NULL;
+
+    if (unlikely(counters == NULL))
+    {
+        pthread_once(&pglite_lwlock_stats_once, pglite_lwlock_stats_init);
+
+        counters = calloc(1, sizeof(PgliteLWLockThreadCounters));
+        if (counters == NULL)
+            return NULL;
+
+        pthread_mutex_lock(&pglite_lwlock_stats_lock);
+        counters->next = pglite_lwlock_threads;
+        if (pglite_lwlock_threads != NULL)
+            pglite_lwlock_threads->prev = counters;
+        pglite_lwlock_threads = counters;
+        pthread_mutex_unlock(&pglite_lwlock_stats_lock);
+
+        pthread_setspecific(pglite_lwlock_stats_key, counters);
+        pglite_lwlock_counters = counters;
+    }
+
+    return &counters->tranches[tranche];
+}
+
+void
+pglite_lwlock_acquired(int tranche)
+{
+    PgliteLWLockCounters *counters = pglite_lwlock_tranche(tranche);
+
+    if (counters != NULL)
+        pglite_lwlock_count(&counters->acquisitions, 1);
+}
+
+void
+pglite_lwlock_spin_delayed(int tranche, int delays)
+{
+    PgliteLWLockCounters *counters;
+
+    if (delays == 0)
+        return;
+
+    counters = pglite_lwlock_tranche(tranche);
+    if (counters != NULL)
+        pglite_lwlock_count(&counters->spin_delays, delays);
+}
+
+/*
+ * Called as the backend goes to sleep on a lock it couldn't get
+ */
+void
+pglite_lwlock_wait_start(int tranche)
+{
+    PgliteLWLockCounters *counters = pglite_lwlock_tranche(tranche);
+
+    if (counters == NULL)
+        return;
+
+    pglite_lwlock_count(&counters->contended, 1);
+
+    pglite_lwlock_wait_tranche = tranche;
+    clock_gettime(CLOCK_MONOTONIC, &pglite_lwlock_wait_started);
+}
+
+void
+pglite_lwlock_wait_end(void)
+{
+    struct timespec now;
+    int64       waited;
+
+    /* not counted, or counting began mid-wait */
+    if (pglite_lwlock_wait_tranche < 0)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    waited = (now.tv_sec - pglite_lwlock_wait_started.tv_sec) * INT64CONST(1000000000) +
+        (now.tv_nsec - pglite_lwlock_wait_started.tv_nsec);
+
+    pglite_lwlock_count(&pglite_lwlock_counters->tranches[pglite_lwlock_wait_tranche].wait_ns,
+                        waited);
+    pglite_lwlock_wait_tranche = -1;
+}
+
+/*
+ * Starts or stops counting, for every thread. What was counted is kept.
+ */
+void
+pglite_set_lwlock_stats(bool enabled)
+{
+    pglite_lwlock_stats_enabled = enabled;
+    pg_memory_barrier();
+}
+
+/*
+ * Fills `stats` with the counters of up to `max` tranches, those that were
+ * ever acquired, returning how many it filled
+ */
+int
+pglite_lwlock_stats(PgliteLWLockStats *stats, int max)
+{
+    int         n = 0;
+
+    pthread_mutex_lock(&pglite_lwlock_stats_lock);
+
+    for (int i = 0; i < PGLITE_LWLOCK_TRANCHES && n < max; i++)
+    {
+        PgliteLWLockStats *tranche = &stats[n];
+
+        *tranche = pglite_lwlock_exited[i];
+        tranche->tranche = i;
+
+        for (PgliteLWLockThreadCounters *thread = pglite_lwlock_threads;
+             thread != NULL;
+             thread = thread->next)
+        {
+            PgliteLWLockCounters *counters = &thread->tranches[i];
+
+            tranche->acquisitions += pg_atomic_read_u64(&counters->acquisitions);
+            tranche->contended += pg_atomic_read_u64(&counters->contended);
+            tranche->spin_delays += pg_atomic_read_u64(&counters->spin_delays);
+            tranche->wait_ns += pg_atomic_read_u64(&counters->wait_ns);
+        }
+
+        if (tranche->acquisitions == 0 && tranche->contended == 0)
+            continue;
+
+        /* the built-in names are constant, and shared by every thread */
+        tranche->name = GetLWLockIdentifier(PG_WAIT_LWLOCK, i);
+        n++;
+    }
+
+    pthread_mutex_unlock(&pglite_lwlock_stats_lock);
+
+    return n;
+}
@@ -0,0 +1,779 @@
+/*
+ * memory_smgr.c
+ *
+ * A storage manager keeping relation forks in process memory, for clusters
+ * that needn't outlive the process, such as Connection::open_in_memory's.
+ * A fork is an array of pages, extended, truncated and unlinked a page at a
+ * time. Nothing is ever written out, so there's nothing to sync either: no
+ * sync requests are registered with the checkpointer, and immedsync and
+ * writeback do nothing.
+ *
+ * The forks are filed under the data directory of their cluster, and shared
+ * by every thread of the process, as the relations created by the bootstrap
+ * thread are used by the backend thread that follows it. Only relation data
+ * is kept here; the control file, WAL and SLRUs still go to the data
+ * directory.
+ *
+ * prepare-postgres.sh adds this to smgr.c's smgrsw[], and has smgropen pick
+ * it for the relations of threads that called pglite_use_memory_smgr. The
+ * places that work on relation files by path rather than through smgr ask
+ * it too: GetNewRelFileNode, copydir, DROP DATABASE and dbsize.c.
+ */
+#include <postgres.h>
+
+#include <pthread.h>
+
+#include <access/xlogutils.h>
+#include <common/hashfn.h>
+#include <common/relpath.h>
+#include <miscadmin.h>
+#include <storage/bufmgr.h>
+#include <storage/smgr.h>
+
+#include "pglite.h"
+
+/* this storage manager's index in smgrsw[] */
+#define PGLITE_MEMORY_SMGR 1
+
+#define PGLITE_MEMORY_BUCKETS 1024
+
+typedef struct PgliteMemoryForkKey
+{
+    RelFileNodeBackend rnode;
+    ForkNumber  forknum;
+} PgliteMemoryForkKey;
+
+typedef struct PgliteMemoryFork
+{
+    PgliteMemoryForkKey key;
+    /* taken exclusively to add or remove pages */
+    pthread_rwlock_t lock;
+    BlockNumber nblocks;
+    BlockNumber max_blocks;
+    char      **pages;
+    struct PgliteMemoryFork *next;
+} PgliteMemoryFork;
+
+typedef struct PgliteMemoryCluster
+{
+    char       *data_dir;
+    /* taken exclusively to create or unlink forks */
+    pthread_rwlock_t lock;
+    PgliteMemoryFork *forks[PGLITE_MEMORY_BUCKETS];
+    struct PgliteMemoryCluster *next;
+} PgliteMemoryCluster;
+
+/* shared by every thread, unlike the globals of the backend */
+static pthread_mutex_t pglite_memory_clusters_lock = PTHREAD_MUTEX_INITIALIZER;
+static PgliteMemoryCluster *pglite_memory_clusters;
+
+static __thread bool pglite_memory_smgr = false;
+static __thread PgliteMemoryCluster *pglite_memory_cluster;
+
+/*
+ * The cluster in DataDir, created on first use
+ */
+static PgliteMemoryCluster *
+pglite_memory_get_cluster(void)
+{
+    PgliteMemoryCluster *cluster = pglite_memory_cluster;
+
+    if (likely(cluster != NULL))
+        return cluster;
+
+    pthread_mutex_lock(&pglite_memory_clusters_lock);
+
+    for (cluster = pglite_memory_clusters; cluster != NULL; cluster = cluster->next)
+    {
+        if (strcmp(cluster->data_dir, DataDir) == 0)
+            break;
+    }
+
+    if (cluster == NULL)
+    {
+        cluster = calloc(1, sizeof(PgliteMemoryCluster));
+        if (cluster != NULL && (cluster->data_dir = strdup(DataDir)) == NULL)
+        {
+            free(cluster);
+            cluster = NULL;
+        }
+
+        if (cluster == NULL)
+        {
+            pthread_mutex_unlock(&pglite_memory_clusters_lock);
+            ereport(ERROR,
+                    (errcode(ERRCODE_OUT_OF_MEMORY),
+                     errmsg("out of memory")));
+        }
+
+        pthread_rwlock_init(&cluster->lock, NULL);
+        cluster->next = pglite_memory_clusters;
+        pglite_memory_clusters = cluster;
+    }
+
+    pthread_mutex_unlock(&pglite_memory_clusters_lock);
+
+    pglite_memory_cluster = cluster;
+    return cluster;
+}
+
+/*
+ * Where the fork is filed, or would be. The cluster must be locked.
+ */
+static PgliteMemoryFork **
+pglite_memory_slot(PgliteMemoryCluster *cluster, RelFileNodeBackend rnode,
+                   ForkNumber forknum)
+{
+    PgliteMemoryForkKey key;
+    PgliteMemoryFork **slot;
+
+    /* hashed as bytes, padding and all */
+    memset(&key, 0, sizeof(key));
+    key.rnode = rnode;
+    key.forknum = forknum;
+
+    slot = &cluster->forks[hash_bytes((const unsigned char *) &key, sizeof(key)) %
+                           PGLITE_MEMORY_BUCKETS];
+
+    while (*slot != NULL && memcmp(&(*slot)->key, &key, sizeof(key)) != 0)
+        slot = &(*slot)->next;
+
+    return slot;
+}
+
+/*
+ * Finds the fork and locks it, shared or exclusive, along with the cluster,
+ * which stays locked so that the fork can't be unlinked under us. Raises an
+ * error as md.c would for a missing file.
+ */
+static PgliteMemoryFork *
+pglite_memory_lock_fork(SMgrRelation reln, ForkNumber forknum, bool exclusive)
+{
+    PgliteMemoryCluster *cluster = pglite_memory_get_cluster();
+    PgliteMemoryFork *fork;
+
+    pthread_rwlock_rdlock(&cluster->lock);
+
+    fork = *pglite_memory_slot(cluster, reln->smgr_rnode, forknum);
+    if (fork == NULL)
+    {
+        pthread_rwlock_unlock(&cluster->lock);
+        errno = ENOENT;
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not open file \"%s\": %m",
+                        relpath(reln->smgr_rnode, forknum))));
+    }
+
+    if (exclusive)
+        pthread_rwlock_wrlock(&fork->lock);
+    else
+        pthread_rwlock_rdlock(&fork->lock);
+
+    return fork;
+}
+
+static void
+pglite_memory_unlock_fork(PgliteMemoryFork *fork)
+{
+    pthread_rwlock_unlock(&fork->lock);
+    pthread_rwlock_unlock(&pglite_memory_cluster->lock);
+}
+
+/*
+ * Adds zeroed pages up to `nblocks`, returning false if out of memory, in
+ * which case the fork is left as it was. The fork must be locked exclusively.
+ */
+static bool
+pglite_memory_grow(PgliteMemoryFork *fork, BlockNumber nblocks)
+{
+    BlockNumber blkno;
+
+    if (nblocks > fork->max_blocks)
+    {
+        BlockNumber max_blocks = Max(fork->max_blocks, 8);
+        char      **pages;
+
+        while (max_blocks < nblocks)
+            max_blocks = Min((uint64) max_blocks * 2, (uint64) InvalidBlockNumber);
+
+        pages = realloc(fork->pages, sizeof(char *) * max_blocks);
+        if (pages == NULL)
+            return false;
+
+        fork->pages = pages;
+        fork->max_blocks = max_blocks;
+    }
+
+    for (blkno = fork->nblocks; blkno < nblocks; blkno++)
+    {
+        fork->pages[blkno] = calloc(1, BLCKSZ);
+        if (fork->pages[blkno] == NULL)
+        {
+            while (blkno-- > fork->nblocks)
+                free(fork->pages[blkno]);
+
+            return false;
+        }
+    }
+
+    fork->nblocks = nblocks;
+    return true;
+}
+
+static void
+pglite_memory_free_fork(PgliteMemoryFork *fork)
+{
+    for (BlockNumber blkno = 0; blkno < fork->nblocks; blkno++)
+        free(fork->pages[blkno]);
+
+    pthread_rwlock_destroy(&fork->lock);
+    free(fork->pages);
+    free(fork);
+}
+
+/*
+ * Stores `buffer` as page `blocknum`, adding zeroed pages before it if it's
+ * past the end, as a write past the end of a file would
+ */
+static void
+pglite_memory_store(SMgrRelation reln, ForkNumber forknum,
+                    BlockNumber blocknum, const char *buffer)
+{
+    PgliteMemoryFork *fork;
+
+    fork = pglite_memory_lock_fork(reln, forknum, false);
+
+    if (blocknum >= fork->nblocks)
+    {
+        pthread_rwlock_unlock(&fork->lock);
+        pthread_rwlock_wrlock(&fork->lock);
+
+        if (blocknum >= fork->nblocks && !pglite_memory_grow(fork, blocknum + 1))
+        {
+            pglite_memory_unlock_fork(fork);
+            ereport(ERROR,
+                    (errcode(ERRCODE_OUT_OF_MEMORY),
+                     errmsg("could not extend file \"%s\": out of memory",
+                            relpath(reln->smgr_rnode, forknum))));
+        }
+    }
+
+    memcpy(fork->pages[blocknum], buffer, BLCKSZ);
+
+    pglite_memory_unlock_fork(fork);
+}
+
+void
+pglite_memory_open(SMgrRelation reln)
+{
+}
+
+void
+pglite_memory_close(SMgrRelation reln, ForkNumber forknum)
+{
+}
+
+void
+pglite_memory_create(SMgrRelation reln, ForkNumber forknum, bool isRedo)
+{
+    PgliteMemoryCluster *cluster = pglite_memory_get_cluster();
+    PgliteMemoryFork **slot;
+    PgliteMemoryFork *fork;
+
+    pthread_rwlock_wrlock(&cluster->lock);
+
+    slot = pglite_memory_slot(cluster, reln->smgr_rnode, forknum);
+    if (*slot != NULL)
+    {
+        pthread_rwlock_unlock(&cluster->lock);
+
+        if (isRedo)
+            return;
+
+        errno = EEXIST;
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not create file \"%s\": %m",
+                        relpath(reln->smgr_rnode, forknum))));
+    }
+
+    fork = calloc(1, sizeof(PgliteMemoryFork));
+    if (fork == NULL)
+    {
+        pthread_rwlock_unlock(&cluster->lock);
+        ereport(ERROR,
+                (errcode(ERRCODE_OUT_OF_MEMORY),
+                 errmsg("out of memory")));
+    }
+
+    memset(&fork->key, 0, sizeof(fork->key));
+    fork->key.rnode = reln->smgr_rnode;
+    fork->key.forknum = forknum;
+    pthread_rwlock_init(&fork->lock, NULL);
+    *slot = fork;
+
+    pthread_rwlock_unlock(&cluster->lock);
+}
+
+bool
+pglite_memory_exists(SMgrRelation reln, ForkNumber forknum)
+{
+    PgliteMemoryCluster *cluster = pglite_memory_get_cluster();
+    bool        exists;
+
+    pthread_rwlock_rdlock(&cluster->lock);
+    exists = *pglite_memory_slot(cluster, reln->smgr_rnode, forknum) != NULL;
+    pthread_rwlock_unlock(&cluster->lock);
+
+    return exists;
+}
+
+/*
+ * Frees the fork at once, where md.c would leave the main fork's first
+ * segment for the next checkpoint to remove: that's so its relfilenode
+ * isn't reused before the checkpoint makes the unlink safe for recovery,
+ * which a cluster in memory never goes through.
+ */
+void
+pglite_memory_unlink(RelFileNodeBackend rnode, ForkNumber forknum, bool isRedo)
+{
+    PgliteMemoryCluster *cluster = pglite_memory_get_cluster();
+    ForkNumber  first = forknum;
+    ForkNumber  last = forknum;
+    PgliteMemoryFork *unlinked = NULL;
+
+    if (forknum == InvalidForkNumber)
+    {
+        first = 0;
+        last = MAX_FORKNUM;
+    }
+
+    pthread_rwlock_wrlock(&cluster->lock);
+
+    for (ForkNumber forkno = first; forkno <= last; forkno++)
+    {
+        PgliteMemoryFork **slot = pglite_memory_slot(cluster, rnode, forkno);
+        PgliteMemoryFork *found = *slot;
+
+        if (found == NULL)
+            continue;
+
+        *slot = found->next;
+        found->next = unlinked;
+        unlinked = found;
+    }
+
+    pthread_rwlock_unlock(&cluster->lock);
+
+    while (unlinked != NULL)
+    {
+        PgliteMemoryFork *next = unlinked->next;
+
+        pglite_memory_free_fork(unlinked);
+        unlinked = next;
+    }
+}
+
+void
+pglite_memory_extend(SMgrRelation reln, ForkNumber forknum,
+                     BlockNumber blocknum, char *buffer, bool skipFsync)
+{
+    if (blocknum == InvalidBlockNumber)
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("cannot extend file \"%s\" beyond %u blocks",
+                        relpath(reln->smgr_rnode, forknum),
+                        InvalidBlockNumber)));
+
+    pglite_memory_store(reln, forknum, blocknum, buffer);
+}
+
+bool
+pglite_memory_prefetch(SMgrRelation reln, ForkNumber forknum,
+                       BlockNumber blocknum)
+{
+    return true;
+}
+
+void
+pglite_memory_read(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+                   char *buffer)
+{
+    PgliteMemoryFork *fork;
+    BlockNumber nblocks;
+
+    fork = pglite_memory_lock_fork(reln, forknum, false);
+
+    nblocks = fork->nblocks;
+    if (blocknum < nblocks)
+        memcpy(buffer, fork->pages[blocknum], BLCKSZ);
+
+    pglite_memory_unlock_fork(fork);
+
+    if (blocknum < nblocks)
+        return;
+
+    /* past the end: as md.c does with a short read */
+    if (zero_damaged_pages || InRecovery)
+        MemSet(buffer, 0, BLCKSZ);
+    else
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_CORRUPTED),
+                 errmsg("could not read block %u in file \"%s\": read only 0 of %d bytes",
+                        blocknum, relpath(reln->smgr_rnode, forknum),
+                        BLCKSZ)));
+}
+
+void
+pglite_memory_write(SMgrRelation reln, ForkNumber forknum,
+                    BlockNumber blocknum, char *buffer, bool skipFsync)
+{
+    pglite_memory_store(reln, forknum, blocknum, buffer);
+}
+
+void
+pglite_memory_writeback(SMgrRelation reln, ForkNumber forknum,
+                        BlockNumber blocknum, BlockNumber nblocks)
+{
+}
+
+BlockNumber
+pglite_memory_nblocks(SMgrRelation reln, ForkNumber forknum)
+{
+    PgliteMemoryFork *fork;
+    BlockNumber nblocks;
+
+    fork = pglite_memory_lock_fork(reln, forknum, false);
+    nblocks = fork->nblocks;
+    pglite_memory_unlock_fork(fork);
+
+    return nblocks;
+}
+
+void
+pglite_memory_truncate(SMgrRelation reln, ForkNumber forknum,
+                       BlockNumber nblocks)
+{
+    PgliteMemoryFork *fork;
+    BlockNumber curnblk;
+
+    fork = pglite_memory_lock_fork(reln, forknum, true);
+
+    curnblk = fork->nblocks;
+    if (nblocks > curnblk)
+    {
+        pglite_memory_unlock_fork(fork);
+
+        /* as md.c: a truncation replayed after a later one already was */
+        if (InRecovery)
+            return;
+
+        ereport(ERROR,
+                (errmsg("could not truncate file \"%s\" to %u blocks: it's only %u blocks now",
+                        relpath(reln->smgr_rnode, forknum),
+                        nblocks, curnblk)));
+    }
+
+    for (BlockNumber blkno = nblocks; blkno < curnblk; blkno++)
+        free(fork->pages[blkno]);
+
+    fork->nblocks = nblocks;
+
+    pglite_memory_unlock_fork(fork);
+}
+
+void
+pglite_memory_immedsync(SMgrRelation reln, ForkNumber forknum)
+{
+}
+
+/*
+ * For GetNewRelFileNode: whether the relfilenode is in use in memory, where
+ * there's no file for it to find in the way
+ */
+bool
+pglite_memory_relation_exists(RelFileNodeBackend rnode)
+{
+    PgliteMemoryCluster *cluster;
+    bool        exists;
+
+    if (!pglite_memory_smgr)
+        return false;
+
+    cluster = pglite_memory_get_cluster();
+
+    pthread_rwlock_rdlock(&cluster->lock);
+    exists = *pglite_memory_slot(cluster, rnode, MAIN_FORKNUM) != NULL;
+    pthread_rwlock_unlock(&cluster->lock);
+
+    return exists;
+}
+
+/*
+ * For calculate_relation_size: the size of the fork, if this thread keeps
+ * relations in memory, 0 if there's no such fork
+ */
+bool
+pglite_memory_fork_size(RelFileNode node, BackendId backend,
+                        ForkNumber forknum, int64 *size)
+{
+    PgliteMemoryCluster *cluster;
+    PgliteMemoryFork *fork;
+    RelFileNodeBackend rnode;
+
+    if (!pglite_memory_smgr)
+        return false;
+
+    cluster = pglite_memory_get_cluster();
+    rnode.node = node;
+    rnode.backend = backend;
+
+    pthread_rwlock_rdlock(&cluster->lock);
+
+    fork = *pglite_memory_slot(cluster, rnode, forknum);
+    *size = fork == NULL ? 0 : (int64) fork->nblocks * BLCKSZ;
+
+    pthread_rwlock_unlock(&cluster->lock);
+
+    return true;
+}
+
+/*
+ * For calculate_database_size, which adds up the files of the database's
+ * directories: the size of its relations in memory, in every tablespace
+ */
+int64
+pglite_memory_database_size(Oid dbid)
+{
+    PgliteMemoryCluster *cluster;
+    int64       size = 0;
+
+    if (!pglite_memory_smgr)
+        return 0;
+
+    cluster = pglite_memory_get_cluster();
+
+    pthread_rwlock_rdlock(&cluster->lock);
+
+    for (int i = 0; i < PGLITE_MEMORY_BUCKETS; i++)
+    {
+        for (PgliteMemoryFork *fork = cluster->forks[i]; fork != NULL; fork = fork->next)
+        {
+            if (fork->key.rnode.node.dbNode == dbid)
+                size += (int64) fork->nblocks * BLCKSZ;
+        }
+    }
+
+    pthread_rwlock_unlock(&cluster->lock);
+
+    return size;
+}
+
+/*
+ * Whether the fork belongs to the database in `db`, in any tablespace if
+ * its spcNode is InvalidOid. Temporary relations are never copied or
+ * dropped with a database: they go with their sessions.
+ */
+static bool
+pglite_memory_in_database(PgliteMemoryFork *fork, const RelFileNode *db)
+{
+    return !RelFileNodeBackendIsTemp(fork->key.rnode) &&
+        fork->key.rnode.node.dbNode == db->dbNode &&
+        (db->spcNode == InvalidOid || fork->key.rnode.node.spcNode == db->spcNode);
+}
+
+/*
+ * Unlinks the forks of the database in `db`, at once. The cluster must be
+ * locked exclusively.
+ */
+static void
+pglite_memory_drop_forks(PgliteMemoryCluster *cluster, const RelFileNode *db)
+{
+    for (int i = 0; i < PGLITE_MEMORY_BUCKETS; i++)
+    {
+        PgliteMemoryFork **slot = &cluster->forks[i];
+
+        while (*slot != NULL)
+        {
+            PgliteMemoryFork *fork = *slot;
+
+            if (!pglite_memory_in_database(fork, db))
+            {
+                slot = &fork->next;
+                continue;
+            }
+
+            *slot = fork->next;
+            pglite_memory_free_fork(fork);
+        }
+    }
+}
+
+/*
+ * For copydir, as CREATE DATABASE with the FILE_COPY strategy and ALTER
+ * DATABASE SET TABLESPACE copy a database's directory: copies its relations
+ * in memory too. Those already in the one copied to are dropped first.
+ */
+void
+pglite_memory_copy_db(const char *fromdir, const char *todir)
+{
+    PgliteMemoryCluster *cluster;
+    RelFileNode from;
+    RelFileNode to;
+    PgliteMemoryFork *copies = NULL;
+    bool        ok = true;
+
+    if (!pglite_memory_smgr ||
+        !pglite_parse_db_path(fromdir, &from.spcNode, &from.dbNode) ||
+        !pglite_parse_db_path(todir, &to.spcNode, &to.dbNode))
+        return;
+
+    cluster = pglite_memory_get_cluster();
+
+    pthread_rwlock_wrlock(&cluster->lock);
+
+    pglite_memory_drop_forks(cluster, &to);
+
+    for (int i = 0; ok && i < PGLITE_MEMORY_BUCKETS; i++)
+    {
+        for (PgliteMemoryFork *fork = cluster->forks[i]; ok && fork != NULL; fork = fork->next)
+        {
+            PgliteMemoryFork *copy;
+
+            if (!pglite_memory_in_database(fork, &from))
+                continue;
+
+            copy = calloc(1, sizeof(PgliteMemoryFork));
+            if (copy == NULL)
+            {
+                ok = false;
+                break;
+            }
+
+            copy->key = fork->key;
+            copy->key.rnode.node.spcNode = to.spcNode;
+            copy->key.rnode.node.dbNode = to.dbNode;
+            pthread_rwlock_init(&copy->lock, NULL);
+            copy->next = copies;
+            copies = copy;
+
+            ok = pglite_memory_grow(copy, fork->nblocks);
+
+            for (BlockNumber blkno = 0; ok && blkno < fork->nblocks; blkno++)
+                memcpy(copy->pages[blkno], fork->pages[blkno], BLCKSZ);
+        }
+    }
+
+    /* filed once the walk's done, so it doesn't come across them */
+    while (copies != NULL)
+    {
+        PgliteMemoryFork *copy = copies;
+
+        copies = copy->next;
+
+        if (ok)
+        {
+            PgliteMemoryFork **slot = pglite_memory_slot(cluster, copy->key.rnode,
+                                                         copy->key.forknum);
+
+            copy->next = NULL;
+            *slot = copy;
+        }
+        else
+            pglite_memory_free_fork(copy);
+    }
+
+    pthread_rwlock_unlock(&cluster->lock);
+
+    if (!ok)
+        ereport(ERROR,
+                (errcode(ERRCODE_OUT_OF_MEMORY),
+                 errmsg("could not copy relations of \"%s\" to \"%s\": out of memory",
+                        fromdir, todir)));
+}
+
+/*
+ * For DROP DATABASE, as it removes the database's directories: frees its
+ * relations in memory
+ */
+void
+pglite_memory_drop_db(Oid dbid)
+{
+    PgliteMemoryCluster *cluster;
+    RelFileNode db;
+
+    if (!pglite_memory_smgr)
+        return;
+
+    cluster = pglite_memory_get_cluster();
+    db.spcNode = InvalidOid;
+    db.dbNode = dbid;
+
+    pthread_rwlock_wrlock(&cluster->lock);
+    pglite_memory_drop_forks(cluster, &db);
+    pthread_rwlock_unlock(&cluster->lock);
+}
+
+/*
+ * The storage manager for smgropen to give relations of this thread: ours
+ * if it keeps them in memory, else the cluster's container if it has one
+ */
+int
+pglite_smgr_which(void)
+{
+    return pglite_memory_smgr ? PGLITE_MEMORY_SMGR : pglite_container_smgr_which();
+}
+
+/*
+ * Keeps the relations this thread opens in memory. Must be called before the
+ * thread opens any, and by every thread working on the same cluster.
+ */
+void
+pglite_use_memory_smgr(void)
+{
+    pglite_memory_smgr = true;
+}
+
+/*
+ * Frees the relations of the cluster in `data_dir`, once no thread is
+ * working on it any more
+ */
+void
+pglite_drop_memory_relations(const char *data_dir)
+{
+    PgliteMemoryCluster **slot;
+    PgliteMemoryCluster *cluster;
+
+    pthread_mutex_lock(&pglite_memory_clusters_lock);
+
+    slot = &pglite_memory_clusters;
+    while (*slot != NULL && strcmp((*slot)->data_dir, data_dir) != 0)
+        slot = &(*slot)->next;
+
+    cluster = *slot;
+    if (cluster != NULL)
+        *slot = cluster->next;
+
+    pthread_mutex_unlock(&pglite_memory_clusters_lock);
+
+    if (cluster == NULL)
+        return;
+
+    for (int i = 0; i < PGLITE_MEMORY_BUCKETS; i++)
+    {
+        PgliteMemoryFork *fork = cluster->forks[i];
+
+        while (fork != NULL)
+        {
+            PgliteMemoryFork *next = fork->next;
+
+            pglite_memory_free_fork(fork);
+            fork = next;
+        }
+    }
+
+    pthread_rwlock_destroy(&cluster->lock);
+    free(cluster->data_dir);
+    free(cluster);
+}
@@ -6,3 +6,9 @@ pglite_set_bootstrap_processing_mode()
 {
     SetProcessingMode(BootstrapProcessing);
 }
+
+void
+pglite_set_normal_processing_mode()
+{
+    SetProcessingMode(NormalProcessing);
+}
@@ -0,0 +1,249 @@
+/*
+ * pglite.h
+ *
+ * Declarations shared between the pglite shims and the Rust side. Included
+ * from bindings.h, so everything in here is visible to bindgen.
+ */
+#ifndef PGLITE_H
+#define PGLITE_H
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "executor/tuptable.h"
+#include "miscadmin.h"
+#include "postmaster/bgworker_internals.h"
+#include "tcop/dest.h"
+#include "utils/catcache.h"
+#include "utils/elog.h"
+#include "utils/plancache.h"
+
+/* exec.c */
+
+extern ErrorData *pglite_exec(const char *query_string, DestReceiver *dest,
+                              uint64 *processed);
+extern ErrorData *pglite_catch_error(void);
+extern void pglite_check_not_aborted(Node *parsetree);
+
+typedef enum PgliteValueKind
+{
+    PGLITE_VALUE_NULL,
+    PGLITE_VALUE_BOOL,
+    PGLITE_VALUE_INT,
+    PGLITE_VALUE_FLOAT,
+    PGLITE_VALUE_TEXT,
+    PGLITE_VALUE_BYTES,
+} PgliteValueKind;
+
+/* a statement parameter, borrowed from the Rust side for the call */
+typedef struct PgliteValue
+{
+    PgliteValueKind kind;
+    bool        b;
+    int64       i;
+    double      f;
+    const char *data;
+    size_t      len;
+} PgliteValue;
+
+extern Datum pglite_value_datum(const PgliteValue *value, Oid typid);
+extern ErrorData *pglite_prepare(const char *query_string,
+                                 CachedPlanSource **plansource);
+extern ErrorData *pglite_drop_plan(CachedPlanSource *plansource);
+extern ErrorData *pglite_execute_plan(CachedPlanSource *plansource,
+                                      const PgliteValue *params, int nparams,
+                                      DestReceiver *dest, uint64 *processed);
+extern ErrorData *pglite_open_cursor(CachedPlanSource *plansource,
+                                     const PgliteValue *params, int nparams,
+                                     char **portal_name);
+extern ErrorData *pglite_fetch(const char *portal_name, long count,
+                               DestReceiver *dest, uint64 *processed);
+extern ErrorData *pglite_close_cursor(const char *portal_name);
+
+/* attach.c */
+
+typedef struct PgliteSharedMemory PgliteSharedMemory;
+
+extern PgliteSharedMemory *pglite_export_shared_memory(void);
+extern void pglite_free_shared_memory(PgliteSharedMemory *shared);
+extern void pglite_crash_shared_memory(PgliteSharedMemory *shared);
+extern bool pglite_postmaster_gone(void);
+extern void pglite_attach_shared_memory(PgliteSharedMemory *shared);
+extern void pglite_claim_child_slot(void);
+extern void pglite_init_attached_session(const char *dbname);
+extern void pglite_detach_shared_memory(void);
+
+/* container_smgr.c */
+
+extern int pglite_container_smgr_which(void);
+extern bool pglite_create_container(const char *data_dir);
+extern bool pglite_parse_db_path(const char *path, Oid *spcNode, Oid *dbNode);
+
+/* copy.c */
+
+extern ErrorData *pglite_copy_in(const char *table, const char *const *columns,
+                                 int ncolumns, const PgliteValue *values,
+                                 int width, int nrows, uint64 *processed);
+
+/* dest.c */
+
+typedef void (*pglite_startup_fn) (void *ctx, TupleDesc desc);
+typedef bool (*pglite_receive_fn) (void *ctx, TupleTableSlot *slot);
+
+typedef struct PgliteColumn
+{
+    const char *name;
+    Oid         typid;
+    int16       typlen;
+    bool        typbyval;
+} PgliteColumn;
+
+extern DestReceiver *pglite_create_receiver(pglite_startup_fn startup,
+                                            pglite_receive_fn receive,
+                                            void *ctx);
+extern void pglite_tupdesc_column(TupleDesc desc, int attnum,
+                                  PgliteColumn *column);
+extern bool pglite_datum_bytes(Datum value, int16 typlen, const char **bytes,
+                               size_t *len);
+extern bool pglite_datum_cstring(Datum value, Oid typid, char **cstring);
+
+/* fs.c */
+
+/*
+ * File system calls on paths relative to a data directory, and on the
+ * descriptors open returned, each returning -1 and setting errno on failure
+ * as the call it stands for. opendir returns a descriptor of the directory,
+ * for fdopendir.
+ */
+typedef struct PgliteVfs
+{
+    void       *ctx;
+    int         (*open) (void *ctx, const char *path, int flags, mode_t mode);
+    int         (*stat) (void *ctx, const char *path, struct stat *buf);
+    int         (*mkdir) (void *ctx, const char *path, mode_t mode);
+    int         (*opendir) (void *ctx, const char *path);
+    int         (*unlink) (void *ctx, const char *path);
+    int         (*rmdir) (void *ctx, const char *path);
+    int         (*rename) (void *ctx, const char *from, const char *to);
+    ssize_t     (*pread) (void *ctx, int fd, void *buf, size_t count, off_t offset);
+    ssize_t     (*pwrite) (void *ctx, int fd, const void *buf, size_t count, off_t offset);
+    int         (*fsync) (void *ctx, int fd);
+    int         (*ftruncate) (void *ctx, int fd, off_t length);
+} PgliteVfs;
+
+extern bool pglite_register_vfs(const char *data_dir, const PgliteVfs *vfs);
+extern int pglite_open(const char *path, int flags, mode_t mode);
+extern int pglite_stat(const char *restrict path, struct stat *restrict buf);
+extern int pglite_mkdir(const char *path, mode_t mode);
+extern DIR *pglite_opendir(const char *path);
+extern int pglite_unlink(const char *path);
+extern int pglite_rmdir(const char *path);
+extern int pglite_rename(const char *from, const char *to);
+extern ssize_t pglite_pread(int fd, void *buf, size_t count, off_t offset);
+extern ssize_t pglite_pwrite(int fd, const void *buf, size_t count, off_t offset);
+extern int pglite_fsync(int fd);
+extern int pglite_ftruncate(int fd, off_t length);
+extern bool pglite_vfs_registered(void);
+
+/* lwlock_stats.c */
+
+typedef struct PgliteLWLockStats
+{
+    int         tranche;
+    const char *name;
+    uint64      acquisitions;
+    /* acquisitions that had to sleep */
+    uint64      contended;
+    uint64      spin_delays;
+    uint64      wait_ns;
+} PgliteLWLockStats;
+
+extern void pglite_set_lwlock_stats(bool enabled);
+extern int pglite_lwlock_stats(PgliteLWLockStats *stats, int max);
+
+/* memory_smgr.c */
+
+extern void pglite_use_memory_smgr(void);
+extern void pglite_drop_memory_relations(const char *data_dir);
+
+/* postmaster.c */
+
+/* requests from children, as returned by pglite_postmaster_wait */
+#define PGLITE_PM_START_AUTOVAC_LAUNCHER 0x1
+#define PGLITE_PM_START_AUTOVAC_WORKER 0x2
+
+extern void pglite_postmaster_init(void);
+extern int pglite_postmaster_wait(long timeout);
+extern void pglite_auxiliary_main(AuxProcType type);
+extern void pglite_autovac_launcher_main(void);
+extern void pglite_autovac_worker_main(void);
+extern RegisteredBgWorker *pglite_next_bgworker(BackgroundWorker **entry);
+extern void pglite_bgworker_started(RegisteredBgWorker *rw, pid_t pid);
+extern void pglite_bgworker_exited(RegisteredBgWorker *rw, int exitstatus);
+extern void pglite_bgworker_main(BackgroundWorker *entry);
+
+/* readahead.c */
+
+extern void pglite_set_readahead(bool enabled);
+
+/* shared_fd.c */
+
+typedef struct PgliteSharedFdStats
+{
+    /* opens of relation segments while sharing */
+    uint64      opens;
+    /* of those, segments some thread had open already */
+    uint64      hits;
+    /* idle descriptors closed to make room */
+    uint64      evictions;
+    /* descriptors the cache has open now */
+    uint64      open;
+} PgliteSharedFdStats;
+
+extern int pglite_vfd_open(const char *path, int flags, mode_t mode);
+extern int pglite_vfd_close(int fd);
+extern void pglite_shared_fd_forget(const char *path);
+extern void pglite_set_shared_fds(bool enabled);
+extern void pglite_shared_fd_stats(PgliteSharedFdStats *stats);
+
+/* shared_plan.c */
+
+typedef struct PgliteSharedPlan PgliteSharedPlan;
+
+extern void pglite_shared_plan_init_backend(void);
+extern PgliteSharedPlan *pglite_shared_plan_lookup(CachedPlanSource *plansource);
+extern List *pglite_shared_plan_stmts(PgliteSharedPlan *plan);
+extern void pglite_shared_plan_release(PgliteSharedPlan *plan);
+extern void pglite_shared_plan_publish(CachedPlanSource *plansource,
+                                       CachedPlan *cplan);
+extern void pglite_forget_shared_plans(void *cluster);
+extern void pglite_set_shared_plans(bool enabled);
+
+/* shared_catcache.c */
+
+extern void pglite_shared_catcache_init_backend(void);
+extern HeapTuple pglite_shared_catcache_lookup(CatCache *cache,
+                                               uint32 hashValue,
+                                               const Datum *arguments,
+                                               uint64 *generation);
+extern void pglite_shared_catcache_fill_entry(CatCTup *ct, HeapTuple tuple);
+extern void pglite_shared_catcache_release_entry(CatCTup *ct);
+extern void pglite_shared_catcache_publish(CatCache *cache, uint32 hashValue,
+                                           HeapTuple tuple, uint64 generation);
+extern void pglite_shared_catcache_invalidate(CatCache *cache,
+                                              uint32 hashValue);
+extern void pglite_shared_catcache_reset(CatCache *cache);
+extern void pglite_forget_shared_catcache(void *cluster);
+extern void pglite_set_shared_catcache(bool enabled);
+
+/* signal.c */
+
+extern int pglite_kill(pid_t pid, int sig);
+extern int pglite_setitimer(__itimer_which_t which,
+                            const struct itimerval *new_value,
+                            struct itimerval *old_value);
+extern void pglite_init_backend_signals(void);
+extern void pglite_end_backend_signals(void);
+
+#endif /* PGLITE_H */
@@ -0,0 +1,264 @@
+/*
+ * postmaster.c
+ *
+ * What the in-process postmaster needs from postmaster.c and from the
+ * startup of its children, with threads in place of forked processes. The
+ * postmaster thread creates the shared memory and waits here for requests
+ * from its children. Each child is a thread that attaches to the shared
+ * memory as an EXEC_BACKEND child would, then enters its main function.
+ *
+ * prepare-postgres.sh takes the InitProcess calls out of autovacuum.c,
+ * auxprocess.c and bgworker.c, as SubPostmasterMain makes them before
+ * attaching, and makes the autovacuum flags global so they can be set before
+ * InitProcess looks at them.
+ */
+#include <postgres.h>
+
+#include <miscadmin.h>
+#include <postmaster/autovacuum.h>
+#include <postmaster/auxprocess.h>
+#include <postmaster/bgworker_internals.h>
+#include <storage/ipc.h>
+#include <storage/latch.h>
+#include <storage/pmsignal.h>
+#include <storage/proc.h>
+#include <utils/memutils.h>
+#include <utils/timestamp.h>
+#include <utils/wait_event.h>
+
+#include "pglite.h"
+
+/* made global by prepare-postgres.sh */
+extern __thread bool am_autovacuum_launcher;
+extern __thread bool am_autovacuum_worker;
+
+/* declared only for EXEC_BACKEND builds */
+extern void AutoVacLauncherMain(int argc, char *argv[]) pg_attribute_noreturn();
+extern void AutoVacWorkerMain(int argc, char *argv[]) pg_attribute_noreturn();
+
+/*
+ * Marks this thread as the postmaster. Called after pglite_init_backend_signals,
+ * so that children signal our thread id.
+ */
+void
+pglite_postmaster_init(void)
+{
+    IsPostmasterEnvironment = true;
+    PostmasterPid = MyProcPid;
+
+    /* where the background worker registrations live, among other things */
+    PostmasterContext = AllocSetContextCreate(TopMemoryContext,
+                                              "Postmaster",
+                                              ALLOCSET_DEFAULT_SIZES);
+    MemoryContextSwitchTo(PostmasterContext);
+}
+
+/*
+ * Sleeps until a child signals us or `timeout` milliseconds pass, and
+ * returns the PGLITE_PM_* requests that came in meanwhile
+ */
+int
+pglite_postmaster_wait(long timeout)
+{
+    int         requests = 0;
+
+    (void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT, timeout,
+                     PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+
+    if (CheckPostmasterSignal(PMSIGNAL_START_AUTOVAC_LAUNCHER))
+        requests |= PGLITE_PM_START_AUTOVAC_LAUNCHER;
+
+    if (CheckPostmasterSignal(PMSIGNAL_START_AUTOVAC_WORKER))
+        requests |= PGLITE_PM_START_AUTOVAC_WORKER;
+
+    /* pglite_next_bgworker picks up any new registrations */
+    if (CheckPostmasterSignal(PMSIGNAL_BACKGROUND_WORKER_CHANGE))
+        BackgroundWorkerStateChange(true);
+
+    return requests;
+}
+
+/*
+ * The next registered background worker due to start, or NULL if there
+ * are none, as maybe_start_bgworkers finds them. `*entry` is set to a copy
+ * of the worker's details for pglite_bgworker_main, and the caller reports
+ * its pid with pglite_bgworker_started before looking for the next.
+ */
+RegisteredBgWorker *
+pglite_next_bgworker(BackgroundWorker **entry)
+{
+    slist_mutable_iter iter;
+    TimestampTz now = 0;
+
+    slist_foreach_modify(iter, &BackgroundWorkerList)
+    {
+        RegisteredBgWorker *rw;
+
+        rw = slist_container(RegisteredBgWorker, rw_lnode, iter.cur);
+
+        /* ignore if already running */
+        if (rw->rw_pid != 0)
+            continue;
+
+        /* if marked for death, clean up and remove from list */
+        if (rw->rw_terminate)
+        {
+            ForgetBackgroundWorker(&iter);
+            continue;
+        }
+
+        /*
+         * If this worker has crashed previously, maybe it needs to be
+         * restarted (unless on registration it specified it doesn't want to
+         * be restarted at all).
+         */
+        if (rw->rw_crashed_at != 0)
+        {
+            if (rw->rw_worker.bgw_restart_time == BGW_NEVER_RESTART)
+            {
+                int         notify_pid;
+
+                notify_pid = rw->rw_worker.bgw_notify_pid;
+
+                ForgetBackgroundWorker(&iter);
+
+                /* Report worker is gone now. */
+                if (notify_pid != 0)
+                    kill(notify_pid, SIGUSR1);
+
+                continue;
+            }
+
+            if (now == 0)
+                now = GetCurrentTimestamp();
+
+            if (!TimestampDifferenceExceeds(rw->rw_crashed_at, now,
+                                            rw->rw_worker.bgw_restart_time * 1000))
+                continue;
+
+            rw->rw_crashed_at = 0;
+        }
+
+        *entry = malloc(sizeof(BackgroundWorker));
+        if (*entry == NULL)
+        {
+            ereport(LOG,
+                    (errcode(ERRCODE_OUT_OF_MEMORY),
+                     errmsg("out of memory")));
+            return NULL;
+        }
+
+        memcpy(*entry, &rw->rw_worker, sizeof(BackgroundWorker));
+
+        return rw;
+    }
+
+    return NULL;
+}
+
+/*
+ * Records the pid of the thread started for `rw`, and lets whoever
+ * registered it know
+ */
+void
+pglite_bgworker_started(RegisteredBgWorker *rw, pid_t pid)
+{
+    rw->rw_pid = pid;
+    ReportBackgroundWorkerPID(rw);
+}
+
+/*
+ * Records the exit of the thread started for `exited`, as
+ * CleanupBackgroundWorker does
+ */
+void
+pglite_bgworker_exited(RegisteredBgWorker *exited, int exitstatus)
+{
+    slist_mutable_iter iter;
+
+    slist_foreach_modify(iter, &BackgroundWorkerList)
+    {
+        RegisteredBgWorker *rw;
+
+        rw = slist_container(RegisteredBgWorker, rw_lnode, iter.cur);
+
+        if (rw != exited)
+            continue;
+
+        if (exitstatus != 0)
+            rw->rw_crashed_at = GetCurrentTimestamp();
+        else
+            rw->rw_crashed_at = 0;
+
+        /* it may have started workers of its own and asked to hear of them */
+        BackgroundWorkerStopNotifications(rw->rw_pid);
+
+        rw->rw_pid = 0;
+        rw->rw_child_slot = 0;
+        ReportBackgroundWorkerExit(&iter);  /* report child death */
+
+        return;
+    }
+}
+
+/*
+ * Runs the startup process, checkpointer, background writer or WAL writer
+ * on this thread, once attached. Only returns by way of proc_exit.
+ */
+void
+pglite_auxiliary_main(AuxProcType type)
+{
+    InitAuxiliaryProcess();
+    CreateSharedMemoryAndSemaphores();
+
+    AuxiliaryProcessMain(type);
+}
+
+void
+pglite_autovac_launcher_main(void)
+{
+    am_autovacuum_launcher = true;
+
+    InitProcess();
+    CreateSharedMemoryAndSemaphores();
+
+    AutoVacLauncherMain(0, NULL);
+}
+
+/*
+ * The postmaster claims a worker's child slot before forking it, but with
+ * no process to fork the worker takes its own.
+ */
+void
+pglite_autovac_worker_main(void)
+{
+    am_autovacuum_worker = true;
+
+    pglite_claim_child_slot();
+    InitProcess();
+    CreateSharedMemoryAndSemaphores();
+
+    AutoVacWorkerMain(0, NULL);
+}
+
+/*
+ * Runs the background worker described by `entry`, taking ownership of it.
+ * Only returns by way of proc_exit.
+ */
+void
+pglite_bgworker_main(BackgroundWorker *entry)
+{
+    MyBgworkerEntry = MemoryContextAlloc(TopMemoryContext,
+                                         sizeof(BackgroundWorker));
+    memcpy(MyBgworkerEntry, entry, sizeof(BackgroundWorker));
+    free(entry);
+
+    IsBackgroundWorker = true;
+
+    pglite_claim_child_slot();
+    InitProcess();
+    CreateSharedMemoryAndSemaphores();
+
+    StartBackgroundWorker();
+}
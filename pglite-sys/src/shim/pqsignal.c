@@ -9,8 +9,41 @@ UnBlockSig,
 BlockSig,
 StartupBlockSig;
 
+/*
+ * As in src/backend/libpq/pqsignal.c. The checkpointer and the other
+ * auxiliary processes block and unblock with these masks, which are
+ * per-thread like the signal masks themselves.
+ */
 void pqinitmask(void)
 {
+    sigemptyset(&UnBlockSig);
+
+    /* First set all signals, then clear some. */
+    sigfillset(&BlockSig);
+    sigfillset(&StartupBlockSig);
+
+    /* Signals that should never be blocked */
+    sigdelset(&BlockSig, SIGTRAP);
+    sigdelset(&StartupBlockSig, SIGTRAP);
+    sigdelset(&BlockSig, SIGABRT);
+    sigdelset(&StartupBlockSig, SIGABRT);
+    sigdelset(&BlockSig, SIGILL);
+    sigdelset(&StartupBlockSig, SIGILL);
+    sigdelset(&BlockSig, SIGFPE);
+    sigdelset(&StartupBlockSig, SIGFPE);
+    sigdelset(&BlockSig, SIGSEGV);
+    sigdelset(&StartupBlockSig, SIGSEGV);
+    sigdelset(&BlockSig, SIGBUS);
+    sigdelset(&StartupBlockSig, SIGBUS);
+    sigdelset(&BlockSig, SIGSYS);
+    sigdelset(&StartupBlockSig, SIGSYS);
+    sigdelset(&BlockSig, SIGCONT);
+    sigdelset(&StartupBlockSig, SIGCONT);
+
+    /* Signals unique to startup */
+    sigdelset(&StartupBlockSig, SIGQUIT);
+    sigdelset(&StartupBlockSig, SIGTERM);
+    sigdelset(&StartupBlockSig, SIGALRM);
 }
 
 int pqsigsetmask(sigset_t mask)
@@ -0,0 +1,676 @@
+/*
+ * readahead.c
+ *
+ * Read-ahead of md.c relations through io_uring. Postgres reads a block
+ * only once it needs it, with a blocking pread, and leaves reading ahead to
+ * posix_fadvise and the kernel's own read-ahead. Here a thread keeps a
+ * window of block reads in flight instead: following a sequential scan as
+ * it goes, and taking smgrprefetch's hints, as bitmap heap scans give them.
+ * smgrread then takes the block from the window, waiting for the read to
+ * complete if it hasn't yet, rather than reading it itself.
+ *
+ * A block read ahead may be written, by this thread or another, before it's
+ * taken, so writes to a relation fork bump a generation of it, and a block
+ * is only taken if no write to its fork began or ended while it was being
+ * read. Writes elsewhere in the fork throw it away too; that's rare enough
+ * while a relation is being scanned from disk.
+ *
+ * prepare-postgres.sh has smgr.c call md.c through here, and adds
+ * pglite_md_fd to md.c for the descriptor and offset of a block.
+ */
+#include <postgres.h>
+
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <common/hashfn.h>
+#include <port/atomics.h>
+#include <storage/md.h>
+#include <storage/smgr.h>
+#include <utils/wait_event.h>
+
+#include "pglite.h"
+
+/* blocks each thread has in flight or read ahead at most */
+#define PGLITE_READAHEAD_WINDOW 32
+
+/* what came of pglite_readahead_submit */
+#define PGLITE_READAHEAD_SUBMITTED 0
+#define PGLITE_READAHEAD_FULL 1
+#define PGLITE_READAHEAD_PAST_END 2
+
+#define PGLITE_READAHEAD_GENERATIONS 4096
+
+/* added to md.c by prepare-postgres.sh */
+extern int pglite_md_fd(SMgrRelation reln, ForkNumber forknum,
+                        BlockNumber blocknum, off_t *offset);
+
+typedef struct PgliteReadaheadGeneration
+{
+    /* writes under way */
+    pg_atomic_uint32 writers;
+    /* writes finished */
+    pg_atomic_uint32 generation;
+} PgliteReadaheadGeneration;
+
+typedef struct PgliteReadaheadSlot
+{
+    bool        in_use;
+    /* the kernel is still reading into page */
+    bool        in_flight;
+    /* asked for by bufmgr, rather than read ahead of a scan */
+    bool        advised;
+    RelFileNodeBackend rnode;
+    ForkNumber  forknum;
+    BlockNumber blocknum;
+    /* the fork's generation when the read was submitted */
+    uint32      generation;
+    /* bytes read, or minus errno, once not in flight */
+    int32       result;
+    /* for evicting the oldest block not taken */
+    uint64      submitted;
+    char       *page;
+} PgliteReadaheadSlot;
+
+typedef struct PgliteReadahead
+{
+    int         ring_fd;
+    void       *sq_ring;
+    size_t      sq_ring_size;
+    void       *cq_ring;
+    size_t      cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t      sqes_size;
+    unsigned   *sq_head;
+    unsigned   *sq_tail;
+    unsigned   *sq_mask;
+    unsigned   *sq_array;
+    unsigned   *cq_head;
+    unsigned   *cq_tail;
+    unsigned   *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* submitted but not yet handed to io_uring_enter */
+    unsigned    to_submit;
+    uint64      submitted;
+    PgliteReadaheadSlot slots[PGLITE_READAHEAD_WINDOW];
+    char       *pages;
+
+    /* the sequential scan being followed */
+    RelFileNodeBackend seq_rnode;
+    ForkNumber  seq_forknum;
+    /* the block it should read next, and the next to read ahead */
+    BlockNumber seq_next;
+    BlockNumber seq_ahead;
+} PgliteReadahead;
+
+bool        pglite_readahead_enabled = false;
+
+/* shared by every thread, unlike the globals of the backend */
+static PgliteReadaheadGeneration pglite_readahead_generations[PGLITE_READAHEAD_GENERATIONS];
+
+static pthread_once_t pglite_readahead_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pglite_readahead_key;
+
+static __thread PgliteReadahead *pglite_readahead;
+/* io_uring couldn't be set up on this thread */
+static __thread bool pglite_readahead_unavailable = false;
+
+static PgliteReadaheadGeneration *
+pglite_readahead_generation(RelFileNodeBackend rnode, ForkNumber forknum)
+{
+    uint32      hash;
+
+    hash = hash_combine(hash_uint32(rnode.node.relNode), hash_uint32(rnode.node.dbNode));
+    hash = hash_combine(hash, hash_uint32((uint32) rnode.backend));
+    hash = hash_combine(hash, (uint32) forknum);
+
+    return &pglite_readahead_generations[hash % PGLITE_READAHEAD_GENERATIONS];
+}
+
+/*
+ * The fork's generation, or false if it's being written
+ */
+static bool
+pglite_readahead_snapshot(PgliteReadaheadGeneration *generation, uint32 *snapshot)
+{
+    *snapshot = pg_atomic_read_u32(&generation->generation);
+    pg_memory_barrier();
+
+    return pg_atomic_read_u32(&generation->writers) == 0;
+}
+
+static void
+pglite_readahead_write_begin(RelFileNodeBackend rnode, ForkNumber forknum)
+{
+    pg_atomic_fetch_add_u32(&pglite_readahead_generation(rnode, forknum)->writers, 1);
+}
+
+static void
+pglite_readahead_write_end(RelFileNodeBackend rnode, ForkNumber forknum)
+{
+    PgliteReadaheadGeneration *generation = pglite_readahead_generation(rnode, forknum);
+
+    pg_atomic_fetch_add_u32(&generation->generation, 1);
+    pg_atomic_fetch_sub_u32(&generation->writers, 1);
+}
+
+static int
+pglite_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete,
+                      unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                   flags, NULL, 0);
+}
+
+/*
+ * Hands the reads submitted so far to the kernel
+ */
+static void
+pglite_readahead_flush(PgliteReadahead *ra)
+{
+    while (ra->to_submit > 0)
+    {
+        int         submitted = pglite_io_uring_enter(ra->ring_fd, ra->to_submit, 0, 0);
+
+        if (submitted < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            /* left in the ring for the next enter */
+            return;
+        }
+
+        ra->to_submit -= Min((unsigned) submitted, ra->to_submit);
+    }
+}
+
+/*
+ * Notes the reads the kernel has completed
+ */
+static void
+pglite_readahead_reap(PgliteReadahead *ra)
+{
+    unsigned    head = *ra->cq_head;
+
+    while (head != __atomic_load_n(ra->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe *cqe = &ra->cqes[head & *ra->cq_mask];
+        PgliteReadaheadSlot *slot = &ra->slots[cqe->user_data];
+
+        slot->result = cqe->res;
+        slot->in_flight = false;
+        head++;
+    }
+
+    __atomic_store_n(ra->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Waits for the slot's read to complete
+ */
+static void
+pglite_readahead_wait(PgliteReadahead *ra, PgliteReadaheadSlot *slot)
+{
+    pglite_readahead_reap(ra);
+    if (!slot->in_flight)
+        return;
+
+    pglite_readahead_flush(ra);
+
+    pgstat_report_wait_start(WAIT_EVENT_DATA_FILE_READ);
+
+    while (slot->in_flight)
+    {
+        if (pglite_io_uring_enter(ra->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+            errno != EINTR)
+            elog(ERROR, "could not wait for read-ahead: %m");
+
+        pglite_readahead_reap(ra);
+    }
+
+    pgstat_report_wait_end();
+}
+
+static void
+pglite_readahead_free(PgliteReadahead *ra)
+{
+    if (ra->sqes != NULL)
+        munmap(ra->sqes, ra->sqes_size);
+    if (ra->cq_ring != NULL && ra->cq_ring != ra->sq_ring)
+        munmap(ra->cq_ring, ra->cq_ring_size);
+    if (ra->sq_ring != NULL)
+        munmap(ra->sq_ring, ra->sq_ring_size);
+    if (ra->ring_fd >= 0)
+        close(ra->ring_fd);
+
+    free(ra->pages);
+    free(ra);
+}
+
+/*
+ * The kernel still reads into the pages of reads in flight, so an exiting
+ * thread waits them out before freeing them
+ */
+static void
+pglite_readahead_thread_exit(void *arg)
+{
+    PgliteReadahead *ra = arg;
+
+    for (int i = 0; i < PGLITE_READAHEAD_WINDOW; i++)
+    {
+        PgliteReadaheadSlot *slot = &ra->slots[i];
+
+        pglite_readahead_reap(ra);
+        pglite_readahead_flush(ra);
+
+        while (slot->in_flight)
+        {
+            if (pglite_io_uring_enter(ra->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+                errno != EINTR)
+                return;         /* leaked, rather than freed under the kernel */
+
+            pglite_readahead_reap(ra);
+        }
+    }
+
+    pglite_readahead_free(ra);
+}
+
+static void
+pglite_readahead_init(void)
+{
+    pthread_key_create(&pglite_readahead_key, pglite_readahead_thread_exit);
+}
+
+/*
+ * This thread's io_uring and window, set up on first use, or NULL if
+ * io_uring isn't available
+ */
+static PgliteReadahead *
+pglite_readahead_get(void)
+{
+    PgliteReadahead *ra = pglite_readahead;
+    struct io_uring_params params;
+    char       *sq_ring;
+    char       *cq_ring;
+
+    if (likely(ra != NULL) || pglite_readahead_unavailable)
+        return ra;
+
+    /* blocks of a cluster with a VFS of its own are read through it */
+    if (pglite_vfs_registered())
+    {
+        pglite_readahead_unavailable = true;
+        return NULL;
+    }
+
+    ra = calloc(1, sizeof(PgliteReadahead));
+    if (ra == NULL)
+        return NULL;
+
+    memset(&params, 0, sizeof(params));
+    ra->ring_fd = syscall(__NR_io_uring_setup, PGLITE_READAHEAD_WINDOW, &params);
+    if (ra->ring_fd < 0)
+        goto unavailable;
+
+    ra->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ra->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ra->sq_ring_size = ra->cq_ring_size = Max(ra->sq_ring_size, ra->cq_ring_size);
+
+    sq_ring = mmap(NULL, ra->sq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ra->ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+        goto unavailable;
+    ra->sq_ring = sq_ring;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        cq_ring = sq_ring;
+    else
+    {
+        cq_ring = mmap(NULL, ra->cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ra->ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED)
+            goto unavailable;
+    }
+    ra->cq_ring = cq_ring;
+
+    ra->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ra->sqes = mmap(NULL, ra->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ra->ring_fd, IORING_OFF_SQES);
+    if (ra->sqes == MAP_FAILED)
+    {
+        ra->sqes = NULL;
+        goto unavailable;
+    }
+
+    ra->sq_head = (unsigned *) (sq_ring + params.sq_off.head);
+    ra->sq_tail = (unsigned *) (sq_ring + params.sq_off.tail);
+    ra->sq_mask = (unsigned *) (sq_ring + params.sq_off.ring_mask);
+    ra->sq_array = (unsigned *) (sq_ring + params.sq_off.array);
+    ra->cq_head = (unsigned *) (cq_ring + params.cq_off.head);
+    ra->cq_tail = (unsigned *) (cq_ring + params.cq_off.tail);
+    ra->cq_mask = (unsigned *) (cq_ring + params.cq_off.ring_mask);
+    ra->cqes = (struct io_uring_cqe *) (cq_ring + params.cq_off.cqes);
+
+    ra->pages = aligned_alloc(BLCKSZ, (size_t) PGLITE_READAHEAD_WINDOW * BLCKSZ);
+    if (ra->pages == NULL)
+        goto unavailable;
+
+    for (int i = 0; i < PGLITE_READAHEAD_WINDOW; i++)
+        ra->slots[i].page = ra->pages + (size_t) i * BLCKSZ;
+
+    ra->seq_next = InvalidBlockNumber;
+
+    pthread_once(&pglite_readahead_once, pglite_readahead_init);
+    pthread_setspecific(pglite_readahead_key, ra);
+
+    pglite_readahead = ra;
+    return ra;
+
+unavailable:
+    elog(DEBUG1, "io_uring is not available, not reading ahead: %m");
+    pglite_readahead_free(ra);
+    pglite_readahead_unavailable = true;
+    return NULL;
+}
+
+static PgliteReadaheadSlot *
+pglite_readahead_find(PgliteReadahead *ra, RelFileNodeBackend rnode,
+                      ForkNumber forknum, BlockNumber blocknum)
+{
+    for (int i = 0; i < PGLITE_READAHEAD_WINDOW; i++)
+    {
+        PgliteReadaheadSlot *slot = &ra->slots[i];
+
+        if (slot->in_use && slot->blocknum == blocknum &&
+            slot->forknum == forknum && RelFileNodeBackendEquals(slot->rnode, rnode))
+            return slot;
+    }
+
+    return NULL;
+}
+
+/*
+ * A slot to read into: a free one, or else the one read longest ago and not
+ * taken. Blocks bufmgr asked for are only given up for others it asks for,
+ * not for a scan's read-ahead. NULL if there's none to give up.
+ */
+static PgliteReadaheadSlot *
+pglite_readahead_free_slot(PgliteReadahead *ra, bool advised)
+{
+    PgliteReadaheadSlot *oldest = NULL;
+
+    pglite_readahead_reap(ra);
+
+    for (int i = 0; i < PGLITE_READAHEAD_WINDOW; i++)
+    {
+        PgliteReadaheadSlot *slot = &ra->slots[i];
+
+        if (slot->in_flight)
+            continue;
+        if (!slot->in_use)
+            return slot;
+        if (slot->advised && !advised)
+            continue;
+        if (oldest == NULL || slot->submitted < oldest->submitted)
+            oldest = slot;
+    }
+
+    if (oldest != NULL)
+        oldest->in_use = false;
+
+    return oldest;
+}
+
+/*
+ * Submits a read of the block, unless it's read already or being written,
+ * or the window is full, or the block is past the fork's last segment
+ */
+static int
+pglite_readahead_submit(PgliteReadahead *ra, SMgrRelation reln,
+                        ForkNumber forknum, BlockNumber blocknum, bool advised)
+{
+    PgliteReadaheadSlot *slot;
+    struct io_uring_sqe *sqe;
+    uint32      generation;
+    unsigned    tail;
+    off_t       offset;
+    int         fd;
+
+    slot = pglite_readahead_find(ra, reln->smgr_rnode, forknum, blocknum);
+    if (slot != NULL)
+    {
+        slot->advised |= advised;
+        return PGLITE_READAHEAD_SUBMITTED;
+    }
+
+    if (!pglite_readahead_snapshot(pglite_readahead_generation(reln->smgr_rnode, forknum),
+                                   &generation))
+        return PGLITE_READAHEAD_SUBMITTED;
+
+    slot = pglite_readahead_free_slot(ra, advised);
+    if (slot == NULL)
+        return PGLITE_READAHEAD_FULL;
+
+    fd = pglite_md_fd(reln, forknum, blocknum, &offset);
+    if (fd < 0)
+        return PGLITE_READAHEAD_PAST_END;
+
+    slot->in_use = true;
+    slot->in_flight = true;
+    slot->advised = advised;
+    slot->rnode = reln->smgr_rnode;
+    slot->forknum = forknum;
+    slot->blocknum = blocknum;
+    slot->generation = generation;
+    slot->submitted = ra->submitted++;
+
+    tail = *ra->sq_tail;
+    sqe = &ra->sqes[tail & *ra->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (uint64) (uintptr_t) slot->page;
+    sqe->len = BLCKSZ;
+    sqe->user_data = slot - ra->slots;
+
+    ra->sq_array[tail & *ra->sq_mask] = tail & *ra->sq_mask;
+    __atomic_store_n(ra->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ra->to_submit++;
+
+    return PGLITE_READAHEAD_SUBMITTED;
+}
+
+/*
+ * Takes the block from the window into `buffer`, returning false if it
+ * wasn't read ahead, or was written since
+ */
+static bool
+pglite_readahead_take(PgliteReadahead *ra, SMgrRelation reln,
+                      ForkNumber forknum, BlockNumber blocknum, char *buffer)
+{
+    PgliteReadaheadSlot *slot;
+    uint32      generation;
+    bool        valid;
+
+    slot = pglite_readahead_find(ra, reln->smgr_rnode, forknum, blocknum);
+    if (slot == NULL)
+        return false;
+
+    pglite_readahead_wait(ra, slot);
+
+    valid = slot->result == BLCKSZ &&
+        pglite_readahead_snapshot(pglite_readahead_generation(reln->smgr_rnode, forknum),
+                                  &generation) &&
+        generation == slot->generation;
+
+    if (valid)
+        memcpy(buffer, slot->page, BLCKSZ);
+
+    slot->in_use = false;
+    return valid;
+}
+
+/*
+ * Follows a sequential scan of the fork, keeping the window full ahead of
+ * it once it's read two blocks in a row
+ */
+static void
+pglite_readahead_follow(PgliteReadahead *ra, SMgrRelation reln,
+                        ForkNumber forknum, BlockNumber blocknum)
+{
+    bool        sequential;
+
+    sequential = blocknum == ra->seq_next && forknum == ra->seq_forknum &&
+        RelFileNodeBackendEquals(reln->smgr_rnode, ra->seq_rnode);
+
+    ra->seq_rnode = reln->smgr_rnode;
+    ra->seq_forknum = forknum;
+    ra->seq_next = blocknum + 1;
+
+    if (!sequential)
+    {
+        ra->seq_ahead = blocknum + 1;
+        return;
+    }
+
+    if (ra->seq_ahead != InvalidBlockNumber)
+        ra->seq_ahead = Max(ra->seq_ahead, blocknum + 1);
+
+    while (ra->seq_ahead != InvalidBlockNumber &&
+           ra->seq_ahead - blocknum <= PGLITE_READAHEAD_WINDOW)
+    {
+        int         submitted = pglite_readahead_submit(ra, reln, forknum, ra->seq_ahead, false);
+
+        if (submitted == PGLITE_READAHEAD_FULL)
+            break;
+
+        if (submitted == PGLITE_READAHEAD_PAST_END)
+        {
+            ra->seq_ahead = InvalidBlockNumber;
+            break;
+        }
+
+        ra->seq_ahead++;
+    }
+
+    pglite_readahead_flush(ra);
+}
+
+void
+pglite_md_read(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+               char *buffer)
+{
+    PgliteReadahead *ra = pglite_readahead_enabled ? pglite_readahead_get() : NULL;
+
+    if (ra == NULL)
+    {
+        mdread(reln, forknum, blocknum, buffer);
+        return;
+    }
+
+    if (!pglite_readahead_take(ra, reln, forknum, blocknum, buffer))
+        mdread(reln, forknum, blocknum, buffer);
+
+    pglite_readahead_follow(ra, reln, forknum, blocknum);
+}
+
+bool
+pglite_md_prefetch(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum)
+{
+    PgliteReadahead *ra = pglite_readahead_enabled ? pglite_readahead_get() : NULL;
+
+    if (ra == NULL)
+        return mdprefetch(reln, forknum, blocknum);
+
+    if (pglite_readahead_submit(ra, reln, forknum, blocknum, true) != PGLITE_READAHEAD_SUBMITTED)
+        return mdprefetch(reln, forknum, blocknum);
+
+    pglite_readahead_flush(ra);
+    return true;
+}
+
+void
+pglite_md_write(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+                char *buffer, bool skipFsync)
+{
+    pglite_readahead_write_begin(reln->smgr_rnode, forknum);
+    PG_TRY();
+    {
+        mdwrite(reln, forknum, blocknum, buffer, skipFsync);
+    }
+    PG_FINALLY();
+    {
+        pglite_readahead_write_end(reln->smgr_rnode, forknum);
+    }
+    PG_END_TRY();
+}
+
+void
+pglite_md_extend(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+                 char *buffer, bool skipFsync)
+{
+    pglite_readahead_write_begin(reln->smgr_rnode, forknum);
+    PG_TRY();
+    {
+        mdextend(reln, forknum, blocknum, buffer, skipFsync);
+    }
+    PG_FINALLY();
+    {
+        pglite_readahead_write_end(reln->smgr_rnode, forknum);
+    }
+    PG_END_TRY();
+}
+
+void
+pglite_md_truncate(SMgrRelation reln, ForkNumber forknum, BlockNumber nblocks)
+{
+    pglite_readahead_write_begin(reln->smgr_rnode, forknum);
+    PG_TRY();
+    {
+        mdtruncate(reln, forknum, nblocks);
+    }
+    PG_FINALLY();
+    {
+        pglite_readahead_write_end(reln->smgr_rnode, forknum);
+    }
+    PG_END_TRY();
+}
+
+void
+pglite_md_unlink(RelFileNodeBackend rnode, ForkNumber forknum, bool isRedo)
+{
+    ForkNumber  first = forknum == InvalidForkNumber ? 0 : forknum;
+    ForkNumber  last = forknum == InvalidForkNumber ? MAX_FORKNUM : forknum;
+
+    for (ForkNumber forkno = first; forkno <= last; forkno++)
+        pglite_readahead_write_begin(rnode, forkno);
+
+    PG_TRY();
+    {
+        mdunlink(rnode, forknum, isRedo);
+    }
+    PG_FINALLY();
+    {
+        for (ForkNumber forkno = first; forkno <= last; forkno++)
+            pglite_readahead_write_end(rnode, forkno);
+    }
+    PG_END_TRY();
+}
+
+/*
+ * Starts or stops reading ahead, for every thread
+ */
+void
+pglite_set_readahead(bool enabled)
+{
+    pglite_readahead_enabled = enabled;
+    pg_memory_barrier();
+}
@@ -0,0 +1,464 @@
+/*
+ * shared_catcache.c
+ *
+ * Catalog tuples shared by every backend thread of a cluster, so sessions
+ * over a large schema don't each read and keep a copy of the same tuples.
+ * Each backend keeps its own catcache.c entries, lists and refcounts, but
+ * an entry for a tuple found here points at the shared copy rather than
+ * holding one of its own, and keeps it alive until the entry goes. A miss
+ * here reads the catalog as usual and shares what it read.
+ *
+ * Tuples are keyed by cluster, database (none for shared catalogs), cache
+ * and hash value, and told apart by their keys. They're marked invalid by
+ * the same invalidations that clear the backends' own entries, in whichever
+ * backend processes one first, so a backend never finds here a tuple it has
+ * had an invalidation for. A tuple read before an invalidation but shared
+ * after it would be stale, so each cache has a generation every
+ * invalidation bumps, and a tuple is only shared if the generation hasn't
+ * moved since before the catalog snapshot it was read with was taken.
+ *
+ * Only backends whose transaction has no xid take part, so none has catalog
+ * changes of its own a shared tuple could hide or that it could share; and
+ * none during bootstrap or with a historic snapshot. Negative entries and
+ * lists stay per backend, as does the relcache.
+ */
+#include <postgres.h>
+
+#include <pthread.h>
+
+#include <access/htup_details.h>
+#include <access/xact.h>
+#include <miscadmin.h>
+#include <port/atomics.h>
+#include <storage/ipc.h>
+#include <storage/pg_shmem.h>
+#include <utils/catcache.h>
+#include <utils/snapmgr.h>
+#include <utils/syscache.h>
+
+#include "pglite.h"
+
+#define PGLITE_SHARED_CATCACHE_BUCKETS 8192
+
+/* tuples past this many aren't shared */
+#define PGLITE_SHARED_CATCACHE_MAX 65536
+
+/* tuples with the same hash looked at per lookup */
+#define PGLITE_SHARED_CATCACHE_CANDIDATES 4
+
+/* what a backend not taking part passes to pglite_shared_catcache_publish */
+#define PGLITE_NO_GENERATION PG_UINT64_MAX
+
+typedef struct PgliteSharedCatCTup
+{
+    /* the key */
+    void       *cluster;
+    Oid         database;
+    int         cacheid;
+    uint32      hash;
+
+    /* t_data is allocated along with this, and never changes */
+    HeapTupleData tuple;
+
+    pg_atomic_uint32 valid;
+    /* one for the table, and one for each backend's entry pointing here */
+    pg_atomic_uint32 refcount;
+
+    struct PgliteSharedCatCTup *next;
+} PgliteSharedCatCTup;
+
+#define PGLITE_SHARED_CATCTUP_SIZE MAXALIGN(sizeof(PgliteSharedCatCTup))
+
+static bool pglite_shared_catcache_enabled = false;
+
+static pthread_rwlock_t pglite_shared_catcache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static PgliteSharedCatCTup *pglite_shared_catcache[PGLITE_SHARED_CATCACHE_BUCKETS];
+static int  pglite_num_shared_catctups;
+
+/* bumped by every invalidation of each cache */
+static pg_atomic_uint64 pglite_shared_catcache_generations[SysCacheSize];
+
+/* the caches are being emptied as the backend exits, not invalidated */
+static __thread bool pglite_shared_catcache_exiting = false;
+
+static Oid
+pglite_shared_catcache_database(CatCache *cache)
+{
+    return cache->cc_relisshared ? InvalidOid : MyDatabaseId;
+}
+
+/*
+ * Whether this backend may use or share tuples, as things are now
+ */
+static bool
+pglite_shared_catcache_usable(void)
+{
+    return pglite_shared_catcache_enabled &&
+        !IsBootstrapProcessingMode() &&
+        !HistoricSnapshotActive() &&
+        !TransactionIdIsValid(GetTopTransactionIdIfAny());
+}
+
+static bool
+pglite_shared_catctup_of(PgliteSharedCatCTup *ctup, CatCache *cache)
+{
+    return ctup->cluster == UsedShmemSegAddr &&
+        ctup->database == pglite_shared_catcache_database(cache) &&
+        ctup->cacheid == cache->id;
+}
+
+static bool
+pglite_shared_catctup_keys_match(PgliteSharedCatCTup *ctup, CatCache *cache,
+                                 const Datum *arguments)
+{
+    for (int i = 0; i < cache->cc_nkeys; i++)
+    {
+        Datum       key;
+        bool        isnull;
+
+        key = heap_getattr(&ctup->tuple, cache->cc_keyno[i],
+                           cache->cc_tupdesc, &isnull);
+
+        if (isnull || !(cache->cc_fastequal[i]) (key, arguments[i]))
+            return false;
+    }
+
+    return true;
+}
+
+static void
+pglite_shared_catctup_release(PgliteSharedCatCTup *ctup)
+{
+    if (pg_atomic_sub_fetch_u32(&ctup->refcount, 1) == 0)
+        free(ctup);
+}
+
+static void
+pglite_shared_catctup_release_all(PgliteSharedCatCTup *ctups)
+{
+    while (ctups != NULL)
+    {
+        PgliteSharedCatCTup *ctup = ctups;
+
+        ctups = ctup->next;
+        pglite_shared_catctup_release(ctup);
+    }
+}
+
+/*
+ * Unlinks the invalid tuples in the chain at link onto *unlinked. Called
+ * with the lock held for writing.
+ */
+static void
+pglite_shared_catcache_unlink_invalid(PgliteSharedCatCTup **link,
+                                      PgliteSharedCatCTup **unlinked)
+{
+    while (*link != NULL)
+    {
+        PgliteSharedCatCTup *ctup = *link;
+
+        if (pg_atomic_read_u32(&ctup->valid))
+        {
+            link = &ctup->next;
+            continue;
+        }
+
+        *link = ctup->next;
+        ctup->next = *unlinked;
+        *unlinked = ctup;
+        pglite_num_shared_catctups--;
+    }
+}
+
+/*
+ * The shared tuple cache would read from its catalog for arguments, or
+ * NULL if there's none. A tuple found comes with a reference for
+ * pglite_shared_catcache_fill_entry to hand to the entry made for it. If
+ * there's none, *generation is set for pglite_shared_catcache_publish, and
+ * the catalog snapshot dropped so the read that follows takes a new one.
+ */
+HeapTuple
+pglite_shared_catcache_lookup(CatCache *cache, uint32 hashValue,
+                              const Datum *arguments, uint64 *generation)
+{
+    PgliteSharedCatCTup *candidates[PGLITE_SHARED_CATCACHE_CANDIDATES];
+    PgliteSharedCatCTup *found = NULL;
+    int         ncandidates = 0;
+
+    *generation = PGLITE_NO_GENERATION;
+
+    if (!pglite_shared_catcache_usable())
+        return NULL;
+
+    /* before anything is looked up, so nothing read after it is missed */
+    *generation = pg_atomic_read_u64(&pglite_shared_catcache_generations[cache->id]);
+    pg_memory_barrier();
+
+    pthread_rwlock_rdlock(&pglite_shared_catcache_lock);
+
+    for (PgliteSharedCatCTup *ctup = pglite_shared_catcache[hashValue % PGLITE_SHARED_CATCACHE_BUCKETS];
+         ctup != NULL && ncandidates < PGLITE_SHARED_CATCACHE_CANDIDATES;
+         ctup = ctup->next)
+    {
+        if (ctup->hash == hashValue &&
+            pglite_shared_catctup_of(ctup, cache) &&
+            pg_atomic_read_u32(&ctup->valid))
+        {
+            pg_atomic_fetch_add_u32(&ctup->refcount, 1);
+            candidates[ncandidates++] = ctup;
+        }
+    }
+
+    pthread_rwlock_unlock(&pglite_shared_catcache_lock);
+
+    /* keys are compared unlocked, as equality functions may allocate */
+    for (int i = 0; i < ncandidates; i++)
+    {
+        if (found == NULL &&
+            pglite_shared_catctup_keys_match(candidates[i], cache, arguments))
+            found = candidates[i];
+        else
+            pglite_shared_catctup_release(candidates[i]);
+    }
+
+    if (found != NULL)
+        return &found->tuple;
+
+    InvalidateCatalogSnapshot();
+
+    return NULL;
+}
+
+/*
+ * Turns ct, made by CatalogCacheCreateEntry as a negative entry for the
+ * tuple's keys, into a positive one for tuple, from
+ * pglite_shared_catcache_lookup. Its keys then point into the shared tuple,
+ * as those of an entry holding its own point into that.
+ */
+void
+pglite_shared_catcache_fill_entry(CatCTup *ct, HeapTuple tuple)
+{
+    CatCache   *cache = ct->my_cache;
+
+    for (int i = 0; i < cache->cc_nkeys; i++)
+    {
+        Form_pg_attribute att = TupleDescAttr(cache->cc_tupdesc,
+                                              cache->cc_keyno[i] - 1);
+        bool        isnull;
+
+        if (!att->attbyval)
+            pfree(DatumGetPointer(ct->keys[i]));
+
+        ct->keys[i] = heap_getattr(tuple, cache->cc_keyno[i],
+                                   cache->cc_tupdesc, &isnull);
+    }
+
+    ct->tuple = *tuple;
+    ct->negative = false;
+}
+
+/*
+ * Lets go of the shared tuple ct points at, if it's one, as ct is freed
+ */
+void
+pglite_shared_catcache_release_entry(CatCTup *ct)
+{
+    /* an entry holding its own tuple has it right after itself */
+    if (ct->negative ||
+        (char *) ct->tuple.t_data == (char *) MAXALIGN(((char *) ct) + sizeof(CatCTup)))
+        return;
+
+    pglite_shared_catctup_release((PgliteSharedCatCTup *)
+                                  ((char *) ct->tuple.t_data - PGLITE_SHARED_CATCTUP_SIZE));
+}
+
+/*
+ * Shares tuple, just read from cache's catalog for hashValue, unless the
+ * cache has been invalidated since generation was read
+ */
+void
+pglite_shared_catcache_publish(CatCache *cache, uint32 hashValue,
+                               HeapTuple tuple, uint64 generation)
+{
+    pg_atomic_uint64 *current = &pglite_shared_catcache_generations[cache->id];
+    PgliteSharedCatCTup *ctup;
+    PgliteSharedCatCTup *unlinked = NULL;
+    PgliteSharedCatCTup **link;
+
+    if (generation == PGLITE_NO_GENERATION ||
+        !pglite_shared_catcache_enabled ||
+        pg_atomic_read_u64(current) != generation)
+        return;
+
+    ctup = malloc(PGLITE_SHARED_CATCTUP_SIZE + tuple->t_len);
+    if (ctup == NULL)
+        return;
+
+    ctup->cluster = UsedShmemSegAddr;
+    ctup->database = pglite_shared_catcache_database(cache);
+    ctup->cacheid = cache->id;
+    ctup->hash = hashValue;
+    ctup->tuple = *tuple;
+    ctup->tuple.t_data = (HeapTupleHeader) ((char *) ctup + PGLITE_SHARED_CATCTUP_SIZE);
+    memcpy(ctup->tuple.t_data, tuple->t_data, tuple->t_len);
+    pg_atomic_init_u32(&ctup->valid, 1);
+    pg_atomic_init_u32(&ctup->refcount, 1);
+
+    pthread_rwlock_wrlock(&pglite_shared_catcache_lock);
+
+    link = &pglite_shared_catcache[hashValue % PGLITE_SHARED_CATCACHE_BUCKETS];
+    pglite_shared_catcache_unlink_invalid(link, &unlinked);
+
+    if (pglite_num_shared_catctups >= PGLITE_SHARED_CATCACHE_MAX)
+    {
+        for (int i = 0; i < PGLITE_SHARED_CATCACHE_BUCKETS; i++)
+            pglite_shared_catcache_unlink_invalid(&pglite_shared_catcache[i], &unlinked);
+    }
+
+    /* an invalidation bumps the generation before it marks tuples */
+    if (pg_atomic_read_u64(current) == generation &&
+        pglite_num_shared_catctups < PGLITE_SHARED_CATCACHE_MAX)
+    {
+        /* the same version of the same tuple, shared by another backend */
+        while (*link != NULL &&
+               !(pglite_shared_catctup_of(*link, cache) &&
+                 ItemPointerEquals(&(*link)->tuple.t_self, &tuple->t_self)))
+            link = &(*link)->next;
+
+        if (*link == NULL)
+        {
+            *link = ctup;
+            pglite_num_shared_catctups++;
+            ctup = NULL;
+        }
+    }
+
+    pthread_rwlock_unlock(&pglite_shared_catcache_lock);
+
+    pglite_shared_catctup_release_all(unlinked);
+
+    if (ctup != NULL)
+        free(ctup);
+}
+
+/*
+ * Marks invalid this cluster and database's tuples of cache, those with
+ * hashValue or all of them
+ */
+static void
+pglite_shared_catcache_mark(CatCache *cache, uint32 hashValue, bool all)
+{
+    int         first = all ? 0 : hashValue % PGLITE_SHARED_CATCACHE_BUCKETS;
+    int         last = all ? PGLITE_SHARED_CATCACHE_BUCKETS - 1 : first;
+
+    /* first, so a tuple read before this can't be shared after it */
+    pg_atomic_fetch_add_u64(&pglite_shared_catcache_generations[cache->id], 1);
+
+    /* even with sharing off, as a tuple may be shared just as it goes off */
+    pthread_rwlock_rdlock(&pglite_shared_catcache_lock);
+
+    for (int i = first; i <= last && pglite_num_shared_catctups > 0; i++)
+    {
+        for (PgliteSharedCatCTup *ctup = pglite_shared_catcache[i];
+             ctup != NULL;
+             ctup = ctup->next)
+        {
+            if ((all || ctup->hash == hashValue) &&
+                pglite_shared_catctup_of(ctup, cache))
+                pg_atomic_write_u32(&ctup->valid, 0);
+        }
+    }
+
+    pthread_rwlock_unlock(&pglite_shared_catcache_lock);
+}
+
+/*
+ * Called by CatCacheInvalidate
+ */
+void
+pglite_shared_catcache_invalidate(CatCache *cache, uint32 hashValue)
+{
+    pglite_shared_catcache_mark(cache, hashValue, false);
+}
+
+/*
+ * Called by ResetCatalogCache. A backend that overflowed the invalidation
+ * queue resets its caches rather than process the messages it missed, so
+ * the shared tuples of the cache have to go with them.
+ */
+void
+pglite_shared_catcache_reset(CatCache *cache)
+{
+    if (!pglite_shared_catcache_exiting)
+        pglite_shared_catcache_mark(cache, 0, true);
+}
+
+static void
+pglite_shared_catcache_exit(int code, Datum arg)
+{
+    /* each entry lets go of its shared tuple as it's removed */
+    pglite_shared_catcache_exiting = true;
+    ResetCatalogCaches();
+    pglite_shared_catcache_exiting = false;
+}
+
+/*
+ * Readies this backend to let go of the shared tuples its entries point at
+ * when it exits, rather than along with its memory
+ */
+void
+pglite_shared_catcache_init_backend(void)
+{
+    on_shmem_exit(pglite_shared_catcache_exit, 0);
+}
+
+/*
+ * Drops the tuples of the cluster whose shared memory is at cluster, or of
+ * every cluster if NULL. Tuples backends' entries point at go once those
+ * entries do.
+ */
+void
+pglite_forget_shared_catcache(void *cluster)
+{
+    PgliteSharedCatCTup *forgotten = NULL;
+
+    pthread_rwlock_wrlock(&pglite_shared_catcache_lock);
+
+    for (int i = 0; i < PGLITE_SHARED_CATCACHE_BUCKETS; i++)
+    {
+        PgliteSharedCatCTup **link = &pglite_shared_catcache[i];
+
+        while (*link != NULL)
+        {
+            PgliteSharedCatCTup *ctup = *link;
+
+            if (cluster == NULL || ctup->cluster == cluster)
+            {
+                *link = ctup->next;
+                ctup->next = forgotten;
+                forgotten = ctup;
+                pglite_num_shared_catctups--;
+            }
+            else
+                link = &ctup->next;
+        }
+    }
+
+    pthread_rwlock_unlock(&pglite_shared_catcache_lock);
+
+    pglite_shared_catctup_release_all(forgotten);
+}
+
+/*
+ * Starts or stops sharing catalog tuples, for every cluster in the process.
+ * Tuples already shared are dropped on stopping, as nothing uses them.
+ */
+void
+pglite_set_shared_catcache(bool enabled)
+{
+    pglite_shared_catcache_enabled = enabled;
+    pg_memory_barrier();
+
+    if (!enabled)
+        pglite_forget_shared_catcache(NULL);
+}
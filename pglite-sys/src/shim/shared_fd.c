@@ -0,0 +1,581 @@
+/*
+ * shared_fd.c
+ *
+ * Descriptors of relation segments shared by every backend thread of the
+ * process. fd.c keeps a virtual fd per open file in each backend, with an
+ * LRU of kernel descriptors sized as if each backend had RLIMIT_NOFILE to
+ * itself; backend threads all share the one limit, and each opens the same
+ * segments again. prepare-postgres.sh has fd.c open and close its virtual
+ * fds' descriptors through here instead, so that a segment is open once for
+ * all threads, whichever of them have it in their LRU, and stays open a
+ * while after the last lets it go in case another wants it.
+ *
+ * Descriptors are counted references, found by the segment's path, which
+ * names its relfilenode, fork and segment number. fd.c only reads and
+ * writes them with pread and pwrite, and only ever lseeks them to their
+ * end, so threads can share them as they are. Only relation segments of the
+ * data directory, opened read-write and without O_CREAT, as md.c opens
+ * them, are shared; fd.c's other files are opened as they would be.
+ *
+ * A segment unlinked or renamed over is forgotten, by fs.c, so that a
+ * relfilenode used again later isn't read through a descriptor of the file
+ * it had before. Threads that still have the old one keep it until they
+ * close it.
+ */
+#include <postgres.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <common/hashfn.h>
+#include <miscadmin.h>
+#include <port/atomics.h>
+#include <storage/fd.h>
+
+#include "pglite.h"
+
+#define PGLITE_SHARED_FD_BUCKETS 16384
+
+typedef struct PgliteSharedFd
+{
+    /* DataDir and the path relative to it */
+    char       *key;
+    uint32      hash;
+    int         fd;
+    int         refcount;
+    /* unlinked or renamed over, so closed once no thread has it */
+    bool        forgotten;
+    struct PgliteSharedFd *next;
+    /* the idle list, of those no thread has, least recently used first */
+    struct PgliteSharedFd *idle_prev;
+    struct PgliteSharedFd *idle_next;
+} PgliteSharedFd;
+
+/* what this thread has of the cache, let go of when it exits */
+typedef struct PgliteSharedFdRefs
+{
+    PgliteSharedFd **held;
+    int         count;
+    int         max;
+} PgliteSharedFdRefs;
+
+bool        pglite_shared_fds_enabled = false;
+
+/* shared by every thread, unlike the globals of the backend */
+static pthread_mutex_t pglite_shared_fd_lock = PTHREAD_MUTEX_INITIALIZER;
+static PgliteSharedFd *pglite_shared_fd_buckets[PGLITE_SHARED_FD_BUCKETS];
+/* by descriptor, NULL where it's not one of ours */
+static PgliteSharedFd **pglite_shared_fd_by_fd;
+static int  pglite_shared_fd_by_fd_size;
+static PgliteSharedFd *pglite_idle_head;
+static PgliteSharedFd *pglite_idle_tail;
+/* descriptors kept open, past which idle ones are closed */
+static int  pglite_shared_fd_max;
+/* bumped as paths are forgotten, for opens that raced with it */
+static uint64 pglite_shared_fd_forgets;
+static PgliteSharedFdStats pglite_shared_fd_stats_now;
+/* descriptors in the cache, and being opened for it */
+static pg_atomic_uint32 pglite_shared_fd_count;
+
+static pthread_once_t pglite_shared_fd_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pglite_shared_fd_key;
+
+static __thread PgliteSharedFdRefs *pglite_shared_fd_refs;
+
+/*
+ * Whether `path` is a segment of a relation that isn't temporary: a
+ * relfilenode under global, base or a tablespace, with an optional fork
+ * name and segment number
+ */
+static bool
+pglite_shared_fd_relation(const char *path)
+{
+    const char *p = path;
+    size_t      len;
+
+    if (strncmp(p, "global/", 7) == 0)
+        p += 7;
+    else
+    {
+        if (strncmp(p, "base/", 5) == 0)
+            p += 5;
+        else if (strncmp(p, "pg_tblspc/", 10) == 0)
+        {
+            /* the tablespace and its version directory */
+            p += 10 + strspn(p + 10, "0123456789");
+            if (*p++ != '/' || (p = strchr(p, '/')) == NULL)
+                return false;
+            p++;
+        }
+        else
+            return false;
+
+        /* the database */
+        len = strspn(p, "0123456789");
+        if (len == 0 || p[len] != '/')
+            return false;
+        p += len + 1;
+    }
+
+    len = strspn(p, "0123456789");
+    if (len == 0)
+        return false;
+    p += len;
+
+    if (strncmp(p, "_fsm", 4) == 0)
+        p += 4;
+    else if (strncmp(p, "_vm", 3) == 0)
+        p += 3;
+    else if (strncmp(p, "_init", 5) == 0)
+        p += 5;
+
+    if (*p == '.')
+    {
+        len = strspn(p + 1, "0123456789");
+        if (len == 0)
+            return false;
+        p += 1 + len;
+    }
+
+    return *p == '\0';
+}
+
+/*
+ * The key of `path`, in `buf`, or false if it's too long for it
+ */
+static bool
+pglite_shared_fd_key_of(const char *path, char *buf, size_t size)
+{
+    return DataDir != NULL &&
+        snprintf(buf, size, "%s/%s", DataDir, path) < size;
+}
+
+static PgliteSharedFd **
+pglite_shared_fd_slot(const char *key, uint32 hash)
+{
+    PgliteSharedFd **slot = &pglite_shared_fd_buckets[hash % PGLITE_SHARED_FD_BUCKETS];
+
+    while (*slot != NULL && ((*slot)->hash != hash || strcmp((*slot)->key, key) != 0))
+        slot = &(*slot)->next;
+
+    return slot;
+}
+
+static void
+pglite_idle_push(PgliteSharedFd *entry)
+{
+    entry->idle_prev = pglite_idle_tail;
+    entry->idle_next = NULL;
+
+    if (pglite_idle_tail != NULL)
+        pglite_idle_tail->idle_next = entry;
+    else
+        pglite_idle_head = entry;
+    pglite_idle_tail = entry;
+}
+
+static void
+pglite_idle_remove(PgliteSharedFd *entry)
+{
+    if (entry->idle_prev != NULL)
+        entry->idle_prev->idle_next = entry->idle_next;
+    else
+        pglite_idle_head = entry->idle_next;
+
+    if (entry->idle_next != NULL)
+        entry->idle_next->idle_prev = entry->idle_prev;
+    else
+        pglite_idle_tail = entry->idle_prev;
+
+    entry->idle_prev = entry->idle_next = NULL;
+}
+
+/*
+ * Takes the entry out of the cache, returning its descriptor for the
+ * caller to close once it has unlocked. Must be idle or forgotten.
+ */
+static int
+pglite_shared_fd_remove(PgliteSharedFd *entry)
+{
+    int         fd = entry->fd;
+
+    if (!entry->forgotten)
+        *pglite_shared_fd_slot(entry->key, entry->hash) = entry->next;
+
+    pglite_shared_fd_by_fd[fd] = NULL;
+    pg_atomic_sub_fetch_u32(&pglite_shared_fd_count, 1);
+    pglite_shared_fd_stats_now.open--;
+
+    free(entry->key);
+    free(entry);
+
+    return fd;
+}
+
+/*
+ * Closes idle descriptors, least recently used first, until no more than
+ * `keep` are open. Must be called locked; the descriptors closed are put in
+ * `fds` for closing once unlocked, up to `max` of them.
+ */
+static int
+pglite_shared_fd_evict(uint64 keep, int *fds, int max)
+{
+    int         n = 0;
+
+    while (n < max && pglite_idle_head != NULL &&
+           pglite_shared_fd_stats_now.open > keep)
+    {
+        PgliteSharedFd *entry = pglite_idle_head;
+
+        pglite_idle_remove(entry);
+        fds[n++] = pglite_shared_fd_remove(entry);
+        pglite_shared_fd_stats_now.evictions++;
+    }
+
+    return n;
+}
+
+static int pglite_shared_fd_release(PgliteSharedFdRefs *refs, int fd);
+
+static void
+pglite_shared_fd_thread_exit(void *arg)
+{
+    PgliteSharedFdRefs *refs = arg;
+
+    /* the virtual fds of an exiting thread aren't closed */
+    while (refs->count > 0)
+        pglite_shared_fd_release(refs, refs->held[refs->count - 1]->fd);
+
+    pglite_shared_fd_refs = NULL;
+    free(refs->held);
+    free(refs);
+}
+
+static void
+pglite_shared_fd_init(void)
+{
+    struct rlimit rlim;
+
+    pthread_key_create(&pglite_shared_fd_key, pglite_shared_fd_thread_exit);
+
+    /* half the limit, leaving the rest to fd.c's other files and threads */
+    if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_cur != RLIM_INFINITY)
+        pglite_shared_fd_max = Max(rlim.rlim_cur / 2, 64);
+    else
+        pglite_shared_fd_max = 4096;
+}
+
+/*
+ * This thread's references, with room for one more, or NULL if out of
+ * memory
+ */
+static PgliteSharedFdRefs *
+pglite_shared_fd_get_refs(void)
+{
+    PgliteSharedFdRefs *refs = pglite_shared_fd_refs;
+
+    if (refs == NULL)
+    {
+        refs = calloc(1, sizeof(PgliteSharedFdRefs));
+        if (refs == NULL)
+            return NULL;
+
+        pthread_setspecific(pglite_shared_fd_key, refs);
+        pglite_shared_fd_refs = refs;
+    }
+
+    if (refs->count == refs->max)
+    {
+        int         max = Max(refs->max * 2, 64);
+        PgliteSharedFd **held = realloc(refs->held, sizeof(PgliteSharedFd *) * max);
+
+        if (held == NULL)
+            return NULL;
+
+        refs->held = held;
+        refs->max = max;
+    }
+
+    return refs;
+}
+
+/*
+ * Makes room in the by-descriptor index for `fd`. Must be called locked.
+ */
+static bool
+pglite_shared_fd_index(int fd)
+{
+    int         size = pglite_shared_fd_by_fd_size;
+    PgliteSharedFd **by_fd;
+
+    if (fd < size)
+        return true;
+
+    size = Max(size, 1024);
+    while (size <= fd)
+        size *= 2;
+
+    by_fd = realloc(pglite_shared_fd_by_fd, sizeof(PgliteSharedFd *) * size);
+    if (by_fd == NULL)
+        return false;
+
+    memset(by_fd + pglite_shared_fd_by_fd_size, 0,
+           sizeof(PgliteSharedFd *) * (size - pglite_shared_fd_by_fd_size));
+
+    pglite_shared_fd_by_fd = by_fd;
+    pglite_shared_fd_by_fd_size = size;
+    return true;
+}
+
+/*
+ * Takes a reference to the entry for this thread. Must be called locked,
+ * with room for it in `refs`.
+ */
+static int
+pglite_shared_fd_ref(PgliteSharedFd *entry, PgliteSharedFdRefs *refs)
+{
+    if (entry->refcount++ == 0)
+        pglite_idle_remove(entry);
+
+    refs->held[refs->count++] = entry;
+    return entry->fd;
+}
+
+/*
+ * Opens the file of a virtual fd, in place of fd.c's BasicOpenFilePerm:
+ * a relation segment's descriptor is shared by every thread that has it
+ * open, and others are opened for this thread alone. Either is given back
+ * with pglite_vfd_close.
+ */
+int
+pglite_vfd_open(const char *path, int flags, mode_t mode)
+{
+    char        key[MAXPGPATH * 2];
+    uint32      hash;
+    PgliteSharedFdRefs *refs;
+    PgliteSharedFd **slot;
+    PgliteSharedFd *entry;
+    uint64      forgets;
+    int         evicted[16];
+    int         nevicted;
+    int         fd;
+
+    if (!pglite_shared_fds_enabled ||
+        (flags & ~O_CLOEXEC) != (O_RDWR | PG_BINARY) ||
+        !pglite_shared_fd_relation(path) ||
+        !pglite_shared_fd_key_of(path, key, sizeof(key)))
+        return BasicOpenFilePerm(path, flags, mode);
+
+    pthread_once(&pglite_shared_fd_once, pglite_shared_fd_init);
+
+    refs = pglite_shared_fd_get_refs();
+    if (refs == NULL)
+        return BasicOpenFilePerm(path, flags, mode);
+
+    hash = hash_bytes((const unsigned char *) key, strlen(key));
+
+    pthread_mutex_lock(&pglite_shared_fd_lock);
+
+    pglite_shared_fd_stats_now.opens++;
+
+    slot = pglite_shared_fd_slot(key, hash);
+    if (*slot != NULL)
+    {
+        pglite_shared_fd_stats_now.hits++;
+        fd = pglite_shared_fd_ref(*slot, refs);
+
+        pthread_mutex_unlock(&pglite_shared_fd_lock);
+        return fd;
+    }
+
+    /* make room for the one about to be opened */
+    nevicted = pglite_shared_fd_evict(pglite_shared_fd_max - 1,
+                                      evicted, lengthof(evicted));
+    forgets = pglite_shared_fd_forgets;
+    /* so that forgetting the path meanwhile knows to tell */
+    pg_atomic_add_fetch_u32(&pglite_shared_fd_count, 1);
+
+    pthread_mutex_unlock(&pglite_shared_fd_lock);
+
+    for (int i = 0; i < nevicted; i++)
+        close(evicted[i]);
+
+    fd = BasicOpenFilePerm(path, flags, mode);
+
+    entry = fd < 0 ? NULL : calloc(1, sizeof(PgliteSharedFd));
+    if (entry == NULL || (entry->key = strdup(key)) == NULL)
+    {
+        pg_atomic_sub_fetch_u32(&pglite_shared_fd_count, 1);
+        free(entry);
+        return fd;
+    }
+
+    entry->hash = hash;
+    entry->fd = fd;
+
+    pthread_mutex_lock(&pglite_shared_fd_lock);
+
+    slot = pglite_shared_fd_slot(key, hash);
+
+    /*
+     * Another thread opened it meanwhile, or it was forgotten, maybe before
+     * this was opened: this thread keeps its descriptor to itself
+     */
+    if (*slot != NULL || forgets != pglite_shared_fd_forgets ||
+        !pglite_shared_fd_index(fd))
+    {
+        pg_atomic_sub_fetch_u32(&pglite_shared_fd_count, 1);
+        pthread_mutex_unlock(&pglite_shared_fd_lock);
+
+        free(entry->key);
+        free(entry);
+        return fd;
+    }
+
+    *slot = entry;
+    pglite_shared_fd_by_fd[fd] = entry;
+    pglite_shared_fd_stats_now.open++;
+
+    entry->refcount = 1;
+    refs->held[refs->count++] = entry;
+
+    pthread_mutex_unlock(&pglite_shared_fd_lock);
+
+    return fd;
+}
+
+/*
+ * Gives back `fd` for the thread whose references `refs` are, NULL if it
+ * has none
+ */
+static int
+pglite_shared_fd_release(PgliteSharedFdRefs *refs, int fd)
+{
+    PgliteSharedFd *entry;
+    int         evicted[16];
+    int         nevicted = 0;
+
+    if (refs == NULL || pg_atomic_read_u32(&pglite_shared_fd_count) == 0)
+        return close(fd);
+
+    pthread_mutex_lock(&pglite_shared_fd_lock);
+
+    entry = fd < pglite_shared_fd_by_fd_size ? pglite_shared_fd_by_fd[fd] : NULL;
+    if (entry == NULL)
+    {
+        pthread_mutex_unlock(&pglite_shared_fd_lock);
+        return close(fd);
+    }
+
+    for (int i = refs->count - 1; i >= 0; i--)
+    {
+        if (refs->held[i] == entry)
+        {
+            refs->held[i] = refs->held[--refs->count];
+            break;
+        }
+    }
+
+    if (--entry->refcount > 0)
+    {
+        pthread_mutex_unlock(&pglite_shared_fd_lock);
+        return 0;
+    }
+
+    if (entry->forgotten)
+    {
+        fd = pglite_shared_fd_remove(entry);
+        pthread_mutex_unlock(&pglite_shared_fd_lock);
+        return close(fd);
+    }
+
+    pglite_idle_push(entry);
+    nevicted = pglite_shared_fd_evict(pglite_shared_fd_max,
+                                      evicted, lengthof(evicted));
+
+    pthread_mutex_unlock(&pglite_shared_fd_lock);
+
+    for (int i = 0; i < nevicted; i++)
+        close(evicted[i]);
+
+    return 0;
+}
+
+/*
+ * Gives back a descriptor of pglite_vfd_open, in place of close(2). One of
+ * a shared segment is kept open for other threads, idle if none has it,
+ * until the cache needs the room or the segment is forgotten.
+ */
+int
+pglite_vfd_close(int fd)
+{
+    return pglite_shared_fd_release(pglite_shared_fd_refs, fd);
+}
+
+/*
+ * Forgets the descriptor of `path`, unlinked or renamed over, if there is
+ * one. Threads that have it keep it until they close it.
+ */
+void
+pglite_shared_fd_forget(const char *path)
+{
+    char        key[MAXPGPATH * 2];
+    uint32      hash;
+    PgliteSharedFd **slot;
+    PgliteSharedFd *entry;
+    int         fd = -1;
+
+    /* after the unlink or rename, as opens of the path are counted before */
+    pg_memory_barrier();
+
+    if (pg_atomic_read_u32(&pglite_shared_fd_count) == 0 ||
+        !pglite_shared_fd_relation(path) ||
+        !pglite_shared_fd_key_of(path, key, sizeof(key)))
+        return;
+
+    hash = hash_bytes((const unsigned char *) key, strlen(key));
+
+    pthread_mutex_lock(&pglite_shared_fd_lock);
+
+    pglite_shared_fd_forgets++;
+
+    slot = pglite_shared_fd_slot(key, hash);
+    entry = *slot;
+    if (entry != NULL)
+    {
+        *slot = entry->next;
+        entry->forgotten = true;
+
+        if (entry->refcount == 0)
+        {
+            pglite_idle_remove(entry);
+            fd = pglite_shared_fd_remove(entry);
+        }
+    }
+
+    pthread_mutex_unlock(&pglite_shared_fd_lock);
+
+    if (fd >= 0)
+        close(fd);
+}
+
+/*
+ * Starts or stops sharing descriptors of segments opened from now on.
+ * Those already shared stay so until closed.
+ */
+void
+pglite_set_shared_fds(bool enabled)
+{
+    pglite_shared_fds_enabled = enabled;
+    pg_memory_barrier();
+}
+
+void
+pglite_shared_fd_stats(PgliteSharedFdStats *stats)
+{
+    pthread_mutex_lock(&pglite_shared_fd_lock);
+    *stats = pglite_shared_fd_stats_now;
+    pthread_mutex_unlock(&pglite_shared_fd_lock);
+}
@@ -0,0 +1,498 @@
+/*
+ * shared_plan.c
+ *
+ * Generic plans shared by every backend thread of a cluster, so sessions
+ * running the same statements plan them once between them rather than once
+ * each. Backends are threads of one process, so a plan copied out of one
+ * backend's memory can be run as it is by any other: the executor doesn't
+ * scribble on plan trees, which is what lets plancache.c reuse them.
+ *
+ * Plans are keyed by query text, parameter types, search_path, role,
+ * database and cluster.
+ * A backend that can't find one plans as usual and shares the generic plan
+ * if plancache.c chose one. Like plancache.c's, a shared plan is checked
+ * again once the locks it needs are taken, and marked invalid by relcache
+ * and syscache callbacks, which every backend registers as it starts so
+ * that sharing can be turned on at any time. Whichever backend processes
+ * an invalidation first marks the plan for all of them.
+ *
+ * Only statements run outside a transaction block take part, so no plan is
+ * made from, or run against, catalog changes still uncommitted; and only in
+ * sessions without temporary tables, which could hide a table a shared plan
+ * names. Row security policies are planned per session too.
+ */
+#include <postgres.h>
+
+#include <pthread.h>
+
+#include <access/xact.h>
+#include <catalog/namespace.h>
+#include <common/hashfn.h>
+#include <miscadmin.h>
+#include <nodes/plannodes.h>
+#include <port/atomics.h>
+#include <storage/lmgr.h>
+#include <storage/pg_shmem.h>
+#include <utils/inval.h>
+#include <utils/memutils.h>
+#include <utils/plancache.h>
+#include <utils/syscache.h>
+
+#include "pglite.h"
+
+#define PGLITE_SHARED_PLAN_BUCKETS 1024
+
+/* plans past this many aren't shared */
+#define PGLITE_SHARED_PLANS_MAX 4096
+
+struct PgliteSharedPlan
+{
+    /* the key */
+    void       *cluster;
+    Oid         database;
+    Oid         role;
+    char       *search_path;
+    char       *query_string;
+    int         num_params;
+    Oid        *param_types;
+    uint32      hash;
+
+    /* owns this, and is deleted with the last reference */
+    MemoryContext context;
+    List       *stmt_list;
+    /* what the plan depends on, as in its PlannedStmts */
+    List       *relationOids;
+    List       *invalItems;
+
+    pg_atomic_uint32 valid;
+    /* one for the table, and one for each backend running it */
+    pg_atomic_uint32 refcount;
+
+    struct PgliteSharedPlan *next;
+};
+
+bool        pglite_shared_plans_enabled = false;
+
+static pthread_rwlock_t pglite_shared_plans_lock = PTHREAD_RWLOCK_INITIALIZER;
+static PgliteSharedPlan *pglite_shared_plans[PGLITE_SHARED_PLAN_BUCKETS];
+static int  pglite_num_shared_plans;
+
+static uint32
+pglite_shared_plan_hash(const char *query_string, int num_params,
+                        const Oid *param_types, const char *search_path,
+                        Oid role)
+{
+    uint32      hash;
+
+    hash = hash_bytes((const unsigned char *) query_string, strlen(query_string));
+    if (num_params > 0)
+        hash = hash_combine(hash, hash_bytes((const unsigned char *) param_types,
+                                             num_params * sizeof(Oid)));
+    hash = hash_combine(hash, hash_bytes((const unsigned char *) search_path,
+                                         strlen(search_path)));
+    hash = hash_combine(hash, hash_bytes((const unsigned char *) &role,
+                                         sizeof(role)));
+    hash = hash_combine(hash, hash_bytes((const unsigned char *) &MyDatabaseId,
+                                         sizeof(MyDatabaseId)));
+
+    return hash;
+}
+
+static bool
+pglite_shared_plan_matches(PgliteSharedPlan *plan, uint32 hash,
+                           const char *query_string, int num_params,
+                           const Oid *param_types, const char *search_path,
+                           Oid role)
+{
+    return plan->hash == hash &&
+        plan->cluster == UsedShmemSegAddr &&
+        plan->database == MyDatabaseId &&
+        plan->role == role &&
+        plan->num_params == num_params &&
+        (num_params == 0 ||
+         memcmp(plan->param_types, param_types, num_params * sizeof(Oid)) == 0) &&
+        strcmp(plan->search_path, search_path) == 0 &&
+        strcmp(plan->query_string, query_string) == 0;
+}
+
+/*
+ * Whether plansource may use or share a plan, as run now
+ */
+static bool
+pglite_shared_plan_usable(CachedPlanSource *plansource)
+{
+    Oid         temp_namespace;
+    Oid         temp_toast_namespace;
+
+    if (!pglite_shared_plans_enabled ||
+        plan_cache_mode == PLAN_CACHE_MODE_FORCE_CUSTOM_PLAN ||
+        plansource->is_oneshot ||
+        plansource->dependsOnRLS ||
+        IsTransactionBlock())
+        return false;
+
+    GetTempNamespaceState(&temp_namespace, &temp_toast_namespace);
+
+    return !OidIsValid(temp_namespace);
+}
+
+static void
+pglite_shared_plan_release_all(PgliteSharedPlan *plans)
+{
+    while (plans != NULL)
+    {
+        PgliteSharedPlan *plan = plans;
+
+        plans = plan->next;
+        pglite_shared_plan_release(plan);
+    }
+}
+
+/*
+ * Marks invalid this cluster's plans that depend on relid, or all of them
+ * if it's InvalidOid
+ */
+static void
+pglite_shared_plan_rel_callback(Datum arg, Oid relid)
+{
+    /* nothing is shared, or was forgotten when sharing stopped */
+    if (!pglite_shared_plans_enabled)
+        return;
+
+    pthread_rwlock_rdlock(&pglite_shared_plans_lock);
+
+    for (int i = 0; i < PGLITE_SHARED_PLAN_BUCKETS; i++)
+    {
+        for (PgliteSharedPlan *plan = pglite_shared_plans[i];
+             plan != NULL;
+             plan = plan->next)
+        {
+            if (plan->cluster != UsedShmemSegAddr)
+                continue;
+
+            if (!OidIsValid(relid) || list_member_oid(plan->relationOids, relid))
+                pg_atomic_write_u32(&plan->valid, 0);
+        }
+    }
+
+    pthread_rwlock_unlock(&pglite_shared_plans_lock);
+}
+
+/*
+ * Marks invalid this cluster's plans that depend on a function or type, as
+ * PlanCacheObjectCallback does
+ */
+static void
+pglite_shared_plan_object_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+    ListCell   *lc;
+
+    if (!pglite_shared_plans_enabled)
+        return;
+
+    pthread_rwlock_rdlock(&pglite_shared_plans_lock);
+
+    for (int i = 0; i < PGLITE_SHARED_PLAN_BUCKETS; i++)
+    {
+        for (PgliteSharedPlan *plan = pglite_shared_plans[i];
+             plan != NULL;
+             plan = plan->next)
+        {
+            if (plan->cluster != UsedShmemSegAddr)
+                continue;
+
+            foreach(lc, plan->invalItems)
+            {
+                PlanInvalItem *item = (PlanInvalItem *) lfirst(lc);
+
+                if (item->cacheId == cacheid &&
+                    (hashvalue == 0 || item->hashValue == hashvalue))
+                {
+                    pg_atomic_write_u32(&plan->valid, 0);
+                    break;
+                }
+            }
+        }
+    }
+
+    pthread_rwlock_unlock(&pglite_shared_plans_lock);
+}
+
+/*
+ * Marks all of this cluster's plans invalid, as PlanCacheSysCallback does
+ */
+static void
+pglite_shared_plan_sys_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+    pglite_shared_plan_rel_callback(arg, InvalidOid);
+}
+
+/*
+ * Registers this backend's invalidation callbacks. Called at startup, before
+ * InitPostgres, by every backend whether or not plans are being shared yet,
+ * so that no invalidation a backend processes is missed once they are.
+ */
+void
+pglite_shared_plan_init_backend(void)
+{
+    CacheRegisterRelcacheCallback(pglite_shared_plan_rel_callback, (Datum) 0);
+    CacheRegisterSyscacheCallback(PROCOID, pglite_shared_plan_object_callback, (Datum) 0);
+    CacheRegisterSyscacheCallback(TYPEOID, pglite_shared_plan_object_callback, (Datum) 0);
+    CacheRegisterSyscacheCallback(NAMESPACEOID, pglite_shared_plan_sys_callback, (Datum) 0);
+    CacheRegisterSyscacheCallback(OPEROID, pglite_shared_plan_sys_callback, (Datum) 0);
+    CacheRegisterSyscacheCallback(AMOPOPID, pglite_shared_plan_sys_callback, (Datum) 0);
+    CacheRegisterSyscacheCallback(FOREIGNSERVEROID, pglite_shared_plan_sys_callback, (Datum) 0);
+    CacheRegisterSyscacheCallback(FOREIGNDATAWRAPPEROID, pglite_shared_plan_sys_callback, (Datum) 0);
+}
+
+/*
+ * Takes the locks running stmt_list needs, as AcquireExecutorLocks does.
+ * Taking them processes any invalidations that came in meanwhile.
+ */
+static void
+pglite_shared_plan_lock_relations(List *stmt_list)
+{
+    ListCell   *lc1;
+    ListCell   *lc2;
+
+    foreach(lc1, stmt_list)
+    {
+        PlannedStmt *stmt = lfirst_node(PlannedStmt, lc1);
+
+        foreach(lc2, stmt->rtable)
+        {
+            RangeTblEntry *rte = (RangeTblEntry *) lfirst(lc2);
+
+            if (rte->rtekind == RTE_RELATION)
+                LockRelationOid(rte->relid, rte->rellockmode);
+        }
+    }
+}
+
+/*
+ * The valid shared plan for plansource, as run now, or NULL if there's none.
+ * The plan's locks are taken, and it's kept until passed to
+ * pglite_shared_plan_release.
+ */
+PgliteSharedPlan *
+pglite_shared_plan_lookup(CachedPlanSource *plansource)
+{
+    PgliteSharedPlan *plan;
+    Oid         role = GetUserId();
+    uint32      hash;
+
+    if (!pglite_shared_plan_usable(plansource))
+        return NULL;
+
+    hash = pglite_shared_plan_hash(plansource->query_string,
+                                   plansource->num_params,
+                                   plansource->param_types,
+                                   namespace_search_path, role);
+
+    pthread_rwlock_rdlock(&pglite_shared_plans_lock);
+
+    for (plan = pglite_shared_plans[hash % PGLITE_SHARED_PLAN_BUCKETS];
+         plan != NULL;
+         plan = plan->next)
+    {
+        if (pglite_shared_plan_matches(plan, hash, plansource->query_string,
+                                       plansource->num_params,
+                                       plansource->param_types,
+                                       namespace_search_path, role) &&
+            pg_atomic_read_u32(&plan->valid))
+        {
+            pg_atomic_fetch_add_u32(&plan->refcount, 1);
+            break;
+        }
+    }
+
+    pthread_rwlock_unlock(&pglite_shared_plans_lock);
+
+    if (plan == NULL)
+        return NULL;
+
+    pglite_shared_plan_lock_relations(plan->stmt_list);
+
+    if (!pg_atomic_read_u32(&plan->valid))
+    {
+        pglite_shared_plan_release(plan);
+        return NULL;
+    }
+
+    return plan;
+}
+
+List *
+pglite_shared_plan_stmts(PgliteSharedPlan *plan)
+{
+    return plan->stmt_list;
+}
+
+void
+pglite_shared_plan_release(PgliteSharedPlan *plan)
+{
+    if (pg_atomic_sub_fetch_u32(&plan->refcount, 1) == 0)
+        MemoryContextDelete(plan->context);
+}
+
+/*
+ * Shares cplan, if it's plansource's generic plan and good for any session
+ * that would look it up
+ */
+void
+pglite_shared_plan_publish(CachedPlanSource *plansource, CachedPlan *cplan)
+{
+    PgliteSharedPlan *plan;
+    PgliteSharedPlan *evicted = NULL;
+    PgliteSharedPlan **link;
+    MemoryContext context;
+    MemoryContext oldcontext;
+    ListCell   *lc;
+
+    if (cplan != plansource->gplan ||
+        !cplan->is_valid ||
+        TransactionIdIsValid(cplan->saved_xmin) ||
+        !pglite_shared_plan_usable(plansource))
+        return;
+
+    foreach(lc, cplan->stmt_list)
+    {
+        PlannedStmt *stmt = lfirst_node(PlannedStmt, lc);
+
+        if (stmt->commandType == CMD_UTILITY)
+            return;
+    }
+
+    /* checked again once locked */
+    if (pglite_num_shared_plans >= PGLITE_SHARED_PLANS_MAX)
+        return;
+
+    context = AllocSetContextCreate(NULL, "pglite shared plan",
+                                    ALLOCSET_SMALL_SIZES);
+    oldcontext = MemoryContextSwitchTo(context);
+
+    plan = palloc0(sizeof(PgliteSharedPlan));
+    plan->cluster = UsedShmemSegAddr;
+    plan->database = MyDatabaseId;
+    plan->role = GetUserId();
+    plan->search_path = pstrdup(namespace_search_path);
+    plan->query_string = pstrdup(plansource->query_string);
+    plan->num_params = plansource->num_params;
+    if (plan->num_params > 0)
+    {
+        plan->param_types = palloc(plan->num_params * sizeof(Oid));
+        memcpy(plan->param_types, plansource->param_types,
+               plan->num_params * sizeof(Oid));
+    }
+    plan->hash = pglite_shared_plan_hash(plan->query_string,
+                                         plan->num_params, plan->param_types,
+                                         plan->search_path, plan->role);
+    plan->context = context;
+    plan->stmt_list = copyObject(cplan->stmt_list);
+
+    foreach(lc, plan->stmt_list)
+    {
+        PlannedStmt *stmt = lfirst_node(PlannedStmt, lc);
+
+        plan->relationOids = list_concat(plan->relationOids, stmt->relationOids);
+        plan->invalItems = list_concat(plan->invalItems, stmt->invalItems);
+    }
+
+    pg_atomic_init_u32(&plan->valid, 1);
+    pg_atomic_init_u32(&plan->refcount, 1);
+
+    MemoryContextSwitchTo(oldcontext);
+
+    pthread_rwlock_wrlock(&pglite_shared_plans_lock);
+
+    /*
+     * Replaces what's there for the key, unless another backend has just
+     * shared a valid plan for it
+     */
+    link = &pglite_shared_plans[plan->hash % PGLITE_SHARED_PLAN_BUCKETS];
+    while (*link != NULL)
+    {
+        PgliteSharedPlan *other = *link;
+
+        if (pglite_shared_plan_matches(other, plan->hash, plan->query_string,
+                                       plan->num_params, plan->param_types,
+                                       plan->search_path, plan->role))
+        {
+            if (pg_atomic_read_u32(&other->valid))
+                break;
+
+            *link = other->next;
+            other->next = evicted;
+            evicted = other;
+            pglite_num_shared_plans--;
+            continue;
+        }
+
+        link = &other->next;
+    }
+
+    if (*link == NULL && pglite_num_shared_plans < PGLITE_SHARED_PLANS_MAX)
+    {
+        *link = plan;
+        pglite_num_shared_plans++;
+        plan = NULL;
+    }
+
+    pthread_rwlock_unlock(&pglite_shared_plans_lock);
+
+    pglite_shared_plan_release_all(evicted);
+
+    if (plan != NULL)
+        pglite_shared_plan_release(plan);
+}
+
+/*
+ * Drops the plans of the cluster whose shared memory is at cluster, or of
+ * every cluster if NULL. Plans being run go once they're released.
+ */
+void
+pglite_forget_shared_plans(void *cluster)
+{
+    PgliteSharedPlan *forgotten = NULL;
+
+    pthread_rwlock_wrlock(&pglite_shared_plans_lock);
+
+    for (int i = 0; i < PGLITE_SHARED_PLAN_BUCKETS; i++)
+    {
+        PgliteSharedPlan **link = &pglite_shared_plans[i];
+
+        while (*link != NULL)
+        {
+            PgliteSharedPlan *plan = *link;
+
+            if (cluster == NULL || plan->cluster == cluster)
+            {
+                *link = plan->next;
+                plan->next = forgotten;
+                forgotten = plan;
+                pglite_num_shared_plans--;
+            }
+            else
+                link = &plan->next;
+        }
+    }
+
+    pthread_rwlock_unlock(&pglite_shared_plans_lock);
+
+    pglite_shared_plan_release_all(forgotten);
+}
+
+/*
+ * Starts or stops sharing plans, for every cluster in the process. Plans
+ * already shared are dropped on stopping, as nothing keeps them valid once
+ * the backends looking them up have gone.
+ */
+void
+pglite_set_shared_plans(bool enabled)
+{
+    pglite_shared_plans_enabled = enabled;
+    pg_memory_barrier();
+
+    if (!enabled)
+        pglite_forget_shared_plans(NULL);
+}
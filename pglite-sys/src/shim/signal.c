@@ -0,0 +1,251 @@
+/*
+ * signal.c
+ *
+ * Signals between backend threads. Postgres addresses a backend by pid and
+ * expects a signal sent to it to be handled by that backend, but every
+ * backend thread shares one process id and the kernel hands process-wide
+ * signals to whichever thread it likes. So each backend thread goes by its
+ * kernel thread id instead, and the backend is built with kill() and
+ * setitimer() routed here, where signals are aimed at single threads.
+ * An id that has ever been a backend thread's is never signalled as a
+ * process: once the thread is gone the kernel may have handed the id to
+ * some other process.
+ *
+ * Handlers are shared by the whole process too, while the checkpointer,
+ * autovacuum and ordinary backends each want their own. So pqsignal only
+ * sets the handler for the calling thread, and one dispatcher per signal
+ * calls the handler of whichever thread the signal lands on.
+ */
+
+/* the real ones, for this file only */
+#undef kill
+#undef setitimer
+
+#include <postgres.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libpq/pqsignal.h>
+#include <miscadmin.h>
+#include <port/atomics.h>
+#include <storage/latch.h>
+#include <storage/procsignal.h>
+
+#include "pglite.h"
+
+/* this thread's handlers, NULL for those it never set */
+static __thread pqsigfunc pglite_handlers[NSIG];
+
+/* what each signal did before we took it over, for threads not our own */
+static struct sigaction pglite_original_actions[NSIG];
+static bool pglite_dispatching[NSIG];
+static pthread_mutex_t pglite_dispatch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* PID_MAX_LIMIT on 64 bit Linux, past which no thread id goes */
+#define PGLITE_MAX_TID (4 * 1024 * 1024)
+
+/* one bit for every thread id that has been a backend's, never cleared */
+static pg_atomic_uint32 pglite_backend_ids[PGLITE_MAX_TID / 32];
+
+/* stands in for ITIMER_REAL, which is shared by the whole process */
+static __thread timer_t pglite_alarm_timer;
+static __thread bool pglite_alarm_timer_created = false;
+
+static bool
+pglite_is_backend_id(pid_t tid)
+{
+    if (tid <= 0 || tid >= PGLITE_MAX_TID)
+        return false;
+
+    return (pg_atomic_read_u32(&pglite_backend_ids[tid / 32]) & (1U << (tid % 32))) != 0;
+}
+
+/*
+ * Sends `sig` to the backend thread `pid`, or to the process `pid` if no
+ * backend thread has ever had that id. A backend that has exited fails
+ * with ESRCH, as a process would. Postgres signals the process group of a
+ * backend, -pid, where it has setsid(), which here means the thread.
+ */
+int
+pglite_kill(pid_t pid, int sig)
+{
+    pid_t       tid = pid < -1 ? -pid : pid;
+
+    if (pglite_is_backend_id(tid))
+        return syscall(SYS_tgkill, getpid(), tid, sig);
+
+    /* one of the application's threads */
+    if (pid > 0 && syscall(SYS_tgkill, getpid(), pid, sig) == 0)
+        return 0;
+
+    return kill(pid, sig);
+}
+
+/*
+ * timeout.c's alarm, on a timer of this thread's own that delivers SIGALRM
+ * to this thread alone
+ */
+int
+pglite_setitimer(__itimer_which_t which, const struct itimerval *new_value,
+                 struct itimerval *old_value)
+{
+    struct itimerspec spec;
+    struct itimerspec old_spec;
+
+    Assert(which == ITIMER_REAL);
+
+    if (!pglite_alarm_timer_created)
+    {
+        struct sigevent sev;
+
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = SIGALRM;
+        sev._sigev_un._tid = syscall(SYS_gettid);
+
+        if (timer_create(CLOCK_MONOTONIC, &sev, &pglite_alarm_timer) < 0)
+            return -1;
+
+        pglite_alarm_timer_created = true;
+    }
+
+    spec.it_value.tv_sec = new_value->it_value.tv_sec;
+    spec.it_value.tv_nsec = new_value->it_value.tv_usec * 1000;
+    spec.it_interval.tv_sec = new_value->it_interval.tv_sec;
+    spec.it_interval.tv_nsec = new_value->it_interval.tv_usec * 1000;
+
+    if (timer_settime(pglite_alarm_timer, 0, &spec, &old_spec) < 0)
+        return -1;
+
+    if (old_value != NULL)
+    {
+        old_value->it_value.tv_sec = old_spec.it_value.tv_sec;
+        old_value->it_value.tv_usec = old_spec.it_value.tv_nsec / 1000;
+        old_value->it_interval.tv_sec = old_spec.it_interval.tv_sec;
+        old_value->it_interval.tv_usec = old_spec.it_interval.tv_nsec / 1000;
+    }
+
+    return 0;
+}
+
+static void
+pglite_dispatch_signal(int signo, siginfo_t *info, void *context)
+{
+    pqsigfunc   handler = pglite_handlers[signo];
+    struct sigaction *original = &pglite_original_actions[signo];
+
+    if (handler == SIG_IGN)
+        return;
+
+    if (handler != NULL && handler != SIG_DFL)
+    {
+        handler(signo);
+        return;
+    }
+
+    /*
+     * Not a signal this thread handles, most likely one for the application
+     * landing on one of our threads: do what would have been done without
+     * us. Re-raising under the default action only makes sense where that
+     * action isn't to ignore it.
+     */
+    if (original->sa_flags & SA_SIGINFO)
+        original->sa_sigaction(signo, info, context);
+    else if (original->sa_handler == SIG_DFL)
+    {
+        if (signo == SIGCHLD || signo == SIGURG || signo == SIGWINCH ||
+            signo == SIGCONT)
+            return;
+
+        sigaction(signo, original, NULL);
+        raise(signo);
+    }
+    else if (original->sa_handler != SIG_IGN)
+        original->sa_handler(signo);
+}
+
+/*
+ * Sets the handler for `signo` on this thread only, returning the one it
+ * replaces. Replaces src/port/pqsignal.c.
+ */
+pqsigfunc
+pqsignal(int signo, pqsigfunc func)
+{
+    pqsigfunc   prev = pglite_handlers[signo];
+
+    pthread_mutex_lock(&pglite_dispatch_lock);
+
+    if (!pglite_dispatching[signo])
+    {
+        struct sigaction act;
+
+        act.sa_sigaction = pglite_dispatch_signal;
+        sigemptyset(&act.sa_mask);
+        act.sa_flags = SA_SIGINFO | SA_RESTART;
+        if (signo == SIGCHLD)
+            act.sa_flags |= SA_NOCLDSTOP;
+
+        if (sigaction(signo, &act, &pglite_original_actions[signo]) < 0)
+        {
+            pthread_mutex_unlock(&pglite_dispatch_lock);
+            return SIG_ERR;
+        }
+
+        pglite_dispatching[signo] = true;
+    }
+
+    pthread_mutex_unlock(&pglite_dispatch_lock);
+
+    pglite_handlers[signo] = func;
+
+    return prev != NULL ? prev : SIG_DFL;
+}
+
+/*
+ * Makes this thread's id its backend pid and readies it for signals from
+ * other backends. Called right after InitStandaloneProcess, which sets
+ * MyProcPid to the process id and hands our local latch to it, and before
+ * InitProcess advertises MyProcPid in shared memory.
+ */
+void
+pglite_init_backend_signals(void)
+{
+    sigset_t    mask;
+
+    MyProcPid = syscall(SYS_gettid);
+    MyLatch->owner_pid = MyProcPid;
+
+    if (MyProcPid < PGLITE_MAX_TID)
+        pg_atomic_fetch_or_u32(&pglite_backend_ids[MyProcPid / 32],
+                               1U << (MyProcPid % 32));
+
+    /*
+     * pqinitmask starts UnBlockSig afresh, so put back the SIGURG that
+     * InitializeLatchSupport added to it: latch.c reads SIGURG from a
+     * signalfd, which only sees it if blocked.
+     */
+    pqinitmask();
+    sigaddset(&UnBlockSig, SIGURG);
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGURG);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    /* sinval catchup and the like, and the postmaster's wakeups */
+    pqsignal(SIGUSR1, procsignal_sigusr1_handler);
+}
+
+void
+pglite_end_backend_signals(void)
+{
+    if (pglite_alarm_timer_created)
+    {
+        timer_delete(pglite_alarm_timer);
+        pglite_alarm_timer_created = false;
+    }
+}
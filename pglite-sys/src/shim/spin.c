@@ -0,0 +1,50 @@
+/*
+ * spin.c
+ *
+ * Spinlock backoff for backend threads. Spinlocks are the native
+ * test-and-set ones s_lock.h has for the platform: a zeroed slock_t is an
+ * unlocked one, so the thread-local copies of s_lock.c's dummy_spinlock
+ * need no initialising, and there's no semaphore emulation to share
+ * between threads.
+ *
+ * Once spinning has gone on for long enough, s_lock.c sleeps for at least
+ * a millisecond, on the grounds that the holder must have been descheduled.
+ * The holder is usually a thread of this process that only needs a CPU
+ * for a moment, so the first few delays yield the CPU instead, and only
+ * then does the sleeping start. prepare-postgres.sh has s_lock.c's
+ * perform_spin_delay call here in place of its pg_usleep.
+ */
+#include <postgres.h>
+
+#include <sched.h>
+
+#include <port/atomics.h>
+#include <storage/s_lock.h>
+
+#include "pglite.h"
+
+#ifndef HAS_TEST_AND_SET
+#error "backend threads need native spinlocks"
+#endif
+
+#ifdef PG_HAVE_ATOMIC_U32_SIMULATION
+#error "backend threads need native atomics"
+#endif
+
+/* delays that only yield, before the first sleep */
+#define PGLITE_SPIN_YIELDS 10
+
+void
+pglite_spin_delay_sleep(SpinDelayStatus *status)
+{
+    if (status->delays <= PGLITE_SPIN_YIELDS)
+    {
+        sched_yield();
+
+        /* so the first sleep is perform_spin_delay's shortest */
+        status->cur_delay = 0;
+        return;
+    }
+
+    pg_usleep(status->cur_delay);
+}
@@ -0,0 +1,198 @@
+/// A connection whose operations are futures, for use from async runtimes.
+/// Jobs are pushed onto the backend's lock-free inbox from any number of
+/// tasks at once and completed through wakers, so waiting on a query never
+/// blocks the caller's thread.
+
+use std::ffi::CString;
+use std::path::Path;
+use std::sync::Arc;
+use std::thread;
+
+use crate::db;
+use crate::db::guc::Settings;
+use crate::db::postgres::Plan;
+use crate::error::Error;
+use crate::inbox::Inbox;
+use crate::oneshot;
+use crate::statement::{StatementCache, STATEMENT_CACHE_CAPACITY};
+use crate::value::Value;
+use crate::{bootstrap, data_dir_cstring, OpenError};
+
+type Job = Box<dyn FnOnce(&mut Session) + Send>;
+
+/// Cheap to clone: clones share one backend thread, which shuts down once
+/// the last of them is dropped.
+#[derive(Clone)]
+pub struct AsyncConnection {
+    inner: Arc<Inner>,
+}
+
+struct Inner {
+    inbox: Arc<Inbox<Job>>,
+}
+
+impl Drop for Inner {
+    fn drop(&mut self) {
+        // the backend drains what's left, then shuts down:
+        self.inbox.close();
+    }
+}
+
+/// Backend thread state carried from one job to the next
+struct Session {
+    statements: StatementCache,
+}
+
+impl AsyncConnection {
+    /// Opens the database in `data_dir`, bootstrapping it first if needed.
+    /// Startup happens on the new backend thread.
+    pub async fn open(data_dir: &Path) -> Result<Self, OpenError> {
+        let needs_bootstrap = !db::bootstrap::is_bootstrapped(data_dir);
+        let data_dir_path = data_dir.to_owned();
+        let data_dir = data_dir_cstring(data_dir)?;
+
+        let inbox = Arc::new(Inbox::new());
+        let (ready, started) = oneshot::channel();
+
+        thread::spawn({
+            let inbox = inbox.clone();
+
+            move || {
+                if needs_bootstrap {
+                    if let Err(error) = bootstrap(&data_dir_path) {
+                        ready.send(Err(error));
+                        return;
+                    }
+                }
+
+                main(data_dir, inbox, ready)
+            }
+        });
+
+        started.await
+            .map_err(|_| OpenError::StartupFailed)??;
+
+        Ok(AsyncConnection { inner: Arc::new(Inner { inbox }) })
+    }
+
+    /// Runs `f` on the backend thread, resolving to its result
+    async fn call<F, R>(&self, f: F) -> Result<R, Error>
+        where F: FnOnce(&mut Session) -> R + Send + 'static, R: Send + 'static
+    {
+        let (sender, receiver) = oneshot::channel();
+
+        let inbox = &self.inner.inbox;
+        inbox.push(Box::new(move |session| sender.send(f(session))));
+
+        // while we hold a handle the inbox is only closed if the backend
+        // has exited, in which case nothing will run what we just pushed:
+        if inbox.is_closed() {
+            let mut stranded = Vec::new();
+            inbox.take_all(&mut stranded);
+        }
+
+        receiver.await.map_err(|_| Error::BackendGone)
+    }
+
+    /// Runs every statement in `sql`, discarding any result rows. Returns
+    /// the number of rows processed by the last statement.
+    pub async fn execute(&self, sql: &str) -> Result<u64, Error> {
+        let sql = CString::new(sql)
+            .map_err(|_| Error::QueryContainsNul)?;
+
+        self.call(move |_| unsafe { db::postgres::exec(&sql, |_| ()) }).await?
+            .map_err(Error::Postgres)
+    }
+
+    /// Runs the single statement in `sql` with `params` and collects its
+    /// result rows. Plans are cached on the backend by SQL text.
+    pub async fn query(&self, sql: &str, params: Vec<Value>) -> Result<Vec<Vec<Value>>, Error> {
+        let sql = sql.to_owned();
+
+        self.call(move |session| {
+            let plan = session.plan(&sql)?;
+            let mut rows = Vec::new();
+
+            unsafe { db::postgres::execute_plan(plan, &params, |row| rows.push(row.values())) }
+                .map_err(Error::Postgres)?;
+
+            Ok(rows)
+        }).await?
+    }
+
+    /// Runs the single statement in `sql` with `params`, discarding any
+    /// result rows. Returns the number of rows processed.
+    pub async fn execute_params(&self, sql: &str, params: Vec<Value>) -> Result<u64, Error> {
+        let sql = sql.to_owned();
+
+        self.call(move |session| {
+            let plan = session.plan(&sql)?;
+
+            unsafe { db::postgres::execute_plan(plan, &params, |_| ()) }
+                .map_err(Error::Postgres)
+        }).await?
+    }
+}
+
+impl Session {
+    fn plan(&mut self, sql: &str) -> Result<Plan, Error> {
+        if let Some(plan) = self.statements.get(sql) {
+            return Ok(plan);
+        }
+
+        let query = CString::new(sql)
+            .map_err(|_| Error::QueryContainsNul)?;
+
+        for plan in self.statements.make_room(1) {
+            unsafe { db::postgres::drop_plan(plan); }
+        }
+
+        let plan = unsafe { db::postgres::prepare(&query) }
+            .map_err(Error::Postgres)?;
+
+        self.statements.insert(sql, plan);
+        Ok(plan)
+    }
+}
+
+/// Fails everything still queued however the backend thread ends, so no
+/// future waits forever
+struct Exited(Arc<Inbox<Job>>);
+
+impl Drop for Exited {
+    fn drop(&mut self) {
+        // dropping a job drops its oneshot sender, which completes the
+        // future with BackendGone:
+        self.0.close();
+
+        let mut jobs = Vec::new();
+        self.0.take_all(&mut jobs);
+    }
+}
+
+fn main(data_dir: CString, inbox: Arc<Inbox<Job>>, ready: oneshot::Sender<Result<(), OpenError>>) {
+    let _exited = Exited(inbox.clone());
+
+    unsafe {
+        db::init::thread_start();
+        db::postgres::main(&data_dir, &Settings::default());
+    }
+
+    ready.send(Ok(()));
+
+    let mut session = Session {
+        statements: StatementCache::new(STATEMENT_CACHE_CAPACITY),
+    };
+
+    let mut jobs = Vec::new();
+
+    while inbox.recv_all(&mut jobs) {
+        for job in jobs.drain(..) {
+            job(&mut session);
+        }
+    }
+
+    unsafe {
+        db::postgres::shutdown();
+    }
+}
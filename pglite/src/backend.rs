@@ -0,0 +1,247 @@
+/// The resident backend thread that owns a Postgres session for the life of
+/// a connection. Work reaches it through an SPSC queue as boxed closures,
+/// which run on the backend thread with all of its thread-local Postgres
+/// state in place.
+
+use std::any::Any;
+use std::cell::Cell;
+use std::ffi::CString;
+use std::hint;
+use std::mem;
+use std::panic::{self, AssertUnwindSafe};
+use std::sync::Arc;
+use std::sync::atomic::{AtomicBool, AtomicU32, Ordering};
+use std::thread;
+use pglite_sys as sys;
+
+use crate::db::guc::Settings;
+use crate::db::ipc::SharedMemory;
+use crate::{db, futex, memory, queue};
+
+type Job = Box<dyn FnOnce() + Send>;
+
+const QUEUE_CAPACITY: usize = 64;
+const SPIN_LIMIT: usize = 1024;
+
+/// The backend thread has exited, most likely because Postgres raised a
+/// FATAL error on it
+#[derive(Debug, Copy, Clone)]
+pub struct BackendGone;
+
+/// A panic raised by caller code running on the backend thread, at a point
+/// where Postgres is still in a consistent state
+pub struct CallerPanic(pub Box<dyn Any + Send>);
+
+pub struct Backend {
+    jobs: Option<queue::Sender<Job>>,
+    shared: Arc<Shared>,
+    submitted: Cell<u32>,
+    thread: Option<thread::JoinHandle<()>>,
+}
+
+struct Shared {
+    /// sequence number of the last job to finish
+    completed: AtomicU32,
+    exited: AtomicBool,
+}
+
+impl Backend {
+    /// Starts a backend thread serving the cluster in `data_dir` and waits
+    /// for it to finish initialising
+    pub fn start(data_dir: CString) -> Result<Self, BackendGone> {
+        Self::spawn(move || unsafe { db::postgres::main(&data_dir, &Settings::default()) })
+    }
+
+    /// Starts a backend thread serving the cluster in `data_dir`, whose
+    /// relations are kept in memory
+    pub fn start_in_memory(data_dir: CString) -> Result<Self, BackendGone> {
+        Self::spawn(move || unsafe {
+            sys::pglite_use_memory_smgr();
+            db::postgres::main(&data_dir, &memory::settings());
+        })
+    }
+
+    /// Starts a backend thread on the cluster in `data_dir`, started with
+    /// `settings`, that attaches to `shared` rather than starting the
+    /// cluster up itself
+    pub fn attach(data_dir: CString, settings: Settings, shared: SharedMemory) -> Result<Self, BackendGone> {
+        Self::spawn(move || unsafe { db::postgres::attach(&data_dir, &settings, shared) })
+    }
+
+    fn spawn<I>(init: I) -> Result<Self, BackendGone>
+        where I: FnOnce() + Send + 'static
+    {
+        let (sender, receiver) = queue::channel::<Job>(QUEUE_CAPACITY);
+
+        let shared = Arc::new(Shared {
+            completed: AtomicU32::new(0),
+            exited: AtomicBool::new(false),
+        });
+
+        let thread = thread::spawn({
+            let shared = shared.clone();
+            move || main(init, receiver, shared)
+        });
+
+        let backend = Backend {
+            jobs: Some(sender),
+            shared,
+            submitted: Cell::new(0),
+            thread: Some(thread),
+        };
+
+        // the backend only starts taking jobs once it's initialised:
+        backend.call(|| ())?;
+
+        Ok(backend)
+    }
+
+    /// Runs `f` on the backend thread and waits for its result. Panics
+    /// wrapped in `CallerPanic` are resumed on the calling thread, any other
+    /// panic takes the backend down with it.
+    pub fn call<F, R>(&self, f: F) -> Result<R, BackendGone>
+        where F: FnOnce() -> R + Send, R: Send
+    {
+        let jobs = self.jobs.as_ref().ok_or(BackendGone)?;
+
+        let seq = self.submitted.get().wrapping_add(1);
+        self.submitted.set(seq);
+
+        let mut result = None::<thread::Result<R>>;
+        let result_ptr = SendPtr(&mut result);
+
+        // signals completion whether the job runs, panics, or is dropped
+        // unrun because the backend went away:
+        let done = Done { shared: &self.shared, seq };
+
+        let job: Box<dyn FnOnce() + Send + '_> = Box::new(move || {
+            let _done = done;
+            let result_ptr = result_ptr;
+            let r = match panic::catch_unwind(AssertUnwindSafe(f)) {
+                Ok(r) => Ok(r),
+                Err(payload) => match payload.downcast::<CallerPanic>() {
+                    Ok(caller) => Err(caller.0),
+                    Err(payload) => panic::resume_unwind(payload),
+                },
+            };
+            unsafe { *result_ptr.0 = Some(r); }
+        });
+
+        // SAFETY: we don't return until the job has signalled completion,
+        // which it only does once it's finished with everything it borrows
+        let job = unsafe { mem::transmute::<_, Job>(job) };
+
+        if jobs.send(job).is_err() {
+            return Err(BackendGone);
+        }
+
+        self.wait(seq);
+
+        match result {
+            Some(Ok(result)) => Ok(result),
+            Some(Err(payload)) => panic::resume_unwind(payload),
+            None => Err(BackendGone),
+        }
+    }
+
+    fn wait(&self, seq: u32) {
+        let completed = &self.shared.completed;
+
+        for _ in 0..SPIN_LIMIT {
+            if completed.load(Ordering::Acquire) == seq {
+                return;
+            }
+            hint::spin_loop();
+        }
+
+        loop {
+            let current = completed.load(Ordering::Acquire);
+
+            if current == seq {
+                return;
+            }
+
+            if self.shared.exited.load(Ordering::Acquire) {
+                // the job may be stranded in the queue, dropping it
+                // signals completion:
+                if let Some(jobs) = &self.jobs {
+                    jobs.drain();
+                }
+
+                if completed.load(Ordering::Acquire) == seq {
+                    return;
+                }
+            }
+
+            futex::wait(completed, current);
+        }
+    }
+}
+
+impl Drop for Backend {
+    fn drop(&mut self) {
+        // closing the queue tells the backend to shut down
+        self.jobs.take();
+
+        if let Some(thread) = self.thread.take() {
+            if thread.join().is_err() {
+                log::error!("pglite: backend thread panicked");
+            }
+        }
+    }
+}
+
+struct SendPtr<T>(*mut T);
+
+unsafe impl<T: Send> Send for SendPtr<T> {}
+
+struct Done<'a> {
+    shared: &'a Shared,
+    seq: u32,
+}
+
+impl<'a> Drop for Done<'a> {
+    fn drop(&mut self) {
+        self.shared.completed.store(self.seq, Ordering::Release);
+        futex::wake_all(&self.shared.completed);
+    }
+}
+
+/// Flags the backend as gone however its thread ends, so callers waiting on
+/// a job don't sleep forever
+struct Exited(Arc<Shared>);
+
+impl Drop for Exited {
+    fn drop(&mut self) {
+        self.0.exited.store(true, Ordering::Release);
+        futex::wake_all(&self.0.completed);
+    }
+}
+
+fn main(init: impl FnOnce(), jobs: queue::Receiver<Job>, shared: Arc<Shared>) {
+    let _exited = Exited(shared);
+
+    // rebound so it's dropped before `_exited`, meaning the queue is closed
+    // by the time anyone waiting is told we're gone:
+    let jobs = jobs;
+
+    unsafe {
+        db::init::thread_start();
+    }
+
+    init();
+
+    while let Some(job) = jobs.recv() {
+        // the cluster went down after a crash, see db::postmaster. Dropping
+        // the job unrun tells the caller we're gone
+        if unsafe { sys::pglite_postmaster_gone() } {
+            break;
+        }
+
+        job();
+    }
+
+    unsafe {
+        db::postgres::shutdown();
+    }
+}
@@ -0,0 +1,36 @@
+/// Clusters whose relations are kept in a single file, pglite.container in
+/// the data directory, rather than in a file per fork and segment (see
+/// pglite-sys/src/shim/container_smgr.c). Opening one opens one file for
+/// all its relations, however many there are, and its data directory
+/// holds a few dozen files rather than thousands.
+
+use std::fs;
+use std::io;
+use std::os::unix::fs::DirBuilderExt;
+use std::path::Path;
+use pglite_sys as sys;
+
+use crate::{data_dir_cstring, db, OpenError};
+
+/// Bootstraps a new cluster in `data_dir` that keeps its relations in a
+/// container file. It's opened as any other, by `Connection::open` or
+/// `Database::open`, which find the file there.
+pub fn create_container(data_dir: &Path) -> Result<(), OpenError> {
+    if db::bootstrap::is_bootstrapped(data_dir) {
+        return Err(OpenError::Io(io::Error::from(io::ErrorKind::AlreadyExists)));
+    }
+
+    match fs::DirBuilder::new().mode(0o700).create(data_dir) {
+        Ok(()) => {}
+        Err(e) if e.kind() == io::ErrorKind::AlreadyExists => {}
+        Err(e) => return Err(OpenError::Io(e)),
+    }
+
+    let path = data_dir_cstring(data_dir)?;
+
+    if !unsafe { sys::pglite_create_container(path.as_ptr()) } {
+        return Err(OpenError::Io(io::Error::last_os_error()));
+    }
+
+    crate::bootstrap(data_dir)
+}
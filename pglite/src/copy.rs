@@ -0,0 +1,80 @@
+/// Bulk loading typed rows straight into a table, without going through
+/// SQL text or COPY's text format.
+
+use std::ffi::CString;
+use std::iter::Peekable;
+
+use crate::db;
+use crate::error::Error;
+use crate::transaction::Transaction;
+use crate::value::Value;
+use crate::Connection;
+
+/// rows sent to the backend per round trip
+const CHUNK_ROWS: usize = 4096;
+
+impl Connection {
+    /// Inserts `rows` into `table`, each row holding a value for each of
+    /// `columns` in order, or for every column of the table if `columns` is
+    /// empty. Columns not listed get their defaults. Returns the number of
+    /// rows inserted.
+    ///
+    /// The load is atomic: it runs in a single transaction, or in the
+    /// caller's if one is open. Only plain tables without BEFORE row
+    /// triggers or generated columns can be loaded this way.
+    pub fn copy_in<I, R>(&self, table: &str, columns: &[&str], rows: I) -> Result<u64, Error>
+        where I: IntoIterator<Item = R>, R: AsRef<[Value]> + Sync
+    {
+        let table = CString::new(table)
+            .map_err(|_| Error::QueryContainsNul)?;
+
+        let columns = columns.iter()
+            .map(|column| CString::new(*column))
+            .collect::<Result<Vec<_>, _>>()
+            .map_err(|_| Error::QueryContainsNul)?;
+
+        let mut rows = rows.into_iter().peekable();
+        let mut chunk = Vec::with_capacity(CHUNK_ROWS);
+
+        next_chunk(&mut rows, &mut chunk);
+
+        // a load that fits in one round trip is atomic on its own:
+        if rows.peek().is_none() {
+            return self.copy_chunk(&table, &columns, &chunk);
+        }
+
+        let transaction = Transaction::begin(self)?;
+        let mut total = 0;
+
+        while !chunk.is_empty() {
+            total += self.copy_chunk(&table, &columns, &chunk)?;
+            next_chunk(&mut rows, &mut chunk);
+        }
+
+        transaction.commit()?;
+
+        Ok(total)
+    }
+
+    fn copy_chunk<R>(&self, table: &CString, columns: &[CString], chunk: &[R]) -> Result<u64, Error>
+        where R: AsRef<[Value]> + Sync
+    {
+        let width = match chunk.first() {
+            Some(row) => row.as_ref().len(),
+            None => return Ok(0),
+        };
+
+        if let Some(row) = chunk.iter().find(|row| row.as_ref().len() != width) {
+            return Err(Error::RowLengthMismatch { expected: width, found: row.as_ref().len() });
+        }
+
+        self.backend.call(|| unsafe { db::postgres::copy_in(table, columns, width, chunk) })
+            .map_err(|_| Error::BackendGone)?
+            .map_err(Error::Postgres)
+    }
+}
+
+fn next_chunk<I: Iterator>(rows: &mut Peekable<I>, chunk: &mut Vec<I::Item>) {
+    chunk.clear();
+    chunk.extend(rows.by_ref().take(CHUNK_ROWS));
+}
@@ -0,0 +1,234 @@
+/// A cluster served by many backend threads at once. An in-process
+/// postmaster starts the cluster up and runs its auxiliary processes; every
+/// connection gets a backend thread of its own attached to the postmaster's
+/// shared memory, so sessions run concurrently with Postgres' own locking
+/// and MVCC between them.
+
+use std::ffi::CString;
+use std::path::Path;
+use std::sync::{Arc, Mutex};
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use crate::backend::Backend;
+use crate::db;
+use crate::db::catcache;
+use crate::db::fd::{self, SharedFdStats};
+use crate::db::guc::Settings;
+use crate::db::lmgr::{self, LWLockStats};
+use crate::db::plancache;
+use crate::db::postgres::Plan;
+use crate::db::postmaster::Postmaster;
+use crate::db::smgr;
+use crate::{bootstrap, data_dir_cstring, Connection, OpenError};
+
+/// Cheap to clone, and safe to share between threads. The cluster shuts
+/// down once the last clone and the last connection are dropped.
+#[derive(Clone)]
+pub struct Database {
+    inner: Arc<Inner>,
+}
+
+struct Inner {
+    data_dir: CString,
+    settings: Settings,
+    /// backends attached and idle, for `connect` to hand out; dropped before
+    /// the postmaster
+    pool: Mutex<Vec<Backend>>,
+    pool_size: AtomicUsize,
+    /// shuts the cluster down on drop, by which time every connection
+    /// has gone
+    postmaster: Postmaster,
+}
+
+impl Database {
+    /// Starts up the cluster in `data_dir`, bootstrapping it first if needed
+    pub fn open(data_dir: &Path) -> Result<Self, OpenError> {
+        Self::open_with_settings(data_dir, &[])
+    }
+
+    /// Starts up the cluster in `data_dir` as `open` does, with server
+    /// settings such as `("shared_buffers", "1GB")` in place of the defaults,
+    /// as if from postgresql.conf. An invalid one fails startup.
+    pub fn open_with_settings(data_dir: &Path, settings: &[(&str, &str)]) -> Result<Self, OpenError> {
+        let settings = Settings::new(settings)
+            .ok_or(OpenError::SettingContainsNul)?;
+
+        if !db::bootstrap::is_bootstrapped(data_dir) {
+            bootstrap(data_dir)?;
+        }
+
+        let data_dir = data_dir_cstring(data_dir)?;
+
+        let postmaster = Postmaster::start(data_dir.clone(), settings.clone())
+            .map_err(|_| OpenError::StartupFailed)?;
+
+        Ok(Database {
+            inner: Arc::new(Inner {
+                data_dir,
+                settings,
+                pool: Mutex::new(Vec::new()),
+                pool_size: AtomicUsize::new(0),
+                postmaster,
+            }),
+        })
+    }
+
+    /// Opens a new session on a backend thread of its own, taking a warm one
+    /// from the pool if there is one. Up to `max_connections` sessions can
+    /// be open at once, pooled backends included. Fails once the cluster has
+    /// gone down after a crash.
+    pub fn connect(&self) -> Result<Connection, OpenError> {
+        if self.inner.postmaster.crashed() {
+            return Err(OpenError::Crashed);
+        }
+
+        let backend = match self.take_pooled() {
+            Some(backend) => backend,
+            None => self.attach()?,
+        };
+
+        Ok(Connection::new(backend, Some(self.clone())))
+    }
+
+    /// Keeps up to `size` backends attached and idle for `connect` to hand
+    /// out, starting them now. Connections dropped while the pool has room
+    /// are reset and their backends go back into it, rather than shutting
+    /// down. The pool starts out empty and sized 0.
+    pub fn set_pool_size(&self, size: usize) -> Result<(), OpenError> {
+        self.inner.pool_size.store(size, Ordering::Relaxed);
+
+        let excess = {
+            let mut pool = self.inner.pool.lock().unwrap();
+            let keep = pool.len().min(size);
+            pool.split_off(keep)
+        };
+
+        // shut down outside the lock
+        drop(excess);
+
+        while self.inner.pool.lock().unwrap().len() < size {
+            let backend = self.attach()?;
+            self.inner.pool.lock().unwrap().push(backend);
+        }
+
+        Ok(())
+    }
+
+    fn attach(&self) -> Result<Backend, OpenError> {
+        Backend::attach(self.inner.data_dir.clone(), self.inner.settings.clone(), self.inner.postmaster.shared())
+            .map_err(|_| OpenError::StartupFailed)
+    }
+
+    /// A pooled backend that's still up, having been terminated neither by
+    /// a FATAL error nor by pg_terminate_backend while it waited
+    fn take_pooled(&self) -> Option<Backend> {
+        loop {
+            let backend = self.inner.pool.lock().unwrap().pop()?;
+
+            if backend.call(|| ()).is_ok() {
+                return Some(backend);
+            }
+        }
+    }
+
+    /// Takes back the backend of a connection being dropped, along with the
+    /// plans it saved. It returns to the pool once its session is reset, if
+    /// there's room, or shuts down.
+    pub(crate) fn recycle(&self, backend: Backend, plans: Vec<Plan>) {
+        let pool_size = self.inner.pool_size.load(Ordering::Relaxed);
+
+        if self.inner.pool.lock().unwrap().len() >= pool_size {
+            return;
+        }
+
+        let reset = backend.call(move || unsafe {
+            for plan in plans {
+                db::postgres::drop_plan(plan);
+            }
+
+            db::postgres::reset_session()
+        });
+
+        match reset {
+            Ok(Ok(())) => {}
+            Ok(Err(error)) => {
+                log::warn!("pglite: resetting session: {}", error);
+                return;
+            }
+            Err(_) => return,
+        }
+
+        let mut pool = self.inner.pool.lock().unwrap();
+
+        if pool.len() < pool_size {
+            pool.push(backend);
+        } else {
+            // shut down outside the lock
+            drop(pool);
+        }
+    }
+
+    /// Starts or stops sharing generic plans between sessions, so sessions
+    /// running the same prepared statements plan them once between them.
+    /// Off to begin with. Plans are shared between sessions with the same
+    /// role and search_path, and only for statements run outside a
+    /// transaction block in sessions without temporary tables. Settings
+    /// that affect planning, such as work_mem, aren't told apart.
+    ///
+    /// The setting is the process's, for every database open in it.
+    pub fn set_shared_plans(&self, enabled: bool) {
+        plancache::set_shared_plans(enabled);
+    }
+
+    /// Starts or stops sharing catalog tuples between sessions, so sessions
+    /// over a large schema keep one copy of each tuple they look up between
+    /// them rather than one each. Off to begin with. Each session still
+    /// keeps its own relcache, catalog lists and misses.
+    ///
+    /// The setting is the process's, for every database open in it.
+    pub fn set_shared_catcache(&self, enabled: bool) {
+        catcache::set_shared_catcache(enabled);
+    }
+
+    /// Starts or stops counting LWLock acquisitions and waits, to find the
+    /// locks sessions queue up on. Off to begin with. The counts are the
+    /// process's, shared by every database open in it, and are kept when
+    /// counting stops.
+    pub fn set_lwlock_stats(&self, enabled: bool) {
+        lmgr::set_stats(enabled);
+    }
+
+    /// Starts or stops reading relation files ahead through io_uring: up to
+    /// 32 blocks ahead of a sequential scan, and the blocks bitmap heap
+    /// scans prefetch, as effective_io_concurrency allows. Off to begin
+    /// with. Where io_uring isn't available, reads go on as they would
+    /// without it.
+    ///
+    /// The setting is the process's, for every database open in it.
+    pub fn set_readahead(&self, enabled: bool) {
+        smgr::set_readahead(enabled);
+    }
+
+    /// Starts or stops sharing descriptors of relation files between
+    /// backend threads, so a file every session reads is open once rather
+    /// than once in each, and one a session closed is kept open a while for
+    /// the next. Off to begin with. Up to half the process' descriptor limit
+    /// is kept open.
+    ///
+    /// The setting is the process's, for every database open in it.
+    pub fn set_shared_fds(&self, enabled: bool) {
+        fd::set_shared_fds(enabled);
+    }
+
+    /// What has been counted since counting was first switched on, for each
+    /// tranche of LWLocks acquired
+    pub fn lwlock_stats(&self) -> Vec<LWLockStats> {
+        lmgr::stats()
+    }
+
+    /// How the descriptors shared between backend threads have been used
+    /// since the process started
+    pub fn shared_fd_stats(&self) -> SharedFdStats {
+        fd::shared_fd_stats()
+    }
+}
@@ -1,11 +1,18 @@
 /// backend/bootstrap
 
 use std::ffi::CStr;
+use std::path::Path;
 use std::ptr;
 use pglite_sys as sys;
 
+/// Whether `data_dir` already holds a bootstrapped cluster
+pub fn is_bootstrapped(data_dir: &Path) -> bool {
+    data_dir.join("global/pg_control").exists()
+}
+
 pub unsafe fn main(data_dir: &CStr) {
     sys::InitStandaloneProcess();
+    sys::pglite_init_backend_signals();
     sys::InitializeGUCOptions();
 
     // this is where we would load postgresql.conf
@@ -30,4 +37,6 @@ pub unsafe fn main(data_dir: &CStr) {
     sys::CommitTransactionCommand();
 
     sys::RelationMapFinishBootstrap();
+
+    sys::pglite_end_backend_signals();
 }
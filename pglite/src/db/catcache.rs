@@ -0,0 +1,10 @@
+/// backend/utils/cache/catcache
+
+use pglite_sys as sys;
+
+/// Starts or stops sharing catalog tuples between the sessions of each
+/// cluster in the process; see shim/shared_catcache.c. Tuples shared so far
+/// are dropped on stopping.
+pub fn set_shared_catcache(enabled: bool) {
+    unsafe { sys::pglite_set_shared_catcache(enabled) }
+}
@@ -0,0 +1,76 @@
+/// backend/tcop/dest
+
+use std::any::Any;
+use std::os::raw::c_void;
+use std::panic::{self, AssertUnwindSafe};
+
+use pglite_sys as sys;
+
+use crate::backend::CallerPanic;
+use crate::row::{Column, Row};
+
+/// Feeds result rows to a Rust closure through the shim DestReceiver
+pub struct RowReceiver<F> {
+    f: F,
+    columns: Vec<Column>,
+    panic: Option<Box<dyn Any + Send>>,
+}
+
+impl<F: FnMut(&Row)> RowReceiver<F> {
+    pub fn new(f: F) -> Self {
+        RowReceiver { f, columns: Vec::new(), panic: None }
+    }
+
+    /// Calls `run` with a DestReceiver delivering to this receiver's
+    /// closure. A panic in the closure stops the executor and is resumed
+    /// here once `run` has returned and Postgres is in a consistent state.
+    pub unsafe fn run<R>(&mut self, run: impl FnOnce(*mut sys::DestReceiver) -> R) -> R {
+        let dest = sys::pglite_create_receiver(
+            Some(startup::<F>),
+            Some(receive::<F>),
+            self as *mut Self as *mut c_void,
+        );
+
+        let result = run(dest);
+
+        if let Some(destroy) = (*dest).rDestroy {
+            destroy(dest);
+        }
+
+        if let Some(payload) = self.panic.take() {
+            panic::resume_unwind(Box::new(CallerPanic(payload)));
+        }
+
+        result
+    }
+}
+
+unsafe extern "C" fn startup<F: FnMut(&Row)>(ctx: *mut c_void, desc: sys::TupleDesc) {
+    let receiver = &mut *(ctx as *mut RowReceiver<F>);
+    let natts = (*desc).natts as usize;
+
+    // called again for each statement that returns rows:
+    receiver.columns.clear();
+    receiver.columns.extend((0..natts).map(|attnum| Column::from_tupdesc(desc, attnum)));
+}
+
+unsafe extern "C" fn receive<F: FnMut(&Row)>(ctx: *mut c_void, slot: *mut sys::TupleTableSlot) -> bool {
+    let receiver = &mut *(ctx as *mut RowReceiver<F>);
+
+    if receiver.panic.is_some() {
+        return false;
+    }
+
+    let row = Row::from_slot(&receiver.columns, slot);
+    let f = &mut receiver.f;
+
+    // unwinding through the executor would skip its cleanup, so the panic
+    // is held until we're back out of Postgres:
+    match panic::catch_unwind(AssertUnwindSafe(|| f(&row))) {
+        Ok(()) => true,
+        Err(payload) => {
+            receiver.panic = Some(payload);
+            false
+        }
+    }
+}
@@ -0,0 +1,49 @@
+/// backend/storage/file/fd
+
+use pglite_sys as sys;
+
+/// How the descriptors of relation segments shared between backend threads
+/// have been used, by every cluster in the process
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct SharedFdStats {
+    /// Relation segments opened while sharing
+    pub opens: u64,
+    /// Of those, segments some thread had open already, or had let go of
+    /// and were still open
+    pub hits: u64,
+    /// Idle descriptors closed to keep within the process' limit
+    pub evictions: u64,
+    /// Descriptors open now
+    pub open: u64,
+}
+
+impl SharedFdStats {
+    /// The share of opens that were hits, 0 if there were none
+    pub fn hit_rate(&self) -> f64 {
+        if self.opens == 0 {
+            0.0
+        } else {
+            self.hits as f64 / self.opens as f64
+        }
+    }
+}
+
+/// Starts or stops sharing descriptors of relation segments between backend
+/// threads; see shim/shared_fd.c. Those shared already stay so until their
+/// threads close them.
+pub fn set_shared_fds(enabled: bool) {
+    unsafe { sys::pglite_set_shared_fds(enabled) }
+}
+
+pub fn shared_fd_stats() -> SharedFdStats {
+    let mut stats = sys::PgliteSharedFdStats { opens: 0, hits: 0, evictions: 0, open: 0 };
+
+    unsafe { sys::pglite_shared_fd_stats(&mut stats) };
+
+    SharedFdStats {
+        opens: stats.opens,
+        hits: stats.hits,
+        evictions: stats.evictions,
+        open: stats.open,
+    }
+}
@@ -0,0 +1,31 @@
+/// backend/utils/misc/guc
+
+use std::ffi::CString;
+use std::sync::Arc;
+use pglite_sys as sys;
+
+/// Server settings a cluster is started with, in place of postgresql.conf.
+/// The postmaster and every thread attached to it apply the same ones, as
+/// the likes of `shared_buffers` and `max_connections` decide the layout of
+/// the shared memory.
+#[derive(Debug, Clone, Default)]
+pub struct Settings(Arc<[(CString, CString)]>);
+
+impl Settings {
+    /// Returns `None` if a name or value contains a nul
+    pub fn new(settings: &[(&str, &str)]) -> Option<Self> {
+        settings.iter()
+            .map(|&(name, value)| Some((CString::new(name).ok()?, CString::new(value).ok()?)))
+            .collect::<Option<Vec<_>>>()
+            .map(|settings| Settings(settings.into()))
+    }
+
+    /// Sets each of them as the postmaster does its `-c` options. Called
+    /// after `InitializeGUCOptions`; an invalid setting raises a FATAL
+    /// error, there being no error handler yet.
+    pub unsafe fn apply(&self) {
+        for (name, value) in self.0.iter() {
+            sys::SetConfigOption(name.as_ptr(), value.as_ptr(), sys::GucContext_PGC_POSTMASTER, sys::GucSource_PGC_S_ARGV);
+        }
+    }
+}
@@ -7,7 +7,6 @@ pub unsafe fn thread_start() {
     tls();
 
     // main.c
-    sys::pglite_init_dummy_spin_lock();
     sys::MemoryContextInit();
     sys::check_strxfrm_bug();
 }
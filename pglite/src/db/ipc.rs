@@ -0,0 +1,40 @@
+/// backend/storage/ipc
+
+use std::io;
+use std::ptr::NonNull;
+use pglite_sys as sys;
+
+/// Where the shared memory created by the postmaster lives, for backend
+/// threads to attach to
+#[derive(Debug, Copy, Clone)]
+pub struct SharedMemory(NonNull<sys::PgliteSharedMemory>);
+
+unsafe impl Send for SharedMemory {}
+unsafe impl Sync for SharedMemory {}
+
+/// Records the shared memory created on this thread
+pub unsafe fn export() -> io::Result<SharedMemory> {
+    NonNull::new(sys::pglite_export_shared_memory())
+        .map(SharedMemory)
+        .ok_or_else(io::Error::last_os_error)
+}
+
+impl SharedMemory {
+    /// Points this thread's shared memory globals at it. See
+    /// `postmaster::init_child`.
+    pub unsafe fn attach(self) {
+        sys::pglite_attach_shared_memory(self.0.as_ptr());
+    }
+
+    /// Tells every thread attached that the cluster is going down after a
+    /// crash. See `postmaster::Children::reap`.
+    pub unsafe fn crash(self) {
+        sys::pglite_crash_shared_memory(self.0.as_ptr());
+    }
+
+    /// Only once the thread that created it and every thread attached to it
+    /// have shut down
+    pub unsafe fn free(self) {
+        sys::pglite_free_shared_memory(self.0.as_ptr());
+    }
+}
@@ -0,0 +1,49 @@
+/// backend/storage/lmgr
+
+use std::ffi::CStr;
+use std::time::Duration;
+use pglite_sys as sys;
+
+/// Tranches past this many aren't counted; see shim/lwlock_stats.c
+const LWLOCK_TRANCHES: usize = 256;
+
+/// How much one tranche of LWLocks has been acquired and waited for, by
+/// every backend thread of the process while counting was switched on
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct LWLockStats {
+    /// The tranche's name, as pg_stat_activity's wait_event gives it
+    pub tranche: String,
+    pub acquisitions: u64,
+    /// Acquisitions that had to sleep until the lock was released
+    pub contended: u64,
+    /// Times a backend spun on the lock's wait list before it could queue
+    pub spin_delays: u64,
+    /// Time spent asleep in contended acquisitions, summed over backends
+    pub wait: Duration,
+}
+
+/// Starts or stops counting for every cluster in the process. Counting
+/// costs a branch per acquisition while it's switched off.
+pub fn set_stats(enabled: bool) {
+    unsafe { sys::pglite_set_lwlock_stats(enabled) }
+}
+
+/// The counts of every tranche acquired at least once
+pub fn stats() -> Vec<LWLockStats> {
+    let mut stats: Vec<sys::PgliteLWLockStats> = Vec::with_capacity(LWLOCK_TRANCHES);
+
+    unsafe {
+        let n = sys::pglite_lwlock_stats(stats.as_mut_ptr(), LWLOCK_TRANCHES as i32);
+        stats.set_len(n as usize);
+    }
+
+    stats.iter()
+        .map(|tranche| LWLockStats {
+            tranche: unsafe { CStr::from_ptr(tranche.name) }.to_string_lossy().into_owned(),
+            acquisitions: tranche.acquisitions,
+            contended: tranche.contended,
+            spin_delays: tranche.spin_delays,
+            wait: Duration::from_nanos(tranche.wait_ns),
+        })
+        .collect()
+}
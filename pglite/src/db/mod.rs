@@ -1,3 +1,12 @@
 pub mod bootstrap;
+pub mod catcache;
+pub mod dest;
+pub mod fd;
+pub mod guc;
 pub mod init;
+pub mod ipc;
+pub mod lmgr;
+pub mod plancache;
+pub mod postgres;
 pub mod postmaster;
+pub mod smgr;
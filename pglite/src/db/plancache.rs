@@ -0,0 +1,10 @@
+/// backend/utils/cache/plancache
+
+use pglite_sys as sys;
+
+/// Starts or stops sharing generic plans between the sessions of each
+/// cluster in the process; see shim/shared_plan.c. Plans shared so far are
+/// dropped on stopping.
+pub fn set_shared_plans(enabled: bool) {
+    unsafe { sys::pglite_set_shared_plans(enabled) }
+}
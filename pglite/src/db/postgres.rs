@@ -0,0 +1,228 @@
+/// backend/tcop
+
+use std::ffi::{CStr, CString};
+use std::ptr::{self, NonNull};
+use pglite_sys as sys;
+
+use crate::error::PostgresError;
+use crate::row::Row;
+use crate::value::Value;
+use super::dest::RowReceiver;
+use super::guc::Settings;
+use super::ipc::SharedMemory;
+
+/// Initialises this thread as a standalone backend connected to the cluster
+/// in `data_dir` with `settings`, much like `PostgresSingleUserMain`
+pub unsafe fn main(data_dir: &CStr, settings: &Settings) {
+    sys::InitStandaloneProcess();
+    sys::pglite_init_backend_signals();
+    sys::InitializeGUCOptions();
+    settings.apply();
+
+    // this is where we would load postgresql.conf
+    // guc.c SelectConfigFiles
+
+    sys::SetDataDir(data_dir.as_ptr());
+    sys::checkDataDir();
+    sys::LocalProcessControlFile(false);
+
+    sys::InitializeMaxBackends();
+    sys::CreateSharedMemoryAndSemaphores();
+    sys::InitProcess();
+    sys::BaseInit();
+
+    sys::pglite_shared_plan_init_backend();
+    sys::pglite_shared_catcache_init_backend();
+
+    // bootstrap only creates template1
+    let dbname = b"template1\0";
+    let invalid_oid: sys::Oid = 0;
+    sys::InitPostgres(dbname.as_ptr() as *const _, invalid_oid, ptr::null(), invalid_oid, false, false, ptr::null_mut());
+
+    sys::pglite_set_normal_processing_mode();
+}
+
+/// Initialises this thread as a backend on the cluster the postmaster
+/// started with `settings`, sharing its shared memory, much like a
+/// postmaster child
+pub unsafe fn attach(data_dir: &CStr, settings: &Settings, shared: SharedMemory) {
+    super::postmaster::init_child(data_dir, settings, shared);
+    sys::pglite_claim_child_slot();
+
+    // finding the shared structures takes locks, and waiting on a lock
+    // takes a PGPROC:
+    sys::InitProcess();
+    sys::CreateSharedMemoryAndSemaphores();
+    sys::BaseInit();
+
+    let dbname = b"template1\0";
+    sys::pglite_init_attached_session(dbname.as_ptr() as *const _);
+
+    sys::pglite_set_normal_processing_mode();
+}
+
+/// Runs every statement in `query`, handing any result rows to `f`. Returns
+/// the number of rows processed by the last statement.
+pub unsafe fn exec(query: &CStr, f: impl FnMut(&Row)) -> Result<u64, PostgresError> {
+    let mut receiver = RowReceiver::new(f);
+    let mut processed = 0;
+
+    let edata = receiver.run(|dest| {
+        sys::pglite_exec(query.as_ptr(), dest, &mut processed)
+    });
+
+    if edata.is_null() {
+        Ok(processed)
+    } else {
+        Err(PostgresError::from_edata(edata))
+    }
+}
+
+/// Runs a fixed utility command such as `b"BEGIN\0"`, discarding any rows
+pub unsafe fn command(sql: &'static [u8]) -> Result<u64, PostgresError> {
+    exec(CStr::from_bytes_with_nul(sql).unwrap(), |_| ())
+}
+
+/// A statement saved in the backend's plan cache. Only valid on the backend
+/// thread that prepared it, and only until it's passed to `drop_plan`.
+#[derive(Debug, Copy, Clone)]
+pub struct Plan(NonNull<sys::CachedPlanSource>);
+
+unsafe impl Send for Plan {}
+
+/// Parses and analyzes the single statement in `query` into the plan cache
+pub unsafe fn prepare(query: &CStr) -> Result<Plan, PostgresError> {
+    let mut plansource = ptr::null_mut();
+    let edata = sys::pglite_prepare(query.as_ptr(), &mut plansource);
+
+    if edata.is_null() {
+        Ok(Plan(NonNull::new(plansource).unwrap()))
+    } else {
+        Err(PostgresError::from_edata(edata))
+    }
+}
+
+/// Runs a prepared statement with `params`, handing any result rows to `f`.
+/// Returns the number of rows processed.
+pub unsafe fn execute_plan(plan: Plan, params: &[Value], f: impl FnMut(&Row)) -> Result<u64, PostgresError> {
+    let params = params.iter()
+        .map(Value::as_param)
+        .collect::<Vec<_>>();
+
+    let mut receiver = RowReceiver::new(f);
+    let mut processed = 0;
+
+    let edata = receiver.run(|dest| {
+        sys::pglite_execute_plan(plan.0.as_ptr(), params.as_ptr(), params.len() as _, dest, &mut processed)
+    });
+
+    if edata.is_null() {
+        Ok(processed)
+    } else {
+        Err(PostgresError::from_edata(edata))
+    }
+}
+
+/// Opens a cursor over a prepared statement, returning the portal's name.
+/// Must be called inside a transaction block.
+pub unsafe fn open_cursor(plan: Plan, params: &[Value]) -> Result<CString, PostgresError> {
+    let params = params.iter()
+        .map(Value::as_param)
+        .collect::<Vec<_>>();
+
+    let mut name = ptr::null_mut();
+    let edata = sys::pglite_open_cursor(plan.0.as_ptr(), params.as_ptr(), params.len() as _, &mut name);
+
+    if edata.is_null() {
+        let portal = CStr::from_ptr(name).to_owned();
+        sys::pfree(name as *mut _);
+        Ok(portal)
+    } else {
+        Err(PostgresError::from_edata(edata))
+    }
+}
+
+/// Hands up to `count` more rows from a cursor to `f`, returning how many
+/// there were
+pub unsafe fn fetch(portal: &CStr, count: usize, f: impl FnMut(&Row)) -> Result<u64, PostgresError> {
+    let mut receiver = RowReceiver::new(f);
+    let mut processed = 0;
+
+    let edata = receiver.run(|dest| {
+        sys::pglite_fetch(portal.as_ptr(), count as _, dest, &mut processed)
+    });
+
+    if edata.is_null() {
+        Ok(processed)
+    } else {
+        Err(PostgresError::from_edata(edata))
+    }
+}
+
+pub unsafe fn close_cursor(portal: &CStr) -> Result<(), PostgresError> {
+    let edata = sys::pglite_close_cursor(portal.as_ptr());
+
+    if edata.is_null() {
+        Ok(())
+    } else {
+        Err(PostgresError::from_edata(edata))
+    }
+}
+
+/// Bulk loads `rows` into `table`, each row holding a value for each of
+/// `columns`, or for every column of the table if `columns` is empty.
+/// Returns the number of rows inserted.
+pub unsafe fn copy_in<R: AsRef<[Value]>>(table: &CStr, columns: &[CString], width: usize, rows: &[R]) -> Result<u64, PostgresError> {
+    let columns = columns.iter()
+        .map(|column| column.as_ptr())
+        .collect::<Vec<_>>();
+
+    let values = rows.iter()
+        .flat_map(|row| row.as_ref())
+        .map(Value::as_param)
+        .collect::<Vec<_>>();
+
+    let mut processed = 0;
+
+    let edata = sys::pglite_copy_in(
+        table.as_ptr(),
+        columns.as_ptr(),
+        columns.len() as _,
+        values.as_ptr(),
+        width as _,
+        rows.len() as _,
+        &mut processed,
+    );
+
+    if edata.is_null() {
+        Ok(processed)
+    } else {
+        Err(PostgresError::from_edata(edata))
+    }
+}
+
+pub unsafe fn drop_plan(plan: Plan) {
+    let edata = sys::pglite_drop_plan(plan.0.as_ptr());
+
+    if !edata.is_null() {
+        log::warn!("pglite: dropping cached plan: {}", PostgresError::from_edata(edata));
+    }
+}
+
+/// Ends whatever a session left behind so the backend can serve another:
+/// rolls back any transaction block, aborted or not, and discards temporary
+/// tables, prepared statements, settings, advisory locks and the like
+pub unsafe fn reset_session() -> Result<(), PostgresError> {
+    if sys::IsTransactionBlock() {
+        command(b"ROLLBACK\0")?;
+    }
+
+    command(b"DISCARD ALL\0").map(|_| ())
+}
+
+/// Releases this backend's shared memory and per-backend resources
+pub unsafe fn shutdown() {
+    sys::shmem_exit(0);
+    sys::pglite_detach_shared_memory();
+    sys::pglite_end_backend_signals();
+}
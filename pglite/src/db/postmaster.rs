@@ -0,0 +1,605 @@
+/// backend/postmaster
+///
+/// The postmaster as a thread of its own. It creates the shared memory,
+/// runs startup, and keeps the checkpointer, background writer, WAL writer
+/// and autovacuum going as child threads until it's told to shut down,
+/// along with the background workers backends register, such as parallel
+/// query workers. Each child attaches to the shared memory as a forked child
+/// would inherit it, then runs the process' own main function until that
+/// calls `proc_exit`.
+///
+/// A child that crashes may leave shared memory inconsistent, with locks
+/// held or a change half made. The postmaster would reinitialise it once
+/// every process had exited, but backend threads attached to it only exit
+/// as their connections are dropped. So the cluster goes down instead: the
+/// children are stopped without a shutdown checkpoint, backends fail every
+/// call from then on, and the next open runs crash recovery.
+
+use std::ffi::{CStr, CString};
+use std::mem;
+use std::panic::{self, AssertUnwindSafe};
+use std::ptr;
+use std::sync::Arc;
+use std::sync::atomic::{AtomicBool, AtomicI32, Ordering};
+use std::sync::mpsc;
+use std::thread;
+use std::time::{Duration, Instant};
+use pglite_sys as sys;
+use pglite_sys::error::ExitThread;
+
+use crate::backend::BackendGone;
+use super::guc::Settings;
+use super::init;
+use super::ipc::{self, SharedMemory};
+
+/// How long the postmaster sleeps between checks on its children when none
+/// of them has asked anything of it, in milliseconds
+const NAPTIME: libc::c_long = 1000;
+
+/// How often a child that's been asked to exit is asked again, in case it
+/// wasn't yet listening
+const STOP_INTERVAL: Duration = Duration::from_millis(10);
+
+/// How long children get to exit after a crash before they're left
+/// running, as SIGKILL_CHILDREN_AFTER_SECS has it
+const CRASH_STOP_TIMEOUT: Duration = Duration::from_secs(5);
+
+pub struct Postmaster {
+    control: Arc<Control>,
+    shared: SharedMemory,
+    thread: Option<thread::JoinHandle<()>>,
+}
+
+struct Control {
+    shutdown: AtomicBool,
+    /// set once a child crashed and the cluster went down
+    crashed: AtomicBool,
+    /// the postmaster thread's id, to wake it with
+    tid: AtomicI32,
+}
+
+impl Postmaster {
+    /// Starts the cluster in `data_dir` with `settings` on a postmaster
+    /// thread and waits for startup to finish, after which backends can
+    /// attach
+    pub fn start(data_dir: CString, settings: Settings) -> Result<Self, BackendGone> {
+        let control = Arc::new(Control {
+            shutdown: AtomicBool::new(false),
+            crashed: AtomicBool::new(false),
+            tid: AtomicI32::new(0),
+        });
+
+        let (ready, started) = mpsc::sync_channel(1);
+
+        let thread = thread::spawn({
+            let control = control.clone();
+            move || main(data_dir, settings, control, ready)
+        });
+
+        match started.recv() {
+            Ok(shared) => Ok(Postmaster { control, shared, thread: Some(thread) }),
+            Err(_) => {
+                // gave up on startup, and has cleaned up after itself:
+                let _ = thread.join();
+                Err(BackendGone)
+            }
+        }
+    }
+
+    /// The shared memory backends attach to. Valid for as long as the
+    /// postmaster is.
+    pub fn shared(&self) -> SharedMemory {
+        self.shared
+    }
+
+    /// Whether the cluster went down after a child crashed. Backends
+    /// attached fail every call from then on, and no more can attach.
+    pub fn crashed(&self) -> bool {
+        self.control.crashed.load(Ordering::Acquire)
+    }
+}
+
+impl Drop for Postmaster {
+    /// Shuts down the children, the checkpointer last with a shutdown
+    /// checkpoint, then the postmaster itself. Every backend attached must
+    /// have exited first.
+    fn drop(&mut self) {
+        self.control.shutdown.store(true, Ordering::Release);
+        signal_thread(self.control.tid.load(Ordering::Acquire), libc::SIGUSR1);
+
+        if let Some(thread) = self.thread.take() {
+            if thread.join().is_err() {
+                log::error!("pglite: postmaster thread panicked");
+            }
+        }
+    }
+}
+
+/// Readies a new thread to attach to the cluster in `data_dir` started with
+/// `settings`, much like
+/// `InitPostmasterChild` and `SubPostmasterMain` ready a forked child. What
+/// comes next depends on the kind of process: it needs a PGPROC before it
+/// can find anything else in the shared memory.
+pub unsafe fn init_child(data_dir: &CStr, settings: &Settings, shared: SharedMemory) {
+    sys::InitStandaloneProcess();
+    sys::pglite_init_backend_signals();
+    sys::InitializeGUCOptions();
+    settings.apply();
+
+    sys::SetDataDir(data_dir.as_ptr());
+    sys::checkDataDir();
+    sys::LocalProcessControlFile(false);
+
+    sys::InitializeMaxBackends();
+    shared.attach();
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+enum ChildKind {
+    Startup,
+    Checkpointer,
+    BgWriter,
+    WalWriter,
+    AutoVacLauncher,
+    AutoVacWorker,
+    BgWorker(BgWorkerEntry),
+}
+
+/// A background worker's details, handed from the postmaster to the thread
+/// that runs it
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+struct BgWorkerEntry(*mut sys::BackgroundWorker);
+
+unsafe impl Send for BgWorkerEntry {}
+
+impl ChildKind {
+    unsafe fn main(self) {
+        match self {
+            ChildKind::Startup => sys::pglite_auxiliary_main(sys::AuxProcType_StartupProcess),
+            ChildKind::Checkpointer => sys::pglite_auxiliary_main(sys::AuxProcType_CheckpointerProcess),
+            ChildKind::BgWriter => sys::pglite_auxiliary_main(sys::AuxProcType_BgWriterProcess),
+            ChildKind::WalWriter => sys::pglite_auxiliary_main(sys::AuxProcType_WalWriterProcess),
+            ChildKind::AutoVacLauncher => sys::pglite_autovac_launcher_main(),
+            ChildKind::AutoVacWorker => sys::pglite_autovac_worker_main(),
+            ChildKind::BgWorker(entry) => sys::pglite_bgworker_main(entry.0),
+        }
+    }
+}
+
+/// A child of the postmaster, in place of a forked process
+struct Child {
+    kind: ChildKind,
+    /// the child thread's id, its pid as far as Postgres is concerned
+    pid: libc::pid_t,
+    /// `pid` while the child is running, zero after
+    tid: Arc<AtomicI32>,
+    /// yields the child's exit code
+    thread: thread::JoinHandle<i32>,
+}
+
+impl Child {
+    fn spawn(kind: ChildKind, data_dir: &CString, settings: &Settings, shared: SharedMemory) -> Self {
+        let tid = Arc::new(AtomicI32::new(0));
+        let data_dir = data_dir.clone();
+        let settings = settings.clone();
+
+        // a child starts with every signal blocked, as a forked child
+        // inherits the postmaster's mask, and unblocks them once its handlers
+        // are in place. Until then a signal's default action would be taken,
+        // which for most of them ends the whole process.
+        let (started, pid) = mpsc::sync_channel(1);
+
+        let thread = with_signals_blocked(|| thread::spawn({
+            let tid = tid.clone();
+            move || child_main(kind, &data_dir, &settings, shared, &tid, started)
+        }));
+
+        // known as soon as the thread is running:
+        let pid = pid.recv().unwrap_or(0);
+
+        Child { kind, pid, tid, thread }
+    }
+
+    fn is_finished(&self) -> bool {
+        self.thread.is_finished()
+    }
+
+    fn signal(&self, signal: libc::c_int) {
+        signal_thread(self.tid.load(Ordering::Acquire), signal);
+    }
+
+    /// Waits for the child to exit, returning its exit code, or `None` if
+    /// it panicked
+    fn join(self) -> Option<i32> {
+        match self.thread.join() {
+            Ok(code) => Some(code),
+            Err(_) => {
+                log::error!("pglite: {:?} thread panicked", self.kind);
+                None
+            }
+        }
+    }
+
+    /// Sends the child `signal` until it exits
+    fn stop(self, signal: libc::c_int) -> Option<i32> {
+        while !self.is_finished() {
+            self.signal(signal);
+            thread::sleep(STOP_INTERVAL);
+        }
+
+        self.join()
+    }
+
+    /// As `stop`, but gives up once `deadline` passes and leaves the child
+    /// running. Returns whether it exited.
+    fn stop_until(self, signal: libc::c_int, deadline: Instant) -> bool {
+        while !self.is_finished() {
+            if Instant::now() >= deadline {
+                log::error!("pglite: {:?} did not exit, leaving it running", self.kind);
+                return false;
+            }
+
+            self.signal(signal);
+            thread::sleep(STOP_INTERVAL);
+        }
+
+        self.join();
+        true
+    }
+}
+
+/// A child that exited in a way that may have left shared memory
+/// inconsistent, as the postmaster's `reaper` judges it
+#[derive(Debug)]
+struct Crash {
+    kind: ChildKind,
+    /// `None` if it panicked
+    code: Option<i32>,
+}
+
+/// Clears a child's thread id however it exits, so it's never signalled
+/// after its id may have been reused
+struct ClearTid<'a>(&'a AtomicI32);
+
+impl<'a> Drop for ClearTid<'a> {
+    fn drop(&mut self) {
+        self.0.store(0, Ordering::Release);
+    }
+}
+
+fn child_main(kind: ChildKind, data_dir: &CStr, settings: &Settings, shared: SharedMemory, tid: &AtomicI32, started: mpsc::SyncSender<libc::pid_t>) -> i32 {
+    let pid = unsafe { libc::gettid() };
+    tid.store(pid, Ordering::Release);
+    let _clear = ClearTid(tid);
+    let _ = started.send(pid);
+
+    let result = panic::catch_unwind(AssertUnwindSafe(|| unsafe {
+        init::thread_start();
+        init_child(data_dir, settings, shared);
+        kind.main();
+    }));
+
+    match result {
+        // the main functions only ever leave through proc_exit:
+        Ok(()) => 0,
+        Err(payload) => match payload.downcast::<ExitThread>() {
+            Ok(exit) => exit.code(),
+            Err(payload) => panic::resume_unwind(payload),
+        },
+    }
+}
+
+/// The children the postmaster thread looks after
+struct Children {
+    data_dir: CString,
+    settings: Settings,
+    shared: SharedMemory,
+    checkpointer: Option<Child>,
+    bgwriter: Option<Child>,
+    walwriter: Option<Child>,
+    autovac_launcher: Option<Child>,
+    autovac_workers: Vec<Child>,
+    bgworkers: Vec<BgWorker>,
+}
+
+/// A background worker's thread, and its registration in the postmaster
+struct BgWorker {
+    registered: *mut sys::RegisteredBgWorker,
+    child: Child,
+}
+
+impl Children {
+    fn spawn(&self, kind: ChildKind) -> Child {
+        Child::spawn(kind, &self.data_dir, &self.settings, self.shared)
+    }
+
+    /// Runs the startup process to completion, returning whether it
+    /// succeeded. Recovery may request checkpoints, so the checkpointer has
+    /// to be running already.
+    fn startup(&self) -> bool {
+        let startup = self.spawn(ChildKind::Startup);
+        startup.join() == Some(0)
+    }
+
+    /// Restarts the background and WAL writers if they exited cleanly
+    /// without being asked to, and forgets the autovacuum workers and
+    /// background workers that have finished. Any other exit is a crash, as
+    /// is any exit of the checkpointer, which only exits when asked to;
+    /// the first found is returned once every finished child is reaped, and
+    /// nothing is restarted after it.
+    fn reap(&mut self) -> Result<(), Crash> {
+        let mut crash = None;
+
+        for kind in [ChildKind::Checkpointer, ChildKind::BgWriter, ChildKind::WalWriter] {
+            let slot = match kind {
+                ChildKind::Checkpointer => &mut self.checkpointer,
+                ChildKind::BgWriter => &mut self.bgwriter,
+                _ => &mut self.walwriter,
+            };
+
+            if slot.as_ref().map_or(false, Child::is_finished) {
+                let code = slot.take().and_then(Child::join);
+
+                if kind == ChildKind::Checkpointer || code != Some(0) {
+                    crash.get_or_insert(Crash { kind, code });
+                } else {
+                    log::warn!("pglite: {:?} exited, restarting it", kind);
+                }
+            }
+
+            if slot.is_none() && crash.is_none() {
+                *slot = Some(Child::spawn(kind, &self.data_dir, &self.settings, self.shared));
+            }
+        }
+
+        if self.autovac_launcher.as_ref().map_or(false, Child::is_finished) {
+            // started again by `serve` if autovacuum is still on:
+            let code = self.autovac_launcher.take().and_then(Child::join);
+
+            if code != Some(0) {
+                crash.get_or_insert(Crash { kind: ChildKind::AutoVacLauncher, code });
+            }
+        }
+
+        let (finished, running) = mem::take(&mut self.autovac_workers)
+            .into_iter()
+            .partition::<Vec<_>, _>(Child::is_finished);
+
+        self.autovac_workers = running;
+
+        for worker in finished {
+            // a FATAL error exits with 1, which leaves shared memory as it
+            // should be:
+            let code = worker.join();
+
+            if !matches!(code, Some(0 | 1)) {
+                crash.get_or_insert(Crash { kind: ChildKind::AutoVacWorker, code });
+            }
+        }
+
+        let (finished, running) = mem::take(&mut self.bgworkers)
+            .into_iter()
+            .partition::<Vec<_>, _>(|worker| worker.child.is_finished());
+
+        self.bgworkers = running;
+
+        for worker in finished {
+            let kind = worker.child.kind;
+            let code = worker.child.join();
+
+            // a panic counts as a crash:
+            unsafe { sys::pglite_bgworker_exited(worker.registered, code.unwrap_or(1)); }
+
+            if !matches!(code, Some(0 | 1)) {
+                crash.get_or_insert(Crash { kind, code });
+            }
+        }
+
+        match crash {
+            Some(crash) => Err(crash),
+            None => Ok(()),
+        }
+    }
+
+    /// Acts on what children asked of us, like the postmaster's
+    /// `sigusr1_handler` and `ServerLoop`
+    fn serve(&mut self, requests: libc::c_int) {
+        let start_launcher = requests & sys::PGLITE_PM_START_AUTOVAC_LAUNCHER as libc::c_int != 0;
+
+        if self.autovac_launcher.is_none() && (start_launcher || unsafe { sys::AutoVacuumingActive() }) {
+            self.autovac_launcher = Some(self.spawn(ChildKind::AutoVacLauncher));
+        }
+
+        if requests & sys::PGLITE_PM_START_AUTOVAC_WORKER as libc::c_int != 0 {
+            let worker = self.spawn(ChildKind::AutoVacWorker);
+            self.autovac_workers.push(worker);
+        }
+
+        self.start_bgworkers();
+    }
+
+    /// Starts every registered background worker that's due, like
+    /// `maybe_start_bgworkers`
+    fn start_bgworkers(&mut self) {
+        loop {
+            let mut entry = ptr::null_mut();
+            let registered = unsafe { sys::pglite_next_bgworker(&mut entry) };
+
+            if registered.is_null() {
+                break;
+            }
+
+            let child = self.spawn(ChildKind::BgWorker(BgWorkerEntry(entry)));
+            unsafe { sys::pglite_bgworker_started(registered, child.pid); }
+
+            self.bgworkers.push(BgWorker { registered, child });
+        }
+    }
+
+    /// Stops every child after a crash, without the shutdown checkpoint,
+    /// as `HandleChildCrash` does. Every thread attached has been told the
+    /// cluster is going down, and exits from its next latch wait, which
+    /// SIGUSR1 wakes it from. Returns whether every child exited in time.
+    fn abort(&mut self) -> bool {
+        let deadline = Instant::now() + CRASH_STOP_TIMEOUT;
+
+        let children = self.autovac_launcher.take().into_iter()
+            .chain(self.autovac_workers.drain(..))
+            .chain(self.bgworkers.drain(..).map(|worker| worker.child))
+            .chain([self.bgwriter.take(), self.walwriter.take(), self.checkpointer.take()].into_iter().flatten())
+            .collect::<Vec<_>>();
+
+        children.into_iter()
+            .fold(true, |stopped, child| child.stop_until(libc::SIGUSR1, deadline) && stopped)
+    }
+
+    /// Stops every child, in the order a fast shutdown does
+    fn stop(&mut self) {
+        if let Some(launcher) = self.autovac_launcher.take() {
+            launcher.stop(libc::SIGTERM);
+        }
+
+        for worker in self.autovac_workers.drain(..) {
+            worker.stop(libc::SIGTERM);
+        }
+
+        for worker in self.bgworkers.drain(..) {
+            worker.child.stop(libc::SIGTERM);
+        }
+
+        for child in [self.bgwriter.take(), self.walwriter.take()].into_iter().flatten() {
+            child.stop(libc::SIGTERM);
+        }
+
+        // runs the shutdown checkpoint, then exits:
+        if let Some(checkpointer) = self.checkpointer.take() {
+            if checkpointer.stop(libc::SIGUSR2) != Some(0) {
+                log::error!("pglite: shutdown checkpoint failed");
+            }
+        }
+    }
+}
+
+fn main(data_dir: CString, settings: Settings, control: Arc<Control>, ready: mpsc::SyncSender<SharedMemory>) {
+    control.tid.store(unsafe { libc::gettid() }, Ordering::Release);
+
+    unsafe {
+        init::thread_start();
+
+        sys::InitStandaloneProcess();
+        sys::pglite_init_backend_signals();
+        sys::pglite_postmaster_init();
+        sys::InitializeGUCOptions();
+        settings.apply();
+
+        sys::SetDataDir(data_dir.as_ptr());
+        sys::checkDataDir();
+        sys::LocalProcessControlFile(false);
+
+        sys::InitializeMaxBackends();
+        sys::CreateSharedMemoryAndSemaphores();
+    }
+
+    let shared = match unsafe { ipc::export() } {
+        Ok(shared) => shared,
+        Err(err) => {
+            log::error!("pglite: failed to export shared memory: {}", err);
+            unsafe { sys::shmem_exit(1); }
+            return;
+        }
+    };
+
+    let mut children = Children {
+        data_dir,
+        settings,
+        shared,
+        checkpointer: None,
+        bgwriter: None,
+        walwriter: None,
+        autovac_launcher: None,
+        autovac_workers: Vec::new(),
+        bgworkers: Vec::new(),
+    };
+
+    children.checkpointer = Some(children.spawn(ChildKind::Checkpointer));
+    children.bgwriter = Some(children.spawn(ChildKind::BgWriter));
+
+    let mut crash = None;
+
+    if children.startup() {
+        children.walwriter = Some(children.spawn(ChildKind::WalWriter));
+        children.serve(0);
+
+        if ready.send(shared).is_ok() {
+            while !control.shutdown.load(Ordering::Acquire) {
+                let requests = unsafe { sys::pglite_postmaster_wait(NAPTIME) };
+
+                if let Err(err) = children.reap() {
+                    crash = Some(err);
+                    break;
+                }
+
+                children.serve(requests);
+            }
+        }
+    } else {
+        log::error!("pglite: startup process failed");
+        drop(ready);
+    }
+
+    match crash {
+        Some(crash) => {
+            log::error!("pglite: {:?} exited with {:?}, shutting the cluster down", crash.kind, crash.code);
+
+            control.crashed.store(true, Ordering::Release);
+            unsafe { shared.crash(); }
+
+            let stopped = children.abort();
+
+            // backends stay attached until their connections are dropped:
+            while !control.shutdown.load(Ordering::Acquire) {
+                unsafe { sys::pglite_postmaster_wait(NAPTIME); }
+            }
+
+            if !stopped {
+                log::error!("pglite: leaving shared memory in place for the children still running");
+                unsafe { sys::pglite_end_backend_signals(); }
+                return;
+            }
+        }
+        None => children.stop(),
+    }
+
+    unsafe {
+        sys::shmem_exit(0);
+        shared.free();
+        sys::pglite_end_backend_signals();
+    }
+}
+
+/// Runs `f` with every signal blocked on this thread, so threads it spawns
+/// start out that way
+fn with_signals_blocked<R>(f: impl FnOnce() -> R) -> R {
+    unsafe {
+        let mut all = mem::zeroed::<libc::sigset_t>();
+        let mut old = mem::zeroed::<libc::sigset_t>();
+
+        libc::sigfillset(&mut all);
+        libc::pthread_sigmask(libc::SIG_SETMASK, &all, &mut old);
+
+        let result = f();
+
+        libc::pthread_sigmask(libc::SIG_SETMASK, &old, ptr::null_mut());
+        result
+    }
+}
+
+/// Sends `signal` to our thread `tid`, if it's running, and never to a
+/// process of that id
+fn signal_thread(tid: libc::pid_t, signal: libc::c_int) {
+    if tid != 0 {
+        unsafe {
+            libc::syscall(libc::SYS_tgkill, libc::getpid(), tid, signal);
+        }
+    }
+}
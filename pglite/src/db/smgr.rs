@@ -0,0 +1,10 @@
+/// backend/storage/smgr
+
+use pglite_sys as sys;
+
+/// Starts or stops reading data files ahead of sequential scans and of
+/// bufmgr's prefetches through io_uring; see shim/readahead.c. Each backend
+/// thread sets up its ring the first time it reads with this on.
+pub fn set_readahead(enabled: bool) {
+    unsafe { sys::pglite_set_readahead(enabled) }
+}
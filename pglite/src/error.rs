@@ -0,0 +1,84 @@
+use std::ffi::CStr;
+use std::fmt;
+use std::os::raw::c_char;
+
+use pglite_sys as sys;
+
+#[derive(Debug)]
+pub enum Error {
+    /// Postgres raised an error running the statement. The transaction it
+    /// ran in has been rolled back.
+    Postgres(PostgresError),
+    QueryContainsNul,
+    /// rows passed to `copy_in` must all have the same number of values
+    RowLengthMismatch { expected: usize, found: usize },
+    /// the backend thread exited, most likely because Postgres raised a
+    /// FATAL error on it
+    BackendGone,
+}
+
+impl fmt::Display for Error {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        match self {
+            Error::Postgres(error) => write!(f, "{}", error),
+            Error::QueryContainsNul => write!(f, "query contains nul byte"),
+            Error::RowLengthMismatch { expected, found } =>
+                write!(f, "row has {} values, expected {}", found, expected),
+            Error::BackendGone => write!(f, "backend thread has exited"),
+        }
+    }
+}
+
+impl std::error::Error for Error {}
+
+#[derive(Debug, Clone)]
+pub struct PostgresError {
+    pub sqlstate: String,
+    pub message: String,
+    pub detail: Option<String>,
+    pub hint: Option<String>,
+}
+
+impl PostgresError {
+    /// Takes ownership of an `ErrorData` returned from the shims, freeing it
+    pub(crate) unsafe fn from_edata(edata: *mut sys::ErrorData) -> Self {
+        let error = PostgresError {
+            sqlstate: unpack_sql_state((*edata).sqlerrcode),
+            message: opt_cstr((*edata).message).unwrap_or_default(),
+            detail: opt_cstr((*edata).detail),
+            hint: opt_cstr((*edata).hint),
+        };
+
+        sys::FreeErrorData(edata);
+
+        error
+    }
+}
+
+impl fmt::Display for PostgresError {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "{} ({})", self.message, self.sqlstate)
+    }
+}
+
+impl std::error::Error for PostgresError {}
+
+/// elog.c unpack_sql_state, without the static buffer
+fn unpack_sql_state(mut sql_state: i32) -> String {
+    let mut buf = String::with_capacity(5);
+
+    for _ in 0..5 {
+        buf.push(char::from((sql_state & 0x3f) as u8 + b'0'));
+        sql_state >>= 6;
+    }
+
+    buf
+}
+
+unsafe fn opt_cstr(ptr: *const c_char) -> Option<String> {
+    if ptr.is_null() {
+        None
+    } else {
+        Some(CStr::from_ptr(ptr).to_string_lossy().into_owned())
+    }
+}
@@ -0,0 +1,58 @@
+/// Thin wrappers over the futex syscall, used to park idle threads on a
+/// 32 bit word without going through a mutex/condvar pair
+
+use std::sync::atomic::AtomicU32;
+
+/// Sleeps until `word` is woken, as long as it still holds `expected`.
+/// Spurious wakeups are possible, callers must re-check their condition.
+#[cfg(target_os = "linux")]
+pub fn wait(word: &AtomicU32, expected: u32) {
+    unsafe {
+        libc::syscall(
+            libc::SYS_futex,
+            word as *const AtomicU32 as *const u32,
+            libc::FUTEX_WAIT | libc::FUTEX_PRIVATE_FLAG,
+            expected,
+            std::ptr::null::<libc::timespec>(),
+        );
+    }
+}
+
+#[cfg(target_os = "linux")]
+pub fn wake_one(word: &AtomicU32) {
+    wake(word, 1);
+}
+
+#[cfg(target_os = "linux")]
+pub fn wake_all(word: &AtomicU32) {
+    wake(word, i32::MAX);
+}
+
+#[cfg(target_os = "linux")]
+fn wake(word: &AtomicU32, count: i32) {
+    unsafe {
+        libc::syscall(
+            libc::SYS_futex,
+            word as *const AtomicU32 as *const u32,
+            libc::FUTEX_WAKE | libc::FUTEX_PRIVATE_FLAG,
+            count,
+        );
+    }
+}
+
+// everything else gets a polling fallback, which is correct but slow:
+
+#[cfg(not(target_os = "linux"))]
+pub fn wait(word: &AtomicU32, expected: u32) {
+    use std::sync::atomic::Ordering;
+
+    if word.load(Ordering::Acquire) == expected {
+        std::thread::yield_now();
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+pub fn wake_one(_word: &AtomicU32) {}
+
+#[cfg(not(target_os = "linux"))]
+pub fn wake_all(_word: &AtomicU32) {}
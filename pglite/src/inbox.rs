@@ -0,0 +1,141 @@
+/// Unbounded lock-free multi-producer/single-consumer queue. Producers push
+/// onto an atomic stack; the consumer takes the whole stack in one swap and
+/// reverses it back into submission order, so a busy consumer pays one
+/// atomic operation per batch rather than per item. An idle consumer spins
+/// briefly and then parks on a futex.
+
+use std::hint;
+use std::ptr;
+use std::sync::atomic::{fence, AtomicBool, AtomicPtr, AtomicU32, Ordering};
+
+use crate::futex;
+
+const SPIN_LIMIT: usize = 128;
+
+const AWAKE: u32 = 0;
+const PARKED: u32 = 1;
+
+pub struct Inbox<T> {
+    head: AtomicPtr<Node<T>>,
+    consumer_state: AtomicU32,
+    closed: AtomicBool,
+}
+
+struct Node<T> {
+    value: T,
+    next: *mut Node<T>,
+}
+
+unsafe impl<T: Send> Send for Inbox<T> {}
+unsafe impl<T: Send> Sync for Inbox<T> {}
+
+impl<T> Inbox<T> {
+    pub fn new() -> Self {
+        Inbox {
+            head: AtomicPtr::new(ptr::null_mut()),
+            consumer_state: AtomicU32::new(AWAKE),
+            closed: AtomicBool::new(false),
+        }
+    }
+
+    pub fn push(&self, value: T) {
+        let node = Box::into_raw(Box::new(Node { value, next: ptr::null_mut() }));
+        let mut head = self.head.load(Ordering::Relaxed);
+
+        loop {
+            unsafe { (*node).next = head; }
+
+            match self.head.compare_exchange_weak(head, node, Ordering::Release, Ordering::Relaxed) {
+                Ok(_) => break,
+                Err(current) => head = current,
+            }
+        }
+
+        self.unpark();
+    }
+
+    /// Moves everything queued into `out`, oldest first. Safe to call from
+    /// any thread, not just the consumer.
+    pub fn take_all(&self, out: &mut Vec<T>) {
+        let mut node = self.head.swap(ptr::null_mut(), Ordering::Acquire);
+        let start = out.len();
+
+        while !node.is_null() {
+            let boxed = unsafe { Box::from_raw(node) };
+            node = boxed.next;
+            out.push(boxed.value);
+        }
+
+        // the stack is newest first:
+        out[start..].reverse();
+    }
+
+    /// Waits for at least one item and moves everything queued into `out`.
+    /// Returns false once the inbox is closed and empty.
+    pub fn recv_all(&self, out: &mut Vec<T>) -> bool {
+        loop {
+            self.take_all(out);
+
+            if !out.is_empty() {
+                return true;
+            }
+
+            if self.is_closed() {
+                // anything pushed right before closing:
+                self.take_all(out);
+                return !out.is_empty();
+            }
+
+            self.park();
+        }
+    }
+
+    /// Wakes the consumer so it sees the inbox closed once drained
+    pub fn close(&self) {
+        self.closed.store(true, Ordering::Release);
+        self.unpark();
+    }
+
+    pub fn is_closed(&self) -> bool {
+        self.closed.load(Ordering::Acquire)
+    }
+
+    fn is_ready(&self) -> bool {
+        !self.head.load(Ordering::Acquire).is_null() || self.is_closed()
+    }
+
+    fn park(&self) {
+        for _ in 0..SPIN_LIMIT {
+            if self.is_ready() {
+                return;
+            }
+            hint::spin_loop();
+        }
+
+        self.consumer_state.store(PARKED, Ordering::SeqCst);
+        fence(Ordering::SeqCst);
+
+        if !self.is_ready() {
+            futex::wait(&self.consumer_state, PARKED);
+        }
+
+        self.consumer_state.store(AWAKE, Ordering::Relaxed);
+    }
+
+    fn unpark(&self) {
+        fence(Ordering::SeqCst);
+
+        if self.consumer_state.load(Ordering::Relaxed) == PARKED {
+            if self.consumer_state.swap(AWAKE, Ordering::SeqCst) == PARKED {
+                futex::wake_one(&self.consumer_state);
+            }
+        }
+    }
+}
+
+impl<T> Drop for Inbox<T> {
+    fn drop(&mut self) {
+        let mut rest = Vec::new();
+        self.take_all(&mut rest);
+    }
+}
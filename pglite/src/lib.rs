@@ -1,33 +1,193 @@
+mod async_connection;
+mod backend;
+mod container;
+mod copy;
+mod database;
 mod db;
+mod error;
+mod futex;
+mod inbox;
+mod memory;
+mod oneshot;
+mod pipeline;
+mod queue;
+mod row;
+mod statement;
+mod stream;
+mod template;
+mod transaction;
+mod value;
+mod vfs;
 
+use std::cell::RefCell;
+use std::io;
+use std::mem::ManuallyDrop;
 use std::path::Path;
 use std::ffi::CString;
 
-pub struct Connection {
+use backend::Backend;
+use memory::MemoryCluster;
+use statement::{StatementCache, STATEMENT_CACHE_CAPACITY};
+
+pub use async_connection::AsyncConnection;
+pub use container::create_container;
+pub use database::Database;
+pub use db::fd::SharedFdStats;
+pub use db::lmgr::LWLockStats;
+pub use error::{Error, PostgresError};
+pub use pipeline::{Pipeline, PipelineError, PipelineResult};
+pub use row::{Column, FromColumn, Row};
+pub use statement::Statement;
+pub use stream::RowStream;
+pub use template::Template;
+pub use value::Value;
+pub use vfs::{register_vfs, DirVfs, Vfs};
 
+pub struct Connection {
+    /// taken on drop, to shut it down or give it back to the database's pool
+    backend: ManuallyDrop<Backend>,
+    statements: RefCell<StatementCache>,
+    /// keeps the cluster up while attached; dropped after the backend
+    database: Option<Database>,
+    /// the cluster of `open_in_memory`, freed once the backend has exited
+    memory: Option<MemoryCluster>,
 }
 
+#[derive(Debug)]
 pub enum OpenError {
     PathNameNotUtf8,
     PathNameContainsNul,
+    SettingContainsNul,
+    Io(io::Error),
+    /// the backend thread exited while starting up
+    StartupFailed,
+    /// the cluster went down after one of its processes crashed
+    Crashed,
 }
 
 impl Connection {
     pub fn open(data_dir: &Path) -> Result<Self, OpenError> {
-        let data_dir = data_dir.to_str()
-            .ok_or(OpenError::PathNameNotUtf8)?;
+        if !db::bootstrap::is_bootstrapped(data_dir) {
+            bootstrap(data_dir)?;
+        }
+
+        let backend = Backend::start(data_dir_cstring(data_dir)?)
+            .map_err(|_| OpenError::StartupFailed)?;
+
+        Ok(Connection::new(backend, None))
+    }
+
+    /// Opens a new, empty database whose relations are kept in memory
+    /// rather than in files, and are gone with the connection. Bootstraps
+    /// every time, so opening one takes as long as bootstrap does.
+    pub fn open_in_memory() -> Result<Self, OpenError> {
+        let memory = MemoryCluster::create()?;
+
+        let backend = memory.start()
+            .map_err(|_| OpenError::StartupFailed)?;
+
+        let mut connection = Connection::new(backend, None);
+        connection.memory = Some(memory);
 
-        let data_dir = CString::new(data_dir)
-            .map_err(|_| OpenError::PathNameContainsNul)?;
+        Ok(connection)
+    }
+
+    fn new(backend: Backend, database: Option<Database>) -> Self {
+        Connection {
+            backend: ManuallyDrop::new(backend),
+            statements: RefCell::new(StatementCache::new(STATEMENT_CACHE_CAPACITY)),
+            database,
+            memory: None,
+        }
+    }
 
-        let thread = std::thread::spawn(move || unsafe {
-            db::init::thread_start();
-            db::bootstrap::main(&data_dir);
-            log::info!("pglite: survived the bootstrap!");
-        });
+    /// Opens the database in `data_dir`, cloning it from `template` first if
+    /// it does not exist yet. This skips bootstrap entirely.
+    pub fn open_with_template(data_dir: &Path, template: &Template) -> Result<Self, OpenError> {
+        if !db::bootstrap::is_bootstrapped(data_dir) {
+            template.clone_into(data_dir)
+                .map_err(OpenError::Io)?;
+        }
+
+        Self::open(data_dir)
+    }
 
-        thread.join().unwrap();
+    /// Runs every statement in `sql`, calling `f` with each result row.
+    /// Rows are read in place on the backend thread, so `f` runs there too.
+    /// Returns the number of rows processed by the last statement.
+    pub fn query<F>(&self, sql: &str, f: F) -> Result<u64, Error>
+        where F: FnMut(&Row) + Send
+    {
+        let sql = CString::new(sql)
+            .map_err(|_| Error::QueryContainsNul)?;
+
+        self.backend.call(move || unsafe { db::postgres::exec(&sql, f) })
+            .map_err(|_| Error::BackendGone)?
+            .map_err(Error::Postgres)
+    }
+
+    /// Runs every statement in `sql`, discarding any result rows
+    pub fn execute(&self, sql: &str) -> Result<u64, Error> {
+        self.query(sql, |_| ())
+    }
 
-        Ok(Connection {})
+    /// Prepares the single statement in `sql`, with `$1`, `$2`, ... for
+    /// parameters. Plans are cached per connection by SQL text, so preparing
+    /// the same statement again is cheap.
+    pub fn prepare(&self, sql: &str) -> Result<Statement<'_>, Error> {
+        Statement::new(self, sql)
     }
+
+    /// Runs the single statement in `sql` through a cursor, returning an
+    /// iterator that fetches the result rows a batch at a time
+    pub fn stream(&self, sql: &str, params: &[Value]) -> Result<RowStream<'_>, Error> {
+        self.prepare(sql)?.stream(params)
+    }
+
+    /// Starts a batch of statements to be sent to the backend in one go
+    pub fn pipeline(&self) -> Pipeline<'_> {
+        Pipeline::new(self)
+    }
+}
+
+impl Drop for Connection {
+    fn drop(&mut self) {
+        // SAFETY: never touched again
+        let backend = unsafe { ManuallyDrop::take(&mut self.backend) };
+
+        match &self.database {
+            Some(database) => database.recycle(backend, self.statements.get_mut().take_all()),
+            None => drop(backend),
+        }
+    }
+}
+
+/// Bootstraps a new cluster in `data_dir` on a throwaway backend thread
+fn bootstrap(data_dir: &Path) -> Result<(), OpenError> {
+    bootstrap_with(data_dir, || ())
+}
+
+/// As `bootstrap`, calling `init` on the thread before bootstrap starts
+fn bootstrap_with<I>(data_dir: &Path, init: I) -> Result<(), OpenError>
+    where I: FnOnce() + Send + 'static
+{
+    let data_dir = data_dir_cstring(data_dir)?;
+
+    let thread = std::thread::spawn(move || unsafe {
+        db::init::thread_start();
+        init();
+        db::bootstrap::main(&data_dir);
+        log::info!("pglite: survived the bootstrap!");
+    });
+
+    // a FATAL during bootstrap takes the thread down with it
+    thread.join().map_err(|_| OpenError::StartupFailed)
+}
+
+fn data_dir_cstring(data_dir: &Path) -> Result<CString, OpenError> {
+    let data_dir = data_dir.to_str()
+        .ok_or(OpenError::PathNameNotUtf8)?;
+
+    CString::new(data_dir)
+        .map_err(|_| OpenError::PathNameContainsNul)
 }
@@ -0,0 +1,87 @@
+/// Clusters whose relations are kept in process memory rather than in files
+/// (see pglite-sys/src/shim/memory_smgr.c), for databases that needn't
+/// outlive the connection, such as those of test suites. Nothing of them is
+/// ever synced, and dropping them frees their relations at once.
+
+use std::ffi::CString;
+use std::fs;
+use std::io;
+use std::os::unix::fs::DirBuilderExt;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use pglite_sys as sys;
+
+use crate::backend::{Backend, BackendGone};
+use crate::db::guc::Settings;
+use crate::{data_dir_cstring, OpenError};
+
+/// Numbers the data directories of this process' clusters
+static NEXT_CLUSTER: AtomicUsize = AtomicUsize::new(0);
+
+/// A cluster with its relations in memory. The control file, WAL and commit
+/// log aren't relations and still go to a data directory, a throwaway one
+/// under the temporary directory that is removed along with the cluster.
+pub struct MemoryCluster {
+    path: PathBuf,
+    data_dir: CString,
+}
+
+impl MemoryCluster {
+    /// Bootstraps a new cluster
+    pub fn create() -> Result<Self, OpenError> {
+        let path = std::env::temp_dir().join(format!("pglite-memory-{}-{}",
+            std::process::id(), NEXT_CLUSTER.fetch_add(1, Ordering::Relaxed)));
+
+        // left behind by a process that had our pid:
+        match fs::remove_dir_all(&path) {
+            Ok(()) => {}
+            Err(e) if e.kind() == io::ErrorKind::NotFound => {}
+            Err(e) => return Err(OpenError::Io(e)),
+        }
+
+        fs::DirBuilder::new()
+            .mode(0o700)
+            .create(&path)
+            .map_err(OpenError::Io)?;
+
+        let cluster = MemoryCluster {
+            data_dir: data_dir_cstring(&path)?,
+            path,
+        };
+
+        crate::bootstrap_with(&cluster.path, || unsafe { sys::pglite_use_memory_smgr() })?;
+
+        Ok(cluster)
+    }
+
+    /// Starts a standalone backend on the cluster. The cluster must outlive
+    /// it.
+    pub fn start(&self) -> Result<Backend, BackendGone> {
+        Backend::start_in_memory(self.data_dir.clone())
+    }
+}
+
+impl Drop for MemoryCluster {
+    fn drop(&mut self) {
+        unsafe {
+            sys::pglite_drop_memory_relations(self.data_dir.as_ptr());
+        }
+
+        if let Err(e) = fs::remove_dir_all(&self.path) {
+            log::warn!("pglite: removing {}: {}", self.path.display(), e);
+        }
+    }
+}
+
+/// Settings for backends on a cluster in memory: as it's gone with the
+/// process anyway, there's no point making its WAL crash safe, or writing
+/// more of it than the cluster needs to run
+pub fn settings() -> Settings {
+    Settings::new(&[
+        ("fsync", "off"),
+        ("synchronous_commit", "off"),
+        ("full_page_writes", "off"),
+        ("wal_level", "minimal"),
+        ("max_wal_senders", "0"),
+    ]).unwrap()
+}
@@ -0,0 +1,110 @@
+/// Single-use channel from the backend thread to a future. The value is
+/// handed over through an atomic flag; the waker sits behind a mutex that's
+/// only contended if the future is polled just as the value arrives.
+
+use std::cell::UnsafeCell;
+use std::future::Future;
+use std::pin::Pin;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Mutex};
+use std::task::{Context, Poll, Waker};
+
+use crate::backend::BackendGone;
+
+pub fn channel<T>() -> (Sender<T>, Receiver<T>) {
+    let shared = Arc::new(Shared {
+        ready: AtomicBool::new(false),
+        value: UnsafeCell::new(None),
+        waker: Mutex::new(None),
+    });
+
+    (Sender { shared: Some(shared.clone()) }, Receiver { shared })
+}
+
+struct Shared<T> {
+    ready: AtomicBool,
+    /// written once by the sender before `ready` is set, read only by the
+    /// receiver after it sees `ready`
+    value: UnsafeCell<Option<Result<T, BackendGone>>>,
+    waker: Mutex<Option<Waker>>,
+}
+
+unsafe impl<T: Send> Send for Shared<T> {}
+unsafe impl<T: Send> Sync for Shared<T> {}
+
+impl<T> Shared<T> {
+    fn complete(&self, value: Result<T, BackendGone>) {
+        unsafe { *self.value.get() = Some(value); }
+        self.ready.store(true, Ordering::Release);
+
+        let waker = match self.waker.lock() {
+            Ok(mut waker) => waker.take(),
+            Err(poison) => poison.into_inner().take(),
+        };
+
+        if let Some(waker) = waker {
+            waker.wake();
+        }
+    }
+}
+
+pub struct Sender<T> {
+    shared: Option<Arc<Shared<T>>>,
+}
+
+impl<T> Sender<T> {
+    pub fn send(mut self, value: T) {
+        if let Some(shared) = self.shared.take() {
+            shared.complete(Ok(value));
+        }
+    }
+}
+
+impl<T> Drop for Sender<T> {
+    fn drop(&mut self) {
+        // dropped unsent, so the job never ran:
+        if let Some(shared) = self.shared.take() {
+            shared.complete(Err(BackendGone));
+        }
+    }
+}
+
+pub struct Receiver<T> {
+    shared: Arc<Shared<T>>,
+}
+
+impl<T> Receiver<T> {
+    fn take(&self) -> Poll<Result<T, BackendGone>> {
+        let value = unsafe { (*self.shared.value.get()).take() };
+        Poll::Ready(value.unwrap_or(Err(BackendGone)))
+    }
+}
+
+impl<T> Future for Receiver<T> {
+    type Output = Result<T, BackendGone>;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Self::Output> {
+        if self.shared.ready.load(Ordering::Acquire) {
+            return self.take();
+        }
+
+        {
+            let mut waker = match self.shared.waker.lock() {
+                Ok(waker) => waker,
+                Err(poison) => poison.into_inner(),
+            };
+
+            match &*waker {
+                Some(existing) if existing.will_wake(cx.waker()) => {}
+                _ => *waker = Some(cx.waker().clone()),
+            }
+        }
+
+        // the value may have arrived before the waker was registered:
+        if self.shared.ready.load(Ordering::Acquire) {
+            return self.take();
+        }
+
+        Poll::Pending
+    }
+}
@@ -0,0 +1,195 @@
+/// Batches of statements sent to the backend as a single job, so a caller
+/// issuing many small writes pays for one cross-thread round trip rather
+/// than one per statement.
+
+use std::collections::HashMap;
+use std::ffi::CString;
+use std::fmt;
+
+use pglite_sys as sys;
+
+use crate::db;
+use crate::db::postgres::Plan;
+use crate::error::Error;
+use crate::value::Value;
+use crate::Connection;
+
+pub struct Pipeline<'conn> {
+    conn: &'conn Connection,
+    statements: Vec<(Box<str>, Vec<Value>)>,
+    transaction: bool,
+}
+
+/// A statement in a pipeline failed. Statements before it have run, and
+/// are committed unless the pipeline was run as a transaction.
+#[derive(Debug)]
+pub struct PipelineError {
+    /// index of the failing statement, or the number of statements if it
+    /// was the closing commit that failed
+    pub index: usize,
+    pub error: Error,
+}
+
+impl fmt::Display for PipelineError {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "pipeline statement {}: {}", self.index, self.error)
+    }
+}
+
+impl std::error::Error for PipelineError {}
+
+/// What one statement of a pipeline returned
+#[derive(Debug, Clone, Default)]
+pub struct PipelineResult {
+    /// number of rows the statement processed
+    pub processed: u64,
+    /// result rows, copied out of the backend as `RowStream` does
+    pub rows: Vec<Vec<Value>>,
+}
+
+enum Source {
+    Cached(Plan),
+    /// index into the statements being prepared by this run
+    Prepare(usize),
+}
+
+impl<'conn> Pipeline<'conn> {
+    pub(crate) fn new(conn: &'conn Connection) -> Self {
+        Pipeline { conn, statements: Vec::new(), transaction: false }
+    }
+
+    /// Queues a single statement to run with `params`. Nothing is sent to
+    /// the backend until `run`.
+    pub fn execute(&mut self, sql: &str, params: impl Into<Vec<Value>>) -> &mut Self {
+        self.statements.push((sql.into(), params.into()));
+        self
+    }
+
+    /// Runs the statements in a single transaction, rolling every one of
+    /// them back if any fails. Has no effect if a transaction block is
+    /// already open on the connection, as the statements run in that.
+    pub fn transaction(&mut self, transaction: bool) -> &mut Self {
+        self.transaction = transaction;
+        self
+    }
+
+    pub fn len(&self) -> usize {
+        self.statements.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.statements.is_empty()
+    }
+
+    /// Runs every queued statement back to back on the backend, returning
+    /// the rows each returned and the number it processed
+    pub fn run(self) -> Result<Vec<PipelineResult>, PipelineError> {
+        let Pipeline { conn, statements, transaction } = self;
+        let mut cache = conn.statements.borrow_mut();
+
+        // resolve as much as we can against the statement cache before we
+        // go to the backend, and prepare the rest in the same job:
+        let mut sources = Vec::with_capacity(statements.len());
+        let mut to_prepare = Vec::<(usize, CString)>::new();
+        let mut pending = HashMap::<&str, usize>::new();
+
+        for (index, (sql, _)) in statements.iter().enumerate() {
+            if let Some(plan) = cache.get(sql) {
+                sources.push(Source::Cached(plan));
+            } else if let Some(&pending) = pending.get(&**sql) {
+                sources.push(Source::Prepare(pending));
+            } else {
+                let query = CString::new(&**sql)
+                    .map_err(|_| PipelineError { index, error: Error::QueryContainsNul })?;
+
+                pending.insert(sql, to_prepare.len());
+                sources.push(Source::Prepare(to_prepare.len()));
+                to_prepare.push((index, query));
+            }
+        }
+
+        // only as many new plans as the cache holds are kept. Evicted plans
+        // and the ones that don't fit may be in use by this run, so they're
+        // only dropped once it's done:
+        let keep = to_prepare.len().min(cache.capacity());
+        let evicted = cache.make_room(keep);
+
+        let (statements_ref, to_prepare_ref) = (&statements, &to_prepare);
+
+        let job = move || unsafe {
+            let mut prepared = Vec::with_capacity(to_prepare_ref.len());
+            let result = run(statements_ref, &sources, to_prepare_ref, transaction, &mut prepared);
+
+            let excess = prepared.split_off(keep.min(prepared.len()));
+
+            for plan in evicted.into_iter().chain(excess) {
+                db::postgres::drop_plan(plan);
+            }
+
+            (prepared, result)
+        };
+
+        let (prepared, result) = conn.backend.call(job)
+            .map_err(|_| PipelineError { index: 0, error: Error::BackendGone })?;
+
+        for (plan, (index, _)) in prepared.into_iter().zip(&to_prepare) {
+            cache.insert(&statements[*index].0, plan);
+        }
+
+        result
+    }
+}
+
+unsafe fn run(
+    statements: &[(Box<str>, Vec<Value>)],
+    sources: &[Source],
+    to_prepare: &[(usize, CString)],
+    transaction: bool,
+    prepared: &mut Vec<Plan>,
+) -> Result<Vec<PipelineResult>, PipelineError> {
+    let grouped = transaction && !sys::IsTransactionBlock();
+
+    if grouped {
+        db::postgres::command(b"BEGIN\0")
+            .map_err(|error| PipelineError { index: 0, error: Error::Postgres(error) })?;
+    }
+
+    let mut results = Vec::with_capacity(statements.len());
+
+    for (index, ((_, params), source)) in statements.iter().zip(sources).enumerate() {
+        let result = match source {
+            Source::Cached(plan) => Ok(*plan),
+            Source::Prepare(i) if *i < prepared.len() => Ok(prepared[*i]),
+            // statements are prepared in order of first use:
+            Source::Prepare(i) => db::postgres::prepare(&to_prepare[*i].1)
+                .map(|plan| { prepared.push(plan); plan }),
+        };
+
+        let mut rows = Vec::new();
+
+        let result = result.and_then(|plan| {
+            db::postgres::execute_plan(plan, params, |row| rows.push(row.values()))
+        });
+
+        match result {
+            Ok(processed) => results.push(PipelineResult { processed, rows }),
+            Err(error) => {
+                if grouped {
+                    // leave the aborted transaction block:
+                    if let Err(error) = db::postgres::command(b"ROLLBACK\0") {
+                        log::warn!("pglite: rolling back pipeline: {}", error);
+                    }
+                }
+
+                return Err(PipelineError { index, error: Error::Postgres(error) });
+            }
+        }
+    }
+
+    if grouped {
+        db::postgres::command(b"COMMIT\0")
+            .map_err(|error| PipelineError { index: statements.len(), error: Error::Postgres(error) })?;
+    }
+
+    Ok(results)
+}
@@ -0,0 +1,213 @@
+/// Bounded lock-free single-producer/single-consumer queue. Both ends spin
+/// briefly and then park on a futex when the queue is empty (receiver) or
+/// full (sender), so an idle backend costs nothing and a busy one never
+/// makes a syscall.
+
+use std::cell::{Cell, UnsafeCell};
+use std::hint;
+use std::marker::PhantomData;
+use std::mem::MaybeUninit;
+use std::sync::Arc;
+use std::sync::atomic::{fence, AtomicBool, AtomicU32, AtomicUsize, Ordering};
+
+use crate::futex;
+
+const SPIN_LIMIT: usize = 128;
+
+const AWAKE: u32 = 0;
+const PARKED: u32 = 1;
+
+pub fn channel<T>(capacity: usize) -> (Sender<T>, Receiver<T>) {
+    let capacity = capacity.max(1).next_power_of_two();
+
+    let slots = (0..capacity)
+        .map(|_| UnsafeCell::new(MaybeUninit::uninit()))
+        .collect();
+
+    let ring = Arc::new(Ring {
+        slots,
+        mask: capacity - 1,
+        head: CachePadded(AtomicUsize::new(0)),
+        tail: CachePadded(AtomicUsize::new(0)),
+        sender_state: AtomicU32::new(AWAKE),
+        receiver_state: AtomicU32::new(AWAKE),
+        closed: AtomicBool::new(false),
+    });
+
+    let sender = Sender { ring: ring.clone(), _not_sync: PhantomData };
+    let receiver = Receiver { ring, _not_sync: PhantomData };
+    (sender, receiver)
+}
+
+#[repr(align(64))]
+struct CachePadded<T>(T);
+
+struct Ring<T> {
+    slots: Box<[UnsafeCell<MaybeUninit<T>>]>,
+    mask: usize,
+    /// next slot to be read, only written by the receiver
+    head: CachePadded<AtomicUsize>,
+    /// next slot to be written, only written by the sender
+    tail: CachePadded<AtomicUsize>,
+    sender_state: AtomicU32,
+    receiver_state: AtomicU32,
+    closed: AtomicBool,
+}
+
+unsafe impl<T: Send> Send for Ring<T> {}
+unsafe impl<T: Send> Sync for Ring<T> {}
+
+impl<T> Ring<T> {
+    fn is_closed(&self) -> bool {
+        self.closed.load(Ordering::Acquire)
+    }
+
+    /// Takes the value at `head`. Caller must be the only consumer and have
+    /// checked the slot is occupied.
+    unsafe fn take(&self, head: usize) -> T {
+        let value = (*self.slots[head & self.mask].get()).assume_init_read();
+        self.head.0.store(head.wrapping_add(1), Ordering::Release);
+        value
+    }
+
+    fn try_pop_exclusive(&self) -> Option<T> {
+        let head = self.head.0.load(Ordering::Relaxed);
+        let tail = self.tail.0.load(Ordering::Acquire);
+
+        if head == tail {
+            None
+        } else {
+            Some(unsafe { self.take(head) })
+        }
+    }
+
+    fn park(&self, state: &AtomicU32, ready: impl Fn() -> bool) {
+        for _ in 0..SPIN_LIMIT {
+            if ready() {
+                return;
+            }
+            hint::spin_loop();
+        }
+
+        state.store(PARKED, Ordering::SeqCst);
+        fence(Ordering::SeqCst);
+
+        if !ready() {
+            futex::wait(state, PARKED);
+        }
+
+        state.store(AWAKE, Ordering::Relaxed);
+    }
+
+    fn unpark(&self, state: &AtomicU32) {
+        fence(Ordering::SeqCst);
+
+        if state.load(Ordering::Relaxed) == PARKED {
+            if state.swap(AWAKE, Ordering::SeqCst) == PARKED {
+                futex::wake_one(state);
+            }
+        }
+    }
+}
+
+impl<T> Drop for Ring<T> {
+    fn drop(&mut self) {
+        while self.try_pop_exclusive().is_some() {}
+    }
+}
+
+pub struct Sender<T> {
+    ring: Arc<Ring<T>>,
+    // exactly one thread may send at a time:
+    _not_sync: PhantomData<Cell<()>>,
+}
+
+impl<T> Sender<T> {
+    /// Enqueues `value`, blocking while the queue is full. Gives the value
+    /// back if the receiver has gone away.
+    pub fn send(&self, value: T) -> Result<(), T> {
+        let ring = &*self.ring;
+        let tail = ring.tail.0.load(Ordering::Relaxed);
+
+        loop {
+            if ring.is_closed() {
+                return Err(value);
+            }
+
+            let has_room = || {
+                let head = ring.head.0.load(Ordering::Acquire);
+                tail.wrapping_sub(head) < ring.slots.len() || ring.is_closed()
+            };
+
+            if has_room() {
+                break;
+            }
+
+            ring.park(&ring.sender_state, has_room);
+        }
+
+        unsafe { (*ring.slots[tail & ring.mask].get()).write(value); }
+        ring.tail.0.store(tail.wrapping_add(1), Ordering::Release);
+        ring.unpark(&ring.receiver_state);
+
+        Ok(())
+    }
+
+    /// Drops anything left in the queue after the receiver has gone away.
+    /// Values sent concurrently with the receiver being dropped can
+    /// otherwise sit in the queue until the sender is dropped too.
+    pub fn drain(&self) {
+        if self.ring.is_closed() {
+            while self.ring.try_pop_exclusive().is_some() {}
+        }
+    }
+}
+
+impl<T> Drop for Sender<T> {
+    fn drop(&mut self) {
+        self.ring.closed.store(true, Ordering::Release);
+        self.ring.unpark(&self.ring.receiver_state);
+    }
+}
+
+pub struct Receiver<T> {
+    ring: Arc<Ring<T>>,
+    // exactly one thread may receive at a time:
+    _not_sync: PhantomData<Cell<()>>,
+}
+
+impl<T> Receiver<T> {
+    /// Dequeues the next value, parking while the queue is empty. Returns
+    /// `None` once the sender has gone away and the queue is drained.
+    pub fn recv(&self) -> Option<T> {
+        let ring = &*self.ring;
+
+        loop {
+            if let Some(value) = ring.try_pop_exclusive() {
+                ring.unpark(&ring.sender_state);
+                return Some(value);
+            }
+
+            if ring.is_closed() {
+                // the sender may have pushed right before closing:
+                return ring.try_pop_exclusive();
+            }
+
+            ring.park(&ring.receiver_state, || {
+                let head = ring.head.0.load(Ordering::Relaxed);
+                head != ring.tail.0.load(Ordering::Acquire) || ring.is_closed()
+            });
+        }
+    }
+}
+
+impl<T> Drop for Receiver<T> {
+    fn drop(&mut self) {
+        while self.ring.try_pop_exclusive().is_some() {}
+
+        // publish closed only once we're done touching the queue, after
+        // this the sender is free to drain it itself
+        self.ring.closed.store(true, Ordering::SeqCst);
+        self.ring.unpark(&self.ring.sender_state);
+    }
+}
@@ -0,0 +1,258 @@
+/// Result rows, read straight out of the executor's tuple slot. Nothing is
+/// converted to text or copied until a value is asked for, and by-reference
+/// values are borrowed from the backend for as long as the `Row` is.
+
+use std::ffi::CStr;
+use std::os::raw::c_char;
+use std::ptr;
+use std::slice;
+use std::str;
+
+use pglite_sys as sys;
+
+use crate::value::Value;
+
+#[derive(Debug, Clone)]
+pub struct Column {
+    name: String,
+    type_oid: sys::Oid,
+    typlen: i16,
+    typbyval: bool,
+}
+
+impl Column {
+    pub(crate) unsafe fn from_tupdesc(desc: sys::TupleDesc, attnum: usize) -> Self {
+        let mut column = std::mem::zeroed::<sys::PgliteColumn>();
+        sys::pglite_tupdesc_column(desc, attnum as _, &mut column);
+
+        Column {
+            name: CStr::from_ptr(column.name as *const c_char).to_string_lossy().into_owned(),
+            type_oid: column.typid,
+            typlen: column.typlen,
+            typbyval: column.typbyval,
+        }
+    }
+
+    pub fn name(&self) -> &str {
+        &self.name
+    }
+
+    pub fn type_oid(&self) -> sys::Oid {
+        self.type_oid
+    }
+}
+
+pub struct Row<'a> {
+    columns: &'a [Column],
+    values: &'a [sys::Datum],
+    nulls: &'a [bool],
+}
+
+impl<'a> Row<'a> {
+    /// Caller must have deformed every attribute of `slot`, and the slot
+    /// must stay untouched for `'a`
+    pub(crate) unsafe fn from_slot(columns: &'a [Column], slot: *const sys::TupleTableSlot) -> Self {
+        let slot = &*slot;
+        let len = columns.len().min(slot.tts_nvalid as usize);
+
+        Row {
+            columns,
+            values: slice::from_raw_parts(slot.tts_values, len),
+            nulls: slice::from_raw_parts(slot.tts_isnull, len),
+        }
+    }
+
+    pub fn columns(&self) -> &'a [Column] {
+        self.columns
+    }
+
+    pub fn len(&self) -> usize {
+        self.values.len()
+    }
+
+    pub fn is_null(&self, idx: usize) -> bool {
+        self.nulls[idx]
+    }
+
+    /// Copies every value out of the row
+    pub fn values(&self) -> Vec<Value> {
+        (0..self.len())
+            .map(|idx| self.get::<Value>(idx).unwrap_or(Value::Null))
+            .collect()
+    }
+
+    /// Returns the value of column `idx`, or `None` if it is null. Panics if
+    /// the column's type can't be read as `T`, as indexing past the end of
+    /// the row does.
+    ///
+    /// Postgres can raise an error detoasting a value or converting it to
+    /// text. The value then reads as empty, or as `Value::Null`, and the
+    /// statement fails with that error once the row has been handed back.
+    pub fn get<T: FromColumn<'a>>(&self, idx: usize) -> Option<T> {
+        if self.nulls[idx] {
+            return None;
+        }
+
+        let column = &self.columns[idx];
+
+        match unsafe { T::from_datum(column, self.values[idx]) } {
+            Some(value) => Some(value),
+            None => panic!("pglite: column {} ({:?}, type oid {}) can't be read as {}",
+                idx, column.name, column.type_oid, std::any::type_name::<T>()),
+        }
+    }
+}
+
+/// Types that can be read directly from a non-null datum. Returns `None` if
+/// the column's type is not one this type can represent.
+pub trait FromColumn<'a>: Sized {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self>;
+}
+
+impl<'a> FromColumn<'a> for bool {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        match column.type_oid {
+            sys::BOOLOID => Some(datum != 0),
+            _ => None,
+        }
+    }
+}
+
+impl<'a> FromColumn<'a> for i16 {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        match column.type_oid {
+            sys::INT2OID => Some(datum as i16),
+            _ => None,
+        }
+    }
+}
+
+impl<'a> FromColumn<'a> for i32 {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        match column.type_oid {
+            sys::INT2OID => Some(datum as i16 as i32),
+            sys::INT4OID => Some(datum as i32),
+            _ => None,
+        }
+    }
+}
+
+impl<'a> FromColumn<'a> for i64 {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        match column.type_oid {
+            sys::INT2OID => Some(datum as i16 as i64),
+            sys::INT4OID => Some(datum as i32 as i64),
+            // int8 is pass by value on 64 bit platforms
+            sys::INT8OID => Some(datum as i64),
+            sys::OIDOID => Some(datum as u32 as i64),
+            _ => None,
+        }
+    }
+}
+
+impl<'a> FromColumn<'a> for u32 {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        match column.type_oid {
+            sys::OIDOID => Some(datum as u32),
+            _ => None,
+        }
+    }
+}
+
+impl<'a> FromColumn<'a> for f32 {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        match column.type_oid {
+            sys::FLOAT4OID => Some(f32::from_bits(datum as u32)),
+            _ => None,
+        }
+    }
+}
+
+impl<'a> FromColumn<'a> for f64 {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        match column.type_oid {
+            sys::FLOAT4OID => Some(f32::from_bits(datum as u32) as f64),
+            // float8 is pass by value on 64 bit platforms
+            sys::FLOAT8OID => Some(f64::from_bits(datum as u64)),
+            _ => None,
+        }
+    }
+}
+
+/// The raw bytes of any by-reference type, in Postgres' binary format
+impl<'a> FromColumn<'a> for &'a [u8] {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        if column.typbyval {
+            return None;
+        }
+
+        let mut ptr = ptr::null();
+        let mut len = 0;
+        if !sys::pglite_datum_bytes(datum, column.typlen, &mut ptr, &mut len) {
+            return Some(&[]);
+        }
+        let bytes = slice::from_raw_parts(ptr as *const u8, len);
+
+        match column.type_oid {
+            // name is a fixed length, nul padded type
+            sys::NAMEOID => {
+                let end = bytes.iter().position(|b| *b == 0).unwrap_or(bytes.len());
+                Some(&bytes[..end])
+            }
+            _ => Some(bytes),
+        }
+    }
+}
+
+impl<'a> FromColumn<'a> for Vec<u8> {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        <&[u8]>::from_datum(column, datum).map(<[u8]>::to_vec)
+    }
+}
+
+impl<'a> FromColumn<'a> for &'a str {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        match column.type_oid {
+            sys::TEXTOID | sys::VARCHAROID | sys::BPCHAROID | sys::NAMEOID => {
+                let bytes = <&[u8]>::from_datum(column, datum)?;
+                // text that isn't valid UTF-8 can still be read as bytes
+                str::from_utf8(bytes).ok()
+            }
+            _ => None,
+        }
+    }
+}
+
+impl<'a> FromColumn<'a> for String {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        <&str>::from_datum(column, datum).map(str::to_owned)
+    }
+}
+
+/// Any value, converted to the closest `Value` variant. Types without one
+/// are converted to text by their output function.
+impl<'a> FromColumn<'a> for Value {
+    unsafe fn from_datum(column: &Column, datum: sys::Datum) -> Option<Self> {
+        let value = match column.type_oid {
+            sys::BOOLOID => Value::Bool(bool::from_datum(column, datum)?),
+            sys::INT2OID | sys::INT4OID | sys::INT8OID | sys::OIDOID =>
+                Value::Int(i64::from_datum(column, datum)?),
+            sys::FLOAT4OID | sys::FLOAT8OID =>
+                Value::Float(f64::from_datum(column, datum)?),
+            sys::TEXTOID | sys::VARCHAROID | sys::BPCHAROID | sys::NAMEOID => {
+                let bytes = <&[u8]>::from_datum(column, datum)?;
+                Value::Text(String::from_utf8_lossy(bytes).into_owned())
+            }
+            sys::BYTEAOID => Value::Bytes(Vec::from_datum(column, datum)?),
+            _ => {
+                let mut text = ptr::null_mut();
+                if !sys::pglite_datum_cstring(datum, column.type_oid, &mut text) {
+                    return Some(Value::Null);
+                }
+                Value::Text(CStr::from_ptr(text).to_string_lossy().into_owned())
+            }
+        };
+
+        Some(value)
+    }
+}
@@ -0,0 +1,154 @@
+/// Prepared statements, and the per-connection LRU cache of them that lets
+/// repeated SQL skip parsing, analysis and planning.
+
+use std::collections::HashMap;
+use std::ffi::CString;
+
+use crate::db;
+use crate::db::postgres::Plan;
+use crate::error::Error;
+use crate::row::Row;
+use crate::stream::RowStream;
+use crate::value::Value;
+use crate::Connection;
+
+pub(crate) const STATEMENT_CACHE_CAPACITY: usize = 128;
+
+pub struct Statement<'conn> {
+    conn: &'conn Connection,
+    sql: Box<str>,
+}
+
+impl<'conn> Statement<'conn> {
+    pub(crate) fn new(conn: &'conn Connection, sql: &str) -> Result<Self, Error> {
+        // prepare up front so errors surface here rather than on first use:
+        conn.plan(sql)?;
+        Ok(Statement { conn, sql: sql.into() })
+    }
+
+    pub fn sql(&self) -> &str {
+        &self.sql
+    }
+
+    pub(crate) fn conn(&self) -> &'conn Connection {
+        self.conn
+    }
+
+    /// Runs the statement with `params`, calling `f` with each result row on
+    /// the backend thread. Returns the number of rows processed.
+    pub fn query<F>(&self, params: &[Value], f: F) -> Result<u64, Error>
+        where F: FnMut(&Row) + Send
+    {
+        // the plan may have been evicted since we were prepared, in which
+        // case this prepares it again:
+        let plan = self.conn.plan(&self.sql)?;
+
+        self.conn.backend.call(move || unsafe { db::postgres::execute_plan(plan, params, f) })
+            .map_err(|_| Error::BackendGone)?
+            .map_err(Error::Postgres)
+    }
+
+    /// Runs the statement with `params`, discarding any result rows
+    pub fn execute(&self, params: &[Value]) -> Result<u64, Error> {
+        self.query(params, |_| ())
+    }
+
+    /// Runs the statement with `params` through a cursor, returning an
+    /// iterator that fetches the result rows a batch at a time
+    pub fn stream(&self, params: &[Value]) -> Result<RowStream<'conn>, Error> {
+        RowStream::open(self, params)
+    }
+}
+
+/// Saved plans keyed by SQL text. Eviction scans for the least recently
+/// used entry, which is cheap next to the parse and plan a miss costs.
+pub(crate) struct StatementCache {
+    capacity: usize,
+    clock: u64,
+    entries: HashMap<Box<str>, Entry>,
+}
+
+struct Entry {
+    plan: Plan,
+    last_used: u64,
+}
+
+impl StatementCache {
+    pub fn new(capacity: usize) -> Self {
+        StatementCache {
+            capacity,
+            clock: 0,
+            entries: HashMap::with_capacity(capacity),
+        }
+    }
+
+    pub fn capacity(&self) -> usize {
+        self.capacity
+    }
+
+    pub fn get(&mut self, sql: &str) -> Option<Plan> {
+        self.clock += 1;
+        let entry = self.entries.get_mut(sql)?;
+        entry.last_used = self.clock;
+        Some(entry.plan)
+    }
+
+    /// Makes room for `incoming` more entries, returning the plans evicted
+    pub fn make_room(&mut self, incoming: usize) -> Vec<Plan> {
+        let mut evicted = Vec::new();
+
+        while !self.entries.is_empty() && self.entries.len() + incoming > self.capacity {
+            let lru = self.entries.iter()
+                .min_by_key(|(_, entry)| entry.last_used)
+                .map(|(sql, _)| sql.clone())
+                .unwrap();
+
+            evicted.extend(self.entries.remove(&lru).map(|entry| entry.plan));
+        }
+
+        evicted
+    }
+
+    pub fn insert(&mut self, sql: &str, plan: Plan) {
+        self.clock += 1;
+        self.entries.insert(sql.into(), Entry { plan, last_used: self.clock });
+    }
+
+    /// Empties the cache, returning every plan it held
+    pub fn take_all(&mut self) -> Vec<Plan> {
+        self.entries.drain()
+            .map(|(_, entry)| entry.plan)
+            .collect()
+    }
+}
+
+impl Connection {
+    /// Looks up the saved plan for `sql`, preparing it on a miss
+    pub(crate) fn plan(&self, sql: &str) -> Result<Plan, Error> {
+        let mut cache = self.statements.borrow_mut();
+
+        if let Some(plan) = cache.get(sql) {
+            return Ok(plan);
+        }
+
+        let query = CString::new(sql)
+            .map_err(|_| Error::QueryContainsNul)?;
+
+        let evicted = cache.make_room(1);
+
+        let plan = self.backend.call(move || unsafe {
+            for plan in evicted {
+                db::postgres::drop_plan(plan);
+            }
+
+            db::postgres::prepare(&query)
+        });
+
+        let plan = plan
+            .map_err(|_| Error::BackendGone)?
+            .map_err(Error::Postgres)?;
+
+        cache.insert(sql, plan);
+        Ok(plan)
+    }
+}
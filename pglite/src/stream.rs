@@ -0,0 +1,123 @@
+/// Streaming query results through a cursor, fetching a batch of rows per
+/// round trip so memory use is bounded by the batch size rather than the
+/// size of the result.
+
+use std::collections::VecDeque;
+use std::ffi::CString;
+
+use crate::db;
+use crate::error::Error;
+use crate::statement::Statement;
+use crate::transaction::Transaction;
+use crate::value::Value;
+use crate::Connection;
+
+pub const DEFAULT_BATCH_SIZE: usize = 1024;
+
+/// An iterator over the rows of a query, read from a cursor on the backend
+/// a batch at a time.
+///
+/// The cursor lives in a transaction block, which is opened for the life of
+/// the stream if one isn't already. Statements run on the connection while
+/// the stream is open run inside it too.
+pub struct RowStream<'conn> {
+    conn: &'conn Connection,
+    portal: CString,
+    batch_size: usize,
+    rows: VecDeque<Vec<Value>>,
+    done: bool,
+    transaction: Option<Transaction<'conn>>,
+}
+
+impl<'conn> RowStream<'conn> {
+    pub(crate) fn open(stmt: &Statement<'conn>, params: &[Value]) -> Result<Self, Error> {
+        let conn = stmt.conn();
+        let transaction = Transaction::begin(conn)?;
+        let plan = conn.plan(stmt.sql())?;
+
+        let portal = conn.backend.call(move || unsafe { db::postgres::open_cursor(plan, params) })
+            .map_err(|_| Error::BackendGone)?
+            .map_err(Error::Postgres)?;
+
+        Ok(RowStream {
+            conn,
+            portal,
+            batch_size: DEFAULT_BATCH_SIZE,
+            rows: VecDeque::new(),
+            done: false,
+            transaction: Some(transaction),
+        })
+    }
+
+    /// Sets how many rows are fetched per round trip to the backend
+    pub fn with_batch_size(mut self, batch_size: usize) -> Self {
+        self.batch_size = batch_size.max(1);
+        self
+    }
+
+    fn fetch(&mut self) -> Result<(), Error> {
+        let portal = &self.portal;
+        let batch_size = self.batch_size;
+        let rows = &mut self.rows;
+
+        let fetched = self.conn.backend.call(move || unsafe {
+            db::postgres::fetch(portal, batch_size, |row| rows.push_back(row.values()))
+        });
+
+        let fetched = fetched
+            .map_err(|_| Error::BackendGone)?
+            .map_err(Error::Postgres)?;
+
+        if (fetched as usize) < batch_size {
+            self.done = true;
+        }
+
+        Ok(())
+    }
+
+    /// Closes the cursor and ends the transaction the stream opened, if any
+    fn close(&mut self) -> Result<(), Error> {
+        let transaction = match self.transaction.take() {
+            Some(transaction) => transaction,
+            None => return Ok(()),
+        };
+
+        let portal = &self.portal;
+
+        self.conn.backend.call(move || unsafe { db::postgres::close_cursor(portal) })
+            .map_err(|_| Error::BackendGone)?
+            .map_err(Error::Postgres)?;
+
+        transaction.commit()
+    }
+}
+
+impl<'conn> Iterator for RowStream<'conn> {
+    type Item = Result<Vec<Value>, Error>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.rows.is_empty() && !self.done {
+            if let Err(error) = self.fetch() {
+                self.done = true;
+                return Some(Err(error));
+            }
+        }
+
+        if let Some(row) = self.rows.pop_front() {
+            return Some(Ok(row));
+        }
+
+        match self.close() {
+            Ok(()) => None,
+            Err(error) => Some(Err(error)),
+        }
+    }
+}
+
+impl<'conn> Drop for RowStream<'conn> {
+    fn drop(&mut self) {
+        if let Err(error) = self.close() {
+            log::warn!("pglite: closing row stream: {}", error);
+        }
+    }
+}
@@ -0,0 +1,170 @@
+use std::fs;
+use std::io;
+use std::os::unix::fs::DirBuilderExt;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, Ordering};
+
+use crate::{db, OpenError};
+
+/// A pre-bootstrapped cluster that new data directories are cloned from.
+///
+/// Bootstrapping parses and executes the entire BKI stream, which takes
+/// hundreds of milliseconds. A template pays that cost once, after which
+/// opening a new database is a file copy (or a reflink, on filesystems that
+/// support it).
+pub struct Template {
+    path: PathBuf,
+}
+
+impl Template {
+    /// Opens the template cluster at `path`, bootstrapping it first if it
+    /// does not exist yet
+    pub fn open(path: &Path) -> Result<Self, OpenError> {
+        if !db::bootstrap::is_bootstrapped(path) {
+            create(path)?;
+        }
+
+        Ok(Template { path: path.to_owned() })
+    }
+
+    pub fn path(&self) -> &Path {
+        &self.path
+    }
+
+    /// Clones this template into `data_dir`, which must not exist yet. The
+    /// clone is made in a staging directory next to it and renamed into
+    /// place, as `create` does, so a crash part way through never leaves a
+    /// half-copied cluster behind.
+    pub(crate) fn clone_into(&self, data_dir: &Path) -> io::Result<()> {
+        let staging = staging_path(data_dir);
+        remove_staging(&staging)?;
+
+        if let Err(e) = clone_dir(&self.path, &staging) {
+            let _ = fs::remove_dir_all(&staging);
+            return Err(e);
+        }
+
+        match fs::rename(&staging, data_dir) {
+            Ok(()) => Ok(()),
+            // somebody else won the race, use theirs:
+            Err(_) if db::bootstrap::is_bootstrapped(data_dir) => {
+                let _ = fs::remove_dir_all(&staging);
+                Ok(())
+            }
+            Err(e) => {
+                let _ = fs::remove_dir_all(&staging);
+                Err(e)
+            }
+        }
+    }
+}
+
+/// Bootstraps into a staging directory next to `path` and renames it into
+/// place, so that a concurrent opener never sees a half-built template
+fn create(path: &Path) -> Result<(), OpenError> {
+    let staging = staging_path(path);
+    remove_staging(&staging).map_err(OpenError::Io)?;
+
+    fs::DirBuilder::new()
+        .mode(0o700)
+        .create(&staging)
+        .map_err(OpenError::Io)?;
+
+    crate::bootstrap(&staging)?;
+
+    match fs::rename(&staging, path) {
+        Ok(()) => Ok(()),
+        // somebody else won the race, use theirs:
+        Err(_) if db::bootstrap::is_bootstrapped(path) => {
+            let _ = fs::remove_dir_all(&staging);
+            Ok(())
+        }
+        Err(e) => Err(OpenError::Io(e)),
+    }
+}
+
+/// A staging directory next to `path` of this call's own, so that threads
+/// creating or cloning into the same path don't build in each other's
+fn staging_path(path: &Path) -> PathBuf {
+    static NEXT: AtomicU64 = AtomicU64::new(0);
+
+    let mut staging = path.as_os_str().to_owned();
+    staging.push(format!(".staging-{}-{}", std::process::id(), NEXT.fetch_add(1, Ordering::Relaxed)));
+    PathBuf::from(staging)
+}
+
+/// Cleans up after an earlier process with the same id that died part way
+/// through
+fn remove_staging(staging: &Path) -> io::Result<()> {
+    match fs::remove_dir_all(staging) {
+        Ok(()) => Ok(()),
+        Err(e) if e.kind() == io::ErrorKind::NotFound => Ok(()),
+        Err(e) => Err(e),
+    }
+}
+
+fn clone_dir(src: &Path, dst: &Path) -> io::Result<()> {
+    fs::DirBuilder::new()
+        .mode(0o700)
+        .create(dst)?;
+
+    for entry in fs::read_dir(src)? {
+        let entry = entry?;
+        let src_path = entry.path();
+        let dst_path = dst.join(entry.file_name());
+
+        // lock and options files belong to whoever had the template open
+        if entry.file_name() == "postmaster.pid" || entry.file_name() == "postmaster.opts" {
+            continue;
+        }
+
+        if entry.file_type()?.is_dir() {
+            clone_dir(&src_path, &dst_path)?;
+        } else {
+            clone_file(&src_path, &dst_path)?;
+        }
+    }
+
+    Ok(())
+}
+
+fn clone_file(src: &Path, dst: &Path) -> io::Result<()> {
+    #[cfg(target_os = "linux")]
+    {
+        if reflink(src, dst).is_ok() {
+            return Ok(());
+        }
+    }
+
+    fs::copy(src, dst).map(|_| ())
+}
+
+#[cfg(target_os = "linux")]
+fn reflink(src: &Path, dst: &Path) -> io::Result<()> {
+    use std::os::unix::fs::{OpenOptionsExt, PermissionsExt};
+    use std::os::unix::io::AsRawFd;
+
+    // _IOW(0x94, 9, int) from linux/fs.h
+    const FICLONE: u32 = 0x40049409;
+
+    let src_file = fs::File::open(src)?;
+    let mode = src_file.metadata()?.permissions().mode();
+
+    let dst_file = fs::OpenOptions::new()
+        .write(true)
+        .create_new(true)
+        .mode(mode)
+        .open(dst)?;
+
+    let rc = unsafe { libc::ioctl(dst_file.as_raw_fd(), FICLONE as _, src_file.as_raw_fd()) };
+
+    if rc < 0 {
+        let err = io::Error::last_os_error();
+        // leave nothing behind for the fallback copy to trip over
+        drop(dst_file);
+        let _ = fs::remove_file(dst);
+        return Err(err);
+    }
+
+    Ok(())
+}
@@ -0,0 +1,60 @@
+use pglite_sys as sys;
+
+use crate::db;
+use crate::error::Error;
+use crate::Connection;
+
+/// Holds work spanning several round trips to the backend in one
+/// transaction block, rolling it back if dropped before `commit`, whether
+/// because of an error or a panic in caller code between round trips
+pub(crate) struct Transaction<'a> {
+    conn: &'a Connection,
+    /// whether we opened the block, rather than running in the caller's
+    open: bool,
+}
+
+impl<'a> Transaction<'a> {
+    pub fn begin(conn: &'a Connection) -> Result<Self, Error> {
+        let open = conn.backend.call(|| unsafe {
+            if sys::IsTransactionBlock() {
+                Ok(false)
+            } else {
+                db::postgres::command(b"BEGIN\0").map(|_| true)
+            }
+        });
+
+        let open = open
+            .map_err(|_| Error::BackendGone)?
+            .map_err(Error::Postgres)?;
+
+        Ok(Transaction { conn, open })
+    }
+
+    pub fn commit(mut self) -> Result<(), Error> {
+        if !self.open {
+            return Ok(());
+        }
+
+        self.open = false;
+
+        self.conn.backend.call(|| unsafe { db::postgres::command(b"COMMIT\0") })
+            .map_err(|_| Error::BackendGone)?
+            .map_err(Error::Postgres)?;
+
+        Ok(())
+    }
+}
+
+impl<'a> Drop for Transaction<'a> {
+    fn drop(&mut self) {
+        if !self.open {
+            return;
+        }
+
+        let result = self.conn.backend.call(|| unsafe { db::postgres::command(b"ROLLBACK\0") });
+
+        if let Ok(Err(error)) = result {
+            log::warn!("pglite: rolling back: {}", error);
+        }
+    }
+}
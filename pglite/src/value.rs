@@ -0,0 +1,109 @@
+use std::ptr;
+
+use pglite_sys as sys;
+
+/// A statement parameter. Values are converted to the parameter's type on
+/// the backend, directly where the representations match (an `Int` for an
+/// `int4` parameter, say) and through the type's text input function
+/// otherwise.
+#[derive(Debug, Clone, PartialEq)]
+pub enum Value {
+    Null,
+    Bool(bool),
+    Int(i64),
+    Float(f64),
+    Text(String),
+    Bytes(Vec<u8>),
+}
+
+impl Value {
+    /// Borrows this value for the shims. The result must not outlive `self`.
+    pub(crate) fn as_param(&self) -> sys::PgliteValue {
+        let mut param = sys::PgliteValue {
+            kind: sys::PgliteValueKind_PGLITE_VALUE_NULL,
+            b: false,
+            i: 0,
+            f: 0.0,
+            data: ptr::null(),
+            len: 0,
+        };
+
+        match self {
+            Value::Null => {}
+            Value::Bool(b) => {
+                param.kind = sys::PgliteValueKind_PGLITE_VALUE_BOOL;
+                param.b = *b;
+            }
+            Value::Int(i) => {
+                param.kind = sys::PgliteValueKind_PGLITE_VALUE_INT;
+                param.i = *i;
+            }
+            Value::Float(f) => {
+                param.kind = sys::PgliteValueKind_PGLITE_VALUE_FLOAT;
+                param.f = *f;
+            }
+            Value::Text(text) => {
+                param.kind = sys::PgliteValueKind_PGLITE_VALUE_TEXT;
+                param.data = text.as_ptr() as *const _;
+                param.len = text.len();
+            }
+            Value::Bytes(bytes) => {
+                param.kind = sys::PgliteValueKind_PGLITE_VALUE_BYTES;
+                param.data = bytes.as_ptr() as *const _;
+                param.len = bytes.len();
+            }
+        }
+
+        param
+    }
+}
+
+impl From<bool> for Value {
+    fn from(b: bool) -> Self { Value::Bool(b) }
+}
+
+impl From<i16> for Value {
+    fn from(i: i16) -> Self { Value::Int(i.into()) }
+}
+
+impl From<i32> for Value {
+    fn from(i: i32) -> Self { Value::Int(i.into()) }
+}
+
+impl From<i64> for Value {
+    fn from(i: i64) -> Self { Value::Int(i) }
+}
+
+impl From<u32> for Value {
+    fn from(i: u32) -> Self { Value::Int(i.into()) }
+}
+
+impl From<f32> for Value {
+    fn from(f: f32) -> Self { Value::Float(f.into()) }
+}
+
+impl From<f64> for Value {
+    fn from(f: f64) -> Self { Value::Float(f) }
+}
+
+impl From<&str> for Value {
+    fn from(text: &str) -> Self { Value::Text(text.to_owned()) }
+}
+
+impl From<String> for Value {
+    fn from(text: String) -> Self { Value::Text(text) }
+}
+
+impl From<&[u8]> for Value {
+    fn from(bytes: &[u8]) -> Self { Value::Bytes(bytes.to_vec()) }
+}
+
+impl From<Vec<u8>> for Value {
+    fn from(bytes: Vec<u8>) -> Self { Value::Bytes(bytes) }
+}
+
+impl<T: Into<Value>> From<Option<T>> for Value {
+    fn from(value: Option<T>) -> Self {
+        value.map(Into::into).unwrap_or(Value::Null)
+    }
+}
@@ -0,0 +1,246 @@
+/// Taking over the file system calls a cluster makes in its data directory,
+/// much as a SQLite VFS does (see pglite-sys/src/shim/fs.c). Paths are
+/// relative to the data directory, unless they're absolute. Relation
+/// segments and temporary files are read, written, synced and truncated
+/// through the VFS too, on the descriptors its `open` returned, so a VFS can
+/// encrypt or checksum their blocks, say; WAL and the other files Postgres
+/// works on with descriptors of its own are read and written as they are.
+
+use std::ffi::{CStr, CString};
+use std::io;
+use std::mem::MaybeUninit;
+use std::os::raw::{c_char, c_int, c_void};
+use std::os::unix::ffi::OsStrExt;
+use std::os::unix::io::{AsRawFd, BorrowedFd, FromRawFd, IntoRawFd, OwnedFd};
+use std::panic::{self, AssertUnwindSafe};
+use std::path::{Component, Path, PathBuf};
+use pglite_sys as sys;
+
+use crate::{data_dir_cstring, OpenError};
+
+pub trait Vfs: Send + Sync {
+    /// As open(2), with its `flags` and `mode`
+    fn open(&self, path: &CStr, flags: c_int, mode: libc::mode_t) -> io::Result<OwnedFd>;
+
+    fn stat(&self, path: &CStr) -> io::Result<libc::stat>;
+
+    fn mkdir(&self, path: &CStr, mode: libc::mode_t) -> io::Result<()>;
+
+    /// Opens the directory at `path` for listing
+    fn open_dir(&self, path: &CStr) -> io::Result<OwnedFd>;
+
+    fn unlink(&self, path: &CStr) -> io::Result<()>;
+
+    fn rmdir(&self, path: &CStr) -> io::Result<()>;
+
+    fn rename(&self, from: &CStr, to: &CStr) -> io::Result<()>;
+
+    /// As pread(2), on a descriptor `open` returned
+    fn read(&self, fd: BorrowedFd<'_>, buf: &mut [u8], offset: u64) -> io::Result<usize> {
+        cvt_len(unsafe { libc::pread(fd.as_raw_fd(), buf.as_mut_ptr() as *mut c_void, buf.len(), offset as libc::off_t) })
+    }
+
+    /// As pwrite(2), on a descriptor `open` returned
+    fn write(&self, fd: BorrowedFd<'_>, buf: &[u8], offset: u64) -> io::Result<usize> {
+        cvt_len(unsafe { libc::pwrite(fd.as_raw_fd(), buf.as_ptr() as *const c_void, buf.len(), offset as libc::off_t) })
+    }
+
+    /// As fsync(2), on a descriptor `open` returned. Not called with the
+    /// cluster's `fsync` setting off.
+    fn sync(&self, fd: BorrowedFd<'_>) -> io::Result<()> {
+        cvt(unsafe { libc::fsync(fd.as_raw_fd()) }).map(drop)
+    }
+
+    /// As ftruncate(2), on a descriptor `open` returned
+    fn truncate(&self, fd: BorrowedFd<'_>, len: u64) -> io::Result<()> {
+        cvt(unsafe { libc::ftruncate(fd.as_raw_fd(), len as libc::off_t) }).map(drop)
+    }
+}
+
+/// The data directory as it is, as the default VFS has it, for a VFS of
+/// your own to build on
+pub struct DirVfs {
+    dir: OwnedFd,
+}
+
+impl DirVfs {
+    pub fn open(data_dir: &Path) -> io::Result<Self> {
+        let path = CString::new(data_dir.as_os_str().as_bytes())
+            .map_err(|_| io::Error::from(io::ErrorKind::InvalidInput))?;
+
+        let fd = cvt(unsafe { libc::open(path.as_ptr(), libc::O_RDONLY | libc::O_DIRECTORY | libc::O_CLOEXEC) })?;
+
+        Ok(DirVfs { dir: unsafe { OwnedFd::from_raw_fd(fd) } })
+    }
+}
+
+impl Vfs for DirVfs {
+    fn open(&self, path: &CStr, flags: c_int, mode: libc::mode_t) -> io::Result<OwnedFd> {
+        let fd = cvt(unsafe { libc::openat(self.dir.as_raw_fd(), path.as_ptr(), flags, mode) })?;
+        Ok(unsafe { OwnedFd::from_raw_fd(fd) })
+    }
+
+    fn stat(&self, path: &CStr) -> io::Result<libc::stat> {
+        let mut buf = MaybeUninit::uninit();
+        cvt(unsafe { libc::fstatat(self.dir.as_raw_fd(), path.as_ptr(), buf.as_mut_ptr(), 0) })?;
+        Ok(unsafe { buf.assume_init() })
+    }
+
+    fn mkdir(&self, path: &CStr, mode: libc::mode_t) -> io::Result<()> {
+        cvt(unsafe { libc::mkdirat(self.dir.as_raw_fd(), path.as_ptr(), mode) }).map(drop)
+    }
+
+    fn open_dir(&self, path: &CStr) -> io::Result<OwnedFd> {
+        self.open(path, libc::O_RDONLY | libc::O_DIRECTORY | libc::O_CLOEXEC, 0)
+    }
+
+    fn unlink(&self, path: &CStr) -> io::Result<()> {
+        cvt(unsafe { libc::unlinkat(self.dir.as_raw_fd(), path.as_ptr(), 0) }).map(drop)
+    }
+
+    fn rmdir(&self, path: &CStr) -> io::Result<()> {
+        cvt(unsafe { libc::unlinkat(self.dir.as_raw_fd(), path.as_ptr(), libc::AT_REMOVEDIR) }).map(drop)
+    }
+
+    fn rename(&self, from: &CStr, to: &CStr) -> io::Result<()> {
+        let dir = self.dir.as_raw_fd();
+        cvt(unsafe { libc::renameat(dir, from.as_ptr(), dir, to.as_ptr()) }).map(drop)
+    }
+}
+
+/// Routes the file system calls of clusters in `data_dir` through `vfs`.
+/// Must be called before any thread of this process works on a cluster
+/// there, as each looks up its VFS only once; registering another later
+/// only affects threads that haven't. A VFS, once registered, lives as
+/// long as the process.
+pub fn register_vfs(data_dir: &Path, vfs: Box<dyn Vfs>) -> Result<(), OpenError> {
+    let data_dir = data_dir_cstring(&backend_path(data_dir).map_err(OpenError::Io)?)?;
+
+    let vfs: &'static Box<dyn Vfs> = Box::leak(Box::new(vfs));
+
+    let table = sys::PgliteVfs {
+        ctx: vfs as *const Box<dyn Vfs> as *mut c_void,
+        open: Some(open),
+        stat: Some(stat),
+        mkdir: Some(mkdir),
+        opendir: Some(opendir),
+        unlink: Some(unlink),
+        rmdir: Some(rmdir),
+        rename: Some(rename),
+        pread: Some(pread),
+        pwrite: Some(pwrite),
+        fsync: Some(fsync),
+        ftruncate: Some(ftruncate),
+    };
+
+    if unsafe { sys::pglite_register_vfs(data_dir.as_ptr(), &table) } {
+        Ok(())
+    } else {
+        Err(OpenError::Io(io::Error::from(io::ErrorKind::OutOfMemory)))
+    }
+}
+
+/// `path` as the backend's `DataDir` would have it: made absolute, with
+/// `.` and `..` resolved without following symlinks
+fn backend_path(path: &Path) -> io::Result<PathBuf> {
+    let path = std::env::current_dir()?.join(path);
+    let mut resolved = PathBuf::new();
+
+    for component in path.components() {
+        match component {
+            Component::CurDir => {}
+            Component::ParentDir => { resolved.pop(); }
+            component => resolved.push(component),
+        }
+    }
+
+    Ok(resolved)
+}
+
+fn cvt(result: c_int) -> io::Result<c_int> {
+    if result < 0 {
+        Err(io::Error::last_os_error())
+    } else {
+        Ok(result)
+    }
+}
+
+fn cvt_len(result: libc::ssize_t) -> io::Result<usize> {
+    if result < 0 {
+        Err(io::Error::last_os_error())
+    } else {
+        Ok(result as usize)
+    }
+}
+
+/// Calls the VFS behind `ctx` for a backend thread, which gets `failed` and
+/// errno set should it fail. A panic can't unwind into Postgres, so it's
+/// reported as an I/O error.
+unsafe fn call<T>(ctx: *mut c_void, failed: T, f: impl FnOnce(&dyn Vfs) -> io::Result<T>) -> T {
+    let vfs = &**(ctx as *const Box<dyn Vfs>);
+
+    let errno = match panic::catch_unwind(AssertUnwindSafe(|| f(vfs))) {
+        Ok(Ok(value)) => return value,
+        Ok(Err(e)) => e.raw_os_error().unwrap_or(libc::EIO),
+        Err(_) => {
+            log::error!("pglite: VFS panicked");
+            libc::EIO
+        }
+    };
+
+    *libc::__errno_location() = errno;
+    failed
+}
+
+unsafe extern "C" fn open(ctx: *mut c_void, path: *const c_char, flags: c_int, mode: sys::mode_t) -> c_int {
+    call(ctx, -1, |vfs| vfs.open(CStr::from_ptr(path), flags, mode).map(IntoRawFd::into_raw_fd))
+}
+
+unsafe extern "C" fn stat(ctx: *mut c_void, path: *const c_char, buf: *mut sys::stat) -> c_int {
+    call(ctx, -1, |vfs| {
+        *(buf as *mut libc::stat) = vfs.stat(CStr::from_ptr(path))?;
+        Ok(0)
+    })
+}
+
+unsafe extern "C" fn mkdir(ctx: *mut c_void, path: *const c_char, mode: sys::mode_t) -> c_int {
+    call(ctx, -1, |vfs| vfs.mkdir(CStr::from_ptr(path), mode).map(|()| 0))
+}
+
+unsafe extern "C" fn opendir(ctx: *mut c_void, path: *const c_char) -> c_int {
+    call(ctx, -1, |vfs| vfs.open_dir(CStr::from_ptr(path)).map(IntoRawFd::into_raw_fd))
+}
+
+unsafe extern "C" fn unlink(ctx: *mut c_void, path: *const c_char) -> c_int {
+    call(ctx, -1, |vfs| vfs.unlink(CStr::from_ptr(path)).map(|()| 0))
+}
+
+unsafe extern "C" fn rmdir(ctx: *mut c_void, path: *const c_char) -> c_int {
+    call(ctx, -1, |vfs| vfs.rmdir(CStr::from_ptr(path)).map(|()| 0))
+}
+
+unsafe extern "C" fn rename(ctx: *mut c_void, from: *const c_char, to: *const c_char) -> c_int {
+    call(ctx, -1, |vfs| vfs.rename(CStr::from_ptr(from), CStr::from_ptr(to)).map(|()| 0))
+}
+
+unsafe extern "C" fn pread(ctx: *mut c_void, fd: c_int, buf: *mut c_void, count: sys::size_t, offset: sys::off_t) -> sys::ssize_t {
+    call(ctx, -1, |vfs| {
+        let buf = std::slice::from_raw_parts_mut(buf as *mut u8, count as usize);
+        vfs.read(BorrowedFd::borrow_raw(fd), buf, offset as u64).map(|n| n as sys::ssize_t)
+    })
+}
+
+unsafe extern "C" fn pwrite(ctx: *mut c_void, fd: c_int, buf: *const c_void, count: sys::size_t, offset: sys::off_t) -> sys::ssize_t {
+    call(ctx, -1, |vfs| {
+        let buf = std::slice::from_raw_parts(buf as *const u8, count as usize);
+        vfs.write(BorrowedFd::borrow_raw(fd), buf, offset as u64).map(|n| n as sys::ssize_t)
+    })
+}
+
+unsafe extern "C" fn fsync(ctx: *mut c_void, fd: c_int) -> c_int {
+    call(ctx, -1, |vfs| vfs.sync(BorrowedFd::borrow_raw(fd)).map(|()| 0))
+}
+
+unsafe extern "C" fn ftruncate(ctx: *mut c_void, fd: c_int, length: sys::off_t) -> c_int {
+    call(ctx, -1, |vfs| vfs.truncate(BorrowedFd::borrow_raw(fd), length as u64).map(|()| 0))
+}
@@ -16,10 +16,313 @@ cp -r postgres/src "$STAGING_SRC/" && cp -r postgres-gen/src "$STAGING_SRC/" &&
 # build tooling. this part of the script does our 'generation' part
 echo "generating sources"
 
-# some generated sources are just copied verbatim from platform impls
-# TODO - impl platform selection logic
-cp postgres/src/backend/port/sysv_shmem.c "$STAGING_SRC/src/backend/port/pg_shmem.c"
-cp postgres/src/backend/port/posix_sema.c "$STAGING_SRC/src/backend/port/pg_sema.c"
+# the platform's pg_shmem.c and pg_sema.c are pglite-sys/src/shim/anon_shmem.c
+# and futex.c, not sysv_shmem.c and posix_sema.c
+
+# backend threads attach to shared memory like EXEC_BACKEND children do (see
+# pglite-sys/src/shim/attach.c), so give them the globals those children
+# are handed, let them through ipci.c's reattach path and have dsm.c map
+# the control segment on first use. the postmaster's children attach before
+# their main functions run (see pglite-sys/src/shim/postmaster.c), so those
+# mustn't create a PGPROC of their own
+echo "patching sources"
+sed -i 's|^#define NON_EXEC_STATIC static$|#define NON_EXEC_STATIC|' \
+    "$STAGING_SRC/src/include/c.h"
+sed -i '/should be attached to shared memory already/d' \
+    "$STAGING_SRC/src/backend/storage/ipc/ipci.c"
+sed -i 's|^#ifdef EXEC_BACKEND$|#if 1 /* pglite: attached backend threads */|' \
+    "$STAGING_SRC/src/backend/storage/ipc/dsm.c"
+sed -i 's|^#ifndef EXEC_BACKEND$|#if 0 /* pglite: attached by postmaster.c */|' \
+    "$STAGING_SRC/src/backend/postmaster/autovacuum.c" \
+    "$STAGING_SRC/src/backend/postmaster/auxprocess.c" \
+    "$STAGING_SRC/src/backend/postmaster/bgworker.c"
+sed -i 's|^static bool am_autovacuum_\(launcher\|worker\) = false;$|bool am_autovacuum_\1 = false;|' \
+    "$STAGING_SRC/src/backend/postmaster/autovacuum.c"
+
+# dynamic shared memory segments come from process memory by default (see
+# pglite-sys/src/shim/dsm_process.c)
+sed -i -e '/^#define DSM_IMPL_MMAP[[:space:]]/a #define DSM_IMPL_PROCESS 5' \
+    -e 's|^\(#define DEFAULT_DYNAMIC_SHARED_MEMORY_TYPE[[:space:]]*\)DSM_IMPL_POSIX$|\1DSM_IMPL_PROCESS|' \
+    "$STAGING_SRC/src/include/storage/dsm_impl.h"
+sed -i -e '/^const struct config_enum_entry dynamic_shared_memory_options\[\] = {$/a \	{"process", DSM_IMPL_PROCESS, false},' \
+    -e 's|^dsm_impl_op(dsm_op op,|pglite_dsm_impl_os_op(dsm_op op,|' \
+    "$STAGING_SRC/src/backend/storage/ipc/dsm_impl.c"
+
+# WaitLatch sleeps on a futex that SetLatch wakes (see
+# pglite-sys/src/shim/futex.c), so move latch.c's out of the way
+sed -i -e 's|^SetLatch(|pglite_signal_SetLatch(|' \
+    -e 's|^WaitLatch(|pglite_signal_WaitLatch(|' \
+    "$STAGING_SRC/src/backend/storage/ipc/latch.c"
+
+# spinning backends yield to the lock holder before they start sleeping
+# (see pglite-sys/src/shim/spin.c)
+sed -i -e '/^#include "storage\/s_lock.h"$/a extern void pglite_spin_delay_sleep(SpinDelayStatus *status);' \
+    -e 's|pg_usleep(status->cur_delay);|pglite_spin_delay_sleep(status);|' \
+    "$STAGING_SRC/src/backend/storage/lmgr/s_lock.c"
+
+# relations can be kept in process memory by a second storage manager (see
+# pglite-sys/src/shim/memory_smgr.c), which smgropen picks for the threads
+# of clusters opened in memory; the places that work on relation files by
+# path rather than through smgr ask it too
+sed -i -e '/^static const f_smgr smgrsw\[\] = {$/i \
+extern void pglite_memory_open(SMgrRelation reln);\
+extern void pglite_memory_close(SMgrRelation reln, ForkNumber forknum);\
+extern void pglite_memory_create(SMgrRelation reln, ForkNumber forknum, bool isRedo);\
+extern bool pglite_memory_exists(SMgrRelation reln, ForkNumber forknum);\
+extern void pglite_memory_unlink(RelFileNodeBackend rnode, ForkNumber forknum, bool isRedo);\
+extern void pglite_memory_extend(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum, char *buffer, bool skipFsync);\
+extern bool pglite_memory_prefetch(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum);\
+extern void pglite_memory_read(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum, char *buffer);\
+extern void pglite_memory_write(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum, char *buffer, bool skipFsync);\
+extern void pglite_memory_writeback(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum, BlockNumber nblocks);\
+extern BlockNumber pglite_memory_nblocks(SMgrRelation reln, ForkNumber forknum);\
+extern void pglite_memory_truncate(SMgrRelation reln, ForkNumber forknum, BlockNumber nblocks);\
+extern void pglite_memory_immedsync(SMgrRelation reln, ForkNumber forknum);\
+extern int pglite_smgr_which(void);\
+' \
+    -e '/^		\.smgr_immedsync = mdimmedsync,$/ {
+n
+s/^	}$/	},/
+a \
+	/* pglite: process memory */\
+	{\
+		.smgr_init = NULL,\
+		.smgr_shutdown = NULL,\
+		.smgr_open = pglite_memory_open,\
+		.smgr_close = pglite_memory_close,\
+		.smgr_create = pglite_memory_create,\
+		.smgr_exists = pglite_memory_exists,\
+		.smgr_unlink = pglite_memory_unlink,\
+		.smgr_extend = pglite_memory_extend,\
+		.smgr_prefetch = pglite_memory_prefetch,\
+		.smgr_read = pglite_memory_read,\
+		.smgr_write = pglite_memory_write,\
+		.smgr_writeback = pglite_memory_writeback,\
+		.smgr_nblocks = pglite_memory_nblocks,\
+		.smgr_truncate = pglite_memory_truncate,\
+		.smgr_immedsync = pglite_memory_immedsync,\
+	}
+}' \
+    -e 's|^\(		reln->smgr_which = \)0;.*$|\1pglite_smgr_which();|' \
+    "$STAGING_SRC/src/backend/storage/smgr/smgr.c"
+sed -i -e '/^Oid$/ {
+N
+/\nGetNewRelFileNode(/i extern bool pglite_memory_relation_exists(RelFileNodeBackend rnode);\
+
+}' \
+    -e 's|^\(		if (access(rpath, F_OK) == 0\))$|\1 \|\| pglite_memory_relation_exists(rnode))|' \
+    "$STAGING_SRC/src/backend/catalog/catalog.c"
+sed -i -e 's|^\(	\)\(if (MakePGDirectory(todir) != 0)\)$|\1/* pglite: the relations of a database in memory, if any */\n\1pglite_memory_copy_db(fromdir, todir);\n\n\1\2|' \
+    -e '/^#include "postgres.h"$/a \
+\
+extern void pglite_memory_copy_db(const char *fromdir, const char *todir);' \
+    "$STAGING_SRC/src/backend/storage/file/copydir.c"
+sed -i -e 's|^\(	remove_dbtablespaces(db_id);\)$|\1\n	pglite_memory_drop_db(db_id);|' \
+    -e '/^#include "postgres.h"$/a \
+\
+extern void pglite_memory_drop_db(Oid dbid);' \
+    "$STAGING_SRC/src/backend/commands/dbcommands.c"
+sed -i -e 's|^\(	\)\(relationpath = relpathbackend(\*rfn, backend, forknum);\)$|\1if (pglite_memory_fork_size(*rfn, backend, forknum, \&totalsize))\n\1	return totalsize;\n\n\1\2|' \
+    -e 's|^\(	totalsize = db_dir_size(pathname);\)$|\1\n\n	/* pglite: relations in memory, if any */\n	totalsize += pglite_memory_database_size(dbOid);|' \
+    -e '/^static int64$/ {
+N
+/\ncalculate_database_size(/i extern int64 pglite_memory_database_size(Oid dbid);\
+
+/\ncalculate_relation_size(/i extern bool pglite_memory_fork_size(RelFileNode node, BackendId backend, ForkNumber forknum, int64 *size);\
+
+}' \
+    "$STAGING_SRC/src/backend/utils/adt/dbsize.c"
+
+# data files are read ahead of scans through io_uring (see
+# pglite-sys/src/shim/readahead.c), which wraps md.c's entries in smgrsw and
+# gets the descriptor and offset of a block from md.c
+sed -i -e '/^static const f_smgr smgrsw\[\] = {$/i \
+extern void pglite_md_unlink(RelFileNodeBackend rnode, ForkNumber forknum, bool isRedo);\
+extern void pglite_md_extend(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum, char *buffer, bool skipFsync);\
+extern bool pglite_md_prefetch(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum);\
+extern void pglite_md_read(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum, char *buffer);\
+extern void pglite_md_write(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum, char *buffer, bool skipFsync);\
+extern void pglite_md_truncate(SMgrRelation reln, ForkNumber forknum, BlockNumber nblocks);\
+' \
+    -e 's|= mdunlink,$|= pglite_md_unlink,|' \
+    -e 's|= mdextend,$|= pglite_md_extend,|' \
+    -e 's|= mdprefetch,$|= pglite_md_prefetch,|' \
+    -e 's|= mdread,$|= pglite_md_read,|' \
+    -e 's|= mdwrite,$|= pglite_md_write,|' \
+    -e 's|= mdtruncate,$|= pglite_md_truncate,|' \
+    "$STAGING_SRC/src/backend/storage/smgr/smgr.c"
+cat >> "$STAGING_SRC/src/backend/storage/smgr/md.c" <<'EOF'
+
+/*
+ * pglite: the descriptor of the segment holding the block, and the block's
+ * offset in it, for reading it ahead. -1 if there's no such segment, or its
+ * virtual fd has been closed.
+ */
+int
+pglite_md_fd(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			 off_t *offset)
+{
+	MdfdVec    *v = _mdfd_getseg(reln, forknum, blocknum, false,
+								 EXTENSION_RETURN_NULL);
+
+	if (v == NULL)
+		return -1;
+
+	*offset = (off_t) BLCKSZ * (blocknum % ((BlockNumber) RELSEG_SIZE));
+	return FileGetRawDesc(v->mdfd_vfd);
+}
+EOF
+
+# relations can be kept in a single file by a third storage manager (see
+# pglite-sys/src/shim/container_smgr.c), which smgropen picks in clusters
+# that have one; the places that work on relation files by path rather than
+# through smgr ask it too
+sed -i -e '/^static const f_smgr smgrsw\[\] = {$/i \
+extern void pglite_container_open(SMgrRelation reln);\
+extern void pglite_container_close(SMgrRelation reln, ForkNumber forknum);\
+extern void pglite_container_create(SMgrRelation reln, ForkNumber forknum, bool isRedo);\
+extern bool pglite_container_exists_fork(SMgrRelation reln, ForkNumber forknum);\
+extern void pglite_container_unlink(RelFileNodeBackend rnode, ForkNumber forknum, bool isRedo);\
+extern void pglite_container_extend(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum, char *buffer, bool skipFsync);\
+extern bool pglite_container_prefetch(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum);\
+extern void pglite_container_read(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum, char *buffer);\
+extern void pglite_container_write(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum, char *buffer, bool skipFsync);\
+extern void pglite_container_writeback(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum, BlockNumber nblocks);\
+extern BlockNumber pglite_container_nblocks(SMgrRelation reln, ForkNumber forknum);\
+extern void pglite_container_truncate(SMgrRelation reln, ForkNumber forknum, BlockNumber nblocks);\
+extern void pglite_container_immedsync(SMgrRelation reln, ForkNumber forknum);\
+' \
+    -e '/^		\.smgr_immedsync = pglite_memory_immedsync,$/ {
+n
+s/^	}$/	},/
+a \
+	/* pglite: a single file */\
+	{\
+		.smgr_init = NULL,\
+		.smgr_shutdown = NULL,\
+		.smgr_open = pglite_container_open,\
+		.smgr_close = pglite_container_close,\
+		.smgr_create = pglite_container_create,\
+		.smgr_exists = pglite_container_exists_fork,\
+		.smgr_unlink = pglite_container_unlink,\
+		.smgr_extend = pglite_container_extend,\
+		.smgr_prefetch = pglite_container_prefetch,\
+		.smgr_read = pglite_container_read,\
+		.smgr_write = pglite_container_write,\
+		.smgr_writeback = pglite_container_writeback,\
+		.smgr_nblocks = pglite_container_nblocks,\
+		.smgr_truncate = pglite_container_truncate,\
+		.smgr_immedsync = pglite_container_immedsync,\
+	}
+}' \
+    "$STAGING_SRC/src/backend/storage/smgr/smgr.c"
+sed -i -e 's|^\(	AbsorbSyncRequests();\)$|\1\n\n	/* pglite: the map of the container, if any */\n	pglite_container_checkpoint();|' \
+    -e '/^#include "storage\/sync.h"$/a \
+\
+extern void pglite_container_checkpoint(void);' \
+    "$STAGING_SRC/src/backend/storage/sync/sync.c"
+sed -i -e '/^Oid$/ {
+N
+/\nGetNewRelFileNode(/i extern bool pglite_container_exists(RelFileNodeBackend rnode);\
+
+}' \
+    -e 's|^\(		if (access(rpath, F_OK) == 0.*\))$|\1 \|\| pglite_container_exists(rnode))|' \
+    "$STAGING_SRC/src/backend/catalog/catalog.c"
+sed -i -e 's|^\(	\)\(if (MakePGDirectory(todir) != 0)\)$|\1/* pglite: the relations of a database in the container, if any */\n\1pglite_container_copy_db(fromdir, todir);\n\n\1\2|' \
+    -e '/^#include "postgres.h"$/a \
+\
+extern void pglite_container_copy_db(const char *fromdir, const char *todir);' \
+    "$STAGING_SRC/src/backend/storage/file/copydir.c"
+sed -i -e 's|^\(	remove_dbtablespaces(db_id);\)$|\1\n	pglite_container_drop_db(db_id);|' \
+    -e 's|^\(	\)\(if (!rmtree(src_dbpath, true))\)$|\1/* pglite: the relations in the container, if any */\n\1pglite_container_drop_db_dir(src_dbpath);\n\n\1\2|' \
+    -e 's|^\(			dst_path = GetDatabasePath(xlrec->db_id, xlrec->tablespace_ids\[i\]);\)$|\1\n\n			/* pglite: the relations in the container, if any */\n			pglite_container_drop_db_dir(dst_path);|' \
+    -e '/^#include "postgres.h"$/a \
+\
+extern void pglite_container_drop_db(Oid dbid);\
+extern void pglite_container_drop_db_dir(const char *dbpath);' \
+    "$STAGING_SRC/src/backend/commands/dbcommands.c"
+sed -i -e '/^		 (op \& UNLOGGED_RELATION_INIT) != 0);$/a \
+\
+	/* pglite: those in the container, if any */\
+	pglite_container_reset_unlogged(op);' \
+    -e '/^#include "postgres.h"$/a \
+\
+extern void pglite_container_reset_unlogged(int op);' \
+    "$STAGING_SRC/src/backend/storage/file/reinit.c"
+sed -i -e '/^static int64$/ {
+N
+/\ncalculate_database_size(/i extern int64 pglite_container_database_size(Oid dbid);\
+
+/\ncalculate_relation_size(/i extern bool pglite_container_fork_size(RelFileNode node, BackendId backend, ForkNumber forknum, int64 *size);\
+
+}' \
+    -e 's|^\(	\)\(relationpath = relpathbackend(\*rfn, backend, forknum);\)$|\1if (pglite_container_fork_size(*rfn, backend, forknum, \&totalsize))\n\1	return totalsize;\n\n\1\2|' \
+    -e 's|^\(	totalsize = db_dir_size(pathname);\)$|\1\n\n	/* pglite: relations in the container, if any */\n	totalsize += pglite_container_database_size(dbOid);|' \
+    "$STAGING_SRC/src/backend/utils/adt/dbsize.c"
+
+# descriptors of relation segments are shared by every backend thread (see
+# pglite-sys/src/shim/shared_fd.c), through which fd.c opens and closes the
+# files of its virtual fds; it reads, writes, syncs and truncates them
+# through the cluster's VFS (see pglite-sys/src/shim/fs.c)
+sed -i -e 's|^\(	*vfdP->fd = \)BasicOpenFilePerm(|\1pglite_vfd_open(|' \
+    -e 's|close(vfdP->fd)|pglite_vfd_close(vfdP->fd)|' \
+    -e 's|^\(	returnCode = \)pg_pread(\(vfdP->fd, buffer, amount, offset);\)$|\1pglite_pread(\2|' \
+    -e 's|^\(	returnCode = \)pg_pwrite(\(VfdCache\[file\]\.fd, buffer, amount, offset);\)$|\1pglite_pwrite(\2|' \
+    -e 's|^\(	returnCode = \)pg_fsync(\(VfdCache\[file\]\.fd);\)$|\1pglite_fsync(\2|' \
+    -e 's|^\(	returnCode = \)ftruncate(\(VfdCache\[file\]\.fd, offset);\)$|\1pglite_ftruncate(\2|' \
+    -e '/^#include "postgres.h"$/a \
+\
+extern int pglite_vfd_open(const char *path, int flags, mode_t mode);\
+extern int pglite_vfd_close(int fd);\
+extern ssize_t pglite_pread(int fd, void *buf, size_t count, off_t offset);\
+extern ssize_t pglite_pwrite(int fd, const void *buf, size_t count, off_t offset);\
+extern int pglite_fsync(int fd);\
+extern int pglite_ftruncate(int fd, off_t length);' \
+    "$STAGING_SRC/src/backend/storage/file/fd.c"
+
+# catalog tuples are shared by every backend thread of a cluster (see
+# pglite-sys/src/shim/shared_catcache.c): a miss looks there before reading
+# the catalog and shares what it read, entries let go of the shared tuple
+# they point at, and invalidations and resets mark shared tuples invalid
+sed -i -e '/^static void$/ {
+N
+/\nCatCacheRemoveCTup(/i extern HeapTuple pglite_shared_catcache_lookup(CatCache *cache, uint32 hashValue, const Datum *arguments, uint64 *generation);\
+extern void pglite_shared_catcache_fill_entry(CatCTup *ct, HeapTuple tuple);\
+extern void pglite_shared_catcache_release_entry(CatCTup *ct);\
+extern void pglite_shared_catcache_publish(CatCache *cache, uint32 hashValue, HeapTuple tuple, uint64 generation);\
+extern void pglite_shared_catcache_invalidate(CatCache *cache, uint32 hashValue);\
+extern void pglite_shared_catcache_reset(CatCache *cache);\
+
+}' \
+    -e '/^SearchCatCacheMiss(CatCache \*cache,$/,/^}$/ {
+/^{$/a \	uint64		pglite_generation;
+/^	relation = table_open(cache->cc_reloid, AccessShareLock);$/i \	/* pglite: a tuple shared by another backend, if any */\
+	ntp = pglite_shared_catcache_lookup(cache, hashValue, arguments, \&pglite_generation);\
+	if (ntp != NULL)\
+	{\
+		ct = CatalogCacheCreateEntry(cache, NULL, arguments,\
+									 hashValue, hashIndex,\
+									 true);\
+		pglite_shared_catcache_fill_entry(ct, ntp);\
+		ResourceOwnerEnlargeCatCacheRefs(CurrentResourceOwner);\
+		ct->refcount++;\
+		ResourceOwnerRememberCatCacheRef(CurrentResourceOwner, \&ct->tuple);\
+		return \&ct->tuple;\
+	}\
+
+/^		break;.*assume only one match/i \		pglite_shared_catcache_publish(cache, hashValue, \&ct->tuple, pglite_generation);
+}' \
+    -e '/\nCatCacheRemoveCTup(CatCache \*cache, CatCTup \*ct)$/,/^}$/ {
+/^	pfree(ct);$/i \	pglite_shared_catcache_release_entry(ct);
+}' \
+    -e '/^	CACHE_elog(DEBUG2, "CatCacheInvalidate: called");$/a \
+\
+	/* pglite: and the tuples shared by every backend */\
+	pglite_shared_catcache_invalidate(cache, hashValue);' \
+    -e '/^	\/\* Remove each list in this cache, or at least mark it dead \*\/$/i \	/* pglite: and the tuples shared by every backend */\
+	pglite_shared_catcache_reset(cache);\
+' \
+    "$STAGING_SRC/src/backend/utils/cache/catcache.c"
 
 # do the rewrite
 echo "rewriting sources"
@@ -756,8 +1059,6 @@ cargo run --package pglite-buildtools --release -- rewrite-globals \
 -c "$STAGING_SRC/src/backend/bootstrap/bootparse.c" \
 -c "$STAGING_SRC/src/backend/parser/gram.c" \
 -c "$STAGING_SRC/src/backend/parser/scan.c" \
--c "$STAGING_SRC/src/backend/port/pg_sema.c" \
--c "$STAGING_SRC/src/backend/port/pg_shmem.c" \
 -c "$STAGING_SRC/src/backend/replication/repl_gram.c" \
 -c "$STAGING_SRC/src/backend/replication/syncrep_gram.c" \
 -c "$STAGING_SRC/src/backend/storage/lmgr/lwlocknames.c" \
@@ -825,4 +1126,27 @@ cargo run --package pglite-buildtools --release -- rewrite-globals \
 -c "$STAGING_SRC/src/port/snprintf.c" \
 -c "$STAGING_SRC/src/port/strerror.c" \
 -c "$STAGING_SRC/src/port/tar.c" \
--c "$STAGING_SRC/src/port/thread.c" \
+-c "$STAGING_SRC/src/port/thread.c"
+
+# lwlock.c counts into pglite-sys/src/shim/lwlock_stats.c while counting is
+# switched on. patched after the rewrite, as the switch is process-wide
+echo "patching rewritten sources"
+sed -i -e '/^#include "postgres.h"$/a \
+extern bool pglite_lwlock_stats_enabled;\
+extern void pglite_lwlock_acquired(int tranche);\
+extern void pglite_lwlock_spin_delayed(int tranche, int delays);\
+extern void pglite_lwlock_wait_start(int tranche);\
+extern void pglite_lwlock_wait_end(void);\
+#define PGLITE_LWLOCK_COUNT(call) \\\
+	do { if (unlikely(pglite_lwlock_stats_enabled)) call; } while (0)' \
+    -e '/^	PRINT_LWDEBUG("LWLock\(Acquire\|ConditionalAcquire\|AcquireOrWait\)", lock, mode);$/a \	PGLITE_LWLOCK_COUNT(pglite_lwlock_acquired(lock->tranche));' \
+    -e '/^LWLockReportWaitStart(LWLock \*lock)$/,/^}$/ {
+/pgstat_report_wait_start(/a \	PGLITE_LWLOCK_COUNT(pglite_lwlock_wait_start(lock->tranche));
+}' \
+    -e '/^LWLockReportWaitEnd(void)$/,/^}$/ {
+/pgstat_report_wait_end();/a \	PGLITE_LWLOCK_COUNT(pglite_lwlock_wait_end());
+}' \
+    -e '/^LWLockWaitListLock(LWLock \*lock)$/,/^}$/ {
+/^			finish_spin_delay(&delayStatus);$/i \			PGLITE_LWLOCK_COUNT(pglite_lwlock_spin_delayed(lock->tranche, delayStatus.delays));
+}' \
+    "$STAGING_SRC/src/backend/storage/lmgr/lwlock.c"
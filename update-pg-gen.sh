@@ -177,8 +177,6 @@ copy-gen-file src/backend/bootstrap/bootparse.c
 copy-gen-file src/backend/bootstrap/bootscanner.c
 copy-gen-file src/backend/parser/gram.c
 copy-gen-file src/backend/parser/scan.c
-copy-gen-file src/backend/port/pg_sema.c
-copy-gen-file src/backend/port/pg_shmem.c
 copy-gen-file src/backend/replication/repl_gram.c
 copy-gen-file src/backend/replication/repl_scanner.c
 copy-gen-file src/backend/replication/syncrep_gram.c